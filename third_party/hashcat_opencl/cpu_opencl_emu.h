@@ -0,0 +1,62 @@
+// 把 hashcat 的 inc_*.cl 当普通 C 编译（--backend native）时先包含这个头文件：
+// 定义 HC_CPU_OPENCL_EMU_H 之后 inc_vendor.h 走 IS_NATIVE 分支（地址空间修饰符全为空，
+// kernel 里的 u32x 就是 u32），这里再补上 OpenCL 内建 / hashcat bitops.h 里那几个函数。
+
+#ifndef HC_CPU_OPENCL_EMU_H
+#define HC_CPU_OPENCL_EMU_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+
+// 模拟时永远是标量
+#undef  VECT_SIZE
+#define VECT_SIZE 1
+
+static inline uint32_t rotl32 (const uint32_t a, const int n)
+{
+  return (a << n) | (a >> (32 - n));
+}
+
+static inline uint32_t rotr32 (const uint32_t a, const int n)
+{
+  return (a >> n) | (a << (32 - n));
+}
+
+static inline uint64_t rotl64 (const uint64_t a, const int n)
+{
+  return (a << n) | (a >> (64 - n));
+}
+
+static inline uint64_t rotr64 (const uint64_t a, const int n)
+{
+  return (a >> n) | (a << (64 - n));
+}
+
+static inline uint32_t byte_swap_32 (const uint32_t v)
+{
+  return __builtin_bswap32 (v);
+}
+
+static inline uint64_t byte_swap_64 (const uint64_t v)
+{
+  return __builtin_bswap64 (v);
+}
+
+// inc_common.cl 的 mark_hash 用到；native 后端不走搜索模式，给个线程安全的实现即可
+static inline uint32_t hc_atomic_inc (volatile uint32_t *p)
+{
+  return __atomic_fetch_add (p, 1, __ATOMIC_RELAXED);
+}
+
+static inline uint32_t hc_atomic_dec (volatile uint32_t *p)
+{
+  return __atomic_fetch_sub (p, 1, __ATOMIC_RELAXED);
+}
+
+static inline uint32_t hc_atomic_or (volatile uint32_t *p, volatile const uint32_t val)
+{
+  return __atomic_fetch_or (p, val, __ATOMIC_RELAXED);
+}
+
+#endif // HC_CPU_OPENCL_EMU_H
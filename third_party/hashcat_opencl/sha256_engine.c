@@ -0,0 +1,2663 @@
+// 设备层和库接口（sha256_engine.h），sha256_host 的命令行和 libsha256_engine 共用：枚举设备、
+// 建 context / queue、编译 program（带 binary 缓存）、slot 的 staging / buffer / event、
+// packed 批次的排队和收尾，以及引擎本身（见 sha256_engine_internal.h 的出错约定）。
+// 这里不退出进程：OpenCL 出错时打印原因，把 cl_int 返回给调用方。
+
+#define _GNU_SOURCE
+
+#include "sha256_engine_internal.h"
+#include "sha256_engine.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+// 跟命令行的 CHECK_CL 一样打印，但把错误码返回给调用方
+#define TRY_CL(err, msg) \
+  do { \
+    const cl_int try_err_ = (err); \
+    if (try_err_ != CL_SUCCESS) { \
+      fprintf(stderr, "%s failed with error %d\n", (msg), try_err_); \
+      return try_err_; \
+    } \
+  } while (0)
+
+// 调用本文件里返回 cl_int 的函数：出错时原因已经打印过，错误码原样往上传
+#define TRY_DEV(expr) \
+  do { \
+    const cl_int try_err_ = (expr); \
+    if (try_err_ != CL_SUCCESS) return try_err_; \
+  } while (0)
+
+const hash_algo_t hash_algos[NUM_HASH_ALGOS] =
+{
+  { "sha256", "SHA256", "sha256_wrapper.cl", "sha256_wrapper", "sha256_wrapper_packed",
+    "sha256_wrapper_short", "sha256_wrapper_vector",
+    "sha256_hmac_setup", "sha256_wrapper_hmac_lines",
+    "sha256_iter_loop", "sha256_pbkdf2_init", "sha256_pbkdf2_loop", "sha256_pbkdf2_comp",
+    "sha256_stream_update", "sha256_merkle_level", "sha256_wrapper_mask",
+    "sha256_salt_setup", "sha256_wrapper_salt_lines",
+    "sha256_dedup_insert", "sha256_dedup_emit",                          40,  64,  8,  8, 1, NATIVE_SHA256 },
+  { "sha512", "SHA512", "sha512_wrapper.cl", "sha512_wrapper", "sha512_wrapper_packed",
+    NULL,                   NULL,
+    "sha512_hmac_setup", "sha512_wrapper_hmac_lines",
+    "sha512_iter_loop", "sha512_pbkdf2_init", "sha512_pbkdf2_loop", "sha512_pbkdf2_comp",
+    "sha512_stream_update", "sha512_merkle_level", NULL,
+    "sha512_salt_setup", "sha512_wrapper_salt_lines",
+    "sha512_dedup_insert", "sha512_dedup_emit",                          72, 128, 16, 16, 0, NATIVE_SHA512 },
+};
+
+// 读取 CL 源码文件；打开 / 读失败时打印原因，返回 NULL
+char *read_text_file (const char *path, size_t *out_size)
+{
+  FILE *f = fopen (path, "rb");
+  if (!f)
+  {
+    perror (path);
+    return NULL;
+  }
+
+  long len = (fseek (f, 0, SEEK_END) == 0) ? ftell (f) : -1;
+  if (len < 0)
+  {
+    perror (path);
+    fclose (f);
+    return NULL;
+  }
+  rewind (f);
+
+  char *buf = (char *) malloc ((size_t) len + 1);
+  if (!buf)
+  {
+    fprintf (stderr, "malloc failed for %s\n", path);
+    fclose (f);
+    return NULL;
+  }
+
+  size_t nread = fread (buf, 1, (size_t) len, f);
+  fclose (f);
+
+  buf[nread] = '\0';
+  if (out_size) *out_size = nread;
+  return buf;
+}
+
+// 打印平台和设备信息
+static void print_platform_device_info (cl_platform_id platform, cl_device_id device)
+{
+  char buf[256];
+  size_t sz = 0;
+
+  if (clGetPlatformInfo (platform, CL_PLATFORM_NAME, sizeof (buf), buf, &sz) == CL_SUCCESS)
+  {
+    if (sz >= sizeof (buf)) sz = sizeof (buf) - 1;
+    buf[sz] = '\0';
+    fprintf (stderr, "[OpenCL] Platform: %s\n", buf);
+  }
+
+  if (clGetDeviceInfo (device, CL_DEVICE_NAME, sizeof (buf), buf, &sz) == CL_SUCCESS)
+  {
+    if (sz >= sizeof (buf)) sz = sizeof (buf) - 1;
+    buf[sz] = '\0';
+    fprintf (stderr, "[OpenCL] Device  : %s\n", buf);
+  }
+}
+
+uint64_t fnv1a64 (uint64_t h, const void *data, size_t len)
+{
+  const unsigned char *p = (const unsigned char *) data;
+
+  for (size_t i = 0; i < len; i++)
+  {
+    h ^= p[i];
+    h *= FNV64_PRIME;
+  }
+
+  return h;
+}
+
+uint64_t fnv1a64_str (uint64_t h, const char *str)
+{
+  // 带上结尾的 '\0'，"ab" + "c" 和 "a" + "bc" 不会撞
+  return fnv1a64 (h, str, strlen (str) + 1);
+}
+
+int hash_source_tree (source_hash_t *sh, const char *path)
+{
+  for (unsigned i = 0; i < sh->num_seen; i++)
+  {
+    if (strcmp (sh->seen[i], path) == 0) return 0;
+  }
+
+  if (sh->num_seen == MAX_HASHED_SOURCES || strlen (path) >= sizeof (sh->seen[0]))
+  {
+    fprintf (stderr, "too many / too long kernel include paths (%s)\n", path);
+    return -1;
+  }
+
+  snprintf (sh->seen[sh->num_seen++], sizeof (sh->seen[0]), "%s", path);
+
+  size_t size = 0;
+  char *src = read_text_file (path, &size);
+  if (!src) return -1;
+
+  int rc = 0;
+
+  sh->h = fnv1a64_str (sh->h, path);
+  sh->h = fnv1a64 (sh->h, src, size);
+
+  for (char *line = src; line && *line; )
+  {
+    char *next = strchr (line, '\n');
+    if (next) *next++ = '\0';
+
+    while (*line == ' ' || *line == '\t') line++;
+
+    if (strncmp (line, "#include \"", 10) == 0)
+    {
+      char *name = line + 10;
+      char *end  = strchr (name, '"');
+
+      if (end)
+      {
+        *end = '\0';
+        if (hash_source_tree (sh, name) != 0) rc = -1;
+      }
+    }
+
+    line = next;
+  }
+
+  free (src);
+
+  return rc;
+}
+
+// 缓存 key：平台 / 设备 / 驱动版本 + 源码树 hash + 编译选项；源码树读不全时返回 -1
+static int program_cache_key (cl_platform_id platform, cl_device_id device,
+                              const char *src_path, const char *build_opts, uint64_t *key)
+{
+  uint64_t h = FNV64_OFFSET;
+
+  char buf[1024];
+
+  const struct { int is_platform; cl_uint param; } infos[] =
+  {
+    { 1, CL_PLATFORM_NAME    },
+    { 1, CL_PLATFORM_VERSION },
+    { 0, CL_DEVICE_NAME      },
+    { 0, CL_DEVICE_VERSION   },
+    { 0, CL_DRIVER_VERSION   },
+  };
+
+  for (size_t i = 0; i < sizeof (infos) / sizeof (infos[0]); i++)
+  {
+    size_t sz = 0;
+    cl_int err = infos[i].is_platform
+               ? clGetPlatformInfo (platform, infos[i].param, sizeof (buf), buf, &sz)
+               : clGetDeviceInfo   (device,   infos[i].param, sizeof (buf), buf, &sz);
+
+    if (err != CL_SUCCESS) sz = 0;
+    if (sz >= sizeof (buf)) sz = sizeof (buf) - 1;
+    buf[sz] = '\0';
+
+    h = fnv1a64_str (h, buf);
+  }
+
+  source_hash_t sh;
+  sh.num_seen = 0;
+  sh.h        = FNV64_OFFSET;
+
+  if (hash_source_tree (&sh, src_path) != 0) return -1;
+
+  h = fnv1a64 (h, &sh.h, sizeof (sh.h));
+  h = fnv1a64_str (h, build_opts);
+
+  *key = h;
+
+  return 0;
+}
+
+static void print_build_log (cl_program program, cl_device_id device)
+{
+  size_t log_size = 0;
+  clGetProgramBuildInfo (program, device, CL_PROGRAM_BUILD_LOG,
+                         0, NULL, &log_size);
+
+  char *log = (char *) malloc (log_size + 1);
+  if (!log) return;
+
+  clGetProgramBuildInfo (program, device, CL_PROGRAM_BUILD_LOG,
+                         log_size, log, NULL);
+  log[log_size] = '\0';
+
+  fprintf (stderr, "Build failed:\n%s\n", log);
+  free (log);
+}
+
+// 从缓存加载编译好的 binary；key 对不上（文件不存在）或驱动拒绝时返回 NULL
+static cl_program load_cached_program (cl_context context, cl_device_id device,
+                                       const char *cache_file, const char *build_opts)
+{
+  FILE *f = fopen (cache_file, "rb");
+  if (!f) return NULL;
+
+  struct stat st;
+  if (fstat (fileno (f), &st) != 0 || st.st_size <= 0)
+  {
+    fclose (f);
+    return NULL;
+  }
+
+  size_t bin_size = (size_t) st.st_size;
+  unsigned char *bin = (unsigned char *) malloc (bin_size);
+
+  const int ok = (bin && fread (bin, 1, bin_size, f) == bin_size);
+  fclose (f);
+
+  if (!ok)
+  {
+    free (bin);
+    return NULL;
+  }
+
+  const unsigned char *bins[] = { bin };
+
+  cl_int status = CL_SUCCESS;
+  cl_int err;
+
+  cl_program program = clCreateProgramWithBinary (context, 1, &device, &bin_size, bins, &status, &err);
+
+  free (bin);
+
+  if (err != CL_SUCCESS || status != CL_SUCCESS) return NULL;
+
+  // binary 也要 build 一次（驱动只做链接，很快）
+  if (clBuildProgram (program, 1, &device, build_opts, NULL, NULL) != CL_SUCCESS)
+  {
+    clReleaseProgram (program);
+    return NULL;
+  }
+
+  return program;
+}
+
+// 把刚从源码编出来的 binary 写进缓存：先写临时文件再 rename，并发的任务不会读到半个文件
+static void save_cached_program (cl_program program, const char *cache_dir, const char *cache_file)
+{
+  size_t bin_size = 0;
+  if (clGetProgramInfo (program, CL_PROGRAM_BINARY_SIZES, sizeof (bin_size), &bin_size, NULL) != CL_SUCCESS
+   || bin_size == 0)
+  {
+    return;
+  }
+
+  unsigned char *bin = (unsigned char *) malloc (bin_size);
+  if (!bin) return;
+
+  unsigned char *bins[] = { bin };
+
+  if (clGetProgramInfo (program, CL_PROGRAM_BINARIES, sizeof (bins), bins, NULL) != CL_SUCCESS)
+  {
+    free (bin);
+    return;
+  }
+
+  mkdir (cache_dir, 0755);
+
+  char tmp_file[4096 + 32];
+  snprintf (tmp_file, sizeof (tmp_file), "%s.%ld.tmp", cache_file, (long) getpid ());
+
+  FILE *f = fopen (tmp_file, "wb");
+
+  if (f)
+  {
+    const int ok = (fwrite (bin, 1, bin_size, f) == bin_size);
+
+    if (fclose (f) == 0 && ok && rename (tmp_file, cache_file) == 0)
+    {
+      fprintf (stderr, "[OpenCL] Program cache: saved %s\n", cache_file);
+    }
+    else
+    {
+      unlink (tmp_file);
+    }
+  }
+
+  free (bin);
+}
+
+// 编译 kernel 源文件：cache_dir 不为 NULL 时先查缓存，没有再从源码编译并写回缓存。
+// 读不到源文件或编译失败时打印原因（编译失败带 build log），返回 NULL
+cl_program build_program (cl_context context, cl_platform_id platform, cl_device_id device,
+                          const char *src_path, const char *build_opts, const char *cache_dir)
+{
+  cl_int err;
+
+  char cache_file[4096];
+  cache_file[0] = '\0';
+
+  if (cache_dir)
+  {
+    uint64_t key = 0;
+
+    if (program_cache_key (platform, device, src_path, build_opts, &key) != 0) return NULL;
+
+    // 文件名 = 源文件名去掉 .cl + key，不同算法的缓存一眼能分开
+    const char *base = strrchr (src_path, '/');
+    base = base ? base + 1 : src_path;
+
+    const int base_len = (int) strcspn (base, ".");
+
+    snprintf (cache_file, sizeof (cache_file), "%s/%.*s.%016llx.kernel",
+              cache_dir, base_len, base, (unsigned long long) key);
+
+    cl_program program = load_cached_program (context, device, cache_file, build_opts);
+
+    if (program)
+    {
+      fprintf (stderr, "[OpenCL] Program cache: loaded %s\n", cache_file);
+      return program;
+    }
+  }
+
+  size_t src_size = 0;
+  char *src = read_text_file (src_path, &src_size);
+  if (!src) return NULL;
+
+  const char  *sources[] = { src };
+  const size_t lengths[] = { src_size };
+
+  cl_program program =
+      clCreateProgramWithSource (context, 1, sources, lengths, &err);
+
+  if (err == CL_SUCCESS)
+  {
+    err = clBuildProgram (program, 1, &device, build_opts, NULL, NULL);
+
+    if (err != CL_SUCCESS)
+    {
+      print_build_log (program, device);
+      clReleaseProgram (program);
+    }
+  }
+
+  free (src);
+
+  if (err != CL_SUCCESS)
+  {
+    fprintf (stderr, "build_program(%s) failed with error %d\n", src_path, err);
+    return NULL;
+  }
+
+  if (cache_dir) save_cached_program (program, cache_dir, cache_file);
+
+  return program;
+}
+
+double now_seconds (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+typedef struct parallel_job
+{
+  parallel_fn_t fn;
+  void         *ctx;
+  unsigned      tid;
+  unsigned      nthreads;
+
+} parallel_job_t;
+
+static void *parallel_thread_main (void *p)
+{
+  parallel_job_t *job = (parallel_job_t *) p;
+
+  job->fn (job->ctx, job->tid, job->nthreads);
+
+  return NULL;
+}
+
+void parallel_run (unsigned nthreads, parallel_fn_t fn, void *ctx)
+{
+  if (nthreads <= 1)
+  {
+    fn (ctx, 0, 1);
+    return;
+  }
+
+  pthread_t      th[MAX_HOST_THREADS];
+  parallel_job_t jobs[MAX_HOST_THREADS];
+  int            started[MAX_HOST_THREADS];
+
+  for (unsigned t = 1; t < nthreads; t++)
+  {
+    jobs[t].fn       = fn;
+    jobs[t].ctx      = ctx;
+    jobs[t].tid      = t;
+    jobs[t].nthreads = nthreads;
+
+    started[t] = (pthread_create (&th[t], NULL, parallel_thread_main, &jobs[t]) == 0);
+  }
+
+  fn (ctx, 0, nthreads);
+
+  // 建不出线程（资源不够）的那几份由调用线程自己做：结果一样，只是慢一点
+  for (unsigned t = 1; t < nthreads; t++)
+  {
+    if (started[t]) pthread_join (th[t], NULL);
+    else            fn (ctx, t, nthreads);
+  }
+}
+
+unsigned default_host_threads (void)
+{
+  long n = sysconf (_SC_NPROCESSORS_ONLN);
+
+  if (n < 1) n = 1;
+  if (n > MAX_HOST_THREADS) n = MAX_HOST_THREADS;
+
+  return (unsigned) n;
+}
+
+// 上传目标 / bitmap / kernel_param 到一个设备（整个运行期常驻）
+static cl_int search_upload (cl_context context, const search_ctx_t *sc, search_dev_t *sd)
+{
+  cl_int err;
+
+  const uint32_t words = 1u << sc->bitmap_bits;
+
+  for (int i = 0; i < 8; i++)
+  {
+    sd->buf_bitmaps[i] = clCreateBuffer (context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                         (size_t) words * sizeof (uint32_t), sc->bitmaps + (size_t) i * words, &err);
+    TRY_CL (err, "clCreateBuffer(bitmap)");
+  }
+
+  // 空目标集也要一个合法的 buffer
+  const size_t num_alloc = (sc->num_targets > 0) ? sc->num_targets : 1;
+
+  sd->buf_digests = clCreateBuffer (context, CL_MEM_READ_ONLY | (sc->num_targets ? CL_MEM_COPY_HOST_PTR : 0),
+                                    num_alloc * 8u * sizeof (uint32_t),
+                                    sc->num_targets ? sc->targets : NULL, &err);
+  TRY_CL (err, "clCreateBuffer(search digests)");
+
+  search_param_t param;
+  memset (&param, 0, sizeof (param));
+
+  param.bitmap_mask   = words - 1;
+  param.bitmap_shift1 = SEARCH_BITMAP_SHIFT1;
+  param.bitmap_shift2 = SEARCH_BITMAP_SHIFT2;
+  param.digests_cnt   = sc->num_targets;
+
+  sd->buf_param = clCreateBuffer (context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                  sizeof (param), &param, &err);
+  TRY_CL (err, "clCreateBuffer(kernel_param)");
+
+  return CL_SUCCESS;
+}
+
+// 设置 kernel 尾部的输出参数（对应 kernel 里的 WRAPPER_OUT_ATTR）
+cl_int set_output_args (cl_kernel kernel, int arg, const search_dev_t *sd, const batch_slot_t *slot)
+{
+  if (!sd)
+  {
+    TRY_CL (clSetKernelArg (kernel, arg++, sizeof (cl_mem), &slot->buf_out),
+              "clSetKernelArg(digests)");
+    return CL_SUCCESS;
+  }
+
+  for (int i = 0; i < 8; i++)
+  {
+    TRY_CL (clSetKernelArg (kernel, arg++, sizeof (cl_mem), &sd->buf_bitmaps[i]),
+              "clSetKernelArg(bitmap)");
+  }
+
+  TRY_CL (clSetKernelArg (kernel, arg++, sizeof (cl_mem), &sd->buf_digests),
+            "clSetKernelArg(digests_buf)");
+  TRY_CL (clSetKernelArg (kernel, arg++, sizeof (cl_mem), &slot->buf_shown),
+            "clSetKernelArg(hashes_shown)");
+  TRY_CL (clSetKernelArg (kernel, arg++, sizeof (cl_mem), &slot->buf_plains),
+            "clSetKernelArg(plains_buf)");
+  TRY_CL (clSetKernelArg (kernel, arg++, sizeof (cl_mem), &slot->buf_result),
+            "clSetKernelArg(d_return_buf)");
+  TRY_CL (clSetKernelArg (kernel, arg++, sizeof (cl_mem), &sd->buf_param),
+            "clSetKernelArg(kernel_param)");
+
+  return CL_SUCCESS;
+}
+
+static int search_plain_cmp (const void *pa, const void *pb)
+{
+  const search_plain_t *a = (const search_plain_t *) pa;
+  const search_plain_t *b = (const search_plain_t *) pb;
+
+  return (a->gidvid > b->gidvid) - (a->gidvid < b->gidvid);
+}
+
+// 一个已完成命令的设备执行时间（profiling 的 START -> END，ns）。
+// 只用于统计：驱动给不出 profiling 信息时记 0，不算出错
+double event_elapsed_ns (cl_event ev)
+{
+  cl_ulong time_start = 0, time_end = 0;
+
+  if (clGetEventProfilingInfo (ev, CL_PROFILING_COMMAND_START, sizeof (time_start), &time_start, NULL) != CL_SUCCESS
+   || clGetEventProfilingInfo (ev, CL_PROFILING_COMMAND_END,   sizeof (time_end),   &time_end,   NULL) != CL_SUCCESS
+   || time_end < time_start)
+  {
+    return 0.0;
+  }
+
+  return (double) (time_end - time_start);
+}
+
+// 搜索模式：按 read_event 读回的计数把命中的 (行, 目标) 读进 out->hits，按行号排序
+static cl_int read_search_hits (batch_slot_t *slot, const search_ctx_t *sc, batch_out_t *out)
+{
+  uint32_t cnt = slot->result_cnt;
+
+  // mark_hash 最多记 digests_cnt 条
+  if (cnt > sc->num_targets) cnt = sc->num_targets;
+
+  out->num_hits = cnt;
+
+  if (cnt == 0) return CL_SUCCESS;
+
+  if (cnt > out->hits_cap)
+  {
+    free (out->hits);
+
+    out->hits_cap = sc->num_targets;
+    out->hits     = (search_plain_t *) malloc ((size_t) out->hits_cap * sizeof (search_plain_t));
+    if (!out->hits)
+    {
+      fprintf (stderr, "malloc failed for search hits (%u)\n", cnt);
+      out->hits_cap = 0;
+      return CL_OUT_OF_HOST_MEMORY;
+    }
+  }
+
+  cl_event ev;
+
+  TRY_CL (clEnqueueReadBuffer (slot->queue, slot->buf_plains, CL_TRUE, 0,
+                                 (size_t) cnt * sizeof (search_plain_t), out->hits,
+                                 0, NULL, &ev),
+            "clEnqueueReadBuffer(plains)");
+
+  out->stats.seconds[STAGE_D2H] += event_elapsed_ns (ev) * 1e-9;
+  out->stats.d2h_bytes          += (size_t) cnt * sizeof (search_plain_t);
+
+  clReleaseEvent (ev);
+
+  qsort (out->hits, cnt, sizeof (search_plain_t), search_plain_cmp);
+
+  return CL_SUCCESS;
+}
+
+// --dedup：read_event 读回的是本批唯一的 digest 数；first 模式再按这个数把 (行号, digest) 记录读进
+// slot 的 staging，排成行号顺序放进 out->uniq。行号在本批内各不相同，按行号记下每条记录的位置，
+// 顺着行号扫一遍就排好了，不用比较排序
+static cl_int read_dedup_records (batch_slot_t *slot, batch_out_t *out)
+{
+  const device_ctx_t *dev = slot->dev;
+
+  uint32_t cnt = slot->result_cnt;
+
+  if (cnt > slot->num_msgs) cnt = slot->num_msgs;
+
+  out->num_uniq = cnt;
+
+  fprintf (stderr, "[OpenCL] Batch %u (device %u): %u unique of %u lines\n",
+           slot->batch_index, dev->id, cnt, slot->num_msgs);
+
+  if (cnt == 0 || dev->dedup != DEDUP_FIRST) return CL_SUCCESS;
+
+  const size_t stride = dev->algo->digest_words + 1u;
+  const size_t bytes  = (size_t) cnt * stride * sizeof (uint32_t);
+
+  cl_event ev;
+
+  TRY_CL (clEnqueueReadBuffer (slot->queue, slot->buf_uniq, CL_TRUE, 0, bytes, slot->stage_out.ptr,
+                                 0, NULL, &ev),
+            "clEnqueueReadBuffer(dedup records)");
+
+  out->stats.seconds[STAGE_D2H] += event_elapsed_ns (ev) * 1e-9;
+  out->stats.d2h_bytes          += bytes;
+
+  clReleaseEvent (ev);
+
+  if (bytes > out->uniq_cap)
+  {
+    free (out->uniq);
+
+    out->uniq_cap = bytes;
+    out->uniq     = (uint32_t *) malloc (bytes);
+    if (!out->uniq)
+    {
+      fprintf (stderr, "malloc failed for dedup records (%zu bytes)\n", bytes);
+      out->uniq_cap = 0;
+      return CL_OUT_OF_HOST_MEMORY;
+    }
+  }
+
+  if (slot->num_msgs > out->slot_cap)
+  {
+    free (out->uniq_slot);
+
+    out->slot_cap  = slot->num_msgs;
+    out->uniq_slot = (uint32_t *) malloc ((size_t) out->slot_cap * sizeof (uint32_t));
+    if (!out->uniq_slot)
+    {
+      fprintf (stderr, "malloc failed for dedup order (%u lines)\n", slot->num_msgs);
+      out->slot_cap = 0;
+      return CL_OUT_OF_HOST_MEMORY;
+    }
+  }
+
+  const uint32_t *recs = (const uint32_t *) slot->stage_out.ptr;
+
+  memset (out->uniq_slot, 0, (size_t) slot->num_msgs * sizeof (uint32_t));
+
+  for (uint32_t k = 0; k < cnt; k++) out->uniq_slot[recs[(size_t) k * stride]] = k + 1;
+
+  uint32_t *dst = out->uniq;
+
+  for (uint32_t i = 0; i < slot->num_msgs; i++)
+  {
+    if (out->uniq_slot[i] == 0) continue;
+
+    memcpy (dst, recs + (size_t) (out->uniq_slot[i] - 1) * stride, stride * sizeof (uint32_t));
+
+    dst += stride;
+  }
+
+  return CL_SUCCESS;
+}
+
+static void pinned_release (cl_command_queue queue, pinned_buf_t *pb)
+{
+  if (!pb->mem) return;
+
+  clEnqueueUnmapMemObject (queue, pb->mem, pb->ptr, 0, NULL, NULL);
+  clReleaseMemObject (pb->mem);
+
+  memset (pb, 0, sizeof (*pb));
+}
+
+// 保证 pinned staging 至少有 need 字节；扩容时旧的 unmap + 释放（slot 空闲时才会调用）。
+// 失败时打印原因、返回 NULL，pb 回到空的状态
+void *pinned_reserve (cl_context context, cl_command_queue queue, pinned_buf_t *pb,
+                      size_t need, cl_ulong max_alloc, const char *what)
+{
+  if (need <= pb->cap) return pb->ptr;
+
+  cl_int err;
+
+  pinned_release (queue, pb);
+
+  // 多留 1/8，后面几批稍微长一点不用再扩
+  size_t cap = need + need / 8;
+  if (cap > max_alloc) cap = need;
+
+  cl_mem mem = clCreateBuffer (context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, cap, NULL, &err);
+  if (err != CL_SUCCESS)
+  {
+    fprintf (stderr, "clCreateBuffer(pinned %s, %zu bytes) failed with error %d\n", what, cap, err);
+    return NULL;
+  }
+
+  void *ptr = clEnqueueMapBuffer (queue, mem, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE,
+                                  0, cap, 0, NULL, NULL, &err);
+  if (err != CL_SUCCESS)
+  {
+    fprintf (stderr, "clEnqueueMapBuffer(staging) failed with error %d\n", err);
+    clReleaseMemObject (mem);
+    return NULL;
+  }
+
+  pb->mem = mem;
+  pb->ptr = ptr;
+  pb->cap = cap;
+
+  return pb->ptr;
+}
+
+// 保证设备 buffer 至少有 need 字节（grow-only）。失败时 *mem 为 NULL、*cap 为 0
+cl_int device_reserve (cl_context context, cl_mem *mem, size_t *cap, size_t need,
+                       cl_mem_flags flags, cl_ulong max_alloc, const char *what)
+{
+  if (need <= *cap) return CL_SUCCESS;
+
+  cl_int err;
+
+  if (*mem) clReleaseMemObject (*mem);
+
+  size_t new_cap = need + need / 8;
+  if (new_cap > max_alloc) new_cap = need;
+
+  *mem = clCreateBuffer (context, flags, new_cap, NULL, &err);
+  if (err != CL_SUCCESS)
+  {
+    fprintf (stderr, "clCreateBuffer(%s, %zu bytes) failed with error %d\n", what, new_cap, err);
+    *mem = NULL;
+    *cap = 0;
+    return err;
+  }
+
+  *cap = new_cap;
+
+  return CL_SUCCESS;
+}
+
+// event 数组里下一个位置（grow-only）。新位置先置 NULL：排队失败时它不会被当成 event 释放
+cl_event *event_list_next (cl_event **events, unsigned *num, unsigned *cap)
+{
+  if (*num == *cap)
+  {
+    const unsigned new_cap = (*cap) ? *cap * 2u : NUM_LEN_BUCKETS;
+
+    cl_event *grown = (cl_event *) realloc (*events, new_cap * sizeof (cl_event));
+    if (!grown)
+    {
+      fprintf (stderr, "malloc failed for events\n");
+      return NULL;
+    }
+
+    *events = grown;
+    *cap    = new_cap;
+  }
+
+  cl_event *ev = &(*events)[(*num)++];
+
+  *ev = NULL;
+
+  return ev;
+}
+
+// 本批下一个 kernel event 的位置
+cl_event *slot_next_event (batch_slot_t *slot)
+{
+  return event_list_next (&slot->kernel_events, &slot->num_kernel_events, &slot->events_cap);
+}
+
+// 非阻塞上传到本 slot 的 buffer，event 和字节数记进本批的 h2d 统计
+cl_int slot_upload (batch_slot_t *slot, cl_mem buf, size_t bytes, const void *src, const char *what)
+{
+  cl_event *ev = event_list_next (&slot->xfer_events, &slot->num_xfer_events, &slot->xfer_cap);
+  if (!ev) return CL_OUT_OF_HOST_MEMORY;
+
+  TRY_CL (clEnqueueWriteBuffer (slot->queue, buf, CL_FALSE, 0, bytes, src, 0, NULL, ev), what);
+
+  slot->stats.h2d_bytes += bytes;
+
+  return CL_SUCCESS;
+}
+
+// 1 维 launch：global size 向上取整到 local_size 的整数倍，多出来的 work-item 由 kernel 里的
+// 越界检查（msg_cnt / n_in）直接返回。event 是 slot_next_event 给的位置，它扩容失败（NULL）时不排队
+cl_int enqueue_kernel_1d (cl_command_queue queue, cl_kernel kernel, size_t work_items, size_t local_size,
+                          cl_event *event, const char *what)
+{
+  if (!event) return CL_OUT_OF_HOST_MEMORY;
+
+  const size_t global_work_size[1] = { (work_items + local_size - 1) / local_size * local_size };
+  const size_t local_work_size[1]  = { local_size };
+
+  TRY_CL (clEnqueueNDRangeKernel (queue, kernel, 1, NULL, global_work_size, local_work_size, 0, NULL, event),
+            what);
+
+  return CL_SUCCESS;
+}
+
+// kernel 在这个设备上允许的最大 work-group（CL_KERNEL_WORK_GROUP_SIZE，取决于寄存器用量）
+static cl_int kernel_wg_limit (cl_kernel kernel, cl_device_id device, size_t *limit)
+{
+  *limit = 0;
+
+  TRY_CL (clGetKernelWorkGroupInfo (kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof (*limit), limit, NULL),
+            "clGetKernelWorkGroupInfo(WORK_GROUP_SIZE)");
+
+  if (*limit == 0) *limit = 1;
+
+  return CL_SUCCESS;
+}
+
+// 不超过 limit 的 want，向下取整到 multiple 的整数倍（limit 比 multiple 还小时就用 limit）
+static size_t round_local_size (size_t want, size_t limit, size_t multiple)
+{
+  if (want > limit) want = limit;
+  if (want >= multiple) want -= want % multiple;
+
+  return (want > 0) ? want : 1;
+}
+
+// 给单独创建的 kernel（*_stream_update / *_merkle_level）挑 work-group：设备选定的大小，
+// 再按这个 kernel 自己的上限收一下。查不到上限时返回 0
+size_t device_kernel_local_size (const device_ctx_t *dev, cl_kernel kernel)
+{
+  size_t limit;
+
+  if (kernel_wg_limit (kernel, dev->device, &limit) != CL_SUCCESS) return 0;
+
+  return round_local_size (dev->local_size, limit, dev->wg_multiple);
+}
+
+// --autotune：这一批用的 work-group 大小。还有没试过的候选就试下一个，否则用当前选定的
+size_t autotune_next (device_ctx_t *dev)
+{
+  if (dev->tune_num > 0 && dev->tune_next < dev->tune_num) return dev->tune_sizes[dev->tune_next++];
+
+  return dev->local_size;
+}
+
+// --autotune：记下一批的 kernel 时间；每个候选都有结果之后选 ns / 消息最小的，调优结束
+static void autotune_record (device_ctx_t *dev, const batch_slot_t *slot, double kernel_ns)
+{
+  if (dev->tune_num == 0) return;
+
+  for (unsigned t = 0; t < dev->tune_num; t++)
+  {
+    if (dev->tune_sizes[t] != slot->local_size) continue;
+
+    dev->tune_ns[t]   += kernel_ns;
+    dev->tune_msgs[t] += slot->num_msgs;
+  }
+
+  unsigned best = 0;
+
+  for (unsigned t = 0; t < dev->tune_num; t++)
+  {
+    if (dev->tune_msgs[t] == 0) return;
+
+    if (dev->tune_ns[t] / (double) dev->tune_msgs[t] < dev->tune_ns[best] / (double) dev->tune_msgs[best]) best = t;
+  }
+
+  dev->local_size = dev->tune_sizes[best];
+
+  char   tried[MAX_TUNE_SIZES * 24];
+  size_t pos = 0;
+
+  for (unsigned t = 0; t < dev->tune_num; t++)
+  {
+    pos += (size_t) snprintf (tried + pos, sizeof (tried) - pos, "%s%zu=%.2f", (t > 0) ? " " : "",
+                              dev->tune_sizes[t], dev->tune_ns[t] / (double) dev->tune_msgs[t]);
+  }
+
+  fprintf (stderr, "[OpenCL] Autotune (device %u): work-group size %zu (ns/msg: %s)\n",
+           dev->id, dev->local_size, tried);
+
+  dev->tune_num = 0;
+}
+
+// slot 的 readback 是否已经完成（不阻塞）
+int slot_finished (const batch_slot_t *slot)
+{
+  cl_int status = CL_QUEUED;
+
+  // 查询本身失败、出错的命令（status < 0）都算结束，交给 collect_slot 的 clWaitForEvents 报错
+  if (clGetEventInfo (slot->read_event, CL_EVENT_COMMAND_EXECUTION_STATUS,
+                      sizeof (status), &status, NULL) != CL_SUCCESS)
+  {
+    return 1;
+  }
+
+  return status <= CL_COMPLETE;
+}
+
+void slot_drop_events (batch_slot_t *slot)
+{
+  for (unsigned e = 0; e < slot->num_kernel_events; e++)
+  {
+    if (slot->kernel_events[e]) clReleaseEvent (slot->kernel_events[e]);
+  }
+  for (unsigned e = 0; e < slot->num_xfer_events; e++)
+  {
+    if (slot->xfer_events[e]) clReleaseEvent (slot->xfer_events[e]);
+  }
+
+  slot->num_kernel_events = 0;
+  slot->num_xfer_events   = 0;
+}
+
+// 等待一个 slot 的 readback 完成，统计 kernel 时间，把结果登记进 out。
+// 真正的写出由 flush_outputs 按 batch 顺序做。
+cl_int collect_slot (batch_slot_t *slot, const search_ctx_t *sc, batch_out_t *out)
+{
+  device_ctx_t *dev = slot->dev;
+
+  const cl_int err = clWaitForEvents (1, &slot->read_event);
+
+  if (err != CL_SUCCESS)
+  {
+    fprintf (stderr, "clWaitForEvents(read) failed with error %d\n", err);
+
+    // 等这一批剩下的命令结束（做完或者同样失败）再释放 event，slot 之后还能接着用
+    clFinish (slot->queue);
+    slot_drop_events (slot);
+    clReleaseEvent (slot->read_event);
+
+    dev->inflight_msgs -= slot->num_msgs;
+
+    return err;
+  }
+
+  double kernel_time_ns = 0.0;
+  double h2d_ns         = 0.0;
+
+  for (unsigned e = 0; e < slot->num_kernel_events; e++)
+  {
+    kernel_time_ns += event_elapsed_ns (slot->kernel_events[e]);
+  }
+
+  for (unsigned e = 0; e < slot->num_xfer_events; e++)
+  {
+    h2d_ns += event_elapsed_ns (slot->xfer_events[e]);
+  }
+
+  double kernel_time_s  = kernel_time_ns * 1e-9;
+
+  slot->stats.seconds[STAGE_H2D]    = h2d_ns * 1e-9;
+  slot->stats.seconds[STAGE_KERNEL] = kernel_time_s;
+
+  // merkle 的 read_event 是设备内拷贝，不算 d2h
+  if (!dev->merkle) slot->stats.seconds[STAGE_D2H] = event_elapsed_ns (slot->read_event) * 1e-9;
+
+  autotune_record (dev, slot, kernel_time_ns);
+
+  // --mask 时每行是 keyspace 个候选
+  const unsigned long long hashes = (unsigned long long) slot->num_msgs * ((sc && sc->mask) ? sc->mask->keyspace : 1u);
+
+  slot->stats.hashes = hashes;
+
+  dev->kernel_time_s += kernel_time_s;
+  dev->msgs_done     += slot->num_msgs;
+  dev->hashes_done   += hashes;
+  dev->inflight_msgs -= slot->num_msgs;
+  dev->batches_done++;
+
+  double hps  = (kernel_time_s > 0.0) ? ((double) hashes / kernel_time_s) : 0.0;
+  double mhps = hps / 1e6;
+
+  fprintf (stderr,
+           "[OpenCL] Batch %u (device %u): kernel time = %.3f ms, speed = %.2f MH/s (%.3e H/s)\n",
+           slot->batch_index, dev->id, kernel_time_s * 1e3, mhps, hps);
+
+  slot_drop_events (slot);
+  clReleaseEvent (slot->read_event);
+
+  out->batch_index = slot->batch_index;
+  out->num_msgs    = slot->num_msgs;
+  out->line_base   = slot->line_base;
+  out->digests     = NULL;
+  out->num_hits    = 0;
+  out->num_uniq    = 0;
+  out->dedup       = dev->dedup;
+  out->device      = dev->id;
+  out->stats       = slot->stats;
+
+  if (sc)
+  {
+    TRY_DEV (read_search_hits (slot, sc, out));
+  }
+  else if (dev->dedup)
+  {
+    TRY_DEV (read_dedup_records (slot, out));
+  }
+  else if (!dev->merkle)
+  {
+    // 先借用 slot 的 staging；轮不到写出时 retire_slot 再拷走
+    out->digests = (uint32_t *) slot->stage_out.ptr;
+  }
+
+  out->ready = 1;
+
+  return CL_SUCCESS;
+}
+
+// 在飞的 batch 里提交最早的那个（没有则返回 NULL）
+batch_slot_t *oldest_busy_slot (device_ctx_t *devs, unsigned num_devs, unsigned depth)
+{
+  batch_slot_t *oldest = NULL;
+
+  for (unsigned d = 0; d < num_devs; d++)
+  {
+    for (unsigned si = 0; si < depth; si++)
+    {
+      batch_slot_t *slot = &devs[d].slots[si];
+
+      if (!slot->busy) continue;
+
+      if (!oldest || slot->batch_index < oldest->batch_index) oldest = slot;
+    }
+  }
+
+  return oldest;
+}
+
+// 设备上的一个空闲 slot（没有则返回 NULL）
+batch_slot_t *free_slot (device_ctx_t *dev, unsigned depth)
+{
+  for (unsigned si = 0; si < depth; si++)
+  {
+    if (!dev->slots[si].busy) return &dev->slots[si];
+  }
+
+  return NULL;
+}
+
+// 给下一批挑设备：谁预计最早把手上的活加这一批做完就给谁
+// （预计时间 = (在飞消息数 + 本批) / 实测吞吐），慢设备只在快设备确实排不过来时才分到活。
+// 还没测出吞吐、又有空 slot 的设备优先，先各跑一批拿到数据。
+// 返回 NULL 表示所有设备都没测过且都忙。
+device_ctx_t *pick_device (device_ctx_t *devs, unsigned num_devs, unsigned depth, uint32_t num_msgs)
+{
+  device_ctx_t *best      = NULL;
+  double        best_cost = 0.0;
+
+  for (unsigned d = 0; d < num_devs; d++)
+  {
+    device_ctx_t *dev = &devs[d];
+
+    double cost;
+
+    if (dev->batches_done == 0 || dev->kernel_time_s <= 0.0)
+    {
+      if (!free_slot (dev, depth)) continue;
+
+      // 负数 = 排在所有测过的设备前面；在飞越少越优先
+      cost = -1.0 / (1.0 + (double) dev->inflight_msgs);
+    }
+    else
+    {
+      const double rate = (double) dev->msgs_done / dev->kernel_time_s;
+
+      cost = (double) (dev->inflight_msgs + num_msgs) / rate;
+    }
+
+    if (!best || cost < best_cost)
+    {
+      best      = dev;
+      best_cost = cost;
+    }
+  }
+
+  return best;
+}
+
+cl_int pipeline_retire (const slot_pipeline_t *pl, batch_slot_t *slot)
+{
+  const cl_int err = pl->retire (slot, pl->ctx);
+
+  slot->busy = 0;
+
+  return err;
+}
+
+cl_int pipeline_acquire (const slot_pipeline_t *pl, uint32_t num_msgs, batch_slot_t **out)
+{
+  for (;;)
+  {
+    device_ctx_t *pick = NULL;
+
+    if (!pl->backlog_full || !pl->backlog_full (pl->ctx))
+    {
+      pick = pick_device (pl->devs, pl->num_devs, pl->depth, num_msgs);
+
+      batch_slot_t *slot = pick ? free_slot (pick, pl->depth) : NULL;
+
+      if (slot)
+      {
+        *out = slot;
+        return CL_SUCCESS;
+      }
+    }
+
+    // 选中的设备没有空 slot 就等它最早提交的那一批，否则等全局最老的
+    TRY_DEV (pipeline_retire (pl, pick ? oldest_busy_slot (pick, 1, pl->depth)
+                                       : oldest_busy_slot (pl->devs, pl->num_devs, pl->depth)));
+  }
+}
+
+void pipeline_begin (batch_slot_t *slot, uint32_t num_msgs, unsigned long long line_base, unsigned batch_index)
+{
+  memset (&slot->stats, 0, sizeof (slot->stats));
+
+  slot->stats.msgs        = num_msgs;
+  slot->num_kernel_events = 0;
+  slot->num_xfer_events   = 0;
+  slot->read_event        = NULL;
+  slot->num_msgs          = num_msgs;
+  slot->line_base         = line_base;
+  slot->batch_index       = batch_index;
+  slot->local_size        = autotune_next (slot->dev);
+}
+
+cl_int pipeline_launch (batch_slot_t *slot, double t_pack)
+{
+  slot->stats.seconds[STAGE_PACK] = now_seconds () - t_pack;
+
+  const cl_int err = clFlush (slot->queue);
+
+  if (err != CL_SUCCESS)
+  {
+    fprintf (stderr, "clFlush failed with error %d\n", err);
+
+    pipeline_abort (slot);
+
+    return err;
+  }
+
+  slot->dev->inflight_msgs += slot->num_msgs;
+
+  slot->busy = 1;
+
+  return CL_SUCCESS;
+}
+
+void pipeline_abort (batch_slot_t *slot)
+{
+  clFinish (slot->queue);
+
+  slot_drop_events (slot);
+
+  if (slot->read_event)
+  {
+    clReleaseEvent (slot->read_event);
+    slot->read_event = NULL;
+  }
+}
+
+cl_int pipeline_reap (const slot_pipeline_t *pl)
+{
+  for (unsigned d = 0; d < pl->num_devs; d++)
+  {
+    for (unsigned si = 0; si < pl->depth; si++)
+    {
+      batch_slot_t *slot = &pl->devs[d].slots[si];
+
+      if (slot->busy && slot_finished (slot)) TRY_DEV (pipeline_retire (pl, slot));
+    }
+  }
+
+  return CL_SUCCESS;
+}
+
+cl_int pipeline_drain (const slot_pipeline_t *pl)
+{
+  for (batch_slot_t *slot; (slot = oldest_busy_slot (pl->devs, pl->num_devs, pl->depth)) != NULL; )
+  {
+    TRY_DEV (pipeline_retire (pl, slot));
+  }
+
+  return CL_SUCCESS;
+}
+
+// --hmac-per-line / --salt-per-line：每行第一个 ':' 之前是 key / salt（没有 ':' 时整行都是 key / salt）
+typedef struct key_scan_ctx
+{
+  const unsigned char *arena;
+  const uint32_t      *offs;
+  const uint32_t      *lens;
+  uint32_t             num_msgs;
+  uint32_t            *key_lens;
+
+} key_scan_ctx_t;
+
+static void key_scan_thread (void *ctx, unsigned tid, unsigned nthreads)
+{
+  key_scan_ctx_t *kc = (key_scan_ctx_t *) ctx;
+
+  const uint32_t k0 = (uint32_t) (((uint64_t) kc->num_msgs * (tid + 0)) / nthreads);
+  const uint32_t k1 = (uint32_t) (((uint64_t) kc->num_msgs * (tid + 1)) / nthreads);
+
+  for (uint32_t k = k0; k < k1; k++)
+  {
+    const unsigned char *line = kc->arena + kc->offs[k];
+    const unsigned char *sep  = (const unsigned char *) memchr (line, ':', kc->lens[k]);
+
+    kc->key_lens[k] = sep ? (uint32_t) (sep - line) : kc->lens[k];
+  }
+}
+
+// --mask：msgs / offs / lens / msg_cnt 已经设好（arg 是下一个参数），每个 base word 的 keyspace
+// 按 MASK_LAUNCH_HASHES 拆成几段，每段一次 launch：work-item 数 = 行数 * 段内的 il_step 组数，
+// 全部排在本 slot 的 in-order queue 上，命中一直累加在同一个 plains_buf 里
+static cl_int enqueue_mask_launches (batch_slot_t *slot, const search_ctx_t *sc, int arg, uint32_t num_msgs)
+{
+  device_ctx_t     *dev    = slot->dev;
+  cl_kernel         kernel = dev->kernel_mask;
+  const mask_cfg_t *mask   = sc->mask;
+
+  const cl_uint mask_len = (cl_uint) mask->len;
+  const cl_uint il_step  = (mask->keyspace < MASK_IL_STEP) ? (cl_uint) mask->keyspace : MASK_IL_STEP;
+
+  // 一段至少让每个 word 跑满一个 il_step
+  uint64_t span = MASK_LAUNCH_HASHES / num_msgs / il_step * il_step;
+
+  if (span < il_step)        span = il_step;
+  if (span > mask->keyspace) span = mask->keyspace;
+
+  TRY_CL (clSetKernelArg (kernel, arg + 0, sizeof (cl_mem),  &dev->buf_mask),
+            "clSetKernelArg(mask_cs)");
+  TRY_CL (clSetKernelArg (kernel, arg + 1, sizeof (cl_uint), &mask_len),
+            "clSetKernelArg(mask_len)");
+  TRY_CL (clSetKernelArg (kernel, arg + 4, sizeof (cl_uint), &il_step),
+            "clSetKernelArg(il_step)");
+
+  TRY_DEV (set_output_args (kernel, arg + 5, &dev->search, slot));
+
+  for (uint64_t il = 0; il < mask->keyspace; il += span)
+  {
+    const cl_uint il_start = (cl_uint) il;
+    const cl_uint il_end   = (cl_uint) ((il + span < mask->keyspace) ? il + span : mask->keyspace);
+    const size_t  groups   = (il_end - il_start + il_step - 1) / il_step;
+
+    TRY_CL (clSetKernelArg (kernel, arg + 2, sizeof (cl_uint), &il_start),
+              "clSetKernelArg(il_start)");
+    TRY_CL (clSetKernelArg (kernel, arg + 3, sizeof (cl_uint), &il_end),
+              "clSetKernelArg(il_end)");
+
+    TRY_DEV (enqueue_kernel_1d (slot->queue, kernel, (size_t) num_msgs * groups, slot->local_size,
+                                slot_next_event (slot), "clEnqueueNDRangeKernel(mask)"));
+  }
+
+  return CL_SUCCESS;
+}
+
+// packed 布局：把本批在 arena（或映射区）里的原始字节原样上传，外加 offs / lens，
+// 传输量 = 真实数据量，不再是 num_msgs * stride。
+// 设备 buffer 多分配 PACKED_TAIL_PAD 给 kernel 越界读。上传全部是非阻塞的：
+// 映射区整个运行期有效，直接从它上传；fread 的 arena 会被下一批覆盖，先拷进 pinned staging。
+// --hmac-per-line 时换成 *_hmac_lines（--salt-per-line 时是 *_salt_lines），再多上传每行的 key / salt 长度；
+// PBKDF2 时换成 *_pbkdf2_init，结果写进 slot 的 tmps（后面由 enqueue_kdf_loops 接着做）；
+// --mask 时换成 *_wrapper_mask，按 keyspace 拆成多次 launch（见 enqueue_mask_launches）。
+cl_int enqueue_packed_batch (batch_slot_t *slot, const search_ctx_t *sc,
+                             const line_reader_t *rd, uint32_t num_msgs, size_t max_len,
+                             unsigned nthreads)
+{
+  device_ctx_t *dev     = slot->dev;
+  cl_context    context = dev->context;
+  cl_kernel     kernel  = dev->kernel_hmac_lines  ? dev->kernel_hmac_lines
+                        : dev->kernel_salt_lines  ? dev->kernel_salt_lines
+                        : dev->kernel_pbkdf2_init ? dev->kernel_pbkdf2_init
+                        : dev->kernel_mask        ? dev->kernel_mask
+                        : dev->kernel_packed;
+
+  const size_t data_bytes = (size_t) rd->offs[num_msgs - 1] + rd->lens[num_msgs - 1];
+  const size_t dev_bytes  = ((data_bytes + 3) & ~(size_t) 3) + PACKED_TAIL_PAD;
+  const size_t idx_bytes  = (size_t) num_msgs * sizeof (uint32_t);
+
+  fprintf (stderr,
+           "[OpenCL] Batch %u (device %u): %u messages, max_len=%zu, layout=packed, msgs_bytes=%zu (flat stride would need %zu)\n",
+           slot->batch_index, dev->id, num_msgs, max_len, data_bytes,
+           (size_t) num_msgs * stride_for_len (max_len, dev->algo));
+
+  TRY_DEV (device_reserve (context, &slot->buf_msgs, &slot->msgs_cap, dev_bytes,  CL_MEM_READ_ONLY, dev->max_alloc, "buf_msgs"));
+  TRY_DEV (device_reserve (context, &slot->buf_offs, &slot->offs_cap, idx_bytes,  CL_MEM_READ_ONLY, dev->max_alloc, "buf_offs"));
+  TRY_DEV (device_reserve (context, &slot->buf_lens, &slot->lens_cap, idx_bytes,  CL_MEM_READ_ONLY, dev->max_alloc, "buf_lens"));
+
+  if (data_bytes > 0)
+  {
+    const void *src = rd->arena;
+
+    if (!rd->map)
+    {
+      void *stage = pinned_reserve (context, slot->queue, &slot->stage_msgs, data_bytes, dev->max_alloc, "msgs");
+      if (!stage) return CL_OUT_OF_RESOURCES;
+
+      memcpy (stage, rd->arena, data_bytes);
+
+      src = stage;
+    }
+
+    TRY_DEV (slot_upload (slot, slot->buf_msgs, data_bytes, src, "clEnqueueWriteBuffer(buf_msgs)"));
+  }
+
+  // offs / lens 在 reader 里会被下一批覆盖，同样走 staging
+  uint32_t *offs = (uint32_t *) pinned_reserve (context, slot->queue, &slot->stage_offs, idx_bytes, dev->max_alloc, "offs");
+  uint32_t *lens = (uint32_t *) pinned_reserve (context, slot->queue, &slot->stage_lens, idx_bytes, dev->max_alloc, "lens");
+  if (!offs || !lens) return CL_OUT_OF_RESOURCES;
+
+  memcpy (offs, rd->offs, idx_bytes);
+  memcpy (lens, rd->lens, idx_bytes);
+
+  TRY_DEV (slot_upload (slot, slot->buf_offs, idx_bytes, offs, "clEnqueueWriteBuffer(buf_offs)"));
+  TRY_DEV (slot_upload (slot, slot->buf_lens, idx_bytes, lens, "clEnqueueWriteBuffer(buf_lens)"));
+
+  const int per_line_keys = (dev->kernel_hmac_lines || dev->kernel_salt_lines);
+
+  if (per_line_keys)
+  {
+    key_scan_ctx_t kc;
+
+    kc.arena    = rd->arena;
+    kc.offs     = rd->offs;
+    kc.lens     = rd->lens;
+    kc.num_msgs = num_msgs;
+    kc.key_lens = (uint32_t *) pinned_reserve (context, slot->queue, &slot->stage_keys, idx_bytes, dev->max_alloc, "keys");
+    if (!kc.key_lens) return CL_OUT_OF_RESOURCES;
+
+    parallel_run ((num_msgs < 65536u) ? 1 : nthreads, key_scan_thread, &kc);
+
+    TRY_DEV (device_reserve (context, &slot->buf_keys, &slot->keys_cap, idx_bytes, CL_MEM_READ_ONLY, dev->max_alloc, "buf_keys"));
+
+    TRY_DEV (slot_upload (slot, slot->buf_keys, idx_bytes, kc.key_lens, "clEnqueueWriteBuffer(buf_keys)"));
+  }
+
+  int arg = 0;
+  TRY_CL (clSetKernelArg (kernel, arg++, sizeof (cl_mem), &slot->buf_msgs),
+            "clSetKernelArg(msgs)");
+  TRY_CL (clSetKernelArg (kernel, arg++, sizeof (cl_mem), &slot->buf_offs),
+            "clSetKernelArg(offs)");
+  TRY_CL (clSetKernelArg (kernel, arg++, sizeof (cl_mem), &slot->buf_lens),
+            "clSetKernelArg(lens)");
+
+  if (per_line_keys)
+  {
+    TRY_CL (clSetKernelArg (kernel, arg++, sizeof (cl_mem), &slot->buf_keys),
+              "clSetKernelArg(key_lens)");
+  }
+
+  const cl_uint msg_cnt = (cl_uint) num_msgs;
+
+  TRY_CL (clSetKernelArg (kernel, arg++, sizeof (cl_uint), &msg_cnt),
+            "clSetKernelArg(msg_cnt)");
+
+  if (dev->kernel_salt_lines)
+  {
+    const cl_uint salt_pos = (cl_uint) dev->salt->pos;
+
+    TRY_CL (clSetKernelArg (kernel, arg++, sizeof (cl_uint), &salt_pos),
+              "clSetKernelArg(salt_pos)");
+  }
+
+  if (dev->buf_hmac)
+  {
+    TRY_CL (clSetKernelArg (kernel, arg++, sizeof (cl_mem), &dev->buf_hmac),
+              "clSetKernelArg(hmac_state)");
+  }
+
+  if (dev->buf_salt_state)
+  {
+    TRY_CL (clSetKernelArg (kernel, arg++, sizeof (cl_mem), &dev->buf_salt_state),
+              "clSetKernelArg(salt_state)");
+  }
+
+  if (dev->kernel_pbkdf2_init)
+  {
+    const size_t  tmps_bytes = (size_t) num_msgs * 4u * dev->algo->digest_words * sizeof (uint32_t);
+    const cl_uint salt_len   = (cl_uint) dev->kdf->salt_len;
+
+    TRY_DEV (device_reserve (context, &slot->buf_tmps, &slot->tmps_cap, tmps_bytes, CL_MEM_READ_WRITE, dev->max_alloc, "buf_tmps"));
+
+    TRY_CL (clSetKernelArg (kernel, arg++, sizeof (cl_mem),  &dev->buf_salt),
+              "clSetKernelArg(salt)");
+    TRY_CL (clSetKernelArg (kernel, arg++, sizeof (cl_uint), &salt_len),
+              "clSetKernelArg(salt_len)");
+    TRY_CL (clSetKernelArg (kernel, arg++, sizeof (cl_mem),  &slot->buf_tmps),
+              "clSetKernelArg(tmps)");
+  }
+  else if (dev->kernel_mask)
+  {
+    return enqueue_mask_launches (slot, sc, arg, num_msgs);
+  }
+  else
+  {
+    TRY_DEV (set_output_args (kernel, arg, sc ? &dev->search : NULL, slot));
+  }
+
+  return enqueue_kernel_1d (slot->queue, kernel, num_msgs, slot->local_size, slot_next_event (slot),
+                            "clEnqueueNDRangeKernel(packed)");
+}
+
+// 按平台顺序列出所有设备，返回个数（列不出来的平台跳过）
+unsigned enumerate_devices (device_entry_t *out, unsigned cap)
+{
+  cl_uint num_platforms = 0;
+
+  if (clGetPlatformIDs (0, NULL, &num_platforms) != CL_SUCCESS || num_platforms == 0) return 0;
+
+  cl_platform_id *platforms =
+      (cl_platform_id *) malloc (sizeof (cl_platform_id) * num_platforms);
+
+  if (!platforms || clGetPlatformIDs (num_platforms, platforms, NULL) != CL_SUCCESS)
+  {
+    fprintf (stderr, "clGetPlatformIDs(list) failed\n");
+    free (platforms);
+    return 0;
+  }
+
+  unsigned n = 0;
+
+  for (cl_uint pi = 0; pi < num_platforms && n < cap; pi++)
+  {
+    cl_uint num_devices = 0;
+
+    if (clGetDeviceIDs (platforms[pi], CL_DEVICE_TYPE_ALL, 0, NULL, &num_devices) != CL_SUCCESS
+        || num_devices == 0)
+    {
+      continue;
+    }
+
+    cl_device_id *devices =
+        (cl_device_id *) malloc (sizeof (cl_device_id) * num_devices);
+
+    if (!devices || clGetDeviceIDs (platforms[pi], CL_DEVICE_TYPE_ALL, num_devices, devices, NULL) != CL_SUCCESS)
+    {
+      fprintf (stderr, "clGetDeviceIDs(list) failed\n");
+      free (devices);
+      continue;
+    }
+
+    for (cl_uint di = 0; di < num_devices && n < cap; di++)
+    {
+      out[n].platform = platforms[pi];
+      out[n].device   = devices[di];
+      out[n].type     = CL_DEVICE_TYPE_DEFAULT;
+
+      clGetDeviceInfo (devices[di], CL_DEVICE_TYPE, sizeof (out[n].type), &out[n].type, NULL);
+
+      n++;
+    }
+
+    free (devices);
+  }
+
+  free (platforms);
+
+  return n;
+}
+
+// 解析 --devices：NULL = 第一个设备（以前的行为）；"all" = 所有 GPU，没有 GPU 就所有 CPU，
+// 再没有就全部；否则是逗号分隔的编号列表（编号见启动时打印的设备列表）。返回选中的个数，出错返回 0
+unsigned select_devices (const device_entry_t *all, unsigned num_all, const char *spec,
+                         unsigned *sel)
+{
+  if (!spec)
+  {
+    sel[0] = 0;
+    return 1;
+  }
+
+  unsigned n = 0;
+
+  if (strcmp (spec, "all") == 0)
+  {
+    static const cl_device_type order[] = { CL_DEVICE_TYPE_GPU, CL_DEVICE_TYPE_CPU, CL_DEVICE_TYPE_ALL };
+
+    for (unsigned o = 0; o < 3 && n == 0; o++)
+    {
+      for (unsigned i = 0; i < num_all && n < MAX_DEVICES; i++)
+      {
+        if (all[i].type & order[o]) sel[n++] = i;
+      }
+    }
+
+    return n;
+  }
+
+  const char *p = spec;
+
+  while (*p)
+  {
+    char *end = NULL;
+    unsigned long v = strtoul (p, &end, 10);
+
+    if (end == p || v >= num_all || n == MAX_DEVICES)
+    {
+      fprintf (stderr, "--devices: bad device list \"%s\" (%u devices available)\n", spec, num_all);
+      return 0;
+    }
+
+    for (unsigned i = 0; i < n; i++)
+    {
+      if (sel[i] == v)
+      {
+        fprintf (stderr, "--devices: device %lu listed twice\n", v);
+        return 0;
+      }
+    }
+
+    sel[n++] = (unsigned) v;
+
+    p = end;
+    if (*p == ',') p++;
+    else if (*p)
+    {
+      fprintf (stderr, "--devices: bad device list \"%s\"\n", spec);
+      return 0;
+    }
+  }
+
+  return n;
+}
+
+// 在 slot 0 的 queue 上跑一次 (输入, 输入长度, 状态) 三个参数的 setup kernel，等它做完：
+// 后面各个 slot 的 queue 都要读状态。kernel 用完就释放，出错时也一样
+static cl_int run_setup_kernel (device_ctx_t *dev, const char *name, cl_mem in, cl_uint in_len, cl_mem state,
+                               const char *what)
+{
+  cl_int err;
+
+  cl_kernel kernel = clCreateKernel (dev->program, name, &err);
+  TRY_CL (err, "clCreateKernel(setup)");
+
+  const size_t global_work_size[1] = { 1 };
+
+  cl_command_queue queue = dev->slots[0].queue;
+
+  err = clSetKernelArg (kernel, 0, sizeof (cl_mem), &in);
+  if (err == CL_SUCCESS) err = clSetKernelArg (kernel, 1, sizeof (cl_uint), &in_len);
+  if (err == CL_SUCCESS) err = clSetKernelArg (kernel, 2, sizeof (cl_mem),  &state);
+  if (err == CL_SUCCESS) err = clEnqueueNDRangeKernel (queue, kernel, 1, NULL, global_work_size, NULL, 0, NULL, NULL);
+  if (err == CL_SUCCESS) err = clFinish (queue);
+
+  clReleaseKernel (kernel);
+
+  TRY_CL (err, what);
+
+  return CL_SUCCESS;
+}
+
+// 给一个设备建 context / queue / program / kernel，以及搜索模式的常驻 buffer
+// HMAC_SHARED：在设备上跑一次 *_hmac_setup，把 key 的 ipad / opad 状态留在 dev->buf_hmac
+static cl_int hmac_setup_state (device_ctx_t *dev, const hmac_cfg_t *hmac)
+{
+  cl_int err;
+
+  const hash_algo_t *algo = dev->algo;
+
+  // setup kernel 按整块读 key：零填充到 block 的整数倍（至少一个 block）
+  const size_t key_bytes   = stride_for_len (hmac->key_len, algo);
+  const size_t state_bytes = 2u * algo->digest_words * sizeof (uint32_t);
+
+  unsigned char *key = (unsigned char *) calloc (key_bytes, 1);
+  if (!key)
+  {
+    fprintf (stderr, "malloc failed for HMAC key\n");
+    return CL_OUT_OF_HOST_MEMORY;
+  }
+
+  if (hmac->key_len > 0) memcpy (key, hmac->key, hmac->key_len);
+
+  cl_mem buf_key = clCreateBuffer (dev->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, key_bytes, key, &err);
+
+  free (key);
+
+  TRY_CL (err, "clCreateBuffer(hmac key)");
+
+  dev->buf_hmac = clCreateBuffer (dev->context, CL_MEM_READ_WRITE, state_bytes, NULL, &err);
+
+  if (err == CL_SUCCESS)
+  {
+    err = run_setup_kernel (dev, algo->kernel_hmac_setup, buf_key, (cl_uint) hmac->key_len, dev->buf_hmac,
+                            "hmac setup");
+  }
+  else
+  {
+    fprintf (stderr, "clCreateBuffer(hmac state) failed with error %d\n", err);
+    dev->buf_hmac = NULL;
+  }
+
+  clReleaseMemObject (buf_key);
+
+  return err;
+}
+
+// SALT_SHARED：salt 的状态留在 dev->buf_salt_state。前缀：在设备上跑一次 *_salt_setup，
+// 把压过 salt 的整个 ctx（midstate + 没满一块的零头 + len）存下来；后缀：[字节数, 原始 salt] 直接上传
+static cl_int salt_setup_state (device_ctx_t *dev, const salt_cfg_t *salt)
+{
+  cl_int err;
+
+  const hash_algo_t *algo = dev->algo;
+
+  // 两种都按整块读 salt：零填充到 block 的整数倍，后缀模式前面多一个 u32 的长度
+  const size_t salt_bytes = stride_for_len (salt->salt_len, algo);
+  const size_t head_bytes = (salt->pos == SALT_SUFFIX) ? sizeof (uint32_t) : 0;
+
+  unsigned char *buf = (unsigned char *) calloc (head_bytes + salt_bytes, 1);
+  if (!buf)
+  {
+    fprintf (stderr, "malloc failed for salt\n");
+    return CL_OUT_OF_HOST_MEMORY;
+  }
+
+  if (salt->salt_len > 0) memcpy (buf + head_bytes, salt->salt, salt->salt_len);
+
+  if (salt->pos == SALT_SUFFIX)
+  {
+    const uint32_t salt_len = (uint32_t) salt->salt_len;
+
+    memcpy (buf, &salt_len, sizeof (salt_len));
+
+    dev->buf_salt_state = clCreateBuffer (dev->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                          head_bytes + salt_bytes, buf, &err);
+
+    free (buf);
+
+    if (err != CL_SUCCESS) dev->buf_salt_state = NULL;
+
+    TRY_CL (err, "clCreateBuffer(salt)");
+
+    return CL_SUCCESS;
+  }
+
+  cl_mem buf_salt = clCreateBuffer (dev->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, salt_bytes, buf, &err);
+
+  free (buf);
+
+  TRY_CL (err, "clCreateBuffer(salt)");
+
+  dev->buf_salt_state = clCreateBuffer (dev->context, CL_MEM_READ_WRITE, SALT_STATE_BYTES, NULL, &err);
+
+  if (err == CL_SUCCESS)
+  {
+    // 跟 hmac_setup_state 一样，做完再给各个 slot 的 queue 用
+    err = run_setup_kernel (dev, algo->kernel_salt_setup, buf_salt, (cl_uint) salt->salt_len, dev->buf_salt_state,
+                            "salt setup");
+  }
+  else
+  {
+    fprintf (stderr, "clCreateBuffer(salt state) failed with error %d\n", err);
+    dev->buf_salt_state = NULL;
+  }
+
+  clReleaseMemObject (buf_salt);
+
+  return err;
+}
+
+// work-group 大小：preferred multiple 取主 kernel 的，上限是本设备建出来的所有 batch kernel 的
+// CL_KERNEL_WORK_GROUP_SIZE 的最小值（同一批的 launch 共用一个大小）。
+// --autotune 的候选是 multiple 的 2 的幂倍，从不小于 32 的那个开始
+static cl_int device_pick_local_size (device_ctx_t *dev, size_t local_size_opt, int autotune)
+{
+  const cl_kernel kernels[] =
+  {
+    dev->kernel, dev->kernel_packed, dev->kernel_short, dev->kernel_vector, dev->kernel_hmac_lines,
+    dev->kernel_iter_loop, dev->kernel_pbkdf2_init, dev->kernel_pbkdf2_loop, dev->kernel_pbkdf2_comp,
+    dev->kernel_mask, dev->kernel_salt_lines
+  };
+
+  size_t multiple = 1;
+
+  TRY_CL (clGetKernelWorkGroupInfo (dev->kernel, dev->device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+                                      sizeof (multiple), &multiple, NULL),
+            "clGetKernelWorkGroupInfo(PREFERRED_WORK_GROUP_SIZE_MULTIPLE)");
+
+  if (multiple == 0) multiple = 1;
+
+  size_t limit = SIZE_MAX;
+
+  for (size_t i = 0; i < sizeof (kernels) / sizeof (kernels[0]); i++)
+  {
+    if (!kernels[i]) continue;
+
+    size_t l;
+
+    TRY_DEV (kernel_wg_limit (kernels[i], dev->device, &l));
+
+    if (l < limit) limit = l;
+  }
+
+  dev->wg_multiple = multiple;
+  dev->wg_limit    = limit;
+
+  if (local_size_opt > limit)
+  {
+    fprintf (stderr, "[OpenCL] --local-size %zu is above the kernel limit %zu on device %u, using %zu\n",
+             local_size_opt, limit, dev->id, limit);
+  }
+
+  dev->local_size = (local_size_opt > 0) ? ((local_size_opt < limit) ? local_size_opt : limit)
+                                         : round_local_size (DEFAULT_LOCAL_SIZE_MAX, limit, multiple);
+
+  if (autotune)
+  {
+    size_t first = multiple;
+    while (first < 32 && first * 2 <= limit) first *= 2;
+
+    for (size_t ls = first; ls <= limit && dev->tune_num < MAX_TUNE_SIZES; ls *= 2)
+    {
+      dev->tune_sizes[dev->tune_num++] = ls;
+    }
+
+    // 只有一种可选时不用调
+    if (dev->tune_num < 2) dev->tune_num = 0;
+  }
+
+  fprintf (stderr, "[OpenCL] Work-group size: %zu (preferred multiple %zu, kernel limit %zu)%s\n",
+           dev->local_size, multiple, limit, (dev->tune_num > 0) ? ", autotune on the first batches" : "");
+
+  return CL_SUCCESS;
+}
+
+cl_int device_setup (device_ctx_t *dev, unsigned id, const device_entry_t *e, const hash_algo_t *algo,
+                     unsigned pipeline_depth, const search_ctx_t *sc, const hmac_cfg_t *hmac,
+                     const kdf_cfg_t *kdf, const salt_cfg_t *salt, int encoding, unsigned vector_width_opt, int layout,
+                     int use_single_block, size_t local_size_opt, int autotune, const char *cache_dir)
+{
+  cl_int err;
+
+  memset (dev, 0, sizeof (*dev));
+
+  dev->id       = id;
+  dev->platform = e->platform;
+  dev->device   = e->device;
+  dev->algo     = algo;
+  dev->kdf      = kdf;
+  dev->salt     = salt;
+
+  print_platform_device_info (dev->platform, dev->device);
+
+  // 每个 slot 一个 queue（带 profiling）
+  // 多个 in-order queue 让上一批的 kernel 和下一批的上传 / 读回可以在设备上重叠
+  dev->context = clCreateContext (NULL, 1, &dev->device, NULL, NULL, &err);
+  TRY_CL (err, "clCreateContext");
+
+  const cl_queue_properties props[] =
+  {
+    CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE,
+    0
+  };
+
+  for (unsigned si = 0; si < pipeline_depth; si++)
+  {
+    dev->slots[si].dev   = dev;
+    dev->slots[si].queue =
+        clCreateCommandQueueWithProperties (dev->context, dev->device, props, &err);
+    TRY_CL (err, "clCreateCommandQueueWithProperties");
+  }
+
+  // 搜索模式：目标 / bitmap 常驻设备，每个 slot 一份命中缓冲和 hashes_shown
+  // （同一个 slot 内每个目标只标记一次，所以 mark_hash 最多写 digests_cnt 条）
+  if (sc)
+  {
+    TRY_DEV (search_upload (dev->context, sc, &dev->search));
+
+    const size_t plains_cnt = (sc->num_targets > 0) ? sc->num_targets : 1;
+
+    uint32_t *zero = (uint32_t *) calloc (plains_cnt, sizeof (uint32_t));
+    if (!zero) return CL_OUT_OF_HOST_MEMORY;
+
+    err = CL_SUCCESS;
+
+    for (unsigned si = 0; si < pipeline_depth && err == CL_SUCCESS; si++)
+    {
+      dev->slots[si].buf_shown = clCreateBuffer (dev->context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                                 plains_cnt * sizeof (uint32_t), zero, &err);
+    }
+
+    free (zero);
+
+    TRY_CL (err, "clCreateBuffer(hashes_shown)");
+
+    for (unsigned si = 0; si < pipeline_depth; si++)
+    {
+      dev->slots[si].buf_plains = clCreateBuffer (dev->context, CL_MEM_WRITE_ONLY,
+                                                  plains_cnt * sizeof (search_plain_t), NULL, &err);
+      TRY_CL (err, "clCreateBuffer(plains_buf)");
+
+      dev->slots[si].buf_result = clCreateBuffer (dev->context, CL_MEM_READ_WRITE,
+                                                  sizeof (cl_uint), NULL, &err);
+      TRY_CL (err, "clCreateBuffer(d_return_buf)");
+    }
+  }
+
+  // 编译算法的 kernel 源文件（每个设备一次；有缓存时直接加载 binary）
+  // 向量宽度：默认取设备的 CL_DEVICE_PREFERRED_VECTOR_WIDTH_INT，--vector N 可以覆盖；
+  // 算法没有向量版（或者 HMAC / 共享 salt / UTF-16LE）时固定为 1
+  unsigned vector_width = vector_width_opt;
+
+  if (!algo->kernel_vector || hmac->mode != HMAC_NONE || salt->mode == SALT_SHARED || encoding != ENCODING_RAW)
+  {
+    vector_width = 1;
+  }
+  else if (vector_width == 0)
+  {
+    cl_uint pref = 1;
+    TRY_CL (clGetDeviceInfo (dev->device, CL_DEVICE_PREFERRED_VECTOR_WIDTH_INT,
+                               sizeof (pref), &pref, NULL),
+              "clGetDeviceInfo(PREFERRED_VECTOR_WIDTH_INT)");
+
+    // inc_types.h 只支持 1 / 2 / 4 / 8 / 16
+    vector_width = 1;
+    while (vector_width * 2 <= pref && vector_width < 16) vector_width *= 2;
+  }
+
+  dev->vector_width = vector_width;
+
+  TRY_CL (clGetDeviceInfo (dev->device, CL_DEVICE_MAX_MEM_ALLOC_SIZE,
+                             sizeof (dev->max_alloc), &dev->max_alloc, NULL),
+            "clGetDeviceInfo(MAX_MEM_ALLOC_SIZE)");
+  TRY_CL (clGetDeviceInfo (dev->device, CL_DEVICE_GLOBAL_MEM_SIZE,
+                             sizeof (dev->global_mem), &dev->global_mem, NULL),
+            "clGetDeviceInfo(GLOBAL_MEM_SIZE)");
+
+  // 如需 -I/path/to/hashcat/OpenCL 在这里加
+  char build_opts[128];
+  if (vector_width > 1)
+  {
+    snprintf (build_opts, sizeof (build_opts), "-D NEW_SIMD_CODE -D VECT_SIZE=%u", vector_width);
+  }
+  else
+  {
+    build_opts[0] = '\0';
+  }
+
+  if (sc)
+  {
+    strncat (build_opts, " -D SEARCH_MODE", sizeof (build_opts) - strlen (build_opts) - 1);
+  }
+
+  if (hmac->mode == HMAC_SHARED)
+  {
+    strncat (build_opts, " -D HMAC_MODE", sizeof (build_opts) - strlen (build_opts) - 1);
+  }
+
+  if (salt->mode == SALT_SHARED)
+  {
+    strncat (build_opts, (salt->pos == SALT_PREFIX) ? " -D SALT_PREFIX_MODE" : " -D SALT_SUFFIX_MODE",
+             sizeof (build_opts) - strlen (build_opts) - 1);
+  }
+
+  if (encoding == ENCODING_UTF16LE)
+  {
+    strncat (build_opts, " -D UTF16LE_MODE", sizeof (build_opts) - strlen (build_opts) - 1);
+  }
+
+  fprintf (stderr, "[OpenCL] Vector width: %u%s%s%s\n", vector_width,
+           (vector_width > 1 && layout == LAYOUT_STRIDE) ? " (" : "",
+           (vector_width > 1 && layout == LAYOUT_STRIDE) ? algo->kernel_vector : "",
+           (vector_width > 1 && layout == LAYOUT_STRIDE) ? ")" : "");
+
+  dev->program = build_program (dev->context, dev->platform, dev->device, algo->kernel_file,
+                                build_opts, cache_dir);
+  if (!dev->program) return CL_BUILD_PROGRAM_FAILURE;
+
+  dev->kernel = clCreateKernel (dev->program, algo->kernel, &err);
+  TRY_CL (err, "clCreateKernel");
+
+  dev->kernel_packed = clCreateKernel (dev->program, algo->kernel_packed, &err);
+  TRY_CL (err, "clCreateKernel(packed)");
+
+  // HMAC 的 inner 从 ipad 之后接着压、salt 改变长度和起点、UTF-16LE 宽化后长度翻倍，单 block 快速路径都不适用
+  if (algo->kernel_short && hmac->mode == HMAC_NONE && salt->mode != SALT_SHARED && encoding == ENCODING_RAW)
+  {
+    dev->kernel_short = clCreateKernel (dev->program, algo->kernel_short, &err);
+    TRY_CL (err, "clCreateKernel(short)");
+  }
+
+  if (algo->kernel_vector)
+  {
+    dev->kernel_vector = clCreateKernel (dev->program, algo->kernel_vector, &err);
+    TRY_CL (err, "clCreateKernel(vector)");
+  }
+
+  if (hmac->mode == HMAC_PER_LINE)
+  {
+    dev->kernel_hmac_lines = clCreateKernel (dev->program, algo->kernel_hmac_lines, &err);
+    TRY_CL (err, "clCreateKernel(hmac lines)");
+  }
+
+  if (hmac->mode == HMAC_SHARED) TRY_DEV (hmac_setup_state (dev, hmac));
+
+  if (salt->mode == SALT_PER_LINE)
+  {
+    dev->kernel_salt_lines = clCreateKernel (dev->program, algo->kernel_salt_lines, &err);
+    TRY_CL (err, "clCreateKernel(salt lines)");
+  }
+  else if (salt->mode == SALT_SHARED)
+  {
+    TRY_DEV (salt_setup_state (dev, salt));
+  }
+
+  if (sc && sc->mask)
+  {
+    dev->kernel_mask = clCreateKernel (dev->program, algo->kernel_mask, &err);
+    TRY_CL (err, "clCreateKernel(mask)");
+
+    dev->buf_mask = clCreateBuffer (dev->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                    (size_t) sc->mask->table_words * sizeof (uint32_t),
+                                    (void *) sc->mask->table, &err);
+    TRY_CL (err, "clCreateBuffer(mask charsets)");
+  }
+
+  if (kdf->mode == KDF_ITER)
+  {
+    dev->kernel_iter_loop = clCreateKernel (dev->program, algo->kernel_iter_loop, &err);
+    TRY_CL (err, "clCreateKernel(iter loop)");
+  }
+  else if (kdf->mode == KDF_PBKDF2)
+  {
+    dev->kernel_pbkdf2_init = clCreateKernel (dev->program, algo->kernel_pbkdf2_init, &err);
+    TRY_CL (err, "clCreateKernel(pbkdf2 init)");
+
+    dev->kernel_pbkdf2_loop = clCreateKernel (dev->program, algo->kernel_pbkdf2_loop, &err);
+    TRY_CL (err, "clCreateKernel(pbkdf2 loop)");
+
+    dev->kernel_pbkdf2_comp = clCreateKernel (dev->program, algo->kernel_pbkdf2_comp, &err);
+    TRY_CL (err, "clCreateKernel(pbkdf2 comp)");
+
+    // *_hmac_update_global_swap 按整块读 salt：零填充到 block 的整数倍
+    const size_t salt_bytes = stride_for_len (kdf->salt_len, algo);
+
+    unsigned char *salt = (unsigned char *) calloc (salt_bytes, 1);
+    if (!salt)
+    {
+      fprintf (stderr, "malloc failed for PBKDF2 salt\n");
+      return CL_OUT_OF_HOST_MEMORY;
+    }
+
+    if (kdf->salt_len > 0) memcpy (salt, kdf->salt, kdf->salt_len);
+
+    dev->buf_salt = clCreateBuffer (dev->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, salt_bytes, salt, &err);
+
+    free (salt);
+
+    TRY_CL (err, "clCreateBuffer(pbkdf2 salt)");
+  }
+
+  TRY_DEV (device_pick_local_size (dev, local_size_opt, autotune));
+
+  fprintf (stderr, "[OpenCL] Layout: %s, single-block fast path: %s\n",
+           (layout == LAYOUT_PACKED) ? "packed" : "stride",
+           (use_single_block && dev->kernel_short && layout == LAYOUT_STRIDE && vector_width == 1) ? "on" : "off");
+
+  return CL_SUCCESS;
+}
+
+void device_release (device_ctx_t *dev, unsigned pipeline_depth, int search)
+{
+  if (dev->kernel)         clReleaseKernel (dev->kernel);
+  if (dev->kernel_packed)  clReleaseKernel (dev->kernel_packed);
+  if (dev->kernel_short)  clReleaseKernel (dev->kernel_short);
+  if (dev->kernel_vector) clReleaseKernel (dev->kernel_vector);
+  if (dev->kernel_hmac_lines) clReleaseKernel (dev->kernel_hmac_lines);
+  if (dev->kernel_iter_loop)   clReleaseKernel (dev->kernel_iter_loop);
+  if (dev->kernel_pbkdf2_init) clReleaseKernel (dev->kernel_pbkdf2_init);
+  if (dev->kernel_pbkdf2_loop) clReleaseKernel (dev->kernel_pbkdf2_loop);
+  if (dev->kernel_pbkdf2_comp) clReleaseKernel (dev->kernel_pbkdf2_comp);
+  if (dev->kernel_mask)        clReleaseKernel (dev->kernel_mask);
+  if (dev->kernel_salt_lines)  clReleaseKernel (dev->kernel_salt_lines);
+  if (dev->kernel_dedup_insert) clReleaseKernel (dev->kernel_dedup_insert);
+  if (dev->kernel_dedup_emit)   clReleaseKernel (dev->kernel_dedup_emit);
+  if (dev->buf_hmac) clReleaseMemObject (dev->buf_hmac);
+  if (dev->buf_salt_state) clReleaseMemObject (dev->buf_salt_state);
+  if (dev->buf_mask) clReleaseMemObject (dev->buf_mask);
+  if (dev->buf_salt) clReleaseMemObject (dev->buf_salt);
+  if (dev->buf_leaves) clReleaseMemObject (dev->buf_leaves);
+  if (dev->program) clReleaseProgram (dev->program);
+  for (unsigned si = 0; si < pipeline_depth; si++)
+  {
+    batch_slot_t *slot = &dev->slots[si];
+
+    pinned_release (slot->queue, &slot->stage_msgs);
+    pinned_release (slot->queue, &slot->stage_lens);
+    pinned_release (slot->queue, &slot->stage_idx);
+    pinned_release (slot->queue, &slot->stage_offs);
+    pinned_release (slot->queue, &slot->stage_keys);
+    pinned_release (slot->queue, &slot->stage_out);
+
+    if (slot->buf_msgs) clReleaseMemObject (slot->buf_msgs);
+    if (slot->buf_lens) clReleaseMemObject (slot->buf_lens);
+    if (slot->buf_idx)  clReleaseMemObject (slot->buf_idx);
+    if (slot->buf_offs) clReleaseMemObject (slot->buf_offs);
+    if (slot->buf_keys) clReleaseMemObject (slot->buf_keys);
+    if (slot->buf_tmps) clReleaseMemObject (slot->buf_tmps);
+    if (slot->buf_out)  clReleaseMemObject (slot->buf_out);
+    if (slot->buf_table) clReleaseMemObject (slot->buf_table);
+    if (slot->buf_uniq)  clReleaseMemObject (slot->buf_uniq);
+
+    if (dev->slots[si].buf_plains) clReleaseMemObject (dev->slots[si].buf_plains);
+    if (dev->slots[si].buf_result) clReleaseMemObject (dev->slots[si].buf_result);
+    if (dev->slots[si].buf_shown)  clReleaseMemObject (dev->slots[si].buf_shown);
+    if (slot->queue)
+    {
+      clFinish (slot->queue);
+      clReleaseCommandQueue (slot->queue);
+    }
+    free (slot->kernel_events);
+    free (slot->xfer_events);
+  }
+  if (search)
+  {
+    for (int i = 0; i < 8; i++)
+    {
+      if (dev->search.buf_bitmaps[i]) clReleaseMemObject (dev->search.buf_bitmaps[i]);
+    }
+    if (dev->search.buf_digests) clReleaseMemObject (dev->search.buf_digests);
+    if (dev->search.buf_param)   clReleaseMemObject (dev->search.buf_param);
+  }
+  if (dev->context) clReleaseContext (dev->context);
+}
+
+void native_thread (void *ctx, unsigned tid, unsigned nthreads)
+{
+  const native_job_t *job = (const native_job_t *) ctx;
+
+  const uint32_t begin = (uint32_t) ((unsigned long long) job->num *  tid      / nthreads);
+  const uint32_t end   = (uint32_t) ((unsigned long long) job->num * (tid + 1) / nthreads);
+
+  native_hash_range (job->impl, job->algo, job->rd->arena, job->rd->offs, job->rd->lens, begin, end, job->digests);
+}
+
+// 库接口（sha256_engine.h）：一组 device_setup 好的设备常驻在引擎里，每次提交的消息
+// 按 packed 布局走 enqueue_packed_batch，读回直接进调用方的 digests；slot 的调度跟命令行一样走 slot_pipeline_t。
+// 排队（选 slot、设 kernel 参数、enqueue）在锁里做；等 read_event 时不拿锁，别的线程照常提交。
+// 一个 slot 做完之前被占着：job 的 poll / wait，或者提交时没有空 slot，都会把它收尾。
+// 原生后端没有 slot：submit 把输入拷进 job 排进队列，引擎自己的计算线程按提交顺序一批批算
+struct sha256_engine
+{
+  pthread_mutex_t    lock;
+  const hash_algo_t *algo;
+  int                backend;     // BACKEND_OPENCL / BACKEND_NATIVE
+  int                impl;        // BACKEND_NATIVE：NATIVE_IMPL_*
+  unsigned           nthreads;
+  unsigned           depth;
+  unsigned           num_devs;
+  device_ctx_t      *devs;
+  slot_pipeline_t    pl;          // retire = engine_retire，把结果交给 slot 的 job
+  hmac_cfg_t         hmac;        // 固定是 HMAC_NONE / KDF_NONE / SALT_NONE，device_setup 要它们一直有效
+  kdf_cfg_t          kdf;
+  salt_cfg_t         salt;
+
+  sha256_engine_job_t *owner[MAX_DEVICES][MAX_PIPELINE_DEPTH];  // 每个忙着的 slot 属于哪个 job
+
+  unsigned           next_batch;
+  unsigned long long next_line;
+
+#ifdef SHA256_ENGINE_FAULT_TEST
+  unsigned           fail_batch;  // 测试用：第几次提交的 job 假装在设备上出错（SHA256_ENGINE_FAIL_BATCH）
+#endif
+
+  // BACKEND_NATIVE：等着算的 job（native_head 最早），都由 lock 保护
+  pthread_t            native_worker;
+  pthread_cond_t       native_cond;   // 有新 job / 要停
+  pthread_cond_t       done_cond;     // 有 job 做完
+  sha256_engine_job_t *native_head;
+  sha256_engine_job_t *native_tail;
+  int                  native_stop;   // destroy：队列算完就退出
+
+};
+
+struct sha256_engine_job
+{
+  sha256_engine_t *eng;
+  batch_slot_t    *slot;          // 做完后为 NULL
+  uint32_t        *digests;
+  uint32_t         num;
+  int              status;        // SHA256_ENGINE_OK，或者收尾时 OpenCL 出错的 SHA256_ENGINE_E_RUNTIME
+  int              done;          // 原子读写：做完之后 poll / wait 不再碰引擎（它可能已经 destroy）
+
+  unsigned         batch;         // 第几次提交（从 1 开始）
+  uint32_t        *input;         // 原生后端：submit 拷下来的 offs[num] + lens[num] + 数据，算完释放
+  struct sha256_engine_job *next; // 原生后端的等待队列
+
+};
+
+// 设备写回的是每个 u32 的值，翻成大端字节
+static void engine_digests_to_be (uint32_t *digests, size_t words)
+{
+  for (size_t i = 0; i < words; i++) digests[i] = __builtin_bswap32 (digests[i]);
+}
+
+// 设备层的 cl_int -> SHA256_ENGINE_*（原因 sha256_engine.c 里已经打印过）
+static int engine_status (cl_int err)
+{
+  if (err == CL_SUCCESS)            return SHA256_ENGINE_OK;
+  if (err == CL_OUT_OF_HOST_MEMORY) return SHA256_ENGINE_E_NOMEM;
+
+  return SHA256_ENGINE_E_RUNTIME;
+}
+
+// 编译时加 -DSHA256_ENGINE_FAULT_TEST 才有：环境变量 SHA256_ENGINE_FAIL_BATCH=N 让第 N 次提交的 job
+// 做完时按设备出错处理（wait 返回 SHA256_ENGINE_E_RUNTIME），给调用方测出错路径用
+static int engine_fault (const sha256_engine_t *eng, const sha256_engine_job_t *job)
+{
+#ifdef SHA256_ENGINE_FAULT_TEST
+  if (eng->fail_batch && job->batch == eng->fail_batch)
+  {
+    fprintf (stderr, "sha256_engine: injected failure for batch %u\n", job->batch);
+    return 1;
+  }
+#else
+  (void) eng;
+  (void) job;
+#endif
+
+  return 0;
+}
+
+// pipeline 的 retire（拿着锁，经 pipeline_retire 调用）：等读回、记账，结果交给 slot 的 job。
+// 读回出错时 job 记下 SHA256_ENGINE_E_RUNTIME，引擎照常往下走
+static cl_int engine_retire (batch_slot_t *slot, void *ctx)
+{
+  sha256_engine_t *eng = (sha256_engine_t *) ctx;
+  device_ctx_t    *dev = slot->dev;
+
+  const unsigned d  = (unsigned) (dev - eng->devs);
+  const unsigned si = (unsigned) (slot - dev->slots);
+
+  sha256_engine_job_t *job = eng->owner[d][si];
+
+  batch_out_t out;
+  memset (&out, 0, sizeof (out));
+
+  job->status = engine_status (collect_slot (slot, NULL, &out));
+
+  if (job->status == SHA256_ENGINE_OK && engine_fault (eng, job)) job->status = SHA256_ENGINE_E_RUNTIME;
+
+  if (job->status == SHA256_ENGINE_OK) engine_digests_to_be (job->digests, (size_t) job->num * eng->algo->digest_words);
+
+  eng->owner[d][si] = NULL;
+  job->slot         = NULL;
+
+  __atomic_store_n (&job->done, 1, __ATOMIC_RELEASE);
+
+  return CL_SUCCESS;
+}
+
+// 原生后端的计算线程：按提交顺序取 job，每批照样用 nthreads 个线程分段算
+static void *engine_native_worker (void *p)
+{
+  sha256_engine_t *eng = (sha256_engine_t *) p;
+
+  pthread_mutex_lock (&eng->lock);
+
+  for (;;)
+  {
+    while (!eng->native_head && !eng->native_stop) pthread_cond_wait (&eng->native_cond, &eng->lock);
+
+    sha256_engine_job_t *job = eng->native_head;
+
+    if (!job) break;
+
+    eng->native_head = job->next;
+
+    if (!eng->native_head) eng->native_tail = NULL;
+
+    pthread_mutex_unlock (&eng->lock);
+
+    line_reader_t view;
+    memset (&view, 0, sizeof (view));
+
+    view.offs  = job->input;
+    view.lens  = job->input + job->num;
+    view.arena = (unsigned char *) (job->input + 2u * (size_t) job->num);
+
+    native_job_t nj;
+
+    nj.impl    = eng->impl;
+    nj.algo    = eng->algo->native_algo;
+    nj.rd      = &view;
+    nj.num     = job->num;
+    nj.digests = job->digests;
+
+    parallel_run ((job->num < 65536u) ? 1 : eng->nthreads, native_thread, &nj);
+
+    engine_digests_to_be (job->digests, (size_t) job->num * eng->algo->digest_words);
+
+    if (engine_fault (eng, job)) job->status = SHA256_ENGINE_E_RUNTIME;
+
+    free (job->input);
+    job->input = NULL;
+
+    // 置 done 之后 job 归 wait 的线程，这里不再碰它
+    pthread_mutex_lock (&eng->lock);
+
+    __atomic_store_n (&job->done, 1, __ATOMIC_RELEASE);
+
+    pthread_cond_broadcast (&eng->done_cond);
+  }
+
+  pthread_mutex_unlock (&eng->lock);
+
+  return NULL;
+}
+
+void sha256_engine_opts_init (sha256_engine_opts_t *opts)
+{
+  memset (opts, 0, sizeof (*opts));
+
+  opts->algo      = "sha256";
+  opts->backend   = SHA256_ENGINE_BACKEND_AUTO;
+  opts->pipeline  = DEFAULT_PIPELINE_DEPTH;
+  opts->cache_dir = "kernels";
+  opts->cpu_impl  = NATIVE_IMPL_AUTO;
+}
+
+const char *sha256_engine_strerror (int err)
+{
+  switch (err)
+  {
+    case SHA256_ENGINE_OK:          return "success";
+    case SHA256_ENGINE_E_ARG:       return "invalid argument";
+    case SHA256_ENGINE_E_DEVICE:    return "no usable device";
+    case SHA256_ENGINE_E_TOO_LARGE: return "batch exceeds the device allocation limit";
+    case SHA256_ENGINE_E_NOMEM:     return "out of memory";
+    case SHA256_ENGINE_E_RUNTIME:   return "OpenCL runtime error";
+  }
+
+  return "unknown error";
+}
+
+int sha256_engine_create (const sha256_engine_opts_t *opts, sha256_engine_t **out)
+{
+  if (!opts || !out) return SHA256_ENGINE_E_ARG;
+
+  *out = NULL;
+
+  const hash_algo_t *algo = NULL;
+
+  for (size_t i = 0; i < NUM_HASH_ALGOS; i++)
+  {
+    if (opts->algo && strcmp (opts->algo, hash_algos[i].name) == 0) algo = &hash_algos[i];
+  }
+
+  if (!algo)
+  {
+    fprintf (stderr, "sha256_engine: unknown algorithm \"%s\"\n", opts->algo ? opts->algo : "(null)");
+    return SHA256_ENGINE_E_ARG;
+  }
+
+  if (opts->pipeline < 1 || opts->pipeline > MAX_PIPELINE_DEPTH)
+  {
+    fprintf (stderr, "sha256_engine: pipeline must be 1..%u\n", MAX_PIPELINE_DEPTH);
+    return SHA256_ENGINE_E_ARG;
+  }
+
+  int backend;
+
+  switch (opts->backend)
+  {
+    case SHA256_ENGINE_BACKEND_AUTO:   backend = BACKEND_AUTO;   break;
+    case SHA256_ENGINE_BACKEND_OPENCL: backend = BACKEND_OPENCL; break;
+    case SHA256_ENGINE_BACKEND_NATIVE: backend = BACKEND_NATIVE; break;
+    default:
+      fprintf (stderr, "sha256_engine: unknown backend %d\n", opts->backend);
+      return SHA256_ENGINE_E_ARG;
+  }
+
+  if (opts->cpu_impl != NATIVE_IMPL_AUTO && !native_impl_supported (opts->cpu_impl, algo->native_algo))
+  {
+    fprintf (stderr, "sha256_engine: CPU implementation %s is not supported for %s on this CPU\n",
+             native_impl_name (opts->cpu_impl), algo->name);
+    return SHA256_ENGINE_E_ARG;
+  }
+
+  device_entry_t all_devices[64];
+  const unsigned num_all = (backend != BACKEND_NATIVE) ? enumerate_devices (all_devices, 64) : 0;
+
+  // 跟命令行的 auto 一样：没给 devices、也没有 GPU 时用原生 CPU 实现
+  if (backend == BACKEND_AUTO)
+  {
+    backend = opts->devices ? BACKEND_OPENCL : BACKEND_NATIVE;
+
+    for (unsigned i = 0; i < num_all; i++)
+    {
+      if (all_devices[i].type & CL_DEVICE_TYPE_GPU) backend = BACKEND_OPENCL;
+    }
+  }
+
+  unsigned dev_sel[MAX_DEVICES];
+  unsigned num_devs = 0;
+
+  if (backend == BACKEND_OPENCL)
+  {
+    if (num_all == 0)
+    {
+      fprintf (stderr, "sha256_engine: no OpenCL devices found on any platform\n");
+      return SHA256_ENGINE_E_DEVICE;
+    }
+
+    num_devs = select_devices (all_devices, num_all, opts->devices, dev_sel);
+
+    if (num_devs == 0) return SHA256_ENGINE_E_DEVICE;
+  }
+
+  sha256_engine_t *eng = (sha256_engine_t *) calloc (1, sizeof (sha256_engine_t));
+  if (!eng) return SHA256_ENGINE_E_NOMEM;
+
+  pthread_mutex_init (&eng->lock, NULL);
+
+  eng->algo     = algo;
+  eng->backend  = backend;
+  eng->depth    = opts->pipeline;
+  eng->nthreads = opts->threads ? opts->threads : default_host_threads ();
+  eng->num_devs = num_devs;
+
+  if (eng->nthreads > MAX_HOST_THREADS) eng->nthreads = MAX_HOST_THREADS;
+
+#ifdef SHA256_ENGINE_FAULT_TEST
+  const char *fail_batch = getenv ("SHA256_ENGINE_FAIL_BATCH");
+
+  if (fail_batch) eng->fail_batch = (unsigned) strtoul (fail_batch, NULL, 10);
+#endif
+
+  if (backend == BACKEND_NATIVE)
+  {
+    eng->impl = (opts->cpu_impl == NATIVE_IMPL_AUTO) ? native_impl_best (algo->native_algo) : opts->cpu_impl;
+
+    pthread_cond_init (&eng->native_cond, NULL);
+    pthread_cond_init (&eng->done_cond, NULL);
+
+    if (pthread_create (&eng->native_worker, NULL, engine_native_worker, eng) != 0)
+    {
+      fprintf (stderr, "sha256_engine: pthread_create failed for the native worker\n");
+
+      pthread_cond_destroy (&eng->native_cond);
+      pthread_cond_destroy (&eng->done_cond);
+      pthread_mutex_destroy (&eng->lock);
+      free (eng);
+
+      return SHA256_ENGINE_E_NOMEM;
+    }
+
+    fprintf (stderr, "[Native] Engine: %s, implementation: %s, threads: %u\n",
+             algo->label, native_impl_name (eng->impl), eng->nthreads);
+
+    *out = eng;
+    return SHA256_ENGINE_OK;
+  }
+
+  eng->devs = (device_ctx_t *) calloc (num_devs, sizeof (device_ctx_t));
+  if (!eng->devs)
+  {
+    pthread_mutex_destroy (&eng->lock);
+    free (eng);
+    return SHA256_ENGINE_E_NOMEM;
+  }
+
+  for (unsigned d = 0; d < num_devs; d++)
+  {
+    const cl_int err = device_setup (&eng->devs[d], dev_sel[d], &all_devices[dev_sel[d]], algo, eng->depth, NULL,
+                                     &eng->hmac, &eng->kdf, &eng->salt, ENCODING_RAW, 1, LAYOUT_PACKED, 0,
+                                     opts->local_size, opts->autotune, opts->cache_dir);
+
+    if (err != CL_SUCCESS)
+    {
+      // 这个设备建了一半的部分和前面建好的设备一起释放
+      for (unsigned k = 0; k <= d; k++) device_release (&eng->devs[k], eng->depth, 0);
+
+      free (eng->devs);
+      pthread_mutex_destroy (&eng->lock);
+      free (eng);
+
+      return engine_status (err);
+    }
+  }
+
+  eng->pl.devs     = eng->devs;
+  eng->pl.num_devs = num_devs;
+  eng->pl.depth    = eng->depth;
+  eng->pl.retire   = engine_retire;
+  eng->pl.ctx      = eng;
+
+  fprintf (stderr, "[OpenCL] Engine: %s, pipeline depth: %u, devices: %u\n", algo->label, eng->depth, num_devs);
+
+  *out = eng;
+  return SHA256_ENGINE_OK;
+}
+
+unsigned sha256_engine_digest_bytes (const sha256_engine_t *eng)
+{
+  return eng->algo->digest_words * (unsigned) sizeof (uint32_t);
+}
+
+int sha256_engine_submit (sha256_engine_t *eng, const void *data, const uint32_t *offs, const uint32_t *lens,
+                          uint32_t num, void *digests, sha256_engine_job_t **job_out)
+{
+  if (!eng || !job_out || (num > 0 && (!data || !offs || !lens || !digests))) return SHA256_ENGINE_E_ARG;
+
+  if ((uintptr_t) digests & 3u) return SHA256_ENGINE_E_ARG;
+
+  *job_out = NULL;
+
+  sha256_engine_job_t *job = (sha256_engine_job_t *) calloc (1, sizeof (sha256_engine_job_t));
+  if (!job) return SHA256_ENGINE_E_NOMEM;
+
+  job->eng     = eng;
+  job->digests = (uint32_t *) digests;
+  job->num     = num;
+
+  // 只读视图：arena / offs / lens 指向调用方的数组，map 为空 -> enqueue_packed_batch 先拷进 staging
+  line_reader_t view;
+  memset (&view, 0, sizeof (view));
+
+  view.arena = (unsigned char *) data;
+  view.offs  = (uint32_t *) offs;
+  view.lens  = (uint32_t *) lens;
+
+  if (num == 0)
+  {
+    job->done = 1;
+  }
+  else if (eng->backend == BACKEND_NATIVE)
+  {
+    // 调用方在 submit 返回后就可以复用输入，所以整批拷一份跟着 job 走；计算线程算完释放
+    const size_t data_bytes = (size_t) offs[num - 1] + lens[num - 1];
+    const size_t idx_bytes  = (size_t) num * sizeof (uint32_t);
+
+    job->input = (uint32_t *) malloc (2 * idx_bytes + data_bytes + 1);
+
+    if (!job->input)
+    {
+      free (job);
+      return SHA256_ENGINE_E_NOMEM;
+    }
+
+    memcpy (job->input,       offs, idx_bytes);
+    memcpy (job->input + num, lens, idx_bytes);
+    memcpy (job->input + 2u * (size_t) num, data, data_bytes);
+
+    pthread_mutex_lock (&eng->lock);
+
+    job->batch = ++eng->next_batch;
+
+    if (eng->native_tail) eng->native_tail->next = job;
+    else                  eng->native_head       = job;
+
+    eng->native_tail = job;
+
+    pthread_cond_signal (&eng->native_cond);
+    pthread_mutex_unlock (&eng->lock);
+  }
+  else
+  {
+    const size_t data_bytes = (size_t) offs[num - 1] + lens[num - 1];
+    const size_t out_bytes  = (size_t) num * eng->algo->digest_words * sizeof (uint32_t);
+
+    // enqueue_packed_batch 的 buf_msgs 按整块多读 PACKED_TAIL_PAD
+    for (unsigned d = 0; d < eng->num_devs; d++)
+    {
+      const cl_ulong max_alloc = eng->devs[d].max_alloc;
+
+      if (data_bytes + 4 + PACKED_TAIL_PAD > max_alloc || out_bytes > max_alloc)
+      {
+        free (job);
+        return SHA256_ENGINE_E_TOO_LARGE;
+      }
+    }
+
+    size_t max_len = 0;
+
+    for (uint32_t i = 0; i < num; i++)
+    {
+      if (lens[i] > max_len) max_len = lens[i];
+    }
+
+    pthread_mutex_lock (&eng->lock);
+
+    // 按预计完成时间挑设备，它没有空 slot 就先收尾它最早的一批（engine_retire 不会失败）
+    batch_slot_t *slot = NULL;
+
+    pipeline_acquire (&eng->pl, num, &slot);
+
+    device_ctx_t *dev = slot->dev;
+
+    const double t_pack = now_seconds ();
+
+    pipeline_begin (slot, num, eng->next_line, ++eng->next_batch);
+
+    job->batch = eng->next_batch;
+
+    slot->stats.in_bytes  = data_bytes;
+    slot->stats.d2h_bytes = out_bytes;
+
+    eng->next_line += num;
+
+    cl_int err = device_reserve (dev->context, &slot->buf_out, &slot->out_cap, out_bytes, CL_MEM_WRITE_ONLY,
+                                 dev->max_alloc, "buf_out");
+
+    if (err == CL_SUCCESS) err = enqueue_packed_batch (slot, NULL, &view, num, max_len, 1);
+
+    if (err == CL_SUCCESS)
+    {
+      err = clEnqueueReadBuffer (slot->queue, slot->buf_out, CL_FALSE, 0, out_bytes, job->digests,
+                                 0, NULL, &slot->read_event);
+
+      if (err != CL_SUCCESS)
+      {
+        fprintf (stderr, "clEnqueueReadBuffer failed with error %d\n", err);
+
+        pipeline_abort (slot);
+      }
+      else
+      {
+        // flush 失败时读回已经等完、event 已经释放：job 不交给调用方，digests 不会再被写
+        err = pipeline_launch (slot, t_pack);
+      }
+    }
+    else
+    {
+      pipeline_abort (slot);
+    }
+
+    if (err != CL_SUCCESS)
+    {
+      // slot 还是空的，之后照常可用
+      pthread_mutex_unlock (&eng->lock);
+
+      free (job);
+      return engine_status (err);
+    }
+
+    job->slot = slot;
+
+    eng->owner[dev - eng->devs][slot - dev->slots] = job;
+
+    pthread_mutex_unlock (&eng->lock);
+  }
+
+  *job_out = job;
+
+  return SHA256_ENGINE_OK;
+}
+
+int sha256_engine_poll (sha256_engine_job_t *job)
+{
+  if (__atomic_load_n (&job->done, __ATOMIC_ACQUIRE)) return 1;
+
+  sha256_engine_t *eng = job->eng;
+
+  if (eng->backend == BACKEND_NATIVE) return 0;
+
+  pthread_mutex_lock (&eng->lock);
+
+  if (!job->done && slot_finished (job->slot)) pipeline_retire (&eng->pl, job->slot);
+
+  const int done = job->done;
+
+  pthread_mutex_unlock (&eng->lock);
+
+  return done;
+}
+
+int sha256_engine_wait (sha256_engine_job_t *job)
+{
+  if (!__atomic_load_n (&job->done, __ATOMIC_ACQUIRE))
+  {
+    sha256_engine_t *eng = job->eng;
+
+    pthread_mutex_lock (&eng->lock);
+
+    if (eng->backend == BACKEND_NATIVE)
+    {
+      while (!job->done) pthread_cond_wait (&eng->done_cond, &eng->lock);
+    }
+    else if (!job->done)
+    {
+      // 等的时候放开锁；别的线程可能先把这个 slot 收尾、再拿去排下一批，所以先 retain 住 event
+      // （retain 失败就直接在锁里等；出错由 engine_retire 里的 collect_slot 报）
+      cl_event ev = job->slot->read_event;
+
+      if (clRetainEvent (ev) == CL_SUCCESS)
+      {
+        pthread_mutex_unlock (&eng->lock);
+
+        clWaitForEvents (1, &ev);
+        clReleaseEvent (ev);
+
+        pthread_mutex_lock (&eng->lock);
+      }
+
+      if (!job->done) pipeline_retire (&eng->pl, job->slot);
+    }
+
+    pthread_mutex_unlock (&eng->lock);
+  }
+
+  const int status = job->status;
+
+  free (job);
+
+  return status;
+}
+
+void sha256_engine_destroy (sha256_engine_t *eng)
+{
+  if (!eng) return;
+
+  if (eng->backend == BACKEND_OPENCL)
+  {
+    pthread_mutex_lock (&eng->lock);
+
+    pipeline_drain (&eng->pl);
+
+    for (unsigned d = 0; d < eng->num_devs; d++)
+    {
+      device_release (&eng->devs[d], eng->depth, 0);
+    }
+
+    pthread_mutex_unlock (&eng->lock);
+
+    free (eng->devs);
+  }
+  else
+  {
+    // 计算线程把已经排队的 job 算完才退出，之后它们的 wait 不再碰引擎
+    pthread_mutex_lock (&eng->lock);
+
+    eng->native_stop = 1;
+
+    pthread_cond_signal (&eng->native_cond);
+    pthread_mutex_unlock (&eng->lock);
+
+    pthread_join (eng->native_worker, NULL);
+
+    pthread_cond_destroy (&eng->native_cond);
+    pthread_cond_destroy (&eng->done_cond);
+  }
+
+  pthread_mutex_destroy (&eng->lock);
+
+  free (eng);
+}
@@ -0,0 +1,91 @@
+// 批量哈希的库接口：sha256_host 的 OpenCL / 原生 CPU 路径按上下文封装成可复用的引擎，
+// 给需要在进程里反复提交小批量的调用方（服务、数据管道）用，不必每次启动进程、重新编译 kernel。
+//
+// 一个引擎 = 一组设备（各自的 context / program / kernel / slot，跟命令行的 --devices 一样），
+// 创建时编译一次（kernels/ 里的 binary 缓存照常用），之后每次提交只排队上传 / kernel / 读回：
+// 设备 buffer 和 pinned staging 都是 grow-only，跨提交复用。每个设备最多 pipeline 个批同时在飞，
+// 提交是异步的，poll / wait 取结果。多个线程可以同时对同一个引擎提交和等待（内部一把锁保护排队），
+// 一个 job 只能由一个线程 poll / wait。原生 CPU 后端也一样：submit 只把输入拷进 job 就返回，
+// 引擎里的计算线程按提交顺序一批批算。
+//
+// 布局跟 --layout packed 一样：消息首尾相接放在 data 里，offs[i] / lens[i] 是第 i 条的字节偏移 / 长度，
+// 按顺序排（最后一条的 offs + lens 就是 data 的有效长度）。submit 返回前输入已经拷进 staging（或 job），
+// 调用方随即可以复用 data / offs / lens；digests（4 字节对齐）要一直有效到 job 完成，
+// 里面是 num 条标准的大端 digest（每条 sha256_engine_digest_bytes 字节）。
+//
+// 出错都返回负的错误码，不会退出进程：参数 / 设备 / 尺寸这类调用方能处理的错误，以及 OpenCL
+// 运行时出错（建 buffer 失败、设备丢失）时的 SHA256_ENGINE_E_RUNTIME，原因照常打到 stderr。
+// 提交之后才出的错由 wait 返回，那个 job 的 digests 内容不确定；引擎本身仍然可以继续用。
+// 只支持普通哈希（没有 --search / HMAC / KDF），CUDA / HIP 后端只在命令行里提供。
+//
+// 编译成库（sha256_engine.c 是设备层和引擎，sha256_native.c 是原生 CPU 后端）:
+//   gcc -O2 -fPIC -shared -o libsha256_engine.so sha256_engine.c sha256_native.c -lOpenCL -lpthread -lm
+
+#ifndef SHA256_ENGINE_H
+#define SHA256_ENGINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SHA256_ENGINE_OK           0
+#define SHA256_ENGINE_E_ARG       -1  // 参数不对（算法名、选项、空指针）
+#define SHA256_ENGINE_E_DEVICE    -2  // 没有可用设备 / devices 列表不对
+#define SHA256_ENGINE_E_TOO_LARGE -3  // 一次提交的数据超过设备单个 buffer 的上限，拆小再交
+#define SHA256_ENGINE_E_NOMEM     -4
+#define SHA256_ENGINE_E_RUNTIME   -5  // OpenCL 调用失败（原因打在 stderr）
+
+#define SHA256_ENGINE_BACKEND_AUTO   0  // 有 OpenCL GPU 用 GPU，没有（也没给 devices）用原生 CPU
+#define SHA256_ENGINE_BACKEND_OPENCL 1
+#define SHA256_ENGINE_BACKEND_NATIVE 2
+
+typedef struct sha256_engine     sha256_engine_t;
+typedef struct sha256_engine_job sha256_engine_job_t;
+
+typedef struct sha256_engine_opts
+{
+  const char *algo;        // "sha256" / "sha512"
+  int         backend;     // SHA256_ENGINE_BACKEND_*
+  const char *devices;     // 同 --devices："all" 或 "0,2,..."；NULL = 第一个设备
+  unsigned    pipeline;    // 每个设备同时在飞的批数（1..8）
+  size_t      local_size;  // 0 = 按 kernel 的 preferred multiple 选
+  int         autotune;    // 前几批实测挑 work-group 大小
+  const char *cache_dir;   // program binary 缓存目录，NULL = 不缓存
+  unsigned    threads;     // 原生后端每批的计算线程数，0 = CPU 核数
+  int         cpu_impl;    // 原生后端的实现（sha256_native.h 的 NATIVE_IMPL_*），-1 = 自动
+
+} sha256_engine_opts_t;
+
+// 命令行的默认值：sha256、auto、第一个设备、pipeline 3、kernels/ 缓存
+void sha256_engine_opts_init (sha256_engine_opts_t *opts);
+
+// 枚举 / 选设备、建 context、编译 program；成功时 *out 是新引擎
+int sha256_engine_create (const sha256_engine_opts_t *opts, sha256_engine_t **out);
+
+unsigned sha256_engine_digest_bytes (const sha256_engine_t *eng);
+
+// 提交 num 条消息，结果写进 digests（num * digest_bytes 字节）。*job 交给 poll / wait。
+// 排队时 OpenCL 出错返回 SHA256_ENGINE_E_RUNTIME（不产生 job，digests 不会再被写）
+int sha256_engine_submit (sha256_engine_t *eng, const void *data, const uint32_t *offs, const uint32_t *lens,
+                          uint32_t num, void *digests, sha256_engine_job_t **job);
+
+// 不阻塞：做完了返回 1（成功与否看 wait 的返回值，成功时 digests 可以读了），还在跑返回 0
+int sha256_engine_poll (sha256_engine_job_t *job);
+
+// 阻塞到 job 做完并释放它（之后 job 不能再用）；返回 SHA256_ENGINE_OK，
+// 这一批在设备上出错时返回 SHA256_ENGINE_E_RUNTIME
+int sha256_engine_wait (sha256_engine_job_t *job);
+
+// 先做完所有在飞的 job（结果照常写进各自的 digests，job 仍需 wait 释放），再释放设备
+void sha256_engine_destroy (sha256_engine_t *eng);
+
+const char *sha256_engine_strerror (int err);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SHA256_ENGINE_H
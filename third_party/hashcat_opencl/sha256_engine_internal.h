@@ -0,0 +1,662 @@
+// sha256_host 和 libsha256_engine 共用的设备层（实现在 sha256_engine.c）：算法表、批次 / slot / 设备的
+// 结构体，以及建 context / 编译 program / 排队 packed 批次 / 收尾这一组函数。不是对外接口，
+// 对外的是 sha256_engine.h；这里的函数在库里是 hidden 的。
+//
+// 出错约定：设备层不退出进程。OpenCL 调用失败时打印 "xxx failed with error N"，返回那个 cl_int
+// （主机内存不够是 CL_OUT_OF_HOST_MEMORY）；返回指针的函数失败时返回 NULL。
+// 命令行用 CHECK_DEV 包一层直接退出，库接口翻成 SHA256_ENGINE_E_*。
+
+#ifndef SHA256_ENGINE_INTERNAL_H
+#define SHA256_ENGINE_INTERNAL_H
+
+#define CL_TARGET_OPENCL_VERSION 120
+#include <CL/cl.h>
+
+/*
+ * 在很多系统里，如果 CL_TARGET_OPENCL_VERSION < 200，
+ * 头文件不会声明 cl_queue_properties 和 clCreateCommandQueueWithProperties。
+ * 这里自己补上 typedef + 原型，方便在 OpenCL 1.2 头文件下使用 2.0 API。
+ */
+#ifndef CL_VERSION_2_0
+typedef cl_bitfield cl_queue_properties;
+extern CL_API_ENTRY cl_command_queue CL_API_CALL
+clCreateCommandQueueWithProperties (cl_context                 context,
+                                    cl_device_id               device,
+                                    const cl_queue_properties *properties,
+                                    cl_int                    *errcode_ret);
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "sha256_native.h"
+
+// work-group 大小（--local-size）：默认取 CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE 的整数倍，
+// 不超过 DEFAULT_LOCAL_SIZE_MAX 和 kernel 的 CL_KERNEL_WORK_GROUP_SIZE；
+// --autotune 在前几批里轮流试 preferred multiple 的 2 的幂倍，最多 MAX_TUNE_SIZES 种
+#define DEFAULT_LOCAL_SIZE_MAX 256
+#define MAX_TUNE_SIZES         8
+
+// 流水线的各个阶段（stderr 的 Stages 汇总和 --metrics）：host 阶段用 CLOCK_MONOTONIC 计时，
+// 设备阶段（上传 / kernel / 读回）用 event profiling，多设备时是各设备的时间之和
+#define STAGE_READ   0  // 读入 + 切行
+#define STAGE_PACK   1  // 分桶 / 打包 / 拷进 staging / 排队
+#define STAGE_H2D    2  // 上传
+#define STAGE_KERNEL 3
+#define STAGE_D2H    4  // 读回（--merkle 时是拷进叶子 buffer 的设备内拷贝）
+#define STAGE_FORMAT 5  // hex / raw 编码
+#define STAGE_WRITE  6  // 写输出文件
+#define NUM_STAGES   7
+
+// 按实际要压缩的 block 数分桶：桶 b（从 0 开始）放 (b+1) 个 block 的消息，
+// stride = (b+1) * block；更长的消息统一进最后一个桶，stride 按该桶实际最大长度算
+#define NUM_LEN_BUCKETS 17
+
+// host 侧并行（切行 / 打包）的最大线程数
+#define MAX_HOST_THREADS 64
+
+// 同时在飞的 batch 数（1 = 串行，2 = 双缓冲，3 = 三缓冲）
+#define DEFAULT_PIPELINE_DEPTH 3
+#define MAX_PIPELINE_DEPTH     8
+
+// 最多同时使用多少个设备（--devices）
+#define MAX_DEVICES 16
+
+// 消息在设备上的布局（--layout）
+#define LAYOUT_STRIDE 0  // 按桶零填充到固定 stride：sha256_wrapper / sha512_wrapper
+#define LAYOUT_PACKED 1  // 首尾相接 + 字节偏移数组：sha256_wrapper_packed / sha512_wrapper_packed
+
+// 每行在哈希前的编码（--encoding）：上传的总是原始字节，UTF-16LE 在 kernel 里宽化（-D UTF16LE_MODE）
+#define ENCODING_RAW     0
+#define ENCODING_UTF16LE 1
+
+// 搜索模式的 bitmap 参数（跟 hashcat 的默认值一致：--bitmap-min 16 / --bitmap-max 18）
+#define SEARCH_BITMAP_MIN    16
+#define SEARCH_BITMAP_MAX    18
+#define SEARCH_BITMAP_SHIFT1 5
+#define SEARCH_BITMAP_SHIFT2 13
+
+// 计算后端（--backend）：auto 在没有 OpenCL GPU、又是普通哈希时走原生 CPU 实现；
+// cuda / hip 只在显式指定时使用
+#define BACKEND_AUTO   0
+#define BACKEND_OPENCL 1
+#define BACKEND_NATIVE 2
+#define BACKEND_CUDA   3
+#define BACKEND_HIP    4
+
+// packed 布局下 msgs 末尾多留的字节：kernel 按整块（再多一个 u32）读，越界部分落在这里
+// （按最大的 SHA-512 block 算：128 + 4 字节）
+#define PACKED_TAIL_PAD 256
+
+// 哈希算法（--algo）：kernel 源文件 / 入口名，以及分桶和输出要用的尺寸
+typedef struct hash_algo
+{
+  const char *name;           // --algo 的取值
+  const char *label;          // 日志里的名字
+  const char *kernel_file;
+  const char *kernel;         // stride 布局
+  const char *kernel_packed;  // packed 布局
+  const char *kernel_short;   // 单 block 快速路径（没有则 NULL）
+  const char *kernel_vector;  // 向量版（没有则 NULL）
+  const char *kernel_hmac_setup;  // 共享 key 的 ipad / opad 预处理
+  const char *kernel_hmac_lines;  // 每行自带 key 的 HMAC（packed 布局）
+  const char *kernel_iter_loop;   // --iterations：在 digests 上原地迭代
+  const char *kernel_pbkdf2_init; // --pbkdf2-salt：init / loop / comp
+  const char *kernel_pbkdf2_loop;
+  const char *kernel_pbkdf2_comp;
+  const char *kernel_stream;      // --stream：多次 launch 流式处理一个文件
+  const char *kernel_merkle;      // --merkle：由下一层算出上一层
+  const char *kernel_mask;        // --mask：设备上生成候选（只有支持 --search 的算法有）
+  const char *kernel_salt_setup;  // --salt（前缀）：salt 的 midstate 预处理
+  const char *kernel_salt_lines;  // --salt-per-line：每行自带 salt（packed 布局）
+  const char *kernel_dedup_insert; // --dedup：digest 插进设备上的 hash 表
+  const char *kernel_dedup_emit;   // --dedup：只留每个 digest 第一次出现的行
+  unsigned    stream_state_bytes; // 设备上 *_stream_state_t 的大小
+  unsigned    block_bytes;    // 压缩函数的 block 大小
+  unsigned    len_bytes;      // padding 末尾的长度字段
+  unsigned    digest_words;   // digest 的 u32 个数
+  int         search;         // 支持 --search
+  int         native_algo;    // --backend native 用的算法（NATIVE_SHA256 / NATIVE_SHA512）
+
+} hash_algo_t;
+
+// HMAC 模式（--hmac-key / --hmac-key-hex / --hmac-per-line）
+#define HMAC_NONE     0
+#define HMAC_SHARED   1  // 所有行共用一个 key：ipad / opad 状态在设备上只算一次
+#define HMAC_PER_LINE 2  // 每行 "key:message"
+
+typedef struct hmac_cfg
+{
+  int            mode;
+  unsigned char *key;         // HMAC_SHARED：原始 key 字节
+  size_t         key_len;
+
+} hmac_cfg_t;
+
+// 迭代 / 密钥派生（--iterations / --pbkdf2-salt / --pbkdf2-salt-hex）
+#define KDF_NONE   0
+#define KDF_ITER   1  // h = H (line)，再做 iterations - 1 轮 h = H (h)（对 raw digest）
+#define KDF_PBKDF2 2  // PBKDF2-HMAC（password = 行，共享 salt），只输出第一个块（dkLen = digest 长度）
+
+typedef struct kdf_cfg
+{
+  int            mode;
+  unsigned       iterations;
+  unsigned       loop_chunk;  // 每次 loop launch 的轮数
+  unsigned char *salt;
+  size_t         salt_len;
+
+} kdf_cfg_t;
+
+// 加盐（--salt / --salt-hex / --salt-per-line，--salt-pos）：H (salt . 行) 或 H (行 . salt)
+#define SALT_NONE     0
+#define SALT_SHARED   1  // 所有行共用一个 salt：前缀的 midstate 在设备上只算一次，放 constant memory
+#define SALT_PER_LINE 2  // 每行 "salt:行"（salt 到第一个 ':' 为止），salt 在 kernel 里原地读
+
+#define SALT_PREFIX 0
+#define SALT_SUFFIX 1
+
+// 前缀模式设备上 *_ctx_t 的大小上限（sha512_ctx_t 是 8 个 u64 + 32 个 u32 + len）
+#define SALT_STATE_BYTES 256
+
+typedef struct salt_cfg
+{
+  int            mode;
+  int            pos;         // SALT_PREFIX / SALT_SUFFIX
+  unsigned char *salt;        // SALT_SHARED：原始 salt 字节
+  size_t         salt_len;
+
+} salt_cfg_t;
+
+// 设备上去重（--dedup first|count）：每批的 digest 在设备上插进 hash 表，只有每个 digest
+// 第一次出现的行回到 host。范围是一批之内（批与批之间不比较）
+#define DEDUP_NONE  0
+#define DEDUP_FIRST 1  // 输出 "行号:hex"，只有第一次出现的行
+#define DEDUP_COUNT 2  // 不读回 digest，每批输出一行 "首行号:行数:唯一数"
+
+// 一批（或整个运行）各阶段的耗时和数据量
+typedef struct stage_stats
+{
+  double             seconds[NUM_STAGES];
+  unsigned long long in_bytes;    // 输入的原始字节
+  unsigned long long h2d_bytes;
+  unsigned long long d2h_bytes;
+  unsigned long long msgs;
+  unsigned long long hashes;      // 算了多少个候选（--mask 时是 msgs x keyspace，否则等于 msgs）
+
+} stage_stats_t;
+
+// pinned host 内存：CL_MEM_ALLOC_HOST_PTR 分配后一直 map 着，ptr 直接当 host 缓冲用，
+// 驱动可以直接对它做 DMA（grow-only，跨 batch 复用）
+typedef struct pinned_buf
+{
+  cl_mem  mem;
+  void   *ptr;
+  size_t  cap;
+
+} pinned_buf_t;
+
+// 一个在飞 batch 的全部状态：独立的 queue / buffer / event，互不干扰。
+// 设备 buffer 和 pinned staging 都是 grow-only，整个运行期属于这个 slot，
+// slot 收尾之前（read_event 完成前）它们都不能碰。
+typedef struct batch_slot
+{
+  cl_command_queue queue;
+
+  cl_mem    buf_msgs;
+  cl_mem    buf_lens;
+  cl_mem    buf_idx;        // 分桶顺序 -> 原始行号
+  cl_mem    buf_offs;       // packed 布局：每行的字节偏移
+  cl_mem    buf_keys;       // --hmac-per-line / --salt-per-line：每行 key（salt）的长度
+  cl_mem    buf_tmps;       // PBKDF2：每条消息的 ipad / opad / U / T，跨 loop launch 保存
+  cl_mem    buf_out;
+
+  size_t    msgs_cap;       // 上面各 buffer 当前的字节数
+  size_t    lens_cap;
+  size_t    idx_cap;
+  size_t    offs_cap;
+  size_t    keys_cap;
+  size_t    tmps_cap;
+  size_t    out_cap;
+
+  int       use_idx;        // 本批分了桶；只有一个桶时 kernel 的 idx 传 NULL
+
+  pinned_buf_t stage_msgs;  // stride：打包好的消息；packed + fread：arena 的副本
+  pinned_buf_t stage_lens;
+  pinned_buf_t stage_idx;
+  pinned_buf_t stage_offs;
+  pinned_buf_t stage_keys;
+  pinned_buf_t stage_out;   // digest 的读回目标
+
+  cl_event *kernel_events;  // 每个非空桶一次 launch，迭代模式再加每次 loop launch（grow-only）
+  unsigned  num_kernel_events;
+  unsigned  events_cap;
+  cl_event *xfer_events;    // 本批的上传（grow-only）
+  unsigned  num_xfer_events;
+  unsigned  xfer_cap;
+  cl_event  read_event;
+
+  stage_stats_t stats;      // 本批的 read / pack（提交时）和设备阶段（收尾时）
+
+  cl_mem    buf_plains;     // 搜索模式：命中记录（plain_t），整个运行期复用
+  cl_mem    buf_shown;      // 搜索模式：本 slot 的 hashes_shown（同一 queue 内按批次顺序执行）
+  cl_mem    buf_result;     // 搜索模式：命中计数（d_return_buf）；--dedup：唯一 digest 的计数。每批清零
+  uint32_t  result_cnt;     // read_event 读回的上面那个计数
+
+  cl_mem    buf_table;      // --dedup：开放寻址表（行号，2 的幂个 u32），每批填 DEDUP_EMPTY
+  cl_mem    buf_uniq;       // --dedup first：唯一的 (行号, digest) 记录，追加顺序
+  size_t    table_cap;
+  size_t    uniq_cap;
+  uint32_t  table_mask;
+
+  struct device_ctx *dev;   // slot 属于哪个设备
+
+  uint32_t  num_msgs;
+  unsigned long long line_base;  // 本批第一行在整个输入中的行号（从 0 开始）
+  unsigned  batch_index;
+  size_t    local_size;     // 本批 launch 用的 work-group 大小（--autotune 按它记账）
+  int       busy;
+
+} batch_slot_t;
+
+// host 侧镜像 inc_types.h 的 plain_t / kernel_param_t（字段和顺序必须一致）
+typedef struct search_plain
+{
+  uint64_t gidvid;      // 命中的行（本批内下标）
+  uint64_t il_pos;
+  uint32_t salt_pos;
+  uint32_t digest_pos;
+  uint32_t hash_pos;    // 命中的目标（排序后的下标）
+  uint32_t extra1;
+  uint32_t extra2;
+
+} search_plain_t;
+
+typedef struct search_param
+{
+  uint32_t bitmap_mask;
+  uint32_t bitmap_shift1;
+  uint32_t bitmap_shift2;
+  uint32_t salt_pos_host;
+  uint64_t loop_pos;
+  uint64_t loop_cnt;
+  uint64_t il_cnt;
+  uint32_t digests_cnt;
+  uint32_t digests_offset_host;
+  uint32_t combs_mode;
+  uint32_t salt_repeat;
+  uint64_t pws_pos;
+  uint64_t gid_max;
+
+} search_param_t;
+
+// --mask：hashcat 的掩码语法。?l ?u ?d ?h ?H ?s ?a ?b 是内置字符集，?? 是 '?' 本身，其它字符原样；
+// 候选 = 输入行 + 掩码展开的后缀（hashcat 的 -a 6），最后一个位置变化最快。
+// 命中的候选编号走 plain_t.il_pos（u32），所以 keyspace 不能超过 2^32
+#define MASK_MAX_LEN 32
+
+// 每个 work-item 连续算的候选数（hashcat 的 amplifier 循环），
+// 以及一次 launch 大约算多少个候选（拆成多次 launch，单次不会撞上 watchdog）
+#define MASK_IL_STEP       256u
+#define MASK_LAUNCH_HASHES (1ull << 28)
+
+typedef struct mask_cfg
+{
+  unsigned  len;                  // 位置数
+  uint64_t  keyspace;             // 每个 base word 的候选数（各位置字符数之积）
+  uint32_t  table_words;
+  uint32_t  table[MASK_MAX_LEN * 2 + MASK_MAX_LEN * 256];  // 上传给 kernel：每个位置 (字符起点, 字符数)，后面是字符
+
+} mask_cfg_t;
+
+// --search：目标 digest（排序去重后）和设备上常驻的 bitmap / hashes_shown
+typedef struct search_ctx
+{
+  uint32_t  num_targets;
+  uint32_t *targets;          // 每个 8 个 u32，按 find_hash 的比较顺序排好
+
+  uint32_t  bitmap_bits;
+  uint32_t *bitmaps;          // s1_a .. s1_d, s2_a .. s2_d，各 1 << bitmap_bits 个 u32
+  uint8_t  *reported;         // 每个目标是否已经写出（每个 slot 各有一份 hashes_shown，写出时再去重）
+
+  const mask_cfg_t *mask;     // --mask：输入行是 base word，候选在设备上生成（NULL = 输入行就是候选）
+
+  unsigned long long total_hits;
+
+} search_ctx_t;
+
+// 搜索模式在每个设备上常驻的部分
+typedef struct search_dev
+{
+  cl_mem    buf_bitmaps[8];
+  cl_mem    buf_digests;
+  cl_mem    buf_param;
+
+} search_dev_t;
+
+// 一个参与计算的设备：自己的 context / program / kernel / slot，外加调度用的吞吐统计
+typedef struct device_ctx
+{
+  unsigned        id;             // 在全部设备枚举里的编号（--devices 用的就是它）
+  cl_platform_id  platform;
+  cl_device_id    device;
+  cl_context      context;
+  cl_program      program;
+
+  cl_kernel       kernel;
+  cl_kernel       kernel_packed;
+  cl_kernel       kernel_short;
+  cl_kernel       kernel_vector;
+  cl_kernel       kernel_hmac_lines;
+  cl_kernel       kernel_iter_loop;
+  cl_kernel       kernel_pbkdf2_init;
+  cl_kernel       kernel_pbkdf2_loop;
+  cl_kernel       kernel_pbkdf2_comp;
+  cl_kernel       kernel_mask;
+  cl_kernel       kernel_salt_lines;
+  cl_kernel       kernel_dedup_insert;
+  cl_kernel       kernel_dedup_emit;
+  int             dedup;          // --dedup：DEDUP_*
+  cl_mem          buf_mask;       // --mask：每个位置的字符集（kernel 按 constant 读）
+  cl_mem          buf_hmac;       // HMAC_SHARED：ipad / opad 状态（kernel 按 constant 读）
+  cl_mem          buf_salt_state; // SALT_SHARED：前缀的 midstate 或后缀的 salt（kernel 按 constant 读）
+  const salt_cfg_t *salt;
+  cl_mem          buf_salt;       // PBKDF2：零填充到 block 整数倍的 salt
+  const kdf_cfg_t *kdf;
+  int             merkle;         // --merkle：每批的 digest 拷进 buf_leaves，不读回
+  cl_mem          buf_leaves;     // --merkle：全部叶子（按行号），grow 时保留已有内容
+  size_t          leaves_cap;
+  unsigned        vector_width;
+  cl_ulong        max_alloc;      // CL_DEVICE_MAX_MEM_ALLOC_SIZE
+  cl_ulong        global_mem;     // CL_DEVICE_GLOBAL_MEM_SIZE
+  size_t          local_size;     // 各 kernel 的 work-group 大小（global 向上取整到它的整数倍）
+  size_t          wg_multiple;    // CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE
+  size_t          wg_limit;       // 各 kernel 的 CL_KERNEL_WORK_GROUP_SIZE 取最小
+  const hash_algo_t *algo;
+
+  // --autotune：候选的 work-group 大小，每个先跑一批，按 kernel 时间 / 消息数选最快的
+  unsigned        tune_num;       // 0 = 不调（或已经调完）
+  unsigned        tune_next;      // 下一批要试的候选
+  size_t          tune_sizes[MAX_TUNE_SIZES];
+  double          tune_ns[MAX_TUNE_SIZES];
+  unsigned long long tune_msgs[MAX_TUNE_SIZES];
+
+  search_dev_t    search;
+  batch_slot_t    slots[MAX_PIPELINE_DEPTH];
+
+  unsigned long long inflight_msgs;  // 已提交、还没收尾的消息数
+  unsigned long long msgs_done;
+  unsigned long long hashes_done;    // --mask 时每行算 keyspace 个候选，速度按它算
+  unsigned           batches_done;
+  double             kernel_time_s;
+
+} device_ctx_t;
+
+// 已收尾、等着按输入顺序写出的一批结果（多设备时完成顺序和提交顺序不一致）
+typedef struct batch_out
+{
+  int             ready;
+  unsigned        batch_index;
+  uint32_t        num_msgs;
+  unsigned long long line_base;
+
+  uint32_t       *digests;        // 普通模式：num_msgs * digest_words 个 u32（指向 slot 的 staging 或 own_digests）
+  size_t          own_cap;
+  uint32_t       *own_digests;    // 等前面的批次时，digest 从 slot 拷到这里（grow-only）
+
+  search_plain_t *hits;           // 搜索模式：按行号排好序的命中（grow-only）
+  uint32_t        hits_cap;
+  uint32_t        num_hits;
+
+  uint32_t       *uniq;           // --dedup first：按行号排好的 (行号, digest) 记录（grow-only）
+  size_t          uniq_cap;
+  uint32_t       *uniq_slot;      // 排序用：每行在读回的记录里的位置 + 1（grow-only）
+  uint32_t        slot_cap;
+  uint32_t        num_uniq;       // --dedup：本批唯一的 digest 数
+  int             dedup;          // 这一批的 DEDUP_*（从设备带过来）
+
+  unsigned        device;
+  stage_stats_t   stats;          // 从 slot 带过来，写出时补上 format / write
+
+} batch_out_t;
+
+// mmap 模式下每个扫描线程的局部结果（grow-only，跨 batch 复用）
+typedef struct scan_part
+{
+  const unsigned char *base;    // 本批起点（offs 相对它）
+  const unsigned char *begin;   // 本线程负责的第一行行首
+  const unsigned char *end;     // 下一个线程的第一行行首
+  const unsigned char *limit;   // 本批终点
+
+  uint32_t *offs;
+  uint32_t *lens;
+  uint32_t  num;
+  uint32_t  cap;
+  size_t    max_len;
+
+} scan_part_t;
+
+// 输入读取器：整块 fread 进 grow-only 的 arena，原地按 '\n' 切行，
+// 每行只记录 (offset, length)，不再逐行 malloc / 拷贝。
+// mmap 模式下 arena 直接指向映射区，不做任何拷贝。
+typedef struct line_reader
+{
+  FILE          *fin;
+  int            eof;
+
+  const unsigned char *map;   // --mmap：整个输入文件的只读映射
+  size_t         map_len;
+  size_t         map_pos;     // 下一批从这里开始
+  unsigned       nthreads;
+  scan_part_t    parts[MAX_HOST_THREADS];
+
+  unsigned char *arena;       // 本批所有行的原始字节（含 '\n'），跨 batch 复用
+  size_t         arena_cap;
+  size_t         data_len;    // arena 中有效字节数
+  size_t         scan_pos;    // [0, scan_pos) 已经切成完整的行
+  size_t         search_pos;  // memchr 续扫位置，超长行不会被反复扫描
+  size_t         max_bytes;   // 单批原始数据的上限（按设备的 MAX_MEM_ALLOC 收紧，不超过 MAX_BATCH_BYTES）
+  size_t         chunk_bytes; // 每次 fread / read 的块大小（--max-mem 时相应缩小）
+  double         flush_s;     // --flush-ms：已经有行时最多等这么久就交出这一批（0 = 读满为止）
+  int            idle;        // --flush-ms：上一次 fill 等到截止时间也没有一行（返回 0 但没到 EOF）
+
+  uint32_t      *offs;        // 第 k 行在 arena 中的起始偏移
+  uint32_t      *lens;        // 第 k 行长度（字节，不含 '\n'）
+  uint32_t       lines_cap;
+
+  unsigned long long total_lines;  // 到目前为止读出的总行数
+
+  int            check_utf8;  // --encoding utf16le：每行必须是合法的 UTF-8
+  int            utf8_bad;    // 遇到过不合法的行：本批到它为止，之后不再交出任何行
+
+} line_reader_t;
+
+
+#pragma GCC visibility push (hidden)
+
+// --algo 的取值（sha256、sha512）
+#define NUM_HASH_ALGOS 2
+
+extern const hash_algo_t hash_algos[NUM_HASH_ALGOS];
+
+static inline size_t stride_for_len (size_t max_len, const hash_algo_t *algo)
+{
+  // 对齐到 block（kernel 按整块读最后一块）
+  const size_t block = algo->block_bytes;
+
+  return (max_len == 0) ? block : ((max_len + block - 1) / block) * block;
+}
+
+// 读取 CL 源码文件（整个读进内存，末尾补 '\0'）；失败返回 NULL
+char *read_text_file (const char *path, size_t *out_size);
+
+// FNV-1a 64，用来给编译缓存算 key
+#define FNV64_OFFSET 0xcbf29ce484222325ull
+#define FNV64_PRIME  0x100000001b3ull
+
+uint64_t fnv1a64 (uint64_t h, const void *data, size_t len);
+uint64_t fnv1a64_str (uint64_t h, const char *str);
+
+// 把源文件和它 #include "..." 进来的所有文件（递归，不管条件编译）都算进 hash
+#define MAX_HASHED_SOURCES 64
+
+typedef struct source_hash
+{
+  char     seen[MAX_HASHED_SOURCES][256];
+  unsigned num_seen;
+  uint64_t h;
+
+} source_hash_t;
+
+// 读不到文件、include 太多 / 路径太长时返回 -1
+int hash_source_tree (source_hash_t *sh, const char *path);
+
+// 编译 kernel 源文件：cache_dir 不为 NULL 时先查缓存，没有再从源码编译并写回缓存；失败返回 NULL
+cl_program build_program (cl_context context, cl_platform_id platform, cl_device_id device,
+                          const char *src_path, const char *build_opts, const char *cache_dir);
+
+double now_seconds (void);
+
+// 简单的 fork-join：nthreads-1 个 pthread + 调用线程自己，全部跑完才返回
+typedef void (*parallel_fn_t) (void *ctx, unsigned tid, unsigned nthreads);
+
+void parallel_run (unsigned nthreads, parallel_fn_t fn, void *ctx);
+
+unsigned default_host_threads (void);
+
+// 设置 kernel 尾部的输出参数（对应 kernel 里的 WRAPPER_OUT_ATTR）；sd 为 NULL 时只有 digests
+cl_int set_output_args (cl_kernel kernel, int arg, const search_dev_t *sd, const batch_slot_t *slot);
+
+// 一个已完成命令的设备执行时间（profiling 的 START -> END，ns）；拿不到时是 0
+double event_elapsed_ns (cl_event ev);
+
+// 保证 pinned staging 至少有 need 字节，返回它的 host 指针；失败返回 NULL
+void *pinned_reserve (cl_context context, cl_command_queue queue, pinned_buf_t *pb,
+                      size_t need, cl_ulong max_alloc, const char *what);
+
+// 保证设备 buffer 至少有 need 字节（grow-only）
+cl_int device_reserve (cl_context context, cl_mem *mem, size_t *cap, size_t need,
+                       cl_mem_flags flags, cl_ulong max_alloc, const char *what);
+
+// event 数组里下一个位置（grow-only，新位置先置 NULL）；扩容失败返回 NULL
+cl_event *event_list_next (cl_event **events, unsigned *num, unsigned *cap);
+
+// 本批下一个 kernel event 的位置（同上）
+cl_event *slot_next_event (batch_slot_t *slot);
+
+// 非阻塞上传到本 slot 的 buffer，event 和字节数记进本批的 h2d 统计
+cl_int slot_upload (batch_slot_t *slot, cl_mem buf, size_t bytes, const void *src, const char *what);
+
+// 1 维 launch，global size 向上取整到 local_size 的整数倍。event 为 NULL
+// （slot_next_event 扩容失败）时不排队，返回 CL_OUT_OF_HOST_MEMORY
+cl_int enqueue_kernel_1d (cl_command_queue queue, cl_kernel kernel, size_t work_items, size_t local_size,
+                          cl_event *event, const char *what);
+
+// 单独创建的 kernel（*_stream_update / *_merkle_level）用的 work-group 大小；查询失败返回 0
+size_t device_kernel_local_size (const device_ctx_t *dev, cl_kernel kernel);
+
+// --autotune：这一批用的 work-group 大小
+size_t autotune_next (device_ctx_t *dev);
+
+// slot 的 readback 是否已经完成（不阻塞；查询出错也算完成，错误由 collect_slot 报）
+int slot_finished (const batch_slot_t *slot);
+
+// 等待一个 slot 的 readback 完成，统计 kernel 时间，把结果登记进 out。
+// 出错时本批的 event 照样释放，out 不可用
+cl_int collect_slot (batch_slot_t *slot, const search_ctx_t *sc, batch_out_t *out);
+
+// 释放本批已经拿到的 kernel / 传输 event（没排上的位置是 NULL，跳过）。排队中途出错时
+// 先 clFinish 本 slot 的 queue 再调用
+void slot_drop_events (batch_slot_t *slot);
+
+// 在飞的 batch 里提交最早的那个 / 设备上的一个空闲 slot（没有则返回 NULL）
+batch_slot_t *oldest_busy_slot (device_ctx_t *devs, unsigned num_devs, unsigned depth);
+batch_slot_t *free_slot (device_ctx_t *dev, unsigned depth);
+
+// 给下一批挑设备（按预计完成时间）；返回 NULL 表示所有设备都没测过且都忙
+device_ctx_t *pick_device (device_ctx_t *devs, unsigned num_devs, unsigned depth, uint32_t num_msgs);
+
+// 一组设备上的 slot 流水线，命令行的批处理循环和引擎共用：挑 slot、开一批、上路、收尾都走这里，
+// 各自只管本批怎么排 kernel / 读回，以及收尾时结果交给谁（retire）
+typedef struct slot_pipeline
+{
+  device_ctx_t *devs;
+  unsigned      num_devs;
+  unsigned      depth;
+
+  cl_int      (*retire) (batch_slot_t *slot, void *ctx);  // 收一个在飞的 slot（里面调 collect_slot）
+  int         (*backlog_full) (void *ctx);                // 可以为 NULL：非 0 时先收最老的一批再挑设备
+  void         *ctx;
+
+} slot_pipeline_t;
+
+// 收尾一个在飞的 slot（阻塞到它做完），之后 slot 空出来；返回 retire 的结果
+cl_int pipeline_retire (const slot_pipeline_t *pl, batch_slot_t *slot);
+
+// 给 num_msgs 条的一批挑设备和空 slot，没有空 slot（或者积压满了）就先收尾最老的一批
+cl_int pipeline_acquire (const slot_pipeline_t *pl, uint32_t num_msgs, batch_slot_t **out);
+
+// 开始往 slot 上排一批：清掉上一批的 event / 统计，记下行号和批号，选本批的 work-group 大小
+void pipeline_begin (batch_slot_t *slot, uint32_t num_msgs, unsigned long long line_base, unsigned batch_index);
+
+// 本批的读回（read_event）已经排上：记 pack 时间、flush，slot 变成在飞。
+// 失败时等已经排上的命令结束并释放本批的 event，slot 还是空的
+cl_int pipeline_launch (batch_slot_t *slot, double t_pack);
+
+// 排队中途出错：等 queue 上已经排上的命令结束，释放本批拿到的所有 event（包括 read_event）
+void pipeline_abort (batch_slot_t *slot);
+
+// 不阻塞：收掉已经做完的 slot
+cl_int pipeline_reap (const slot_pipeline_t *pl);
+
+// 按提交顺序收尾所有在飞的 slot
+cl_int pipeline_drain (const slot_pipeline_t *pl);
+
+// packed 布局：上传本批在 rd 里的原始字节 + offs / lens，排上 kernel（--mask 时是多次 launch）
+cl_int enqueue_packed_batch (batch_slot_t *slot, const search_ctx_t *sc,
+                             const line_reader_t *rd, uint32_t num_msgs, size_t max_len,
+                             unsigned nthreads);
+
+// 枚举到的一个 OpenCL 设备（所有平台、所有类型）
+typedef struct device_entry
+{
+  cl_platform_id platform;
+  cl_device_id   device;
+  cl_device_type type;
+
+} device_entry_t;
+
+// 按平台顺序列出所有设备，返回个数
+unsigned enumerate_devices (device_entry_t *out, unsigned cap);
+
+// 解析 --devices（NULL = 第一个设备，"all"，或逗号分隔的编号），返回选中的个数，出错返回 0
+unsigned select_devices (const device_entry_t *all, unsigned num_all, const char *spec,
+                         unsigned *sel);
+
+// 给一个设备建 context / queue / program / kernel，以及搜索模式的常驻 buffer。
+// 出错时 dev 里已经建好的部分留着，由 device_release 释放
+cl_int device_setup (device_ctx_t *dev, unsigned id, const device_entry_t *e, const hash_algo_t *algo,
+                     unsigned pipeline_depth, const search_ctx_t *sc, const hmac_cfg_t *hmac,
+                     const kdf_cfg_t *kdf, const salt_cfg_t *salt, int encoding, unsigned vector_width_opt, int layout,
+                     int use_single_block, size_t local_size_opt, int autotune, const char *cache_dir);
+
+// 释放 device_setup 建的所有东西（没建的跳过）
+void device_release (device_ctx_t *dev, unsigned pipeline_depth, int search);
+
+// --backend native：一批的 [0, num) 行切成 nthreads 段连续区间交给 native_hash_range
+typedef struct native_job
+{
+  int                  impl;
+  int                  algo;
+  const line_reader_t *rd;
+  uint32_t             num;
+  uint32_t            *digests;
+
+} native_job_t;
+
+void native_thread (void *ctx, unsigned tid, unsigned nthreads);
+
+#pragma GCC visibility pop
+
+#endif // SHA256_ENGINE_INTERNAL_H
@@ -0,0 +1,232 @@
+// CUDA / HIP 的动态加载和运行时编译（见 sha256_gpu.h）。
+// 跟 hashcat 的 ext_cuda / ext_nvrtc / ext_hip / ext_hiprtc 一样按名字 dlsym，
+// 带版本后缀的入口（*_v2）取 CUDA 头文件 #define 之后的那个名字。
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+
+#include "sha256_gpu.h"
+
+#define GPU_LIB_DRIVER 0
+#define GPU_LIB_RTC    1
+
+typedef struct gpu_symbol
+{
+  void      **slot;
+  int         lib;
+  const char *cuda_name;
+  const char *hip_name;
+
+} gpu_symbol_t;
+
+// 依次尝试这些名字，发行版通常只装带 so 版本号的那个
+static const char *const cuda_driver_libs[] = { "libcuda.so.1", "libcuda.so", NULL };
+static const char *const cuda_rtc_libs[]    = { "libnvrtc.so", "libnvrtc.so.12", "libnvrtc.so.11.2", NULL };
+static const char *const hip_driver_libs[]  = { "libamdhip64.so", "libamdhip64.so.6", "libamdhip64.so.5", NULL };
+static const char *const hip_rtc_libs[]     = { "libhiprtc.so", "libhiprtc.so.6", "libhiprtc.so.5", NULL };
+
+static void *gpu_dlopen_any (const char *const *names)
+{
+  for (unsigned i = 0; names[i]; i++)
+  {
+    void *lib = dlopen (names[i], RTLD_NOW | RTLD_LOCAL);
+
+    if (lib) return lib;
+  }
+
+  return NULL;
+}
+
+int gpu_api_load (gpu_api_t *api, int kind)
+{
+  memset (api, 0, sizeof (gpu_api_t));
+
+  api->kind     = kind;
+  api->label    = (kind == GPU_API_CUDA) ? "CUDA" : "HIP";
+  api->code_ext = (kind == GPU_API_CUDA) ? "ptx"  : "hsaco";
+
+  const char *const *driver_libs = (kind == GPU_API_CUDA) ? cuda_driver_libs : hip_driver_libs;
+  const char *const *rtc_libs    = (kind == GPU_API_CUDA) ? cuda_rtc_libs    : hip_rtc_libs;
+
+  api->lib = gpu_dlopen_any (driver_libs);
+  if (!api->lib)
+  {
+    fprintf (stderr, "[%s] Cannot load %s (%s)\n", api->label, driver_libs[0], dlerror ());
+    return -1;
+  }
+
+  api->rtc_lib = gpu_dlopen_any (rtc_libs);
+  if (!api->rtc_lib)
+  {
+    fprintf (stderr, "[%s] Cannot load %s (%s)\n", api->label, rtc_libs[0], dlerror ());
+    gpu_api_unload (api);
+    return -1;
+  }
+
+  // HIP 没有 CUDA 那种 context 就直接用 hipCtxCreate（ROCm 里标了 deprecated，但一直导出）
+  const gpu_symbol_t symbols[] =
+  {
+    { (void **) &api->init,             GPU_LIB_DRIVER, "cuInit",                 "hipInit"                 },
+    { (void **) &api->driver_version,   GPU_LIB_DRIVER, "cuDriverGetVersion",     "hipDriverGetVersion"     },
+    { (void **) &api->device_count,     GPU_LIB_DRIVER, "cuDeviceGetCount",       "hipGetDeviceCount"       },
+    { (void **) &api->device_get,       GPU_LIB_DRIVER, "cuDeviceGet",            "hipDeviceGet"            },
+    { (void **) &api->device_name,      GPU_LIB_DRIVER, "cuDeviceGetName",        "hipDeviceGetName"        },
+    { (void **) &api->device_total_mem, GPU_LIB_DRIVER, "cuDeviceTotalMem_v2",    "hipDeviceTotalMem"       },
+    { (void **) &api->device_attribute, GPU_LIB_DRIVER, "cuDeviceGetAttribute",   "hipDeviceGetAttribute"   },
+    { (void **) &api->ctx_create,       GPU_LIB_DRIVER, "cuCtxCreate_v2",         "hipCtxCreate"            },
+    { (void **) &api->ctx_destroy,      GPU_LIB_DRIVER, "cuCtxDestroy_v2",        "hipCtxDestroy"           },
+    { (void **) &api->module_load_data, GPU_LIB_DRIVER, "cuModuleLoadData",       "hipModuleLoadData"       },
+    { (void **) &api->module_function,  GPU_LIB_DRIVER, "cuModuleGetFunction",    "hipModuleGetFunction"    },
+    { (void **) &api->module_unload,    GPU_LIB_DRIVER, "cuModuleUnload",         "hipModuleUnload"         },
+    { (void **) &api->mem_alloc,        GPU_LIB_DRIVER, "cuMemAlloc_v2",          "hipMalloc"               },
+    { (void **) &api->mem_free,         GPU_LIB_DRIVER, "cuMemFree_v2",           "hipFree"                 },
+    { (void **) &api->host_alloc,       GPU_LIB_DRIVER, "cuMemHostAlloc",         "hipHostMalloc"           },
+    { (void **) &api->host_free,        GPU_LIB_DRIVER, "cuMemFreeHost",          "hipHostFree"             },
+    { (void **) &api->memcpy_htod,      GPU_LIB_DRIVER, "cuMemcpyHtoDAsync_v2",   "hipMemcpyHtoDAsync"      },
+    { (void **) &api->memcpy_dtoh,      GPU_LIB_DRIVER, "cuMemcpyDtoHAsync_v2",   "hipMemcpyDtoHAsync"      },
+    { (void **) &api->launch,           GPU_LIB_DRIVER, "cuLaunchKernel",         "hipModuleLaunchKernel"   },
+    { (void **) &api->stream_create,    GPU_LIB_DRIVER, "cuStreamCreate",         "hipStreamCreateWithFlags" },
+    { (void **) &api->stream_destroy,   GPU_LIB_DRIVER, "cuStreamDestroy_v2",     "hipStreamDestroy"        },
+    { (void **) &api->event_create,     GPU_LIB_DRIVER, "cuEventCreate",          "hipEventCreateWithFlags" },
+    { (void **) &api->event_record,     GPU_LIB_DRIVER, "cuEventRecord",          "hipEventRecord"          },
+    { (void **) &api->event_sync,       GPU_LIB_DRIVER, "cuEventSynchronize",     "hipEventSynchronize"     },
+    { (void **) &api->event_elapsed,    GPU_LIB_DRIVER, "cuEventElapsedTime",     "hipEventElapsedTime"     },
+    { (void **) &api->event_destroy,    GPU_LIB_DRIVER, "cuEventDestroy_v2",      "hipEventDestroy"         },
+    { (void **) &api->rtc_create,       GPU_LIB_RTC,    "nvrtcCreateProgram",     "hiprtcCreateProgram"     },
+    { (void **) &api->rtc_compile,      GPU_LIB_RTC,    "nvrtcCompileProgram",    "hiprtcCompileProgram"    },
+    { (void **) &api->rtc_log_size,     GPU_LIB_RTC,    "nvrtcGetProgramLogSize", "hiprtcGetProgramLogSize" },
+    { (void **) &api->rtc_log,          GPU_LIB_RTC,    "nvrtcGetProgramLog",     "hiprtcGetProgramLog"     },
+    { (void **) &api->rtc_code_size,    GPU_LIB_RTC,    "nvrtcGetPTXSize",        "hiprtcGetCodeSize"       },
+    { (void **) &api->rtc_code,         GPU_LIB_RTC,    "nvrtcGetPTX",            "hiprtcGetCode"           },
+    { (void **) &api->rtc_destroy,      GPU_LIB_RTC,    "nvrtcDestroyProgram",    "hiprtcDestroyProgram"    },
+    { (void **) &api->rtc_error_string, GPU_LIB_RTC,    "nvrtcGetErrorString",    "hiprtcGetErrorString"    },
+  };
+
+  for (size_t i = 0; i < sizeof (symbols) / sizeof (symbols[0]); i++)
+  {
+    const char *name = (kind == GPU_API_CUDA) ? symbols[i].cuda_name : symbols[i].hip_name;
+
+    *symbols[i].slot = dlsym ((symbols[i].lib == GPU_LIB_RTC) ? api->rtc_lib : api->lib, name);
+
+    if (!*symbols[i].slot)
+    {
+      fprintf (stderr, "[%s] Missing symbol %s\n", api->label, name);
+      gpu_api_unload (api);
+      return -1;
+    }
+  }
+
+  // 错误字符串只是锦上添花，缺了也能跑
+  if (kind == GPU_API_CUDA)
+  {
+    *(void **) &api->cu_error_string = dlsym (api->lib, "cuGetErrorString");
+  }
+  else
+  {
+    *(void **) &api->hip_error_string = dlsym (api->lib, "hipGetErrorString");
+  }
+
+  const gpu_result_t err = api->init (0);
+
+  if (err != GPU_SUCCESS)
+  {
+    fprintf (stderr, "[%s] Initialization failed with error %d (%s)\n", api->label, err, gpu_error_string (api, err));
+    gpu_api_unload (api);
+    return -1;
+  }
+
+  return 0;
+}
+
+void gpu_api_unload (gpu_api_t *api)
+{
+  if (api->rtc_lib) dlclose (api->rtc_lib);
+  if (api->lib)     dlclose (api->lib);
+
+  api->rtc_lib = NULL;
+  api->lib     = NULL;
+}
+
+const char *gpu_error_string (const gpu_api_t *api, gpu_result_t err)
+{
+  const char *str = NULL;
+
+  if (api->cu_error_string)
+  {
+    if (api->cu_error_string (err, &str) != GPU_SUCCESS) str = NULL;
+  }
+  else if (api->hip_error_string)
+  {
+    str = api->hip_error_string (err);
+  }
+
+  return str ? str : "unknown error";
+}
+
+int gpu_compile (const gpu_api_t *api, const char *src, const char *name, const char **options, int num_options,
+                 char **code, size_t *code_size)
+{
+  gpu_rtc_program_t prog = NULL;
+
+  gpu_rtc_result_t err = api->rtc_create (&prog, src, name, 0, NULL, NULL);
+
+  if (err != GPU_SUCCESS)
+  {
+    fprintf (stderr, "[%s] Creating program %s failed: %s\n", api->label, name, api->rtc_error_string (err));
+    return -1;
+  }
+
+  err = api->rtc_compile (prog, num_options, options);
+
+  if (err != GPU_SUCCESS)
+  {
+    size_t log_size = 0;
+
+    api->rtc_log_size (prog, &log_size);
+
+    char *log = (char *) malloc (log_size + 1);
+
+    if (log && api->rtc_log (prog, log) == GPU_SUCCESS)
+    {
+      log[log_size] = '\0';
+
+      fprintf (stderr, "Build failed:\n%s\n", log);
+    }
+
+    free (log);
+
+    fprintf (stderr, "[%s] Compiling %s failed: %s\n", api->label, name, api->rtc_error_string (err));
+
+    api->rtc_destroy (&prog);
+    return -1;
+  }
+
+  size_t size = 0;
+
+  if (api->rtc_code_size (prog, &size) != GPU_SUCCESS || size == 0)
+  {
+    fprintf (stderr, "[%s] Compiling %s produced no code\n", api->label, name);
+    api->rtc_destroy (&prog);
+    return -1;
+  }
+
+  char *buf = (char *) malloc (size);
+
+  if (!buf || api->rtc_code (prog, buf) != GPU_SUCCESS)
+  {
+    fprintf (stderr, "[%s] Reading the compiled code of %s failed\n", api->label, name);
+    free (buf);
+    api->rtc_destroy (&prog);
+    return -1;
+  }
+
+  api->rtc_destroy (&prog);
+
+  *code      = buf;
+  *code_size = size;
+
+  return 0;
+}
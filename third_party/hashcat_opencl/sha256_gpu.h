@@ -0,0 +1,112 @@
+// CUDA / HIP 后端（sha256_host --backend cuda|hip）：运行时 dlopen 驱动 API 和运行时编译库
+// （libcuda + libnvrtc / libamdhip64 + libhiprtc），编译 sha256_host 不需要 CUDA / ROCm SDK。
+// kernel 还是 sha256_wrapper.cl / sha512_wrapper.cl：NVRTC 定义 __CUDACC__、hiprtc 定义 __HIPCC__，
+// inc_vendor.h 据此走 IS_CUDA / IS_HIP，KERNEL_FQ / GLOBAL_AS 等修饰符都已经映射好。
+// 用到的这一小部分 driver API 两边一一对应、参数顺序和 ABI 相同（handle 都是指针，
+// CUdeviceptr / hipDeviceptr_t 都是 64 位，错误码 0 = 成功），所以共用一张函数表。
+
+#ifndef SHA256_GPU_H
+#define SHA256_GPU_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define GPU_API_CUDA 0
+#define GPU_API_HIP  1
+
+#define GPU_SUCCESS 0
+
+#define GPU_STREAM_NON_BLOCKING 1  // CU_STREAM_NON_BLOCKING / hipStreamNonBlocking：不跟默认 stream 同步
+
+typedef int       gpu_result_t;       // CUresult / hipError_t
+typedef int       gpu_rtc_result_t;   // nvrtcResult / hiprtcResult
+typedef int       gpu_device_t;
+typedef void     *gpu_context_t;
+typedef void     *gpu_module_t;
+typedef void     *gpu_function_t;
+typedef void     *gpu_stream_t;
+typedef void     *gpu_event_t;
+typedef void     *gpu_rtc_program_t;
+typedef uint64_t  gpu_deviceptr_t;
+
+typedef struct gpu_api
+{
+  int         kind;           // GPU_API_CUDA / GPU_API_HIP
+  const char *label;          // 日志前缀里的名字："CUDA" / "HIP"
+  const char *code_ext;       // 缓存文件的扩展名：ptx / hsaco
+  void       *lib;            // 驱动 API
+  void       *rtc_lib;        // 运行时编译
+
+  gpu_result_t (*init)             (unsigned int flags);
+  gpu_result_t (*driver_version)   (int *version);
+  gpu_result_t (*device_count)     (int *count);
+  gpu_result_t (*device_get)       (gpu_device_t *dev, int ordinal);
+  gpu_result_t (*device_name)      (char *name, int len, gpu_device_t dev);
+  gpu_result_t (*device_total_mem) (size_t *bytes, gpu_device_t dev);
+  gpu_result_t (*device_attribute) (int *value, int attrib, gpu_device_t dev);  // 只有 CUDA 用（枚举值两边不同）
+  gpu_result_t (*ctx_create)       (gpu_context_t *ctx, unsigned int flags, gpu_device_t dev);
+  gpu_result_t (*ctx_destroy)      (gpu_context_t ctx);
+  gpu_result_t (*module_load_data) (gpu_module_t *mod, const void *image);
+  gpu_result_t (*module_function)  (gpu_function_t *fn, gpu_module_t mod, const char *name);
+  gpu_result_t (*module_unload)    (gpu_module_t mod);
+  gpu_result_t (*mem_alloc)        (gpu_deviceptr_t *ptr, size_t bytes);
+  gpu_result_t (*mem_free)         (gpu_deviceptr_t ptr);
+  gpu_result_t (*host_alloc)       (void **ptr, size_t bytes, unsigned int flags);
+  gpu_result_t (*host_free)        (void *ptr);
+  gpu_result_t (*memcpy_htod)      (gpu_deviceptr_t dst, const void *src, size_t bytes, gpu_stream_t stream);
+  gpu_result_t (*memcpy_dtoh)      (void *dst, gpu_deviceptr_t src, size_t bytes, gpu_stream_t stream);
+  gpu_result_t (*launch)           (gpu_function_t fn, unsigned int gx, unsigned int gy, unsigned int gz,
+                                    unsigned int bx, unsigned int by, unsigned int bz, unsigned int shared_bytes,
+                                    gpu_stream_t stream, void **params, void **extra);
+  gpu_result_t (*stream_create)    (gpu_stream_t *stream, unsigned int flags);
+  gpu_result_t (*stream_destroy)   (gpu_stream_t stream);
+  gpu_result_t (*event_create)     (gpu_event_t *ev, unsigned int flags);
+  gpu_result_t (*event_record)     (gpu_event_t ev, gpu_stream_t stream);
+  gpu_result_t (*event_sync)       (gpu_event_t ev);
+  gpu_result_t (*event_elapsed)    (float *ms, gpu_event_t start, gpu_event_t end);
+  gpu_result_t (*event_destroy)    (gpu_event_t ev);
+
+  gpu_rtc_result_t (*rtc_create)       (gpu_rtc_program_t *prog, const char *src, const char *name,
+                                        int num_headers, const char **headers, const char **include_names);
+  gpu_rtc_result_t (*rtc_compile)      (gpu_rtc_program_t prog, int num_options, const char **options);
+  gpu_rtc_result_t (*rtc_log_size)     (gpu_rtc_program_t prog, size_t *size);
+  gpu_rtc_result_t (*rtc_log)          (gpu_rtc_program_t prog, char *log);
+  gpu_rtc_result_t (*rtc_code_size)    (gpu_rtc_program_t prog, size_t *size);
+  gpu_rtc_result_t (*rtc_code)         (gpu_rtc_program_t prog, char *code);
+  gpu_rtc_result_t (*rtc_destroy)      (gpu_rtc_program_t *prog);
+  const char      *(*rtc_error_string) (gpu_rtc_result_t err);
+
+  // 两边的错误字符串接口不一样，gpu_error_string 按 kind 分开调
+  gpu_result_t     (*cu_error_string)  (gpu_result_t err, const char **str);
+  const char      *(*hip_error_string) (gpu_result_t err);
+
+} gpu_api_t;
+
+// CUDA 的设备属性（CUdevice_attribute）
+#define GPU_CU_ATTR_MAX_THREADS_PER_BLOCK 1
+#define GPU_CU_ATTR_CC_MAJOR              75
+#define GPU_CU_ATTR_CC_MINOR              76
+
+// 驱动 API 调用失败就退出，跟 CHECK_CL 一样
+#define CHECK_GPU(api, err, msg) \
+  do { \
+    const gpu_result_t check_err_ = (err); \
+    if (check_err_ != GPU_SUCCESS) { \
+      fprintf(stderr, "%s failed with error %d (%s)\n", (msg), check_err_, gpu_error_string ((api), check_err_)); \
+      exit(1); \
+    } \
+  } while (0)
+
+// 加载驱动和运行时编译库、解析全部符号并 init；库不存在或缺符号时打印原因，返回 -1
+int gpu_api_load (gpu_api_t *api, int kind);
+
+void gpu_api_unload (gpu_api_t *api);
+
+const char *gpu_error_string (const gpu_api_t *api, gpu_result_t err);
+
+// 运行时编译 src（name 只用于日志 / 报错），成功返回 0，*code 是 PTX（CUDA）或 code object（HIP），
+// 调用方 free；失败时把编译日志打到 stderr，返回 -1
+int gpu_compile (const gpu_api_t *api, const char *src, const char *name, const char **options, int num_options,
+                 char **code, size_t *code_size);
+
+#endif // SHA256_GPU_H
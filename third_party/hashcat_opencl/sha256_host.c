@@ -2,321 +2,5725 @@
 //
 // 对输入文件每一行做 SHA256（不含 '\n'），输出到结果文件。
 // 使用 hashcat 的 sha256_wrapper.cl + inc_* 实现。
+// --algo sha512 改用 sha512_wrapper.cl（inc_hash_sha512.*）：128 字节 block、64 字节 digest，
+// 分批 / 流水线 / 多设备 / 输出格式都和 SHA256 共用（没有单 block、向量版和 --search）。
 // 支持分批处理超大文件，避免一次性分配几十 GB 内存。
+//
+// 流水线：每个设备最多 N 个 batch 同时在飞（每个 batch 一个 slot，独立 buffer / queue / event），
+// 读取解析第 k+1 批、写出第 k-1 批的同时，GPU 在跑第 k 批。
+// 每个 slot 的设备 buffer 和 pinned staging（ALLOC_HOST_PTR + 常驻 map）都是 grow-only，
+// 跨 batch 复用，上传 / 读回全部是非阻塞的 clEnqueueWrite/ReadBuffer。
+//
+// 输入：默认按块 fread；--mmap 时直接映射输入文件（零拷贝），
+// 由多个线程各自负责一段映射区间，用 memchr（glibc 的 SIMD 实现）找行边界。
+// 输入 / 输出文件名是 "-" 时用 stdin / stdout，生成器（mask 展开、zcat）可以直接接管道。
+// --flush-ms N：慢的生产者也不用等一整批读满，手上有行、等满 N 毫秒就交出这一批，
+// 没有新行时先把在飞的批次写出去。--max-mem MB：host 内存按 在飞的 slot 数 + 读入 + 输出 分份，
+// 每份限制一批的原始数据 / 行数（pinned staging 跟设备 buffer 同样大小），读入块也相应缩小。
+//
+// 输出：digest 分块多线程格式化成 hex（SSSE3 pshufb 查表，不支持时退回 256 项双字符表），
+// 每个线程写自己的大缓冲，按顺序一次 writev，不再逐行 fprintf。
+// --out-format raw 直接写大端 digest（没有分隔符），--out-bytes N 只输出前 N 字节
+// （hex 和 raw 都适用），给只需要前缀做去重 / join 的下游用。
+//
+// 打包：按算法的 block 数把行分桶，每个桶用自己的 stride 单独 launch，
+// 一条超长行不会把整批的 stride 撑大；kernel 按原始行号写回 digest。
+// --no-buckets 退回整批一个 stride 的旧布局。
+// 桶 0（<= 55 字节，一个 block）自动走单 block 快速路径 kernel，--no-single-block 关闭。
+// 设备的 preferred vector width > 1 时（CPU runtime / AMD），改用每个 work-item 算
+// VECT_SIZE 条消息的 sha256_wrapper_vector，--vector N 手动指定宽度。
+//
+// --search targets_file：只找命中。目标（每行一个 hex digest）和 hashcat 格式的 bitmap
+// 常驻设备，kernel 用 check / find_hash 比对，每个目标只报第一次命中；只读回命中的
+// (行号, 目标)，输出文件每行 "行号:hex"（行号从 0 开始），不再写每一行的 digest。
+// 加 --mask MASK（hashcat 的掩码语法，?l ?u ?d ?h ?H ?s ?a ?b）则每行是 base word，
+// 候选 word + 掩码后缀在 kernel 的 il_pos 循环里生成、哈希、比对（hashcat 的 -a 6），
+// 上传的只有 word 本身；输出每行 "行号:后缀:hex"。
+// --layout packed 则完全不打包：arena 原样上传 + 每行字节偏移，传输量等于真实数据量。
+//
+// --encoding utf16le：哈希每行的 UTF-16LE 形式（NTLM 一类的格式），上传的仍是原始的 8 位数据，
+// kernel 里宽化：纯 ASCII 时每个字节后面补 0（hashcat 的 *_update_global_utf16le_swap），
+// 含非 ASCII 时整行按 UTF-8 解码成 UTF-16LE（U+10000 以上是代理对，行长不限）。传输量和 stride 都不翻倍。
+// 输入必须是合法的 UTF-8（RFC 3629）：reader 逐行校验，遇到不合法的行报出行号（从 0 开始），
+// 它之前的行照常写出，它和之后的都不再哈希，最后以失败退出，不会写出错的 digest。
+// --mask 的后缀按单字节宽化（每个字节后面补 0，跟 hashcat 一样），不做 UTF-8 解码。
+//
+// HMAC：--hmac-key KEY（或 --hmac-key-hex）所有行共用一个 key，用 -D HMAC_MODE 编译，
+// 每个设备开头跑一次 *_hmac_setup 把 ipad / opad 状态算好放进 constant memory，
+// 之后每条消息只做 inner / outer 的收尾压缩；--hmac-per-line 则每行是 "key:message"
+// （key 到第一个 ':' 为止，没有 ':' 时整行是 key、消息为空），走 packed 布局的 *_hmac_lines。
+//
+// 加盐：--salt SALT（或 --salt-hex）所有行共用一个 salt，--salt-pos prefix（默认）算 H (salt . 行)、
+// suffix 算 H (行 . salt)。前缀时每个设备开头跑一次 *_salt_setup，压过 salt 的 ctx（整块的 midstate
+// 加上零头）放进 constant memory，每条消息从它接着压；后缀时 salt 原样放在 constant memory，收尾前接上。
+// 都不在 host 上把 salt 拼进每一行，上传量和 stride 不变。--salt-per-line 则每行是 "salt:行"
+// （salt 到第一个 ':' 为止），走 packed 布局的 *_salt_lines，salt 在 kernel 里原地读。
+//
+// 迭代 / KDF：--iterations N 对每行做 h = H (line) 之后再迭代 h = H (h)（共 N 次哈希）；
+// 加 --pbkdf2-salt（或 --pbkdf2-salt-hex）则是 PBKDF2-HMAC（password = 行，N 轮，输出第一个块）。
+// 跟 hashcat 的 loop kernel 一样，轮数按 --loop-chunk 拆成多次 launch，状态常驻设备，
+// 单次 launch 不会因为迭代次数太大撞上 watchdog。
+//
+// --stream：输入文件的每一行是一个文件路径，输出每个文件内容的 digest（按清单顺序）。
+// 文件按 --stream-chunk 大小分轮流式上传，每个文件的状态（h + 64 位长度）常驻设备，
+// 多 GB 的文件也不需要整个读进 host 内存。
+//
+// --merkle：每行的 digest 是叶子，留在设备上（每批拷进常驻的叶子 buffer），全部读完后在设备上
+// 逐层算 parent = H (left || right)（奇数个时最后一个原样升层），只读回根；
+// --merkle-proof LEAF 再输出这个叶子的审计路径。
+//
+// --dedup first：每批的 digest 留在设备上插进全局内存里的 hash 表（CAS 占槽，atomic_min 留下最小行号），
+// 只有每个 digest 在本批里第一次出现的行读回，输出 "行号:hex"（行号从 0 开始，跟 --search 一样）；
+// --dedup count 只读回唯一数，每批输出一行 "首行号:行数:唯一数"。读回量和输出量按重复率缩小。
+// 只在一批之内去重（批与批之间不比较），跨批的重复要靠更大的 --batch-lines。
+//
+// 编译好的 program binary 缓存在 kernels/（--cache-dir 可改，--no-cache 关闭），
+// key = 平台 / 设备 / 驱动版本 + kernel 源码树 hash + 编译选项，对不上就重新编译。
+//
+// 多设备：--devices all（所有 GPU，没有就所有 CPU）或 --devices 0,2,...（编号见启动时的设备列表），
+// 每个设备自己的 context / program / slot。空出 slot 的设备来要活，下一批交给按实测吞吐
+// 预计最早做完的设备；结果先进环形缓冲，再按输入顺序写出。默认只用第一个设备。
+//
+// 批大小：每批的行数在运行时按 CL_DEVICE_GLOBAL_MEM_SIZE / CL_DEVICE_MAX_MEM_ALLOC_SIZE 和
+// 上一批每行实际占用的设备字节数（stride 布局下取决于分桶后的 stride）算，小卡不会建 buffer 失败，
+// 大卡也不会被固定的行数限住；--batch-lines N 固定行数。某一批的 stride 布局放不下时这一批改走 packed。
+// work-group 大小取 CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE 的整数倍（--local-size N 指定，
+// --autotune 在前几批里实测挑最快的），global size 向上取整，kernel 里按消息数做越界检查。
+//
+// 分阶段计时：read / pack / h2d / kernel / d2h / format / write。设备上的三段用 OpenCL event 的
+// profiling（每次上传、每个 kernel、读回各一个 event），host 上的用单调时钟；结束时 stderr 打汇总，
+// --metrics FILE 另外写 JSON lines（每批一行 + 合计一行）或 --metrics-format prom 的 Prometheus textfile。
+//
+// --bench：用固定种子生成几种长度分布的语料（8 / 16 / 55 / 64 / 119 字节定长、Zipf、带少量长行），
+// 对每个 kernel 变体 / host 模式（wrapper、single-block、vector、packed、serial、native）重新执行本程序，
+// 预热后取多次的中位数，报告 kernel MH/s、端到端 MH/s 和 MB/s，每次的输出都和 CPU 参考实现比对。
+//
+// --backend native：不经过 OpenCL，每行的 digest 直接在 host 线程上算（sha256_native.c：hashcat 的
+// inc_hash_sha*.cl 按 IS_NATIVE 编译的标量版，x86 上还有 SHA-NI 和 AVX2 / AVX-512 multi-buffer，
+// --cpu-impl 指定，默认按 CPU 特性挑最快的）；读入 / 输出 / 计时跟 OpenCL 路径共用。只支持普通哈希。
+// 默认的 auto 在没有 OpenCL GPU（也没给 --devices）时对普通哈希自动用它。
+//
+// --backend cuda / hip：同一份 *_wrapper.cl 用 NVRTC / hiprtc 运行时编译（sha256_gpu.c 按需 dlopen
+// 驱动和编译库，编译本程序不需要 SDK），packed kernel + 每个 slot 一条 stream、pinned staging，
+// 上传 / kernel / 读回异步排队、event 计时。也只支持普通哈希，--devices N 选设备编号。
+//
+// 库接口（sha256_engine.h）：同一套设备初始化 / slot / packed kernel 封装成引擎，编译一次、
+// buffer 常驻，调用方多线程异步提交 (data, offs, lens) 批次、poll / wait 取 digest。
+// 设备层和引擎在 sha256_engine.c（命令行和库共用），本文件只有命令行：读入 / 输出 / 各种模式 / bench / serve。
+// 批处理循环和引擎的 submit 用同一套 slot 调度（slot_pipeline_t），这里只管每批怎么排 kernel 和结果怎么写出。
+//
+// --serve SOCKET：常驻进程，引擎只建一次，在 Unix socket 上收 (长度数组 + 消息) 的二进制请求；
+// 各连接的小请求攒成一批（--serve-batch 条消息或 --serve-latency 毫秒，先到为准）提交，
+// 结果分回每个请求。SIGINT / SIGTERM 时做完已排队的请求再退出。
+//
+// 用法: sha256_host [--algo sha256|sha512] [--pipeline N] [--mmap] [--threads N] [--no-buckets]
+//                   [--layout stride|packed] [--no-single-block] [--vector N] [--search targets_file [--mask MASK]]
+//                   [--cache-dir DIR] [--no-cache] [--devices all|i,j,...]
+//                   [--out-format hex|raw] [--out-bytes N] [--encoding raw|utf16le]
+//                   [--hmac-key KEY | --hmac-key-hex HEX | --hmac-per-line]
+//                   [--salt SALT | --salt-hex HEX | --salt-per-line] [--salt-pos prefix|suffix] [--dedup first|count]
+//                   [--iterations N] [--pbkdf2-salt SALT | --pbkdf2-salt-hex HEX] [--loop-chunk N]
+//                   [--stream [--stream-chunk BYTES] [--stream-files N]] [--merkle [--merkle-proof LEAF]]
+//                   [--batch-lines N] [--local-size N] [--autotune]
+//                   [--metrics FILE [--metrics-format json|prom]]
+//                   [--backend auto|opencl|native|cuda|hip] [--cpu-impl auto|scalar|avx2|avx512|shani]
+//                   [--max-mem MB] [--flush-ms MS] <input_file|-> <output_file|->
+//        sha256_host --bench [--bench-lines N] [--bench-warmup N] [--bench-reps N]
+//                    [--bench-variants LIST] [--bench-corpora LIST] [--algo ...] [--devices ...] [--metrics FILE]
+//        sha256_host --serve SOCKET [--serve-batch N] [--serve-latency MS] [--algo ...] [--devices ...]
+//                    [--pipeline N] [--backend auto|opencl|native] [--cpu-impl ...] [--threads N]
+//                    [--local-size N] [--autotune] [--cache-dir DIR] [--no-cache]
+// 编译: gcc -O2 -o sha256_host sha256_host.c sha256_engine.c sha256_native.c sha256_gpu.c -lOpenCL -lpthread -lm -ldl
+// 库:   gcc -O2 -fPIC -shared -o libsha256_engine.so sha256_engine.c sha256_native.c -lOpenCL -lpthread -lm
+
+#define _GNU_SOURCE
+
+#include "sha256_engine_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <signal.h>
+
+#if defined (__x86_64__) || defined (__i386__)
+#include <tmmintrin.h>
+#endif
+
+#include "sha256_native.h"
+#include "sha256_gpu.h"
+#include "sha256_engine.h"
+
+#define CHECK_CL(err, msg) \
+  do { \
+    if ((err) != CL_SUCCESS) { \
+      fprintf(stderr, "%s failed with error %d\n", (msg), (err)); \
+      exit(1); \
+    } \
+  } while (0)
+
+// 设备层（sha256_engine.c）的函数出错时已经打印过原因，只返回错误码；命令行直接退出
+#define CHECK_DEV(expr) \
+  do { \
+    if ((expr) != CL_SUCCESS) exit(1); \
+  } while (0)
+
+// 一批最多处理多少行（上限；实际每批的行数按设备内存和上一批每行占用的字节数在运行时算，
+// --batch-lines N 可以固定）
+#define MAX_BATCH_LINES 50000000u  // 5000 万
+
+// 每个设备最多拿 CL_DEVICE_GLOBAL_MEM_SIZE 的多少（分给 pipeline 的各个 slot），
+// 剩下的留给搜索 buffer / Merkle 叶子 / 驱动自己
+#define BATCH_MEM_PERCENT 75
+
+// --metrics-format
+#define METRICS_JSON 0  // 每批写出后一行 JSON，最后一行是合计
+#define METRICS_PROM 1  // Prometheus textfile（给 node_exporter 的 textfile collector），结束时整个写出
+
+// --bench：每个语料的行数、预热 / 计时的次数，以及生成语料的随机种子（固定，结果可复现）
+#define BENCH_DEFAULT_LINES  (1u << 20)
+#define BENCH_DEFAULT_WARMUP 1
+#define BENCH_DEFAULT_REPS   3
+#define BENCH_MAX_REPS       64
+#define BENCH_SEED           0x5eed5a256ULL
+#define BENCH_ZIPF_MAX_LEN   256   // Zipf 语料的长度取 1..256，P(len = k) ∝ 1 / k
+#define BENCH_OUTLIER_EVERY  4096  // outliers 语料：每 4096 行有一行 1 KB..16 KB 的长行
+
+// arena 每次从文件读入的块大小，以及单批 arena 的上限（行偏移用 u32 表示）
+#define READ_CHUNK_BYTES (16u << 20)          // 16 MB
+#define MAX_BATCH_BYTES  ((size_t) 1u << 31)  // 2 GB
+
+// SHA-256 加上 0x80 和 8 字节长度仍然放得进一个 block 的最大消息长度（= 桶 0）
+#define SINGLE_BLOCK_MAX_LEN 55
+
+// --iterations / --pbkdf2-salt：每次 loop launch 默认做多少轮（--loop-chunk 可改），
+// 跟 hashcat 的 kernel_loops 一样，保证单次 launch 远低于显示驱动的 watchdog 超时
+#define DEFAULT_LOOP_CHUNK 1024
+
+// --stream：每个文件每轮读多少字节（--stream-chunk，向上取整到 block），一组同时处理多少个文件
+// （--stream-files）。host 内存是 pipeline 深度 x 组大小 x chunk，跟文件大小无关
+#define DEFAULT_STREAM_CHUNK (1u << 20)  // 1 MB
+#define DEFAULT_STREAM_FILES 64
+
+// 跟 *_stream_update 里的 chunk_flags 一致
+#define STREAM_FIRST 1
+#define STREAM_LAST  2
+
+// --max-mem 的下限（MB）：再小的话每次读入的块和一批的 arena 都小得没有意义
+#define MIN_MAX_MEM_MB 16
+
+// --backend native 默认每批的行数（--batch-lines 可改）：够摊薄线程启动，digest 缓冲也不大
+#define NATIVE_BATCH_LINES (1u << 20)
+
+// 共享 salt 的上限：后缀模式整个 salt 放进 constant memory
+#define SALT_MAX_LEN 4096
+
+// 流式文件哈希（--stream / --stream-chunk / --stream-files）
+typedef struct stream_cfg
+{
+  int      enabled;
+  size_t   chunk_bytes;
+  uint32_t group_files;
+
+} stream_cfg_t;
+
+static const char *const stage_names[NUM_STAGES] =
+{
+  "read", "pack", "h2d", "kernel", "d2h", "format", "write"
+};
+
+// 一行 hex 输出：最长的 digest（SHA-512，128 个 hex 字符）+ '\n'
+#define HEX_LINE_BYTES 129
+
+// 输出格式（--out-format）
+#define OUT_FORMAT_HEX 0  // 每行 hex + '\n'
+#define OUT_FORMAT_RAW 1  // 大端字节首尾相接，没有分隔符
+
+// digest (u32 数组，按大端字节序输出) 的前 nbytes 字节 -> 一条输出记录，不写 '\0'
+// hex 记录 2 * nbytes + 1 字节，raw 记录 nbytes 字节
+typedef void (*hex_encode_fn_t) (const uint32_t *d, char *out, unsigned nbytes);
+
+// 查表版：每个字节一次查 256 项的双字符表
+static char hex_pairs[256][2];
+
+static void hex_pairs_init (void)
+{
+  static const char hexdig[] = "0123456789abcdef";
+
+  for (int v = 0; v < 256; v++)
+  {
+    hex_pairs[v][0] = hexdig[v >> 4];
+    hex_pairs[v][1] = hexdig[v & 0xf];
+  }
+}
+
+// nbytes 是 4 的倍数
+static void hex_encode_scalar (const uint32_t *d, char *out, unsigned nbytes)
+{
+  for (unsigned j = 0; j < nbytes / 4; j++)
+  {
+    const uint32_t v = d[j];
+
+    memcpy (out + j * 8 + 0, hex_pairs[(v >> 24) & 0xff], 2);
+    memcpy (out + j * 8 + 2, hex_pairs[(v >> 16) & 0xff], 2);
+    memcpy (out + j * 8 + 4, hex_pairs[(v >>  8) & 0xff], 2);
+    memcpy (out + j * 8 + 6, hex_pairs[(v >>  0) & 0xff], 2);
+  }
+
+  out[nbytes * 2] = '\n';
+}
+
+#if defined (__x86_64__) || defined (__i386__)
+// SSSE3 版：pshufb 做每个 u32 的字节翻转，再拆高 / 低 nibble 交错，
+// 最后用 pshufb 查 16 项的 "0123456789abcdef" 表，16 字节输入 -> 32 个 hex 字符（nbytes 是 16 的倍数）
+__attribute__ ((target ("ssse3")))
+static void hex_encode_ssse3 (const uint32_t *d, char *out, unsigned nbytes)
+{
+  const __m128i bswap = _mm_setr_epi8 (3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+  const __m128i lut   = _mm_setr_epi8 ('0', '1', '2', '3', '4', '5', '6', '7',
+                                       '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+  const __m128i mask  = _mm_set1_epi8 (0x0f);
+
+  for (unsigned i = 0; i < nbytes / 16; i++)
+  {
+    const __m128i x  = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) (d + i * 4)), bswap);
+    const __m128i hi = _mm_and_si128 (_mm_srli_epi16 (x, 4), mask);
+    const __m128i lo = _mm_and_si128 (x, mask);
+
+    _mm_storeu_si128 ((__m128i *) (out + i * 32 +  0), _mm_shuffle_epi8 (lut, _mm_unpacklo_epi8 (hi, lo)));
+    _mm_storeu_si128 ((__m128i *) (out + i * 32 + 16), _mm_shuffle_epi8 (lut, _mm_unpackhi_epi8 (hi, lo)));
+  }
+
+  out[nbytes * 2] = '\n';
+}
+#endif
+
+// 任意长度的 hex（--out-bytes 不是 4 的倍数）
+static void hex_encode_prefix (const uint32_t *d, char *out, unsigned nbytes)
+{
+  for (unsigned i = 0; i < nbytes; i++)
+  {
+    const uint32_t v = d[i / 4] >> (24 - 8 * (i % 4));
+
+    memcpy (out + i * 2, hex_pairs[v & 0xff], 2);
+  }
+
+  out[nbytes * 2] = '\n';
+}
+
+// raw：每个 u32 翻成大端直接拷出去（nbytes 是 4 的倍数）
+static void raw_encode_full (const uint32_t *d, char *out, unsigned nbytes)
+{
+  for (unsigned j = 0; j < nbytes / 4; j++)
+  {
+    const uint32_t be = __builtin_bswap32 (d[j]);
+
+    memcpy (out + j * 4, &be, 4);
+  }
+}
+
+static void raw_encode_prefix (const uint32_t *d, char *out, unsigned nbytes)
+{
+  uint32_t be[16];
+
+  for (unsigned j = 0; j < (nbytes + 3) / 4; j++) be[j] = __builtin_bswap32 (d[j]);
+
+  memcpy (out, be, nbytes);
+}
+
+// 按输出格式选实现；hex 长度是 16 的倍数（全长 digest）时 CPU 支持 SSSE3 就用向量版。
+// *rec_bytes 返回每条记录的字节数
+static hex_encode_fn_t hex_encode_select (int format, unsigned nbytes, size_t *rec_bytes)
+{
+  hex_pairs_init ();
+
+  if (format == OUT_FORMAT_RAW)
+  {
+    *rec_bytes = nbytes;
+
+    return (nbytes % 4 == 0) ? raw_encode_full : raw_encode_prefix;
+  }
+
+  *rec_bytes = (size_t) nbytes * 2 + 1;
+
+  if (nbytes % 4 != 0) return hex_encode_prefix;
+
+  #if defined (__x86_64__) || defined (__i386__)
+  if (nbytes % 16 == 0 && __builtin_cpu_supports ("ssse3")) return hex_encode_ssse3;
+  #endif
+
+  return hex_encode_scalar;
+}
+
+// 输出写出器：digest 分块并行编码（hex / raw，可截断），每个线程写进自己的大缓冲（grow-only），
+// 再按线程顺序一次 writev 出去，顺序和输入一致。
+// 搜索模式的少量命中行仍然走 fout（stdio），两者混用前先 fflush。
+// 各阶段的累计统计；--metrics 时每批写一行 JSON，或者结束时写 Prometheus textfile
+typedef struct metrics
+{
+  int             format;         // METRICS_JSON / METRICS_PROM
+  const char     *path;           // NULL = 只在 stderr 打汇总
+  FILE           *fp;             // METRICS_JSON：打开着的输出
+  const char     *algo;
+  const char     *label;          // stderr 汇总的前缀：OpenCL / Native / CUDA / HIP
+  unsigned        batches;
+  stage_stats_t   total;          // format / write 在 out_writer 里累计，结束时并进来
+
+} metrics_t;
+
+typedef struct out_writer
+{
+  FILE           *fout;
+  int             fd;
+  unsigned        nthreads;
+  hex_encode_fn_t encode;
+  unsigned        out_bytes;      // 每条 digest 输出前多少字节（--out-bytes）
+  size_t          rec_bytes;      // 每条输出记录的字节数
+  unsigned        digest_words;   // 输入里每条 digest 占多少个 u32
+
+  char           *bufs[MAX_HOST_THREADS];
+  size_t          caps[MAX_HOST_THREADS];
+
+  double          format_s;       // 累计的编码 / 写出时间
+  double          write_s;
+  metrics_t      *metrics;
+
+  unsigned long long dedup_lines; // --dedup：写出的批次里的总行数 / 唯一 digest 数
+  unsigned long long dedup_uniq;
+
+} out_writer_t;
+
+// 一次格式化多少行（SHA256 hex 全长每行 65 字节，1M 行 = 65 MB）
+#define HEX_CHUNK_LINES (1u << 20)
+
+// 带行号的记录前面的 "行号:" 最多这么多字节（20 位十进制 + ':'）
+#define LINE_PREFIX_MAX 21
+
+typedef struct hex_job
+{
+  out_writer_t   *w;
+  const uint32_t *digests;        // indexed 时每条是 (行号, digest)，多一个 u32
+  uint32_t        num;
+  int             indexed;
+  unsigned long long line_base;   // indexed：记录里的行号加上它才是输入里的行号
+  size_t          lens[MAX_HOST_THREADS];
+
+} hex_job_t;
+
+// 写 "行号:"，返回字节数
+static size_t format_line_prefix (char *dst, unsigned long long v)
+{
+  char     tmp[20];
+  unsigned n = 0;
+
+  do
+  {
+    tmp[n++] = (char) ('0' + v % 10u);
+    v /= 10u;
+  } while (v);
+
+  for (unsigned i = 0; i < n; i++) dst[i] = tmp[n - 1 - i];
+
+  dst[n] = ':';
+
+  return n + 1;
+}
+
+static void hex_thread (void *p, unsigned tid, unsigned nthreads)
+{
+  hex_job_t    *job = (hex_job_t *) p;
+  out_writer_t *w   = job->w;
+
+  const uint32_t begin = (uint32_t) (((uint64_t) job->num * (tid + 0)) / nthreads);
+  const uint32_t end   = (uint32_t) (((uint64_t) job->num * (tid + 1)) / nthreads);
+
+  const size_t stride = w->digest_words + (job->indexed ? 1u : 0u);
+
+  char *dst = w->bufs[tid];
+
+  for (uint32_t k = begin; k < end; k++)
+  {
+    const uint32_t *rec = job->digests + (size_t) k * stride;
+
+    if (job->indexed) dst += format_line_prefix (dst, job->line_base + rec[0]);
+
+    w->encode (rec + (job->indexed ? 1 : 0), dst, w->out_bytes);
+
+    dst += w->rec_bytes;
+  }
+
+  job->lens[tid] = (size_t) (dst - w->bufs[tid]);
+}
+
+static void out_writer_init (out_writer_t *w, FILE *fout, unsigned nthreads, int format, unsigned out_bytes,
+                             unsigned digest_words)
+{
+  memset (w, 0, sizeof (*w));
+
+  w->fout         = fout;
+  w->fd           = fileno (fout);
+  w->nthreads     = nthreads;
+  w->out_bytes    = out_bytes;
+  w->digest_words = digest_words;
+  w->encode       = hex_encode_select (format, out_bytes, &w->rec_bytes);
+}
+
+static void out_writer_free (out_writer_t *w)
+{
+  for (unsigned t = 0; t < MAX_HOST_THREADS; t++) free (w->bufs[t]);
+}
+
+// writev 直到全部写完（处理部分写和 EINTR）
+static void writev_all (int fd, struct iovec *iov, int iovcnt)
+{
+  while (iovcnt > 0)
+  {
+    ssize_t n = writev (fd, iov, iovcnt);
+
+    if (n < 0)
+    {
+      if (errno == EINTR) continue;
+
+      perror ("writev");
+      exit (1);
+    }
+
+    while (iovcnt > 0 && (size_t) n >= iov->iov_len)
+    {
+      n -= (ssize_t) iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+
+    if (iovcnt > 0)
+    {
+      iov->iov_base = (char *) iov->iov_base + n;
+      iov->iov_len -= (size_t) n;
+    }
+  }
+}
+
+// 把 num 个 digest（indexed 时是 (行号, digest) 记录，每行前面加 "line_base + 行号:"）按输出格式写出
+static void out_writer_emit (out_writer_t *w, const uint32_t *digests, uint32_t num, int indexed,
+                             unsigned long long line_base)
+{
+  if (num == 0) return;
+
+  const size_t stride   = w->digest_words + (indexed ? 1u : 0u);
+  const size_t line_max = w->rec_bytes + (indexed ? LINE_PREFIX_MAX : 0u);
+
+  // 之前可能有走 stdio 的输出
+  fflush (w->fout);
+
+  for (uint32_t done = 0; done < num; )
+  {
+    const uint32_t   n        = (num - done < HEX_CHUNK_LINES) ? (num - done) : HEX_CHUNK_LINES;
+    const unsigned   nthreads = (n < 65536u) ? 1 : w->nthreads;
+
+    // 每个线程最多分到 ceil(n / nthreads) 行
+    const size_t need = (((size_t) n + nthreads - 1) / nthreads) * line_max;
+
+    for (unsigned t = 0; t < nthreads; t++)
+    {
+      if (need <= w->caps[t]) continue;
+
+      free (w->bufs[t]);
+
+      w->bufs[t] = (char *) malloc (need);
+      w->caps[t] = need;
+      if (!w->bufs[t])
+      {
+        fprintf (stderr, "malloc failed for hex output buffer (%zu bytes)\n", need);
+        exit (1);
+      }
+    }
+
+    hex_job_t job;
+
+    job.w         = w;
+    job.digests   = digests + (size_t) done * stride;
+    job.num       = n;
+    job.indexed   = indexed;
+    job.line_base = line_base;
+
+    const double t0 = now_seconds ();
+
+    parallel_run (nthreads, hex_thread, &job);
+
+    const double t1 = now_seconds ();
+
+    struct iovec iov[MAX_HOST_THREADS];
+
+    int iovcnt = 0;
+
+    for (unsigned t = 0; t < nthreads; t++)
+    {
+      if (job.lens[t] == 0) continue;
+
+      iov[iovcnt].iov_base = w->bufs[t];
+      iov[iovcnt].iov_len  = job.lens[t];
+      iovcnt++;
+    }
+
+    writev_all (w->fd, iov, iovcnt);
+
+    w->format_s += t1 - t0;
+    w->write_s  += now_seconds () - t1;
+
+    done += n;
+  }
+}
+
+static void out_writer_digests (out_writer_t *w, const uint32_t *digests, uint32_t num)
+{
+  out_writer_emit (w, digests, num, 0, 0);
+}
+
+// --metrics：JSON lines 的输出在开头打开，Prometheus textfile 到结束时才写
+static void metrics_open (metrics_t *m, int format, const char *path, const char *algo)
+{
+  memset (m, 0, sizeof (*m));
+
+  m->format = format;
+  m->path   = path;
+  m->algo   = algo;
+  m->label  = "OpenCL";
+
+  if (path && format == METRICS_JSON)
+  {
+    m->fp = fopen (path, "w");
+    if (!m->fp)
+    {
+      perror (path);
+      exit (1);
+    }
+  }
+}
+
+static void metrics_json_stats (FILE *fp, const stage_stats_t *st)
+{
+  fprintf (fp, "\"messages\":%llu,\"hashes\":%llu,\"in_bytes\":%llu,\"h2d_bytes\":%llu,\"d2h_bytes\":%llu",
+           st->msgs, st->hashes, st->in_bytes, st->h2d_bytes, st->d2h_bytes);
+
+  for (unsigned i = 0; i < NUM_STAGES; i++)
+  {
+    fprintf (fp, ",\"%s_s\":%.6f", stage_names[i], st->seconds[i]);
+  }
+}
+
+static void stage_stats_add (stage_stats_t *dst, const stage_stats_t *src)
+{
+  for (unsigned i = 0; i < NUM_STAGES; i++) dst->seconds[i] += src->seconds[i];
+
+  dst->in_bytes  += src->in_bytes;
+  dst->h2d_bytes += src->h2d_bytes;
+  dst->d2h_bytes += src->d2h_bytes;
+  dst->msgs      += src->msgs;
+  dst->hashes    += src->hashes;
+}
+
+// 一批写出之后：并进合计，JSON 模式再写一行
+static void metrics_batch (metrics_t *m, const batch_out_t *out)
+{
+  stage_stats_add (&m->total, &out->stats);
+
+  m->batches++;
+
+  if (!m->fp) return;
+
+  fprintf (m->fp, "{\"type\":\"batch\",\"algo\":\"%s\",\"batch\":%u,\"device\":%u,\"line_base\":%llu,",
+           m->algo, out->batch_index, out->device, out->line_base);
+  metrics_json_stats (m->fp, &out->stats);
+  fprintf (m->fp, "}\n");
+  fflush (m->fp);
+}
+
+// 结束：stderr 打各阶段汇总（format / write 取 out_writer 的累计，流式模式也在里面）；JSON 写合计行，Prometheus 先写 path.tmp 再 rename（collector 不会读到半个文件）
+static void metrics_finish (metrics_t *m, const out_writer_t *w, double wall_s)
+{
+  stage_stats_t *t = &m->total;
+
+  t->seconds[STAGE_FORMAT] = w->format_s;
+  t->seconds[STAGE_WRITE]  = w->write_s;
+
+  fprintf (stderr, "[%s] Stages:", m->label);
+  for (unsigned i = 0; i < NUM_STAGES; i++)
+  {
+    fprintf (stderr, " %s = %.3f ms%s", stage_names[i], t->seconds[i] * 1e3, (i + 1 < NUM_STAGES) ? "," : "");
+  }
+  fprintf (stderr, " (h2d %.1f MB, d2h %.1f MB)\n", (double) t->h2d_bytes / 1e6, (double) t->d2h_bytes / 1e6);
+
+  if (!m->path) return;
+
+  if (m->format == METRICS_JSON)
+  {
+    fprintf (m->fp, "{\"type\":\"total\",\"algo\":\"%s\",\"batches\":%u,\"wall_s\":%.6f,",
+             m->algo, m->batches, wall_s);
+    metrics_json_stats (m->fp, t);
+    fprintf (m->fp, "}\n");
+
+    if (fclose (m->fp) != 0) perror (m->path);
+
+    m->fp = NULL;
+
+    fprintf (stderr, "[%s] Metrics: %s (JSON lines)\n", m->label, m->path);
+    return;
+  }
+
+  const size_t tmp_len = strlen (m->path) + 5;
+
+  char *tmp = (char *) malloc (tmp_len);
+  if (!tmp)
+  {
+    fprintf (stderr, "malloc failed for metrics path\n");
+    exit (1);
+  }
+
+  snprintf (tmp, tmp_len, "%s.tmp", m->path);
+
+  FILE *fp = fopen (tmp, "w");
+  if (!fp)
+  {
+    perror (tmp);
+    free (tmp);
+    return;
+  }
+
+  fprintf (fp, "# HELP sha256_host_stage_seconds_total Time spent in each pipeline stage (device stages summed over devices).\n");
+  fprintf (fp, "# TYPE sha256_host_stage_seconds_total counter\n");
+  for (unsigned i = 0; i < NUM_STAGES; i++)
+  {
+    fprintf (fp, "sha256_host_stage_seconds_total{algo=\"%s\",stage=\"%s\"} %.6f\n", m->algo, stage_names[i], t->seconds[i]);
+  }
+
+  fprintf (fp, "# HELP sha256_host_bytes_total Bytes read from the input and moved to / from the devices.\n");
+  fprintf (fp, "# TYPE sha256_host_bytes_total counter\n");
+  fprintf (fp, "sha256_host_bytes_total{algo=\"%s\",direction=\"in\"} %llu\n",  m->algo, t->in_bytes);
+  fprintf (fp, "sha256_host_bytes_total{algo=\"%s\",direction=\"h2d\"} %llu\n", m->algo, t->h2d_bytes);
+  fprintf (fp, "sha256_host_bytes_total{algo=\"%s\",direction=\"d2h\"} %llu\n", m->algo, t->d2h_bytes);
+
+  fprintf (fp, "# HELP sha256_host_messages_total Messages hashed.\n");
+  fprintf (fp, "# TYPE sha256_host_messages_total counter\n");
+  fprintf (fp, "sha256_host_messages_total{algo=\"%s\"} %llu\n", m->algo, t->msgs);
+
+  fprintf (fp, "# HELP sha256_host_hashes_total Candidates hashed (messages times the mask keyspace with --mask).\n");
+  fprintf (fp, "# TYPE sha256_host_hashes_total counter\n");
+  fprintf (fp, "sha256_host_hashes_total{algo=\"%s\"} %llu\n", m->algo, t->hashes);
+
+  fprintf (fp, "# HELP sha256_host_batches_total Batches processed.\n");
+  fprintf (fp, "# TYPE sha256_host_batches_total counter\n");
+  fprintf (fp, "sha256_host_batches_total{algo=\"%s\"} %u\n", m->algo, m->batches);
+
+  fprintf (fp, "# HELP sha256_host_wall_seconds End-to-end time of the run.\n");
+  fprintf (fp, "# TYPE sha256_host_wall_seconds gauge\n");
+  fprintf (fp, "sha256_host_wall_seconds{algo=\"%s\"} %.6f\n", m->algo, wall_s);
+
+  if (fclose (fp) != 0 || rename (tmp, m->path) != 0)
+  {
+    perror (m->path);
+  }
+  else
+  {
+    fprintf (stderr, "[%s] Metrics: %s (Prometheus textfile)\n", m->label, m->path);
+  }
+
+  free (tmp);
+}
+
+static void line_reader_init (line_reader_t *rd, FILE *fin, unsigned nthreads)
+{
+  memset (rd, 0, sizeof (*rd));
+
+  rd->fin         = fin;
+  rd->nthreads    = nthreads;
+  rd->max_bytes   = MAX_BATCH_BYTES;
+  rd->chunk_bytes = READ_CHUNK_BYTES;
+}
+
+// --max-mem：读入这一侧最多用 bytes（arena 里的一批原始数据；每次读的块取它的 1/4，
+// arena 一开始就按 4 块分配）
+static void line_reader_cap_mem (line_reader_t *rd, size_t bytes)
+{
+  if (bytes < rd->max_bytes) rd->max_bytes = bytes;
+  if (bytes / 4 < rd->chunk_bytes) rd->chunk_bytes = bytes / 4;
+}
+
+// 切换到 mmap 模式；不是普通文件（管道等）时返回 -1，调用方退回 fread 模式
+static int line_reader_map (line_reader_t *rd)
+{
+  struct stat st;
+
+  if (fstat (fileno (rd->fin), &st) != 0 || !S_ISREG (st.st_mode))
+  {
+    return -1;
+  }
+
+  rd->map_len = (size_t) st.st_size;
+  rd->map_pos = 0;
+
+  if (rd->map_len == 0)
+  {
+    // 空文件不能 mmap，直接当作 EOF
+    rd->map = (const unsigned char *) "";
+    rd->eof = 1;
+    return 0;
+  }
+
+  void *p = mmap (NULL, rd->map_len, PROT_READ, MAP_PRIVATE, fileno (rd->fin), 0);
+  if (p == MAP_FAILED)
+  {
+    perror ("mmap");
+    return -1;
+  }
+
+  madvise (p, rd->map_len, MADV_SEQUENTIAL);
+
+  rd->map = (const unsigned char *) p;
+
+  return 0;
+}
+
+static void line_reader_free (line_reader_t *rd)
+{
+  if (rd->map && rd->map_len > 0)
+  {
+    munmap ((void *) rd->map, rd->map_len);
+  }
+  else
+  {
+    free (rd->arena);
+  }
+
+  free (rd->offs);
+  free (rd->lens);
+
+  for (unsigned t = 0; t < MAX_HOST_THREADS; t++)
+  {
+    free (rd->parts[t].offs);
+    free (rd->parts[t].lens);
+  }
+
+  memset (rd, 0, sizeof (*rd));
+}
+
+// 保证行索引至少能放 num 行
+static void line_reader_reserve (line_reader_t *rd, uint32_t num)
+{
+  if (num > rd->lines_cap)
+  {
+    uint32_t new_cap = (rd->lines_cap == 0) ? (1u << 16) : rd->lines_cap;
+    while (new_cap < num && new_cap < MAX_BATCH_LINES) new_cap *= 2u;
+    if (new_cap > MAX_BATCH_LINES) new_cap = MAX_BATCH_LINES;
+
+    uint32_t *offs = (uint32_t *) realloc (rd->offs, (size_t) new_cap * sizeof (uint32_t));
+    uint32_t *lens = (uint32_t *) realloc (rd->lens, (size_t) new_cap * sizeof (uint32_t));
+    if (!offs || !lens)
+    {
+      fprintf (stderr, "realloc failed for line index (%u lines)\n", new_cap);
+      exit (1);
+    }
+
+    rd->offs      = offs;
+    rd->lens      = lens;
+    rd->lines_cap = new_cap;
+  }
+}
+
+static void line_reader_push (line_reader_t *rd, uint32_t num, size_t off, size_t len)
+{
+  line_reader_reserve (rd, num + 1);
+
+  rd->offs[num] = (uint32_t) off;
+  rd->lens[num] = (uint32_t) len;
+}
+
+static void scan_part_push (scan_part_t *part, size_t off, size_t len)
+{
+  if (part->num >= part->cap)
+  {
+    uint32_t new_cap = (part->cap == 0) ? (1u << 16) : part->cap * 2u;
+
+    uint32_t *offs = (uint32_t *) realloc (part->offs, (size_t) new_cap * sizeof (uint32_t));
+    uint32_t *lens = (uint32_t *) realloc (part->lens, (size_t) new_cap * sizeof (uint32_t));
+    if (!offs || !lens)
+    {
+      fprintf (stderr, "realloc failed for scan index (%u lines)\n", new_cap);
+      exit (1);
+    }
+
+    part->offs = offs;
+    part->lens = lens;
+    part->cap  = new_cap;
+  }
+
+  part->offs[part->num] = (uint32_t) off;
+  part->lens[part->num] = (uint32_t) len;
+  part->num++;
+
+  if (len > part->max_len) part->max_len = len;
+}
+
+// 扫描线程：切出行首落在 [begin, end) 里的所有行（最后一行可以越过 end，直到 limit）
+static void scan_part_thread (void *ctx, unsigned tid, unsigned nthreads)
+{
+  (void) nthreads;
+
+  scan_part_t *part = &((scan_part_t *) ctx)[tid];
+
+  part->num     = 0;
+  part->max_len = 0;
+
+  const unsigned char *pos = part->begin;
+
+  while (pos < part->end)
+  {
+    const unsigned char *nl = (const unsigned char *) memchr (pos, '\n', (size_t) (part->limit - pos));
+    const unsigned char *eol = nl ? nl : part->limit;
+
+    scan_part_push (part, (size_t) (pos - part->base), (size_t) (eol - pos));
+
+    pos = nl ? nl + 1 : part->limit;
+  }
+}
+
+typedef struct scan_merge_ctx
+{
+  line_reader_t *rd;
+  uint32_t       first[MAX_HOST_THREADS];  // 每个 part 在总索引里的起始行号
+  uint32_t       num;                      // 本批最终保留的行数
+
+} scan_merge_ctx_t;
+
+static void scan_merge_thread (void *ctx, unsigned tid, unsigned nthreads)
+{
+  (void) nthreads;
+
+  scan_merge_ctx_t *mc   = (scan_merge_ctx_t *) ctx;
+  scan_part_t      *part = &mc->rd->parts[tid];
+
+  const uint32_t first = mc->first[tid];
+
+  if (first >= mc->num) return;
+
+  uint32_t cnt = part->num;
+  if (first + cnt > mc->num) cnt = mc->num - first;
+
+  memcpy (mc->rd->offs + first, part->offs, (size_t) cnt * sizeof (uint32_t));
+  memcpy (mc->rd->lens + first, part->lens, (size_t) cnt * sizeof (uint32_t));
+}
+
+// mmap 模式读一批：取一段完整的行，分给 nthreads 个线程并行切行，再拼成一个索引
+static uint32_t line_reader_fill_mmap (line_reader_t *rd, uint32_t max_lines, size_t *out_max_len)
+{
+  *out_max_len = 0;
+
+  if (rd->map_pos >= rd->map_len)
+  {
+    rd->eof = 1;
+    return 0;
+  }
+
+  const unsigned char *base  = rd->map + rd->map_pos;
+  const size_t         avail = rd->map_len - rd->map_pos;
+
+  // 区间长度：上限 max_bytes；有了平均行长之后按 max_lines 估计，少扫多余的数据
+  size_t span = (avail < rd->max_bytes) ? avail : rd->max_bytes;
+
+  if (rd->total_lines > 0)
+  {
+    const double avg = (double) rd->map_pos / (double) rd->total_lines;
+    const double est = avg * (double) max_lines * 1.1 + READ_CHUNK_BYTES;
+
+    if (est < (double) span) span = (size_t) est;
+  }
+
+  // 区间终点对齐到 span 之内最后一个行尾之后（不超过 max_bytes）；一行都放不下时才往后找
+  const unsigned char *limit = base + avail;
+
+  if (span < avail)
+  {
+    const unsigned char *nl = (const unsigned char *) memrchr (base, '\n', span);
+
+    if (!nl) nl = (const unsigned char *) memchr (base + span, '\n', avail - span);
+
+    if (nl) limit = nl + 1;
+  }
+
+  const size_t len = (size_t) (limit - base);
+
+  if (len > (size_t) UINT32_MAX)
+  {
+    fprintf (stderr, "input line too long (> %u bytes)\n", UINT32_MAX);
+    exit (1);
+  }
+
+  // 切成 nthreads 段，每段起点推进到下一个行首（数据太少时不值得开线程）
+  const unsigned nthreads = (len < ((size_t) 1 << 20)) ? 1 : rd->nthreads;
+
+  for (unsigned t = 0; t < nthreads; t++)
+  {
+    const unsigned char *begin = base;
+
+    if (t > 0)
+    {
+      const unsigned char *p  = base + (len / nthreads) * t;
+      const unsigned char *nl = (const unsigned char *) memchr (p - 1, '\n', (size_t) (limit - p + 1));
+
+      begin = nl ? nl + 1 : limit;
+
+      if (begin < rd->parts[t - 1].begin) begin = rd->parts[t - 1].begin;
+
+      rd->parts[t - 1].end = begin;
+    }
+
+    rd->parts[t].base  = base;
+    rd->parts[t].begin = begin;
+    rd->parts[t].limit = limit;
+  }
+
+  rd->parts[nthreads - 1].end = limit;
+
+  parallel_run (nthreads, scan_part_thread, rd->parts);
+
+  // 汇总每段的起始行号；超过 max_lines 的行留给下一批
+  scan_merge_ctx_t mc;
+  mc.rd = rd;
+
+  uint32_t total    = 0;
+  size_t   max_len  = 0;
+  size_t   consumed = len;
+
+  for (unsigned t = 0; t < nthreads; t++)
+  {
+    scan_part_t *part = &rd->parts[t];
+
+    mc.first[t] = total;
+
+    const uint32_t room = max_lines - total;
+
+    if (part->num <= room)
+    {
+      total += part->num;
+
+      if (part->max_len > max_len) max_len = part->max_len;
+      continue;
+    }
+
+    // 这一段被截断：只统计保留下来的行，下一批从第一条没保留的行开始
+    for (uint32_t k = 0; k < room; k++)
+    {
+      if (part->lens[k] > max_len) max_len = part->lens[k];
+    }
+
+    consumed = part->offs[room];
+    total   += room;
+
+    for (unsigned u = t + 1; u < nthreads; u++) mc.first[u] = total;
+    break;
+  }
+
+  mc.num = total;
+
+  line_reader_reserve (rd, total);
+
+  parallel_run (nthreads, scan_merge_thread, &mc);
+
+  rd->arena        = (unsigned char *) base;
+  rd->map_pos     += consumed;
+  rd->total_lines += total;
+
+  *out_max_len = max_len;
+
+  return total;
+}
+
+// 读一批行（最多 max_lines 行），返回行数；各行的位置在 rd->offs / rd->lens 里，
+// 数据在 rd->arena 里，直到下一次调用之前都有效
+static uint32_t line_reader_fill_read (line_reader_t *rd, uint32_t max_lines, size_t *out_max_len)
+{
+  // 上一批没用完的尾巴（不完整的行 / 未扫描的数据）挪到 arena 开头
+  if (rd->scan_pos > 0)
+  {
+    memmove (rd->arena, rd->arena + rd->scan_pos, rd->data_len - rd->scan_pos);
+
+    rd->data_len   -= rd->scan_pos;
+    rd->search_pos -= rd->scan_pos;
+    rd->scan_pos    = 0;
+  }
+
+  uint32_t num     = 0;
+  size_t   max_len = 0;
+
+  const double deadline = (rd->flush_s > 0.0) ? now_seconds () + rd->flush_s : 0.0;
+
+  rd->idle = 0;
+
+  while (num < max_lines)
+  {
+    unsigned char *nl = NULL;
+
+    if (rd->search_pos < rd->data_len)
+    {
+      nl = (unsigned char *) memchr (rd->arena + rd->search_pos, '\n',
+                                     rd->data_len - rd->search_pos);
+    }
+
+    if (nl)
+    {
+      const size_t end = (size_t) (nl - rd->arena);
+      const size_t len = end - rd->scan_pos;
+
+      // 这一行会让本批超过 max_bytes：留给下一批（从 scan_pos 接着切）
+      if (end > rd->max_bytes && num > 0) break;
+
+      line_reader_push (rd, num, rd->scan_pos, len);
+      if (len > max_len) max_len = len;
+      num++;
+
+      rd->scan_pos   = end + 1;
+      rd->search_pos = end + 1;
+      continue;
+    }
+
+    rd->search_pos = rd->data_len;
+
+    if (rd->eof)
+    {
+      // 最后一行没有 '\n'
+      if (rd->scan_pos < rd->data_len)
+      {
+        const size_t len = rd->data_len - rd->scan_pos;
+
+        line_reader_push (rd, num, rd->scan_pos, len);
+        if (len > max_len) max_len = len;
+        num++;
+
+        rd->scan_pos = rd->data_len;
+      }
+      break;
+    }
+
+    // 本批 arena 够大了，剩下的留给下一批
+    if (rd->data_len >= rd->max_bytes && num > 0) break;
+
+    if (rd->data_len + rd->chunk_bytes > rd->arena_cap)
+    {
+      if (rd->data_len + rd->chunk_bytes > (size_t) UINT32_MAX)
+      {
+        fprintf (stderr, "input line too long (> %zu bytes)\n", rd->data_len);
+        exit (1);
+      }
+
+      size_t new_cap = (rd->arena_cap == 0) ? rd->chunk_bytes * 4 : rd->arena_cap * 2;
+      if (new_cap < rd->data_len + rd->chunk_bytes) new_cap = rd->data_len + rd->chunk_bytes;
+      if (new_cap > (size_t) UINT32_MAX) new_cap = (size_t) UINT32_MAX;
+
+      unsigned char *arena = (unsigned char *) realloc (rd->arena, new_cap);
+      if (!arena)
+      {
+        fprintf (stderr, "realloc failed for input arena (%zu bytes)\n", new_cap);
+        exit (1);
+      }
+
+      rd->arena     = arena;
+      rd->arena_cap = new_cap;
+    }
+
+    size_t nread;
+
+    if (rd->flush_s > 0.0)
+    {
+      // --flush-ms：最多等到截止时间，生产者再慢也按时交出这一批（一行都还没有时返回 0、置 idle，
+      // 调用方先把在飞的批次写出去再接着等）；read 拿到多少算多少（fread 会一直等到读满一整块）
+      const double remain = deadline - now_seconds ();
+
+      struct pollfd pfd = { fileno (rd->fin), POLLIN, 0 };
+
+      if (remain <= 0.0 || poll (&pfd, 1, (int) (remain * 1e3) + 1) <= 0)
+      {
+        if (num == 0) rd->idle = 1;
+        break;
+      }
+
+      ssize_t n;
+
+      do
+      {
+        n = read (fileno (rd->fin), rd->arena + rd->data_len, rd->chunk_bytes);
+      }
+      while (n < 0 && errno == EINTR);
+
+      if (n < 0)
+      {
+        perror ("read");
+        exit (1);
+      }
+
+      if (n == 0) rd->eof = 1;
+
+      nread = (size_t) n;
+    }
+    else
+    {
+      nread = fread (rd->arena + rd->data_len, 1, rd->chunk_bytes, rd->fin);
+
+      if (nread == 0)
+      {
+        if (ferror (rd->fin))
+        {
+          perror ("fread");
+          exit (1);
+        }
+        rd->eof = 1;
+      }
+    }
+
+    rd->data_len += nread;
+  }
+
+  rd->total_lines += num;
+
+  *out_max_len = max_len;
+
+  return num;
+}
+
+// RFC 3629 的 UTF-8：不接受过长编码、代理区 U+D800..U+DFFF、超过 U+10FFFF 和截断的序列
+static int utf8_valid (const unsigned char *s, size_t len)
+{
+  size_t i = 0;
+
+  while (i < len)
+  {
+    const unsigned char c = s[i];
+
+    if (c < 0x80)
+    {
+      i++;
+      continue;
+    }
+
+    size_t        extra;
+    unsigned char lo = 0x80;
+    unsigned char hi = 0xbf;
+
+    if      (c >= 0xc2 && c <= 0xdf) extra = 1;
+    else if (c == 0xe0)            { extra = 2; lo = 0xa0; }
+    else if (c == 0xed)            { extra = 2; hi = 0x9f; }
+    else if (c >= 0xe1 && c <= 0xef) extra = 2;
+    else if (c == 0xf0)            { extra = 3; lo = 0x90; }
+    else if (c == 0xf4)            { extra = 3; hi = 0x8f; }
+    else if (c >= 0xf1 && c <= 0xf3) extra = 3;
+    else return 0;
+
+    if (len - i - 1 < extra) return 0;
+
+    if (s[i + 1] < lo || s[i + 1] > hi) return 0;
+
+    for (size_t k = 2; k <= extra; k++)
+    {
+      if ((s[i + k] & 0xc0) != 0x80) return 0;
+    }
+
+    i += extra + 1;
+  }
+
+  return 1;
+}
+
+// 读一批行。--encoding utf16le 时逐行校验 UTF-8：kernel 没法编码不合法的行，
+// 本批截到它之前，报出行号，之后的调用都返回 0（调用方当作 EOF 收尾，最后看 utf8_bad 以失败退出）
+static uint32_t line_reader_fill (line_reader_t *rd, uint32_t max_lines, size_t *out_max_len)
+{
+  if (rd->utf8_bad)
+  {
+    rd->idle     = 0;
+    *out_max_len = 0;
+    return 0;
+  }
+
+  const uint32_t num = rd->map ? line_reader_fill_mmap (rd, max_lines, out_max_len)
+                               : line_reader_fill_read (rd, max_lines, out_max_len);
+
+  if (!rd->check_utf8) return num;
+
+  for (uint32_t k = 0; k < num; k++)
+  {
+    if (utf8_valid (rd->arena + rd->offs[k], rd->lens[k])) continue;
+
+    rd->total_lines -= num - k;
+    rd->utf8_bad     = 1;
+
+    fprintf (stderr, "--encoding utf16le: line %llu is not valid UTF-8, stopping before it\n", rd->total_lines);
+
+    return k;
+  }
+
+  return num;
+}
+
+// 一批的分桶布局：每个桶在排序后索引 / msgs_bytes 里的位置和 stride
+typedef struct bucket_plan
+{
+  uint32_t count[NUM_LEN_BUCKETS];
+  uint32_t first[NUM_LEN_BUCKETS];         // 在分桶后的 lens / idx 中的起始下标
+  size_t   stride_bytes[NUM_LEN_BUCKETS];
+  size_t   base_bytes[NUM_LEN_BUCKETS];    // 在 msgs_bytes 中的起始字节
+  size_t   total_bytes;
+  unsigned num_nonempty;
+  int      single_block;                   // 桶 0 全是一个 block 的消息（SHA256：<= SINGLE_BLOCK_MAX_LEN）
+
+} bucket_plan_t;
+
+static inline unsigned len_bucket (uint32_t len, const hash_algo_t *algo)
+{
+  // 加上 0x80 和长度字段之后要压缩的 block 数
+  const uint32_t blocks = (len + algo->len_bytes) / algo->block_bytes + 1u;
+
+  return (blocks < NUM_LEN_BUCKETS) ? blocks - 1u : NUM_LEN_BUCKETS - 1u;
+}
+
+// 按 stride 打包：每行复制到所在桶的下一个槽，只给槽的尾部补零；
+// 分桶时同时生成分桶顺序的 lens 和 idx（桶内保持原始顺序）
+typedef struct pack_ctx
+{
+  const unsigned char *arena;
+  const uint32_t      *offs;
+  const uint32_t      *lens;
+  uint32_t             num_msgs;
+  unsigned char       *msgs_bytes;
+  const hash_algo_t   *algo;
+
+  int                  bucketed;
+  const bucket_plan_t *plan;
+  uint32_t            *lens_sorted;
+  uint32_t            *idx_sorted;
+
+  uint32_t             count[MAX_HOST_THREADS][NUM_LEN_BUCKETS];
+  size_t               max_len_last[MAX_HOST_THREADS];
+
+} pack_ctx_t;
+
+static void pack_count_thread (void *ctx, unsigned tid, unsigned nthreads)
+{
+  pack_ctx_t *pc = (pack_ctx_t *) ctx;
+
+  const uint32_t k0 = (uint32_t) (((uint64_t) pc->num_msgs * (tid + 0)) / nthreads);
+  const uint32_t k1 = (uint32_t) (((uint64_t) pc->num_msgs * (tid + 1)) / nthreads);
+
+  uint32_t *count   = pc->count[tid];
+  size_t    max_len = 0;
+
+  memset (count, 0, sizeof (pc->count[tid]));
+
+  for (uint32_t k = k0; k < k1; k++)
+  {
+    const uint32_t len = pc->lens[k];
+    const unsigned b   = len_bucket (len, pc->algo);
+
+    count[b]++;
+
+    if (b == NUM_LEN_BUCKETS - 1 && len > max_len) max_len = len;
+  }
+
+  pc->max_len_last[tid] = max_len;
+}
+
+static void pack_thread (void *ctx, unsigned tid, unsigned nthreads)
+{
+  pack_ctx_t *pc = (pack_ctx_t *) ctx;
+
+  const bucket_plan_t *plan = pc->plan;
+
+  const uint32_t k0 = (uint32_t) (((uint64_t) pc->num_msgs * (tid + 0)) / nthreads);
+  const uint32_t k1 = (uint32_t) (((uint64_t) pc->num_msgs * (tid + 1)) / nthreads);
+
+  if (!pc->bucketed)
+  {
+    const size_t stride_bytes = plan->stride_bytes[0];
+
+    for (uint32_t k = k0; k < k1; k++)
+    {
+      const uint32_t len_k = pc->lens[k];
+
+      unsigned char *dst = pc->msgs_bytes + (size_t) k * stride_bytes;
+
+      memcpy (dst, pc->arena + pc->offs[k], len_k);
+      memset (dst + len_k, 0, stride_bytes - len_k);
+    }
+
+    return;
+  }
+
+  // 本线程在每个桶里的写入位置 = 桶起点 + 前面线程在这个桶里的行数
+  uint32_t cursor[NUM_LEN_BUCKETS];
+
+  for (unsigned b = 0; b < NUM_LEN_BUCKETS; b++)
+  {
+    cursor[b] = plan->first[b];
+
+    for (unsigned t = 0; t < tid; t++) cursor[b] += pc->count[t][b];
+  }
+
+  for (uint32_t k = k0; k < k1; k++)
+  {
+    const uint32_t len_k = pc->lens[k];
+    const unsigned b     = len_bucket (len_k, pc->algo);
+    const uint32_t pos   = cursor[b]++;
+
+    const size_t stride_bytes = plan->stride_bytes[b];
+
+    unsigned char *dst = pc->msgs_bytes + plan->base_bytes[b]
+                       + (size_t) (pos - plan->first[b]) * stride_bytes;
+
+    memcpy (dst, pc->arena + pc->offs[k], len_k);
+    memset (dst + len_k, 0, stride_bytes - len_k);
+
+    pc->lens_sorted[pos] = len_k;
+    pc->idx_sorted[pos]  = k;
+  }
+}
+
+// 统计每个桶的行数，排出各桶在 msgs_bytes 里的位置；不分桶时整批就是一个桶
+static void plan_buckets (pack_ctx_t *pc, bucket_plan_t *plan, int use_buckets,
+                          size_t max_len, unsigned nthreads)
+{
+  memset (plan, 0, sizeof (*plan));
+
+  if (!use_buckets)
+  {
+    plan->count[0]        = pc->num_msgs;
+    plan->stride_bytes[0] = stride_for_len (max_len, pc->algo);
+    plan->total_bytes     = (size_t) pc->num_msgs * plan->stride_bytes[0];
+    plan->num_nonempty    = 1;
+    plan->single_block    = (len_bucket ((uint32_t) max_len, pc->algo) == 0);
+
+    pc->bucketed = 0;
+    pc->plan     = plan;
+    return;
+  }
+
+  parallel_run (nthreads, pack_count_thread, pc);
+
+  size_t max_len_last = 0;
+
+  for (unsigned t = 0; t < nthreads; t++)
+  {
+    for (unsigned b = 0; b < NUM_LEN_BUCKETS; b++) plan->count[b] += pc->count[t][b];
+
+    if (pc->max_len_last[t] > max_len_last) max_len_last = pc->max_len_last[t];
+  }
+
+  uint32_t first = 0;
+  size_t   base  = 0;
+
+  for (unsigned b = 0; b < NUM_LEN_BUCKETS; b++)
+  {
+    plan->stride_bytes[b] = (b < NUM_LEN_BUCKETS - 1) ? (size_t) (b + 1) * pc->algo->block_bytes
+                                                      : stride_for_len (max_len_last, pc->algo);
+    plan->first[b]        = first;
+    plan->base_bytes[b]   = base;
+
+    first += plan->count[b];
+    base  += (size_t) plan->count[b] * plan->stride_bytes[b];
+
+    if (plan->count[b] > 0) plan->num_nonempty++;
+  }
+
+  plan->total_bytes = base;
+
+  // 在下面合并之前判断：合并后的桶 0 可能来自更长的桶
+  plan->single_block = (plan->count[0] > 0);
+
+  // 只有一个非空桶时顺序不变，不需要 idx，也不需要重排 lens
+  pc->bucketed = (plan->num_nonempty > 1);
+  pc->plan     = plan;
+
+  if (!pc->bucketed)
+  {
+    for (unsigned b = 0; b < NUM_LEN_BUCKETS; b++)
+    {
+      if (plan->count[b] == 0) continue;
+
+      plan->first[0]        = 0;
+      plan->count[0]        = plan->count[b];
+      plan->stride_bytes[0] = plan->stride_bytes[b];
+      plan->base_bytes[0]   = 0;
+
+      if (b > 0) plan->count[b] = 0;
+      break;
+    }
+  }
+}
+
+// 单调时钟（秒），用于端到端计时
+// digest (nbytes / 4 个 u32) -> 大端字节序 -> hex
+static void write_digest_hex (FILE *fout, const uint32_t *d, unsigned nbytes)
+{
+  // 以大端方式写入（和标准 SHA256 / SHA512 一致）
+  char hex[HEX_LINE_BYTES];
+  hex_encode_scalar (d, hex, nbytes);
+  fwrite (hex, 1, (size_t) nbytes * 2 + 1, fout);
+}
+
+// 跟 kernel 里 hash_comp 一样的顺序：先比 word 3，再 2、1、0
+static int search_target_cmp (const void *pa, const void *pb)
+{
+  const uint32_t *a = (const uint32_t *) pa;
+  const uint32_t *b = (const uint32_t *) pb;
+
+  for (int i = 3; i >= 0; i--)
+  {
+    if (a[i] > b[i]) return  1;
+    if (a[i] < b[i]) return -1;
+  }
+
+  return 0;
+}
+
+static int hex_nibble (int c)
+{
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// 解析 --hmac-key-hex / --pbkdf2-salt-hex 的参数：偶数个 hex 字符 -> 新分配的字节串（替换掉 *out）
+static int parse_hex_arg (const char *opt, const char *hex, unsigned char **out, size_t *out_len)
+{
+  const size_t hex_len = strlen (hex);
+
+  if (hex_len % 2 != 0)
+  {
+    fprintf (stderr, "%s needs an even number of hex digits\n", opt);
+    return -1;
+  }
+
+  unsigned char *bytes = (unsigned char *) malloc (hex_len / 2 + 1);
+  if (!bytes)
+  {
+    fprintf (stderr, "malloc failed for %s\n", opt);
+    return -1;
+  }
+
+  for (size_t i = 0; i < hex_len / 2; i++)
+  {
+    const int hi = hex_nibble ((unsigned char) hex[i * 2 + 0]);
+    const int lo = hex_nibble ((unsigned char) hex[i * 2 + 1]);
+
+    if (hi < 0 || lo < 0)
+    {
+      fprintf (stderr, "%s: invalid hex digit\n", opt);
+      free (bytes);
+      return -1;
+    }
+
+    bytes[i] = (unsigned char) ((hi << 4) | lo);
+  }
+
+  free (*out);
+
+  *out     = bytes;
+  *out_len = hex_len / 2;
+
+  return 0;
+}
+
+// 读入目标文件（每行一个 64 位 hex 的 SHA-256），转成 kernel 的 big-endian word，排序去重
+static void load_search_targets (const char *path, search_ctx_t *sc)
+{
+  FILE *f = fopen (path, "rb");
+  if (!f)
+  {
+    perror (path);
+    exit (1);
+  }
+
+  uint32_t cap = 1024;
+  uint32_t num = 0;
+
+  uint32_t *t = (uint32_t *) malloc ((size_t) cap * 8u * sizeof (uint32_t));
+
+  char line[256];
+  unsigned long long line_no = 0;
+
+  while (fgets (line, sizeof (line), f))
+  {
+    line_no++;
+
+    size_t len = strlen (line);
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) len--;
+
+    if (len == 0) continue;
+
+    if (len != 64)
+    {
+      fprintf (stderr, "%s:%llu: expected 64 hex characters\n", path, line_no);
+      exit (1);
+    }
+
+    if (num == cap)
+    {
+      cap *= 2;
+      t = (uint32_t *) realloc (t, (size_t) cap * 8u * sizeof (uint32_t));
+    }
+
+    if (!t)
+    {
+      fprintf (stderr, "malloc failed for search targets\n");
+      exit (1);
+    }
+
+    uint32_t *d = t + (size_t) num * 8u;
+
+    for (int i = 0; i < 8; i++)
+    {
+      uint32_t v = 0;
+
+      for (int j = 0; j < 8; j++)
+      {
+        const int n = hex_nibble ((unsigned char) line[i * 8 + j]);
+        if (n < 0)
+        {
+          fprintf (stderr, "%s:%llu: invalid hex digit\n", path, line_no);
+          exit (1);
+        }
+        v = (v << 4) | (uint32_t) n;
+      }
+
+      d[i] = v;
+    }
+
+    num++;
+  }
+
+  fclose (f);
+
+  qsort (t, num, 8u * sizeof (uint32_t), search_target_cmp);
+
+  // find_hash 只比前 4 个 word，重复的只留一个
+  uint32_t uniq = 0;
+
+  for (uint32_t k = 0; k < num; k++)
+  {
+    if (uniq > 0 && search_target_cmp (t + (size_t) k * 8u, t + (size_t) (uniq - 1) * 8u) == 0) continue;
+
+    memmove (t + (size_t) uniq * 8u, t + (size_t) k * 8u, 8u * sizeof (uint32_t));
+    uniq++;
+  }
+
+  sc->targets     = t;
+  sc->num_targets = uniq;
+}
+
+// 生成 hashcat 格式的两级 bitmap（host 上只算一次，每个设备各上传一份）
+static void search_build (search_ctx_t *sc)
+{
+  // bitmap 越大误判越少：从 SEARCH_BITMAP_MIN 往上加，直到填充率 <= 1/8 或到上限
+  uint32_t bits = SEARCH_BITMAP_MIN;
+  while (bits < SEARCH_BITMAP_MAX && (unsigned long long) sc->num_targets * 8u > (1ull << bits) * 32u) bits++;
+
+  const uint32_t words = 1u << bits;
+  const uint32_t mask  = words - 1;
+
+  uint32_t *bm = (uint32_t *) calloc ((size_t) words * 8u, sizeof (uint32_t));
+  sc->reported = (uint8_t *) calloc ((sc->num_targets > 0) ? sc->num_targets : 1, 1);
+  if (!bm || !sc->reported)
+  {
+    fprintf (stderr, "malloc failed for search bitmaps\n");
+    exit (1);
+  }
+
+  for (uint32_t k = 0; k < sc->num_targets; k++)
+  {
+    const uint32_t *d = sc->targets + (size_t) k * 8u;
+
+    for (int i = 0; i < 4; i++)
+    {
+      bm[(size_t) (i + 0) * words + ((d[i] >> SEARCH_BITMAP_SHIFT1) & mask)] |= 1u << (d[i] & 0x1f);
+      bm[(size_t) (i + 4) * words + ((d[i] >> SEARCH_BITMAP_SHIFT2) & mask)] |= 1u << (d[i] & 0x1f);
+    }
+  }
+
+  sc->bitmap_bits = bits;
+  sc->bitmaps     = bm;
+
+  fprintf (stderr, "[OpenCL] Search: %u unique targets, bitmap bits = %u\n", sc->num_targets, bits);
+}
+
+// 解析 --mask，填好给 kernel 的字符集表；掩码不合法时打印原因，返回 -1
+static int mask_parse (const char *text, mask_cfg_t *m)
+{
+  static const char cs_lower[]   = "abcdefghijklmnopqrstuvwxyz";
+  static const char cs_upper[]   = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+  static const char cs_digit[]   = "0123456789";
+  static const char cs_hex_lo[]  = "0123456789abcdef";
+  static const char cs_hex_up[]  = "0123456789ABCDEF";
+  static const char cs_special[] = " !\"#$%&'()*+,-./:;<=>?@[\\]^_`{|}~";
+
+  memset (m, 0, sizeof (*m));
+
+  // 先数位置数，字符从 table[2 * len] 开始放
+  unsigned len = 0;
+
+  for (const char *c = text; *c; c++, len++)
+  {
+    if (*c == '?' && *++c == '\0')
+    {
+      fprintf (stderr, "--mask: trailing '?' in \"%s\"\n", text);
+      return -1;
+    }
+  }
+
+  if (len == 0 || len > MASK_MAX_LEN)
+  {
+    fprintf (stderr, "--mask must have 1..%u positions\n", MASK_MAX_LEN);
+    return -1;
+  }
+
+  m->len         = len;
+  m->keyspace    = 1;
+  m->table_words = len * 2;
+
+  const char *c = text;
+
+  for (unsigned p = 0; p < len; p++, c++)
+  {
+    char        literal[2] = { *c, '\0' };
+    const char *set        = literal;
+    unsigned    set_len    = 1;
+    int         all_bytes  = 0;
+
+    if (*c == '?')
+    {
+      c++;
+
+      switch (*c)
+      {
+        case 'l': set = cs_lower;   break;
+        case 'u': set = cs_upper;   break;
+        case 'd': set = cs_digit;   break;
+        case 'h': set = cs_hex_lo;  break;
+        case 'H': set = cs_hex_up;  break;
+        case 's': set = cs_special; break;
+        case 'a': set = NULL;       break;
+        case 'b': all_bytes = 1;    break;
+        case '?': set = "?";        break;
+        default:
+          fprintf (stderr, "--mask: unknown charset ?%c\n", *c);
+          return -1;
+      }
+    }
+
+    uint32_t *out = m->table + m->table_words;
+
+    if (all_bytes)
+    {
+      set_len = 256;
+
+      for (unsigned k = 0; k < 256; k++) out[k] = k;
+    }
+    else if (!set)
+    {
+      // ?a = ?l?u?d?s
+      const char *parts[] = { cs_lower, cs_upper, cs_digit, cs_special };
+
+      set_len = 0;
+
+      for (unsigned i = 0; i < 4; i++)
+      {
+        for (const char *q = parts[i]; *q; q++) out[set_len++] = (unsigned char) *q;
+      }
+    }
+    else
+    {
+      set_len = (unsigned) strlen (set);
+
+      for (unsigned k = 0; k < set_len; k++) out[k] = (unsigned char) set[k];
+    }
+
+    m->table[p * 2 + 0] = m->table_words;
+    m->table[p * 2 + 1] = set_len;
+    m->table_words     += set_len;
+    m->keyspace        *= set_len;
+
+    if (m->keyspace > 0xffffffffull)
+    {
+      fprintf (stderr, "--mask: keyspace of \"%s\" exceeds 2^32 per word; move leading positions into the wordlist\n", text);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+// 第 il_pos 个候选的掩码部分（m->len 字节）
+static void mask_suffix (const mask_cfg_t *m, uint32_t il_pos, unsigned char *out)
+{
+  for (int p = (int) m->len - 1; p >= 0; p--)
+  {
+    const uint32_t cnt = m->table[p * 2 + 1];
+
+    out[p]  = (unsigned char) m->table[m->table[p * 2] + il_pos % cnt];
+    il_pos /= cnt;
+  }
+}
+
+// 写出 "后缀:"；含 ':' 或不可打印字节时跟 hashcat 一样写成 $HEX[...]
+static void write_mask_suffix (FILE *fout, const mask_cfg_t *m, uint32_t il_pos)
+{
+  unsigned char suffix[MASK_MAX_LEN];
+
+  mask_suffix (m, il_pos, suffix);
+
+  int plain = 1;
+
+  for (unsigned k = 0; k < m->len; k++)
+  {
+    if (suffix[k] < 0x20 || suffix[k] > 0x7e || suffix[k] == ':') plain = 0;
+  }
+
+  if (plain)
+  {
+    fwrite (suffix, 1, m->len, fout);
+  }
+  else
+  {
+    fputs ("$HEX[", fout);
+
+    for (unsigned k = 0; k < m->len; k++) fprintf (fout, "%02x", suffix[k]);
+
+    fputc (']', fout);
+  }
+
+  fputc (':', fout);
+}
+
+// 写出一批结果。搜索模式下每个 slot 各有一份 hashes_shown（不同 queue / 设备上的批次
+// 执行先后不定，共用一份会让后面的批次抢先标记），同一个目标可能在几个 slot 里各命中一次：
+// 按 batch 顺序写，只保留输入里最早的那次
+static void write_batch_out (batch_out_t *out, out_writer_t *w, search_ctx_t *sc, const hash_algo_t *algo)
+{
+  if (sc)
+  {
+    for (uint32_t k = 0; k < out->num_hits; k++)
+    {
+      const uint32_t t = out->hits[k].hash_pos;
+
+      if (sc->reported[t]) continue;
+
+      sc->reported[t] = 1;
+      sc->total_hits++;
+
+      fprintf (w->fout, "%llu:", out->line_base + (unsigned long long) out->hits[k].gidvid);
+      if (sc->mask) write_mask_suffix (w->fout, sc->mask, (uint32_t) out->hits[k].il_pos);
+      write_digest_hex (w->fout, sc->targets + (size_t) t * 8u, 32);
+    }
+
+  }
+  else if (out->dedup)
+  {
+    w->dedup_lines += out->num_msgs;
+    w->dedup_uniq  += out->num_uniq;
+
+    if (out->dedup == DEDUP_COUNT)
+    {
+      fprintf (w->fout, "%llu:%u:%u\n", out->line_base, out->num_msgs, out->num_uniq);
+    }
+    else
+    {
+      // "行号:hex"，行号从 0 开始（跟 --search 一样）
+      out_writer_emit (w, out->uniq, out->num_uniq, 1, out->line_base);
+
+      // 本批第一行总是第一次出现
+      if (out->batch_index == 1 && out->num_uniq > 0)
+      {
+        fprintf (stderr, "[OpenCL] First line %s = ", algo->label);
+        write_digest_hex (stderr, out->uniq + 1, algo->digest_words * 4u);
+      }
+    }
+  }
+  else if (out->digests)
+  {
+    // 写出到输出文件（多线程编码 + writev）
+    out_writer_digests (w, out->digests, out->num_msgs);
+
+    // 可选：打印第一批第一条做 sanity check
+    if (out->batch_index == 1 && out->num_msgs > 0)
+    {
+      fprintf (stderr, "[OpenCL] First line %s = ", algo->label);
+      write_digest_hex (stderr, out->digests, algo->digest_words * 4u);
+    }
+
+    out->digests = NULL;
+  }
+
+  out->ready = 0;
+}
+
+// 从 *next_write 开始，把已经收尾的连续几批按顺序写出
+static void flush_outputs (batch_out_t *ring, unsigned ring_cap, unsigned *next_write,
+                           out_writer_t *w, search_ctx_t *sc, const hash_algo_t *algo)
+{
+  for (;;)
+  {
+    batch_out_t *out = &ring[*next_write % ring_cap];
+
+    if (!out->ready || out->batch_index != *next_write) break;
+
+    // 搜索模式的命中和 --dedup count 的汇总走 stdio，不经过 out_writer：整段都算 write
+    const double t0       = now_seconds ();
+    const double format_0 = w->format_s;
+    const double write_0  = w->write_s;
+
+    write_batch_out (out, w, sc, algo);
+
+    if (sc || out->dedup == DEDUP_COUNT) w->write_s += now_seconds () - t0;
+
+    out->stats.seconds[STAGE_FORMAT] = w->format_s - format_0;
+    out->stats.seconds[STAGE_WRITE]  = w->write_s  - write_0;
+
+    metrics_batch (w->metrics, out);
+
+    (*next_write)++;
+  }
+}
+
+// 批处理循环的输出端（slot_pipeline_t 的 ctx）：收尾的 batch 先进环，再按 batch_index 顺序写出
+typedef struct out_ring
+{
+  batch_out_t  *ring;
+  unsigned      cap;
+  unsigned      next_write;   // 下一个要写出的 batch_index
+  unsigned      batch_index;  // 最近提交的 batch_index
+  out_writer_t *w;
+  search_ctx_t *sc;
+
+} out_ring_t;
+
+// pipeline 的 backlog_full：积压太多（最老的一批还没写出）时先等它
+static int out_ring_full (void *ctx)
+{
+  const out_ring_t *r = (const out_ring_t *) ctx;
+
+  return r->batch_index - r->next_write >= r->cap;
+}
+
+// pipeline 的 retire：收一个 slot 并尽量往前写。轮到它的话 digest 直接从 pinned staging 写出
+// （单设备时总是这样），否则拷进环里的 own_digests，slot 马上可以接下一批
+static cl_int retire_slot (batch_slot_t *slot, void *ctx)
+{
+  out_ring_t  *r   = (out_ring_t *) ctx;
+  batch_out_t *out = &r->ring[slot->batch_index % r->cap];
+
+  const hash_algo_t *algo = slot->dev->algo;
+
+  const cl_int err = collect_slot (slot, r->sc, out);
+
+  if (err != CL_SUCCESS) return err;
+
+  flush_outputs (r->ring, r->cap, &r->next_write, r->w, r->sc, algo);
+
+  if (out->ready && out->digests)
+  {
+    const size_t bytes = (size_t) out->num_msgs * algo->digest_words * sizeof (uint32_t);
+
+    if (bytes > out->own_cap)
+    {
+      free (out->own_digests);
+
+      out->own_cap     = bytes;
+      out->own_digests = (uint32_t *) malloc (bytes);
+      if (!out->own_digests)
+      {
+        fprintf (stderr, "malloc failed for pending digests (%zu bytes)\n", bytes);
+        exit (1);
+      }
+    }
+
+    memcpy (out->own_digests, out->digests, bytes);
+
+    out->digests = out->own_digests;
+  }
+
+  return CL_SUCCESS;
+}
+
+// --iterations / --pbkdf2-salt：第一轮（或 PBKDF2 init）已经排进 queue，
+// 剩下的轮数按 loop_chunk 拆成多次 launch，状态留在设备上（迭代：buf_out；PBKDF2：buf_tmps），
+// 全部挂在本 slot 的 in-order queue 上，不和 host 往返。PBKDF2 最后再跑一次 comp 交给输出阶段。
+static void enqueue_kdf_loops (batch_slot_t *slot, const search_ctx_t *sc)
+{
+  device_ctx_t    *dev = slot->dev;
+  const kdf_cfg_t *kdf = dev->kdf;
+
+  if (kdf->mode == KDF_NONE) return;
+
+  cl_kernel loop  = (kdf->mode == KDF_ITER) ? dev->kernel_iter_loop : dev->kernel_pbkdf2_loop;
+  cl_mem   *state = (kdf->mode == KDF_ITER) ? &slot->buf_out : &slot->buf_tmps;
+
+  const cl_uint msg_cnt = (cl_uint) slot->num_msgs;
+
+  for (unsigned done = 1; done < kdf->iterations; )
+  {
+    const cl_uint loop_cnt = (kdf->iterations - done < kdf->loop_chunk)
+                           ? kdf->iterations - done : kdf->loop_chunk;
+
+    CHECK_CL (clSetKernelArg (loop, 0, sizeof (cl_mem),  state),     "clSetKernelArg(state)");
+    CHECK_CL (clSetKernelArg (loop, 1, sizeof (cl_uint), &loop_cnt), "clSetKernelArg(loop_cnt)");
+    CHECK_CL (clSetKernelArg (loop, 2, sizeof (cl_uint), &msg_cnt),  "clSetKernelArg(msg_cnt)");
+
+    CHECK_DEV (enqueue_kernel_1d (slot->queue, loop, slot->num_msgs, slot->local_size, slot_next_event (slot),
+                                  "clEnqueueNDRangeKernel(loop)"));
+
+    done += loop_cnt;
+  }
+
+  if (kdf->mode == KDF_PBKDF2)
+  {
+    cl_kernel comp = dev->kernel_pbkdf2_comp;
+
+    CHECK_CL (clSetKernelArg (comp, 0, sizeof (cl_mem),  &slot->buf_tmps), "clSetKernelArg(tmps)");
+    CHECK_CL (clSetKernelArg (comp, 1, sizeof (cl_uint), &msg_cnt),        "clSetKernelArg(msg_cnt)");
+
+    CHECK_DEV (set_output_args (comp, 2, sc ? &dev->search : NULL, slot));
+
+    CHECK_DEV (enqueue_kernel_1d (slot->queue, comp, slot->num_msgs, slot->local_size, slot_next_event (slot),
+                                  "clEnqueueNDRangeKernel(comp)"));
+  }
+}
+
+// --dedup：每个设备两个 kernel，每个 slot 一个唯一数计数（跟搜索模式的 d_return_buf 同一个字段）
+static void dedup_setup (device_ctx_t *dev, int mode, unsigned depth)
+{
+  cl_int err;
+
+  dev->dedup = mode;
+
+  if (mode == DEDUP_NONE) return;
+
+  dev->kernel_dedup_insert = clCreateKernel (dev->program, dev->algo->kernel_dedup_insert, &err);
+  CHECK_CL (err, "clCreateKernel(dedup insert)");
+
+  dev->kernel_dedup_emit = clCreateKernel (dev->program, dev->algo->kernel_dedup_emit, &err);
+  CHECK_CL (err, "clCreateKernel(dedup emit)");
+
+  for (unsigned si = 0; si < depth; si++)
+  {
+    dev->slots[si].buf_result = clCreateBuffer (dev->context, CL_MEM_READ_WRITE, sizeof (cl_uint), NULL, &err);
+    CHECK_CL (err, "clCreateBuffer(dedup count)");
+  }
+}
+
+// --dedup：本批的 digest 全部算完（buf_out 里按行号放好）之后排队：表填空、计数清零，
+// insert 把每行插进表，emit 只数 / 追加每个 digest 第一次出现的那行。
+// 表是 >= 2 倍行数的 2 的幂，线性探测的链很短
+static void enqueue_dedup (batch_slot_t *slot)
+{
+  device_ctx_t      *dev  = slot->dev;
+  const hash_algo_t *algo = dev->algo;
+
+  size_t table_size = 1;
+  while (table_size < 2u * (size_t) slot->num_msgs) table_size *= 2;
+
+  const size_t table_bytes = table_size * sizeof (uint32_t);
+
+  CHECK_DEV (device_reserve (dev->context, &slot->buf_table, &slot->table_cap, table_bytes, CL_MEM_READ_WRITE,
+                             dev->max_alloc, "buf_table"));
+
+  if (dev->dedup == DEDUP_FIRST)
+  {
+    CHECK_DEV (device_reserve (dev->context, &slot->buf_uniq, &slot->uniq_cap,
+                               (size_t) slot->num_msgs * (algo->digest_words + 1u) * sizeof (uint32_t),
+                               CL_MEM_WRITE_ONLY, dev->max_alloc, "buf_uniq"));
+  }
+
+  slot->table_mask = (uint32_t) (table_size - 1);
+
+  const cl_uint empty = 0xffffffffu;
+  const cl_uint zero  = 0;
+
+  CHECK_CL (clEnqueueFillBuffer (slot->queue, slot->buf_table, &empty, sizeof (empty), 0, table_bytes, 0, NULL, NULL),
+            "clEnqueueFillBuffer(dedup table)");
+  CHECK_CL (clEnqueueFillBuffer (slot->queue, slot->buf_result, &zero, sizeof (zero), 0, sizeof (cl_uint), 0, NULL, NULL),
+            "clEnqueueFillBuffer(dedup count)");
+
+  const cl_uint msg_cnt    = (cl_uint) slot->num_msgs;
+  const cl_uint table_mask = (cl_uint) slot->table_mask;
+
+  cl_kernel insert = dev->kernel_dedup_insert;
+  cl_kernel emit   = dev->kernel_dedup_emit;
+
+  CHECK_CL (clSetKernelArg (insert, 0, sizeof (cl_mem),  &slot->buf_out),   "clSetKernelArg(digests)");
+  CHECK_CL (clSetKernelArg (insert, 1, sizeof (cl_mem),  &slot->buf_table), "clSetKernelArg(table)");
+  CHECK_CL (clSetKernelArg (insert, 2, sizeof (cl_uint), &table_mask),      "clSetKernelArg(table_mask)");
+  CHECK_CL (clSetKernelArg (insert, 3, sizeof (cl_uint), &msg_cnt),         "clSetKernelArg(msg_cnt)");
+
+  CHECK_DEV (enqueue_kernel_1d (slot->queue, insert, slot->num_msgs, slot->local_size, slot_next_event (slot),
+                                "clEnqueueNDRangeKernel(dedup insert)"));
+
+  CHECK_CL (clSetKernelArg (emit, 0, sizeof (cl_mem),  &slot->buf_out),    "clSetKernelArg(digests)");
+  CHECK_CL (clSetKernelArg (emit, 1, sizeof (cl_mem),  &slot->buf_table),  "clSetKernelArg(table)");
+  CHECK_CL (clSetKernelArg (emit, 2, sizeof (cl_uint), &table_mask),       "clSetKernelArg(table_mask)");
+  CHECK_CL (clSetKernelArg (emit, 3, sizeof (cl_mem),  &slot->buf_result), "clSetKernelArg(uniq_cnt)");
+  CHECK_CL (clSetKernelArg (emit, 4, sizeof (cl_mem),  (dev->dedup == DEDUP_FIRST) ? &slot->buf_uniq : NULL),
+            "clSetKernelArg(records)");
+  CHECK_CL (clSetKernelArg (emit, 5, sizeof (cl_uint), &msg_cnt),          "clSetKernelArg(msg_cnt)");
+
+  CHECK_DEV (enqueue_kernel_1d (slot->queue, emit, slot->num_msgs, slot->local_size, slot_next_event (slot),
+                                "clEnqueueNDRangeKernel(dedup emit)"));
+}
+
+// 等一轮 stream kernel 做完，累计它的 kernel 时间并释放 event（NULL 表示这个 slot 还没用过）
+static void stream_wait_round (cl_event *ev, batch_slot_t *slot, stage_stats_t *st)
+{
+  if (!*ev) return;
+
+  CHECK_CL (clWaitForEvents (1, ev), "clWaitForEvents(stream)");
+
+  st->seconds[STAGE_KERNEL] += event_elapsed_ns (*ev) * 1e-9;
+
+  clReleaseEvent (*ev);
+  *ev = NULL;
+
+  // 这一轮的上传在同一个 in-order queue 上排在 kernel 前面，已经做完
+  for (unsigned e = 0; e < slot->num_xfer_events; e++)
+  {
+    st->seconds[STAGE_H2D] += event_elapsed_ns (slot->xfer_events[e]) * 1e-9;
+
+    clReleaseEvent (slot->xfer_events[e]);
+  }
+
+  slot->num_xfer_events = 0;
+}
+
+// 流式模式的上传：所有轮次都在 slot 0 的 queue 上，event 记在这一轮用的 slot 里
+static void stream_upload (cl_command_queue queue, batch_slot_t *slot, cl_mem buf, size_t bytes,
+                           const void *src, stage_stats_t *st, const char *what)
+{
+  cl_event *ev = event_list_next (&slot->xfer_events, &slot->num_xfer_events, &slot->xfer_cap);
+  if (!ev) exit (1);
+
+  CHECK_CL (clEnqueueWriteBuffer (queue, buf, CL_FALSE, 0, bytes, src, 0, NULL, ev), what);
+
+  st->h2d_bytes += bytes;
+}
+
+// --stream：输入文件每一行是一个要哈希的文件路径（比如 find DIR -type f 的输出），
+// 输出按清单顺序，每个文件内容一个 digest。每组 group_files 个文件同时打开，每一轮从每个
+// 还没读完的文件读 chunk_bytes（block 的整数倍）上传，launch 一次 *_stream_update；
+// 每个文件的状态（h + 64 位总长度）常驻设备，所以 host 内存跟文件大小无关。
+// 轮次轮流使用 depth 个 slot 的 buffer：host 读第 r 轮的同时设备在跑前面的轮次，
+// 所有轮次都在 slot 0 的 in-order queue 上，同一个文件的块按顺序更新状态。只用一个设备。
+static void run_stream (device_ctx_t *dev, line_reader_t *rd, out_writer_t *w,
+                        const stream_cfg_t *cfg, unsigned depth)
+{
+  cl_int err;
+
+  const hash_algo_t *algo    = dev->algo;
+  cl_context         context = dev->context;
+  batch_slot_t      *home    = &dev->slots[0];  // 状态和 digest 放在 slot 0
+  cl_command_queue   queue   = home->queue;
+
+  cl_kernel kernel = clCreateKernel (dev->program, algo->kernel_stream, &err);
+  CHECK_CL (err, "clCreateKernel(stream)");
+
+  const size_t local_size = device_kernel_local_size (dev, kernel);
+  if (local_size == 0) exit (1);
+
+  const uint32_t group        = cfg->group_files;
+  const size_t   chunk        = cfg->chunk_bytes;
+  const size_t   block        = algo->block_bytes;
+  const cl_uint  msg_stride   = (cl_uint) (chunk / 4);
+  const size_t   digest_bytes = (size_t) algo->digest_words * sizeof (uint32_t);
+
+  FILE **files = (FILE **) calloc (group, sizeof (FILE *));
+  if (!files)
+  {
+    fprintf (stderr, "malloc failed for stream files\n");
+    exit (1);
+  }
+
+  char   *path     = NULL;
+  size_t  path_cap = 0;
+
+  cl_event round_events[MAX_PIPELINE_DEPTH] = { NULL };
+
+  unsigned long long total_bytes  = 0;
+  unsigned long long total_rounds = 0;
+  stage_stats_t      st;
+
+  memset (&st, 0, sizeof (st));
+
+  for (unsigned group_index = 1; ; group_index++)
+  {
+    size_t   max_len = 0;
+    double   t_read  = now_seconds ();
+    uint32_t num     = line_reader_fill (rd, group, &max_len);
+
+    st.seconds[STAGE_READ] += now_seconds () - t_read;
+
+    if (num == 0 && rd->idle) continue;
+    if (num == 0) break;
+
+    t_read = now_seconds ();
+
+    if (max_len + 1 > path_cap)
+    {
+      path_cap = max_len + 1;
+      path     = (char *) realloc (path, path_cap);
+      if (!path)
+      {
+        fprintf (stderr, "malloc failed for stream path\n");
+        exit (1);
+      }
+    }
+
+    for (uint32_t i = 0; i < num; i++)
+    {
+      memcpy (path, rd->arena + rd->offs[i], rd->lens[i]);
+      path[rd->lens[i]] = '\0';
+
+      files[i] = fopen (path, "rb");
+      if (!files[i])
+      {
+        perror (path);
+        exit (1);
+      }
+    }
+
+    st.seconds[STAGE_READ] += now_seconds () - t_read;
+
+    CHECK_DEV (device_reserve (context, &home->buf_tmps, &home->tmps_cap, (size_t) num * algo->stream_state_bytes,
+                               CL_MEM_READ_WRITE, dev->max_alloc, "buf_states"));
+    CHECK_DEV (device_reserve (context, &home->buf_out, &home->out_cap, (size_t) num * digest_bytes,
+                               CL_MEM_WRITE_ONLY, dev->max_alloc, "buf_out"));
+
+    if (!pinned_reserve (context, queue, &home->stage_out, (size_t) num * digest_bytes, dev->max_alloc, "digests")) exit (1);
+
+    unsigned long long group_bytes = 0;
+    unsigned           rounds      = 0;
+
+    for (uint32_t active = num; active > 0; rounds++, total_rounds++)
+    {
+      const unsigned si   = (unsigned) (total_rounds % depth);
+      batch_slot_t  *slot = &dev->slots[si];
+
+      // 这个 slot 上一次的 kernel 做完了，它的 staging / 设备 buffer 才能复用
+      stream_wait_round (&round_events[si], slot, &st);
+
+      const size_t idx_bytes  = (size_t) active * sizeof (uint32_t);
+      const size_t msgs_bytes = (size_t) active * chunk;
+
+      unsigned char *msgs  = (unsigned char *) pinned_reserve (context, queue, &slot->stage_msgs, msgs_bytes, dev->max_alloc, "msgs");
+      uint32_t      *lens  = (uint32_t *) pinned_reserve (context, queue, &slot->stage_lens, idx_bytes, dev->max_alloc, "lens");
+      uint32_t      *flags = (uint32_t *) pinned_reserve (context, queue, &slot->stage_keys, idx_bytes, dev->max_alloc, "flags");
+      uint32_t      *idx   = (uint32_t *) pinned_reserve (context, queue, &slot->stage_idx,  idx_bytes, dev->max_alloc, "idx");
+
+      if (!msgs || !lens || !flags || !idx) exit (1);
+
+      uint32_t k = 0;
+
+      t_read = now_seconds ();
+
+      for (uint32_t i = 0; i < num; i++)
+      {
+        if (!files[i]) continue;
+
+        unsigned char *dst = msgs + (size_t) k * chunk;
+
+        const size_t n = fread (dst, 1, chunk, files[i]);
+
+        uint32_t f = (rounds == 0) ? STREAM_FIRST : 0;
+
+        if (n < chunk)
+        {
+          if (ferror (files[i]))
+          {
+            fprintf (stderr, "read error in stream file %u of group %u\n", i, group_index);
+            exit (1);
+          }
+
+          // 最后一个不完整的 block 零填充（kernel 按整块读）
+          const size_t padded = (n + block - 1) / block * block;
+
+          memset (dst + n, 0, padded - n);
+
+          fclose (files[i]);
+          files[i] = NULL;
+          active--;
+
+          f |= STREAM_LAST;
+        }
+
+        lens[k]  = (uint32_t) n;
+        flags[k] = f;
+        idx[k]   = i;
+        k++;
+
+        group_bytes += n;
+      }
+
+      st.seconds[STAGE_READ] += now_seconds () - t_read;
+
+      CHECK_DEV (device_reserve (context, &slot->buf_msgs, &slot->msgs_cap, msgs_bytes, CL_MEM_READ_ONLY, dev->max_alloc, "buf_msgs"));
+      CHECK_DEV (device_reserve (context, &slot->buf_lens, &slot->lens_cap, idx_bytes,  CL_MEM_READ_ONLY, dev->max_alloc, "buf_lens"));
+      CHECK_DEV (device_reserve (context, &slot->buf_keys, &slot->keys_cap, idx_bytes,  CL_MEM_READ_ONLY, dev->max_alloc, "buf_flags"));
+      CHECK_DEV (device_reserve (context, &slot->buf_idx,  &slot->idx_cap,  idx_bytes,  CL_MEM_READ_ONLY, dev->max_alloc, "buf_idx"));
+
+      stream_upload (queue, slot, slot->buf_msgs, (size_t) k * chunk, msgs,  &st, "clEnqueueWriteBuffer(buf_msgs)");
+      stream_upload (queue, slot, slot->buf_lens, (size_t) k * 4u,    lens,  &st, "clEnqueueWriteBuffer(buf_lens)");
+      stream_upload (queue, slot, slot->buf_keys, (size_t) k * 4u,    flags, &st, "clEnqueueWriteBuffer(buf_flags)");
+      stream_upload (queue, slot, slot->buf_idx,  (size_t) k * 4u,    idx,   &st, "clEnqueueWriteBuffer(buf_idx)");
+
+      int arg = 0;
+      CHECK_CL (clSetKernelArg (kernel, arg++, sizeof (cl_mem),  &slot->buf_msgs), "clSetKernelArg(msgs)");
+      CHECK_CL (clSetKernelArg (kernel, arg++, sizeof (cl_mem),  &slot->buf_lens), "clSetKernelArg(lens)");
+      CHECK_CL (clSetKernelArg (kernel, arg++, sizeof (cl_mem),  &slot->buf_keys), "clSetKernelArg(flags)");
+      CHECK_CL (clSetKernelArg (kernel, arg++, sizeof (cl_mem),  &slot->buf_idx),  "clSetKernelArg(idx)");
+      CHECK_CL (clSetKernelArg (kernel, arg++, sizeof (cl_uint), &msg_stride),     "clSetKernelArg(msg_stride)");
+      CHECK_CL (clSetKernelArg (kernel, arg++, sizeof (cl_uint), &k),              "clSetKernelArg(msg_cnt)");
+      CHECK_CL (clSetKernelArg (kernel, arg++, sizeof (cl_mem),  &home->buf_tmps), "clSetKernelArg(states)");
+      CHECK_CL (clSetKernelArg (kernel, arg++, sizeof (cl_mem),  &home->buf_out),  "clSetKernelArg(digests)");
+
+      CHECK_DEV (enqueue_kernel_1d (queue, kernel, k, local_size, &round_events[si], "clEnqueueNDRangeKernel(stream)"));
+      CHECK_CL (clFlush (queue), "clFlush");
+    }
+
+    // 本组最后一轮之后 digest 才齐，阻塞读回后按清单顺序写出
+    cl_event read_event;
+
+    CHECK_CL (clEnqueueReadBuffer (queue, home->buf_out, CL_TRUE, 0, (size_t) num * digest_bytes,
+                                   home->stage_out.ptr, 0, NULL, &read_event),
+              "clEnqueueReadBuffer(stream digests)");
+
+    st.seconds[STAGE_D2H] += event_elapsed_ns (read_event) * 1e-9;
+    st.d2h_bytes          += (size_t) num * digest_bytes;
+
+    clReleaseEvent (read_event);
+
+    out_writer_digests (w, (const uint32_t *) home->stage_out.ptr, num);
+
+    fprintf (stderr, "[OpenCL] Stream group %u: %u files, %llu bytes, %u rounds\n",
+             group_index, num, group_bytes, rounds);
+
+    total_bytes       += group_bytes;
+    dev->msgs_done    += num;
+    dev->hashes_done  += num;
+    dev->batches_done += 1;
+    st.in_bytes       += group_bytes;
+    st.msgs           += num;
+    st.hashes         += num;
+    w->metrics->batches++;
+  }
+
+  for (unsigned si = 0; si < depth; si++)
+  {
+    stream_wait_round (&round_events[si], &dev->slots[si], &st);
+  }
+
+  const double secs = st.seconds[STAGE_KERNEL];
+
+  dev->kernel_time_s += secs;
+
+  stage_stats_add (&w->metrics->total, &st);
+
+  fprintf (stderr, "[OpenCL] Stream: %llu files, %llu bytes, %llu launches, kernel throughput = %.2f MB/s\n",
+           dev->msgs_done, total_bytes, total_rounds, (secs > 0.0) ? (double) total_bytes / secs / 1e6 : 0.0);
+
+  free (path);
+  free (files);
+  clReleaseKernel (kernel);
+}
+
+// --merkle：保证 buf_leaves 至少有 need 字节。跟 device_reserve 不同，扩容要保留已经拷进来的叶子：
+// 先等所有 slot 的 queue 上还在飞的拷贝做完，再整体拷进新 buffer（按倍数扩，次数很少）
+static void merkle_reserve (device_ctx_t *dev, size_t need, unsigned depth)
+{
+  if (need <= dev->leaves_cap) return;
+
+  cl_int err;
+
+  size_t new_cap = (dev->leaves_cap) ? dev->leaves_cap * 2 : need;
+  if (new_cap < need) new_cap = need;
+  if (new_cap > dev->max_alloc) new_cap = need;
+
+  if (new_cap > dev->max_alloc)
+  {
+    fprintf (stderr, "--merkle: %zu bytes of leaves exceed the device's max allocation (%llu bytes)\n",
+             need, (unsigned long long) dev->max_alloc);
+    exit (1);
+  }
+
+  cl_mem mem = clCreateBuffer (dev->context, CL_MEM_READ_WRITE, new_cap, NULL, &err);
+  CHECK_CL (err, "clCreateBuffer(merkle leaves)");
+
+  if (dev->buf_leaves)
+  {
+    for (unsigned si = 0; si < depth; si++)
+    {
+      CHECK_CL (clFinish (dev->slots[si].queue), "clFinish(merkle grow)");
+    }
+
+    cl_command_queue queue = dev->slots[0].queue;
+
+    CHECK_CL (clEnqueueCopyBuffer (queue, dev->buf_leaves, mem, 0, 0, dev->leaves_cap, 0, NULL, NULL),
+              "clEnqueueCopyBuffer(merkle grow)");
+    CHECK_CL (clFinish (queue), "clFinish(merkle grow)");
+
+    clReleaseMemObject (dev->buf_leaves);
+  }
+
+  dev->buf_leaves = mem;
+  dev->leaves_cap = new_cap;
+}
+
+// --merkle：所有批次收尾后，在设备上逐层往上算到根（每层一次 launch，两个 buffer 轮流当输入 / 输出），
+// 只读回根；proof_index >= 0 时再读回这个叶子和它每一层的兄弟节点（审计路径）。
+// 输出：第一行根；有 proof 时接着 "leaf <i> <hex>"，再自下而上每层一行 "L <hex>" / "R <hex>"，
+// 表示兄弟在左边 / 右边（落单升层的那一层没有兄弟，不输出）。
+static void merkle_build (device_ctx_t *dev, FILE *fout, unsigned long long num_leaves, long long proof_index,
+                          unsigned depth)
+{
+  cl_int err;
+
+  const hash_algo_t *algo         = dev->algo;
+  const size_t       digest_bytes = (size_t) algo->digest_words * sizeof (uint32_t);
+  cl_command_queue   queue        = dev->slots[0].queue;
+
+  if (num_leaves == 0)
+  {
+    fprintf (stderr, "[OpenCL] Merkle: no leaves, nothing written\n");
+    return;
+  }
+
+  if (num_leaves > 0xffffffffULL)
+  {
+    fprintf (stderr, "--merkle: too many leaves (%llu)\n", num_leaves);
+    exit (1);
+  }
+
+  if (proof_index >= (long long) num_leaves)
+  {
+    fprintf (stderr, "--merkle-proof: leaf %lld out of range (%llu leaves)\n", proof_index, num_leaves);
+    exit (1);
+  }
+
+  for (unsigned si = 0; si < depth; si++)
+  {
+    CHECK_CL (clFinish (dev->slots[si].queue), "clFinish(merkle)");
+  }
+
+  cl_kernel kernel = clCreateKernel (dev->program, algo->kernel_merkle, &err);
+  CHECK_CL (err, "clCreateKernel(merkle)");
+
+  const size_t local_size = device_kernel_local_size (dev, kernel);
+  if (local_size == 0) exit (1);
+
+  // 第二个 buffer 只需要放第一层（叶子数的一半向上取整），之后各层都不会更大
+  cl_mem bufs[2];
+
+  bufs[0] = dev->buf_leaves;
+  bufs[1] = clCreateBuffer (dev->context, CL_MEM_READ_WRITE, (size_t) ((num_leaves + 1) / 2) * digest_bytes, NULL, &err);
+  CHECK_CL (err, "clCreateBuffer(merkle level)");
+
+  // 审计路径：每层最多一个兄弟，外加叶子本身（32 层对 u32 个叶子足够）
+  uint32_t path[34][16];
+  int      path_side[34];
+  unsigned path_len = 0;
+
+  uint32_t n     = (uint32_t) num_leaves;
+  uint32_t pos   = (proof_index >= 0) ? (uint32_t) proof_index : 0;
+  unsigned cur   = 0;
+  unsigned level = 0;
+
+  cl_event events[34];
+
+  // 读回的命令都排在覆盖这一层的 kernel 之前（in-order queue），不需要等
+  if (proof_index >= 0)
+  {
+    CHECK_CL (clEnqueueReadBuffer (queue, bufs[cur], CL_FALSE, (size_t) pos * digest_bytes, digest_bytes,
+                                   path[path_len++], 0, NULL, NULL),
+              "clEnqueueReadBuffer(merkle leaf)");
+  }
+
+  while (n > 1)
+  {
+    if (proof_index >= 0 && (pos ^ 1u) < n)
+    {
+      path_side[path_len] = (pos & 1u) ? 'L' : 'R';
+
+      CHECK_CL (clEnqueueReadBuffer (queue, bufs[cur], CL_FALSE, (size_t) (pos ^ 1u) * digest_bytes, digest_bytes,
+                                     path[path_len++], 0, NULL, NULL),
+                "clEnqueueReadBuffer(merkle sibling)");
+    }
+
+    const cl_uint n_in = n;
+
+    CHECK_CL (clSetKernelArg (kernel, 0, sizeof (cl_mem),  &bufs[cur]),     "clSetKernelArg(in)");
+    CHECK_CL (clSetKernelArg (kernel, 1, sizeof (cl_mem),  &bufs[cur ^ 1]), "clSetKernelArg(out)");
+    CHECK_CL (clSetKernelArg (kernel, 2, sizeof (cl_uint), &n_in),          "clSetKernelArg(n_in)");
+
+    CHECK_DEV (enqueue_kernel_1d (queue, kernel, (size_t) (n / 2 + (n & 1)), local_size, &events[level],
+                                  "clEnqueueNDRangeKernel(merkle)"));
+
+    n    = n / 2 + (n & 1);
+    pos  = pos / 2;
+    cur ^= 1;
+    level++;
+  }
+
+  uint32_t root[16];
+
+  CHECK_CL (clEnqueueReadBuffer (queue, bufs[cur], CL_TRUE, 0, digest_bytes, root, 0, NULL, NULL),
+            "clEnqueueReadBuffer(merkle root)");
+
+  double kernel_ns = 0.0;
+
+  for (unsigned l = 0; l < level; l++)
+  {
+    cl_ulong t0 = 0, t1 = 0;
+
+    CHECK_CL (clGetEventProfilingInfo (events[l], CL_PROFILING_COMMAND_START, sizeof (t0), &t0, NULL),
+              "clGetEventProfilingInfo(START)");
+    CHECK_CL (clGetEventProfilingInfo (events[l], CL_PROFILING_COMMAND_END, sizeof (t1), &t1, NULL),
+              "clGetEventProfilingInfo(END)");
+
+    kernel_ns += (double) (t1 - t0);
+
+    clReleaseEvent (events[l]);
+  }
+
+  write_digest_hex (fout, root, (unsigned) digest_bytes);
+
+  if (proof_index >= 0)
+  {
+    fprintf (fout, "leaf %lld ", proof_index);
+    write_digest_hex (fout, path[0], (unsigned) digest_bytes);
+
+    for (unsigned k = 1; k < path_len; k++)
+    {
+      fprintf (fout, "%c ", path_side[k]);
+      write_digest_hex (fout, path[k], (unsigned) digest_bytes);
+    }
+  }
+
+  fprintf (stderr, "[OpenCL] Merkle: %llu leaves, %u levels, tree kernel time = %.3f ms, root = ",
+           num_leaves, level, kernel_ns * 1e-6);
+  write_digest_hex (stderr, root, (unsigned) digest_bytes);
+
+  clReleaseMemObject (bufs[1]);
+  clReleaseKernel (kernel);
+}
+
+// 每批设备内存的预算（多设备时按最小的那个设备算，一批可能交给任何一个设备）
+typedef struct batch_budget
+{
+  size_t   slot_bytes;    // 一个 slot 的全部设备 buffer 加起来的上限
+  size_t   max_alloc;     // 单个 buffer 的上限（CL_DEVICE_MAX_MEM_ALLOC_SIZE）
+  size_t   fixed_bytes;   // 每行除消息本身以外的设备字节：lens、idx 或 offs、输出，以及 key 长度 / PBKDF2 tmps
+  size_t   fixed_max;     // 其中单个 buffer 每行最多占多少（决定 max_alloc 能放几行）
+  uint32_t lines_opt;     // --batch-lines（0 = 按内存算）
+
+} batch_budget_t;
+
+static void batch_budget_init (batch_budget_t *bb, const device_ctx_t *devs, unsigned num_devs, unsigned depth,
+                               const hmac_cfg_t *hmac, const kdf_cfg_t *kdf, int search, int dedup, uint32_t lines_opt)
+{
+  const size_t digest_bytes = (size_t) devs[0].algo->digest_words * sizeof (uint32_t);
+
+  bb->slot_bytes = SIZE_MAX;
+  bb->max_alloc  = SIZE_MAX;
+
+  for (unsigned d = 0; d < num_devs; d++)
+  {
+    const size_t slot_bytes = (size_t) (devs[d].global_mem / 100u * BATCH_MEM_PERCENT / depth);
+
+    if (slot_bytes         < bb->slot_bytes) bb->slot_bytes = slot_bytes;
+    if (devs[d].max_alloc < bb->max_alloc)  bb->max_alloc  = (size_t) devs[d].max_alloc;
+  }
+
+  // 两个 u32 索引（lens + idx / offs），外加 digest 输出（搜索模式不用）
+  bb->fixed_bytes = 2u * sizeof (uint32_t) + (search ? 0 : digest_bytes);
+  bb->fixed_max   = search ? sizeof (uint32_t) : digest_bytes;
+
+  if (hmac->mode == HMAC_PER_LINE || devs[0].kernel_salt_lines) bb->fixed_bytes += sizeof (uint32_t);
+
+  if (kdf->mode == KDF_PBKDF2)
+  {
+    bb->fixed_bytes += 4u * digest_bytes;
+    bb->fixed_max    = 4u * digest_bytes;
+  }
+
+  // --dedup：表每行最多 4 个 u32（>= 2 倍行数的 2 的幂），first 模式再加一条 (行号, digest) 记录
+  if (dedup != DEDUP_NONE)
+  {
+    const size_t rec_bytes = (dedup == DEDUP_FIRST) ? sizeof (uint32_t) + digest_bytes : 0;
+
+    bb->fixed_bytes += 4u * sizeof (uint32_t) + rec_bytes;
+
+    if (4u * sizeof (uint32_t) > bb->fixed_max) bb->fixed_max = 4u * sizeof (uint32_t);
+    if (rec_bytes              > bb->fixed_max) bb->fixed_max = rec_bytes;
+  }
+
+  bb->lines_opt = lines_opt;
+}
+
+// 按每行消息占的设备字节（上一批实测；第一批按一个 block 估）算下一批最多读多少行
+static uint32_t batch_lines_for (const batch_budget_t *bb, double line_bytes)
+{
+  if (bb->lines_opt > 0) return bb->lines_opt;
+
+  const double per_line = line_bytes + (double) bb->fixed_bytes;
+  const double widest   = (line_bytes > (double) bb->fixed_max) ? line_bytes : (double) bb->fixed_max;
+
+  double lines = (double) bb->slot_bytes / per_line;
+
+  if ((double) bb->max_alloc / widest < lines) lines = (double) bb->max_alloc / widest;
+
+  if (lines < 1.0) return 1;
+  if (lines > (double) MAX_BATCH_LINES) return MAX_BATCH_LINES;
+
+  return (uint32_t) lines;
+}
+
+// 返回处理的总行数；*hash_time_s 是所有批次 CPU 计算的累计时间
+static unsigned long long run_native (line_reader_t *rd, out_writer_t *w, const hash_algo_t *algo, int impl,
+                                      unsigned nthreads, uint32_t batch_lines, double *hash_time_s)
+{
+  uint32_t *digests     = NULL;  // grow-only
+  uint32_t  digests_cap = 0;
+
+  unsigned long long total_msgs = 0;
+
+  batch_out_t out;
+  memset (&out, 0, sizeof (out));
+
+  *hash_time_s = 0.0;
+
+  for (;;)
+  {
+    size_t   max_len  = 0;
+    double   t_read   = now_seconds ();
+    uint32_t num_msgs = line_reader_fill (rd, batch_lines, &max_len);
+
+    t_read = now_seconds () - t_read;
+
+    if (num_msgs == 0 && rd->idle) continue;
+    if (num_msgs == 0) break;
+
+    if (num_msgs > digests_cap)
+    {
+      free (digests);
+
+      digests     = (uint32_t *) malloc ((size_t) num_msgs * algo->digest_words * sizeof (uint32_t));
+      digests_cap = num_msgs;
+      if (!digests)
+      {
+        fprintf (stderr, "malloc failed for native digests (%u lines)\n", num_msgs);
+        exit (1);
+      }
+    }
+
+    native_job_t job;
+
+    job.impl    = impl;
+    job.algo    = algo->native_algo;
+    job.rd      = rd;
+    job.num     = num_msgs;
+    job.digests = digests;
+
+    // 行数太少时起线程比算还慢
+    const unsigned threads = (num_msgs < 4096u) ? 1 : nthreads;
+
+    const double t0 = now_seconds ();
+
+    parallel_run (threads, native_thread, &job);
+
+    const double t_hash = now_seconds () - t0;
+
+    *hash_time_s += t_hash;
+    total_msgs   += num_msgs;
+
+    const double hps  = (t_hash > 0.0) ? ((double) num_msgs / t_hash) : 0.0;
+    const double mhps = hps / 1e6;
+
+    out.batch_index++;
+
+    fprintf (stderr,
+             "[Native] Batch %u: %u messages, max_len=%zu, hash time = %.3f ms, speed = %.2f MH/s (%.3e H/s)\n",
+             out.batch_index, num_msgs, max_len, t_hash * 1e3, mhps, hps);
+
+    const double format_0 = w->format_s;
+    const double write_0  = w->write_s;
+
+    out_writer_digests (w, digests, num_msgs);
+
+    memset (&out.stats, 0, sizeof (out.stats));
+
+    out.num_msgs  = num_msgs;
+    out.line_base = rd->total_lines - num_msgs;
+
+    out.stats.seconds[STAGE_READ]   = t_read;
+    out.stats.seconds[STAGE_KERNEL] = t_hash;
+    out.stats.seconds[STAGE_FORMAT] = w->format_s - format_0;
+    out.stats.seconds[STAGE_WRITE]  = w->write_s  - write_0;
+    out.stats.in_bytes              = (unsigned long long) rd->offs[num_msgs - 1] + rd->lens[num_msgs - 1];
+    out.stats.msgs                  = num_msgs;
+    out.stats.hashes                = num_msgs;
+
+    metrics_batch (w->metrics, &out);
+  }
+
+  free (digests);
+
+  return total_msgs;
+}
+
+// --backend cuda / hip：plain 哈希走 packed kernel（arena 原样上传，不用分桶打包）。
+// 每个 slot 一条 stream、一组 pinned staging（cuMemHostAlloc / hipHostMalloc，驱动直接 DMA）
+// 和 grow-only 的设备 buffer；上传、kernel、读回都是异步排进 slot 的 stream，
+// 前后各记一个 event，读下一批 / 写上一批的同时 GPU 在跑这一批（跟 OpenCL 路径的 slot 一样）
+#define GPU_EV_START 0
+#define GPU_EV_H2D   1
+#define GPU_EV_KERN  2
+#define GPU_EV_D2H   3
+#define GPU_NUM_EV   4
+
+// 默认每批的行数上限（--batch-lines 可改）：pinned 内存是锁页的 host 内存，不按显存放到最大
+#define GPU_BATCH_LINES   (1u << 22)
+#define GPU_DEFAULT_BLOCK 256
+
+typedef struct gpu_slot
+{
+  gpu_stream_t    stream;
+  gpu_event_t     ev[GPU_NUM_EV];
+
+  unsigned char  *h_msgs;         // pinned staging（grow-only）
+  size_t          h_msgs_cap;
+  uint32_t       *h_offs;
+  uint32_t       *h_lens;
+  size_t          h_idx_cap;      // h_offs / h_lens 各自的字节数
+  uint32_t       *h_digests;
+  size_t          h_digests_cap;
+
+  gpu_deviceptr_t d_msgs;         // 设备 buffer（grow-only）
+  size_t          d_msgs_cap;
+  gpu_deviceptr_t d_offs;
+  gpu_deviceptr_t d_lens;
+  size_t          d_idx_cap;
+  gpu_deviceptr_t d_digests;
+  size_t          d_digests_cap;
+
+  int             busy;
+  unsigned        batch_index;
+  uint32_t        num_msgs;
+  unsigned long long line_base;
+  stage_stats_t   stats;
+
+} gpu_slot_t;
+
+typedef struct gpu_ctx
+{
+  gpu_api_t          api;
+  gpu_device_t       device;
+  gpu_context_t      context;
+  gpu_module_t       module;
+  gpu_function_t     kernel;
+  const hash_algo_t *algo;
+  int                encoding;       // ENCODING_*：UTF-16LE 时 kernel 加 -DUTF16LE_MODE 编译
+
+  char               name[256];
+  size_t             total_mem;
+  unsigned           block_size;
+  unsigned           depth;
+  gpu_slot_t         slots[MAX_PIPELINE_DEPTH];
+
+  double             kernel_time_s;
+  unsigned long long msgs_done;
+
+} gpu_ctx_t;
+
+// pinned host 内存，至少 need 字节（grow-only，多留 1/8）
+static void gpu_host_reserve (gpu_ctx_t *g, void **ptr, size_t *cap, size_t need, const char *what)
+{
+  if (need <= *cap) return;
+
+  if (*ptr) CHECK_GPU (&g->api, g->api.host_free (*ptr), "host_free");
+
+  const size_t new_cap = need + need / 8;
+
+  const gpu_result_t err = g->api.host_alloc (ptr, new_cap, 0);
+  if (err != GPU_SUCCESS)
+  {
+    fprintf (stderr, "[%s] pinned alloc (%s, %zu bytes) failed with error %d (%s)\n",
+             g->api.label, what, new_cap, err, gpu_error_string (&g->api, err));
+    exit (1);
+  }
+
+  *cap = new_cap;
+}
+
+// 设备 buffer，至少 need 字节（grow-only，多留 1/8）
+static void gpu_device_reserve (gpu_ctx_t *g, gpu_deviceptr_t *ptr, size_t *cap, size_t need, const char *what)
+{
+  if (need <= *cap) return;
+
+  if (*ptr) CHECK_GPU (&g->api, g->api.mem_free (*ptr), "mem_free");
+
+  const size_t new_cap = need + need / 8;
+
+  const gpu_result_t err = g->api.mem_alloc (ptr, new_cap);
+  if (err != GPU_SUCCESS)
+  {
+    fprintf (stderr, "[%s] device alloc (%s, %zu bytes) failed with error %d (%s)\n",
+             g->api.label, what, new_cap, err, gpu_error_string (&g->api, err));
+    exit (1);
+  }
+
+  *cap = new_cap;
+}
+
+// 编译 kernel 源文件成 PTX / code object，缓存规则跟 build_program 一样：
+// key = 后端 / 设备 / 驱动版本 + 源码树 hash + 编译选项，文件名 = 源文件名去掉 .cl + key + 扩展名
+static void gpu_build_module (gpu_ctx_t *g, const char *src_path, const char *cache_dir)
+{
+  const char *opts[12];
+  int         num_opts = 0;
+  char        arch_opt[64];
+
+  opts[num_opts++] = "-I.";
+
+  if (g->api.kind == GPU_API_CUDA)
+  {
+    int major = 0, minor = 0;
+
+    CHECK_GPU (&g->api, g->api.device_attribute (&major, GPU_CU_ATTR_CC_MAJOR, g->device), "device_attribute(cc major)");
+    CHECK_GPU (&g->api, g->api.device_attribute (&minor, GPU_CU_ATTR_CC_MINOR, g->device), "device_attribute(cc minor)");
+
+    // 只给虚拟架构：PTX 由驱动按实际的卡 JIT，跟 hashcat 一样，新卡不用等 NVRTC 更新
+    snprintf (arch_opt, sizeof (arch_opt), "--gpu-architecture=compute_%d%d", major, minor);
+
+    opts[num_opts++] = arch_opt;
+    opts[num_opts++] = "--restrict";
+    opts[num_opts++] = "--device-as-default-execution-space";
+
+    // IS_NV + 这几条 PTX 指令（sm_20 起都有）：byte_swap / bfe 走 prmt / bfe.u32，不走 OpenCL 的 rotate
+    opts[num_opts++] = "-DVENDOR_ID=32";
+    opts[num_opts++] = "-DHAS_PRMT=1";
+    opts[num_opts++] = "-DHAS_BFE=1";
+    opts[num_opts++] = "-DHAS_MOV64=1";
+  }
+  else
+  {
+    // hiprtc 不给 --offload-arch 时按当前设备的 gfx 架构编；V_PERM_B32 从 GCN3 起都有
+    opts[num_opts++] = "-DHAS_VPERM=1";
+  }
+
+  if (g->encoding == ENCODING_UTF16LE) opts[num_opts++] = "-DUTF16LE_MODE";
+
+  char cache_file[4096];
+  cache_file[0] = '\0';
+
+  if (cache_dir)
+  {
+    int driver_version = 0;
+    g->api.driver_version (&driver_version);
+
+    uint64_t h = FNV64_OFFSET;
+
+    h = fnv1a64_str (h, g->api.label);
+    h = fnv1a64_str (h, g->name);
+    h = fnv1a64 (h, &driver_version, sizeof (driver_version));
+
+    for (int i = 0; i < num_opts; i++) h = fnv1a64_str (h, opts[i]);
+
+    source_hash_t sh;
+    sh.num_seen = 0;
+    sh.h        = FNV64_OFFSET;
+
+    if (hash_source_tree (&sh, src_path) != 0) exit (1);
+
+    h = fnv1a64 (h, &sh.h, sizeof (sh.h));
+
+    const char *base = strrchr (src_path, '/');
+    base = base ? base + 1 : src_path;
+
+    const int base_len = (int) strcspn (base, ".");
+
+    snprintf (cache_file, sizeof (cache_file), "%s/%.*s.%016llx.%s",
+              cache_dir, base_len, base, (unsigned long long) h, g->api.code_ext);
+
+    FILE *f = fopen (cache_file, "rb");
+
+    if (f)
+    {
+      struct stat st;
+
+      char *code = NULL;
+
+      if (fstat (fileno (f), &st) == 0 && st.st_size > 0)
+      {
+        // PTX 是文本，cuModuleLoadData 要求以 '\0' 结尾
+        code = (char *) calloc ((size_t) st.st_size + 1, 1);
+
+        if (code && fread (code, 1, (size_t) st.st_size, f) != (size_t) st.st_size)
+        {
+          free (code);
+          code = NULL;
+        }
+      }
+
+      fclose (f);
+
+      if (code && g->api.module_load_data (&g->module, code) == GPU_SUCCESS)
+      {
+        fprintf (stderr, "[%s] Program cache: loaded %s\n", g->api.label, cache_file);
+        free (code);
+        return;
+      }
+
+      free (code);
+    }
+  }
+
+  size_t src_size = 0;
+  char *src = read_text_file (src_path, &src_size);
+  if (!src) exit (1);
+
+  char  *code      = NULL;
+  size_t code_size = 0;
+
+  if (gpu_compile (&g->api, src, src_path, opts, num_opts, &code, &code_size) != 0) exit (1);
+
+  free (src);
+
+  CHECK_GPU (&g->api, g->api.module_load_data (&g->module, code), "module_load_data");
+
+  if (cache_dir)
+  {
+    mkdir (cache_dir, 0755);
+
+    char tmp_file[4096 + 32];
+    snprintf (tmp_file, sizeof (tmp_file), "%s.%ld.tmp", cache_file, (long) getpid ());
+
+    FILE *f = fopen (tmp_file, "wb");
+
+    if (f)
+    {
+      const int ok = (fwrite (code, 1, code_size, f) == code_size);
+
+      if (fclose (f) == 0 && ok && rename (tmp_file, cache_file) == 0)
+      {
+        fprintf (stderr, "[%s] Program cache: saved %s\n", g->api.label, cache_file);
+      }
+      else
+      {
+        unlink (tmp_file);
+      }
+    }
+  }
+
+  free (code);
+}
+
+// 加载后端、建 context / module / 每个 slot 的 stream 和 event
+static void gpu_setup (gpu_ctx_t *g, int kind, int ordinal, const hash_algo_t *algo, int encoding, unsigned depth,
+                       size_t local_size_opt, const char *cache_dir)
+{
+  memset (g, 0, sizeof (*g));
+
+  if (gpu_api_load (&g->api, kind) != 0) exit (1);
+
+  int count = 0;
+  CHECK_GPU (&g->api, g->api.device_count (&count), "device_count");
+
+  if (ordinal >= count)
+  {
+    fprintf (stderr, "[%s] Device %d not found (%d devices)\n", g->api.label, ordinal, count);
+    exit (1);
+  }
+
+  g->algo     = algo;
+  g->encoding = encoding;
+  g->depth    = depth;
+
+  CHECK_GPU (&g->api, g->api.device_get (&g->device, ordinal), "device_get");
+  CHECK_GPU (&g->api, g->api.device_name (g->name, (int) sizeof (g->name) - 1, g->device), "device_name");
+  CHECK_GPU (&g->api, g->api.device_total_mem (&g->total_mem, g->device), "device_total_mem");
+  CHECK_GPU (&g->api, g->api.ctx_create (&g->context, 0, g->device), "ctx_create");
+
+  g->block_size = local_size_opt ? (unsigned) local_size_opt : GPU_DEFAULT_BLOCK;
+
+  if (kind == GPU_API_CUDA)
+  {
+    int max_block = 0;
+
+    if (g->api.device_attribute (&max_block, GPU_CU_ATTR_MAX_THREADS_PER_BLOCK, g->device) == GPU_SUCCESS
+        && max_block > 0 && g->block_size > (unsigned) max_block)
+    {
+      g->block_size = (unsigned) max_block;
+    }
+  }
+
+  int driver_version = 0;
+  g->api.driver_version (&driver_version);
+
+  fprintf (stderr, "[%s] Device %d: %s, %zu MB, driver %d\n", g->api.label, ordinal, g->name,
+           g->total_mem >> 20, driver_version);
+
+  gpu_build_module (g, algo->kernel_file, cache_dir);
+
+  CHECK_GPU (&g->api, g->api.module_function (&g->kernel, g->module, algo->kernel_packed), "module_function");
+
+  for (unsigned si = 0; si < depth; si++)
+  {
+    gpu_slot_t *slot = &g->slots[si];
+
+    CHECK_GPU (&g->api, g->api.stream_create (&slot->stream, GPU_STREAM_NON_BLOCKING), "stream_create");
+
+    for (unsigned e = 0; e < GPU_NUM_EV; e++)
+    {
+      CHECK_GPU (&g->api, g->api.event_create (&slot->ev[e], 0), "event_create");
+    }
+  }
+
+  fprintf (stderr, "[%s] Kernel: %s, block size %u, %u streams\n", g->api.label, algo->kernel_packed,
+           g->block_size, depth);
+}
+
+static double gpu_elapsed_s (gpu_ctx_t *g, gpu_event_t start, gpu_event_t end)
+{
+  float ms = 0.0f;
+
+  CHECK_GPU (&g->api, g->api.event_elapsed (&ms, start, end), "event_elapsed");
+
+  return (double) ms * 1e-3;
+}
+
+// 等一个 slot 的读回完成，按 event 拆出 h2d / kernel / d2h，写出 digest
+static void gpu_collect (gpu_ctx_t *g, gpu_slot_t *slot, out_writer_t *w)
+{
+  CHECK_GPU (&g->api, g->api.event_sync (slot->ev[GPU_EV_D2H]), "event_sync");
+
+  slot->stats.seconds[STAGE_H2D]    = gpu_elapsed_s (g, slot->ev[GPU_EV_START], slot->ev[GPU_EV_H2D]);
+  slot->stats.seconds[STAGE_KERNEL] = gpu_elapsed_s (g, slot->ev[GPU_EV_H2D],   slot->ev[GPU_EV_KERN]);
+  slot->stats.seconds[STAGE_D2H]    = gpu_elapsed_s (g, slot->ev[GPU_EV_KERN],  slot->ev[GPU_EV_D2H]);
+
+  const double kernel_time_s = slot->stats.seconds[STAGE_KERNEL];
+
+  g->kernel_time_s += kernel_time_s;
+  g->msgs_done     += slot->num_msgs;
+
+  double hps  = (kernel_time_s > 0.0) ? ((double) slot->num_msgs / kernel_time_s) : 0.0;
+  double mhps = hps / 1e6;
+
+  fprintf (stderr, "[%s] Batch %u: %u messages, kernel time = %.3f ms, speed = %.2f MH/s (%.3e H/s)\n",
+           g->api.label, slot->batch_index, slot->num_msgs, kernel_time_s * 1e3, mhps, hps);
+
+  const double format_0 = w->format_s;
+  const double write_0  = w->write_s;
+
+  out_writer_digests (w, slot->h_digests, slot->num_msgs);
+
+  batch_out_t out;
+  memset (&out, 0, sizeof (out));
+
+  out.batch_index = slot->batch_index;
+  out.num_msgs    = slot->num_msgs;
+  out.line_base   = slot->line_base;
+  out.stats       = slot->stats;
+
+  out.stats.seconds[STAGE_FORMAT] = w->format_s - format_0;
+  out.stats.seconds[STAGE_WRITE]  = w->write_s  - write_0;
+
+  metrics_batch (w->metrics, &out);
+
+  slot->busy = 0;
+}
+
+// 批处理循环：slot 轮流用，轮到的 slot 还在忙就先收它（它总是最早提交的那一批，顺序天然不乱）。
+// 返回处理的总行数
+static unsigned long long run_gpu (gpu_ctx_t *g, line_reader_t *rd, out_writer_t *w, uint32_t batch_lines)
+{
+  const hash_algo_t *algo         = g->algo;
+  const size_t       digest_bytes = (size_t) algo->digest_words * 4u;
+
+  unsigned batch_index = 0;
+
+  for (;;)
+  {
+    size_t   max_len  = 0;
+    double   t_read   = now_seconds ();
+    uint32_t num_msgs = line_reader_fill (rd, batch_lines, &max_len);
+
+    t_read = now_seconds () - t_read;
+
+    // --flush-ms：暂时没有新行，先按提交顺序把在飞的批次收尾写出去
+    if (num_msgs == 0 && rd->idle)
+    {
+      for (unsigned k = 0; k < g->depth; k++)
+      {
+        gpu_slot_t *slot = &g->slots[(batch_index + k) % g->depth];
+
+        if (slot->busy) gpu_collect (g, slot, w);
+      }
+
+      continue;
+    }
+
+    if (num_msgs == 0) break;
+
+    batch_index++;
+
+    gpu_slot_t *slot = &g->slots[(batch_index - 1) % g->depth];
+
+    if (slot->busy) gpu_collect (g, slot, w);
+
+    const double t_pack = now_seconds ();
+
+    const size_t data_bytes = (size_t) rd->offs[num_msgs - 1] + rd->lens[num_msgs - 1];
+    const size_t msgs_bytes = data_bytes + PACKED_TAIL_PAD;
+    const size_t idx_bytes  = (size_t) num_msgs * sizeof (uint32_t);
+    const size_t out_bytes  = (size_t) num_msgs * digest_bytes;
+
+    gpu_host_reserve (g, (void **) &slot->h_msgs,    &slot->h_msgs_cap,    msgs_bytes, "msgs");
+    gpu_host_reserve (g, (void **) &slot->h_digests, &slot->h_digests_cap, out_bytes,  "digests");
+
+    if (idx_bytes > slot->h_idx_cap)
+    {
+      size_t cap = slot->h_idx_cap;
+
+      gpu_host_reserve (g, (void **) &slot->h_offs, &cap,             idx_bytes, "offs");
+      gpu_host_reserve (g, (void **) &slot->h_lens, &slot->h_idx_cap, idx_bytes, "lens");
+    }
+
+    gpu_device_reserve (g, &slot->d_msgs,    &slot->d_msgs_cap,    msgs_bytes, "msgs");
+    gpu_device_reserve (g, &slot->d_digests, &slot->d_digests_cap, out_bytes,  "digests");
+
+    if (idx_bytes > slot->d_idx_cap)
+    {
+      size_t cap = slot->d_idx_cap;
+
+      gpu_device_reserve (g, &slot->d_offs, &cap,             idx_bytes, "offs");
+      gpu_device_reserve (g, &slot->d_lens, &slot->d_idx_cap, idx_bytes, "lens");
+    }
+
+    // reader 的 arena 下一批就会被覆盖，先拷进 pinned staging；kernel 按整块读，尾部清零
+    memcpy (slot->h_msgs, rd->arena, data_bytes);
+    memset (slot->h_msgs + data_bytes, 0, PACKED_TAIL_PAD);
+    memcpy (slot->h_offs, rd->offs, idx_bytes);
+    memcpy (slot->h_lens, rd->lens, idx_bytes);
+
+    memset (&slot->stats, 0, sizeof (slot->stats));
+
+    slot->busy        = 1;
+    slot->batch_index = batch_index;
+    slot->num_msgs    = num_msgs;
+    slot->line_base   = rd->total_lines - num_msgs;
+
+    slot->stats.seconds[STAGE_READ] = t_read;
+    slot->stats.in_bytes            = data_bytes;
+    slot->stats.h2d_bytes           = msgs_bytes + 2 * idx_bytes;
+    slot->stats.d2h_bytes           = out_bytes;
+    slot->stats.msgs                = num_msgs;
+    slot->stats.hashes              = num_msgs;
+
+    gpu_api_t *api = &g->api;
+
+    CHECK_GPU (api, api->event_record (slot->ev[GPU_EV_START], slot->stream), "event_record");
+    CHECK_GPU (api, api->memcpy_htod (slot->d_msgs, slot->h_msgs, msgs_bytes, slot->stream), "memcpy_htod(msgs)");
+    CHECK_GPU (api, api->memcpy_htod (slot->d_offs, slot->h_offs, idx_bytes,  slot->stream), "memcpy_htod(offs)");
+    CHECK_GPU (api, api->memcpy_htod (slot->d_lens, slot->h_lens, idx_bytes,  slot->stream), "memcpy_htod(lens)");
+    CHECK_GPU (api, api->event_record (slot->ev[GPU_EV_H2D], slot->stream), "event_record");
+
+    // 参数跟 *_wrapper_packed 一致：msgs, msg_offs, msg_lens, msg_cnt, digests
+    void *params[] = { &slot->d_msgs, &slot->d_offs, &slot->d_lens, &slot->num_msgs, &slot->d_digests };
+
+    const unsigned grid = (num_msgs + g->block_size - 1) / g->block_size;
+
+    CHECK_GPU (api, api->launch (g->kernel, grid, 1, 1, g->block_size, 1, 1, 0, slot->stream, params, NULL),
+               "launch");
+    CHECK_GPU (api, api->event_record (slot->ev[GPU_EV_KERN], slot->stream), "event_record");
+    CHECK_GPU (api, api->memcpy_dtoh (slot->h_digests, slot->d_digests, out_bytes, slot->stream), "memcpy_dtoh");
+    CHECK_GPU (api, api->event_record (slot->ev[GPU_EV_D2H], slot->stream), "event_record");
+
+    slot->stats.seconds[STAGE_PACK] = now_seconds () - t_pack;
+  }
+
+  // 按提交顺序收掉还在飞的批次
+  for (unsigned k = 0; k < g->depth; k++)
+  {
+    gpu_slot_t *slot = &g->slots[(batch_index + k) % g->depth];
+
+    if (slot->busy) gpu_collect (g, slot, w);
+  }
+
+  return g->msgs_done;
+}
+
+static void gpu_release (gpu_ctx_t *g)
+{
+  gpu_api_t *api = &g->api;
+
+  for (unsigned si = 0; si < g->depth; si++)
+  {
+    gpu_slot_t *slot = &g->slots[si];
+
+    if (slot->h_msgs)    api->host_free (slot->h_msgs);
+    if (slot->h_offs)    api->host_free (slot->h_offs);
+    if (slot->h_lens)    api->host_free (slot->h_lens);
+    if (slot->h_digests) api->host_free (slot->h_digests);
+    if (slot->d_msgs)    api->mem_free (slot->d_msgs);
+    if (slot->d_offs)    api->mem_free (slot->d_offs);
+    if (slot->d_lens)    api->mem_free (slot->d_lens);
+    if (slot->d_digests) api->mem_free (slot->d_digests);
+
+    for (unsigned e = 0; e < GPU_NUM_EV; e++) api->event_destroy (slot->ev[e]);
+
+    api->stream_destroy (slot->stream);
+  }
+
+  api->module_unload (g->module);
+  api->ctx_destroy (g->context);
+
+  gpu_api_unload (api);
+}
+
+// --serve PATH：常驻进程，引擎（context / program / 设备 buffer）一直热着，在 Unix socket 上收请求。
+// 协议（小端）：请求 = u32 消息数 n + u32 数据总字节 + n 个 u32 长度 + 首尾相接的消息；
+// 响应 = u32 状态（SERVE_*）+ 成功时 n 条大端 digest。一个连接上可以连着发多个请求，按顺序回。
+// 各个连接的请求进同一个队列，合批线程攒够 --serve-batch 条消息、或者最早的请求等满
+// --serve-latency 毫秒就拼成一批提交（不等它做完，接着攒下一批），收尾线程按提交顺序 wait，
+// 再把 digest 分回各个请求。只有普通哈希：HMAC / salt / KDF / --encoding / --search / --dedup 这类
+// 选项在命令行解析时就被拒绝。
+#define SERVE_OK         0
+#define SERVE_E_REQUEST  1  // 请求格式不对 / 超过上限（之后连接被关闭）
+#define SERVE_E_ENGINE   2  // 引擎拒绝了这一批，或者这一批在设备上出错（原因打在 stderr）
+#define SERVE_E_SHUTDOWN 3
+
+#define SERVE_DEFAULT_BATCH      65536
+#define SERVE_DEFAULT_LATENCY_MS 2
+#define SERVE_MAX_REQ_MSGS       (1u << 24)
+#define SERVE_MAX_BATCH_BYTES    ((size_t) 256u << 20)  // 一批原始数据的上限，也是单个请求的上限
+#define SERVE_BACKLOG            64
+#define SERVE_POLL_MS            200                    // accept 循环检查退出信号的间隔
+
+typedef struct serve_req
+{
+  uint32_t          num;
+  uint32_t          data_bytes;
+  uint32_t         *lens;
+  unsigned char    *data;
+  unsigned char    *digests;      // num * digest_bytes
+  int               status;
+  int               done;
+  double            t_arrive;
+  struct serve_req *next;
+
+} serve_req_t;
+
+// 已经提交、等收尾的一批
+typedef struct serve_flight
+{
+  sha256_engine_job_t *job;
+  serve_req_t         *reqs;      // 本批的请求（按拼接顺序，NULL 结尾）
+  unsigned             num_reqs;
+  uint32_t             num_msgs;
+  uint32_t            *digests;
+  double               t_first;   // 本批最早的请求到达的时间
+  struct serve_flight *next;
+
+} serve_flight_t;
+
+typedef struct serve_ctx
+{
+  sha256_engine_t *eng;
+  unsigned         digest_bytes;
+  uint32_t         batch_msgs;
+  double           latency_s;
+
+  pthread_mutex_t  lock;
+  pthread_cond_t   queue_cond;    // 有新请求 / 要停（CLOCK_MONOTONIC，攒批时按截止时间等）
+  pthread_cond_t   flight_cond;   // 有新的在飞批次 / 合批线程退出了
+  pthread_cond_t   done_cond;     // 有请求做完
+  serve_req_t     *head;
+  serve_req_t     *tail;
+  uint32_t         queued_msgs;
+  size_t           queued_bytes;
+  serve_flight_t  *fhead;
+  serve_flight_t  *ftail;
+  int              stop;          // 不再收新请求，合批线程把队列交完就退出
+  int              batcher_done;
+
+  unsigned long long batches;
+  unsigned long long msgs;
+  unsigned long long reqs;
+
+} serve_ctx_t;
+
+// 0 = 对端关了（一个字节都没读到），1 = 读满，-1 = 出错 / 读到一半断开
+static int serve_read_full (int fd, void *buf, size_t len)
+{
+  unsigned char *p = (unsigned char *) buf;
+
+  for (size_t got = 0; got < len; )
+  {
+    const ssize_t n = read (fd, p + got, len - got);
+
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return (got == 0 && n == 0) ? 0 : -1;
+
+    got += (size_t) n;
+  }
+
+  return 1;
+}
+
+static int serve_write_full (int fd, const void *buf, size_t len)
+{
+  const unsigned char *p = (const unsigned char *) buf;
+
+  for (size_t put = 0; put < len; )
+  {
+    const ssize_t n = send (fd, p + put, len - put, MSG_NOSIGNAL);
+
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+
+    put += (size_t) n;
+  }
+
+  return 0;
+}
+
+static void serve_req_free (serve_req_t *req)
+{
+  free (req->lens);
+  free (req->data);
+  free (req->digests);
+  free (req);
+}
+
+// 拿着锁调用：一批的请求全部标记完成
+static void serve_finish_reqs (serve_ctx_t *ctx, serve_req_t *reqs, int status)
+{
+  for (serve_req_t *req = reqs; req; req = req->next)
+  {
+    req->status = status;
+    req->done   = 1;
+  }
+
+  pthread_cond_broadcast (&ctx->done_cond);
+}
+
+static void *serve_batcher (void *p)
+{
+  serve_ctx_t *ctx = (serve_ctx_t *) p;
+
+  // 拼接用的 host 数组（grow-only）：submit 返回前引擎已经拷进自己的 staging，下一批可以直接覆盖
+  unsigned char *data     = NULL;
+  size_t         data_cap = 0;
+  uint32_t      *offs     = NULL;
+  uint32_t      *lens     = NULL;
+  uint32_t       idx_cap  = 0;
+
+  pthread_mutex_lock (&ctx->lock);
+
+  for (;;)
+  {
+    while (!ctx->head && !ctx->stop) pthread_cond_wait (&ctx->queue_cond, &ctx->lock);
+
+    if (!ctx->head) break;
+
+    // 攒批：够数了、或者最早的请求等到了截止时间就交
+    const double deadline = ctx->head->t_arrive + ctx->latency_s;
+
+    while (!ctx->stop && ctx->queued_msgs < ctx->batch_msgs && ctx->queued_bytes < SERVE_MAX_BATCH_BYTES)
+    {
+      if (now_seconds () >= deadline) break;
+
+      struct timespec ts;
+
+      ts.tv_sec  = (time_t) deadline;
+      ts.tv_nsec = (long) ((deadline - (double) ts.tv_sec) * 1e9);
+
+      pthread_cond_timedwait (&ctx->queue_cond, &ctx->lock, &ts);
+    }
+
+    // 从队头取，至少一个请求（单个大请求自己成一批）
+    serve_req_t *first    = ctx->head;
+    serve_req_t *last     = NULL;
+    unsigned     num_reqs = 0;
+    uint32_t     num_msgs = 0;
+    size_t       bytes    = 0;
+
+    for (serve_req_t *req = ctx->head; req; req = req->next)
+    {
+      if (num_reqs > 0 && ((size_t) num_msgs + req->num > ctx->batch_msgs
+                           || bytes + req->data_bytes > SERVE_MAX_BATCH_BYTES)) break;
+
+      num_msgs += req->num;
+      bytes    += req->data_bytes;
+      last      = req;
+      num_reqs++;
+    }
+
+    // 本批的请求从队列上摘下来，链表在 last 处断开（之后客户端线程只会往新的队尾追加）
+    ctx->head          = last->next;
+    last->next         = NULL;
+    ctx->queued_msgs  -= num_msgs;
+    ctx->queued_bytes -= bytes;
+
+    if (!ctx->head) ctx->tail = NULL;
+
+    pthread_mutex_unlock (&ctx->lock);
+
+    serve_flight_t *f = (serve_flight_t *) calloc (1, sizeof (serve_flight_t));
+
+    if (bytes > data_cap)
+    {
+      free (data);
+      data_cap = bytes + bytes / 8;
+      data     = (unsigned char *) malloc (data_cap);
+    }
+
+    if (num_msgs > idx_cap)
+    {
+      free (offs);
+      free (lens);
+      idx_cap = num_msgs + num_msgs / 8;
+      offs    = (uint32_t *) malloc ((size_t) idx_cap * sizeof (uint32_t));
+      lens    = (uint32_t *) malloc ((size_t) idx_cap * sizeof (uint32_t));
+    }
+
+    if (!f || (bytes > 0 && !data) || !offs || !lens)
+    {
+      fprintf (stderr, "malloc failed for serve batch\n");
+      exit (1);
+    }
+
+    f->reqs     = first;
+    f->num_reqs = num_reqs;
+    f->num_msgs = num_msgs;
+    f->t_first  = first->t_arrive;
+    f->digests  = (uint32_t *) malloc ((size_t) num_msgs * ctx->digest_bytes + sizeof (uint32_t));
+
+    if (!f->digests)
+    {
+      fprintf (stderr, "malloc failed for serve digests\n");
+      exit (1);
+    }
+
+    uint32_t m   = 0;
+    size_t   pos = 0;
+
+    for (serve_req_t *req = first; req; req = req->next)
+    {
+      memcpy (data + pos, req->data, req->data_bytes);
+
+      for (uint32_t i = 0; i < req->num; i++)
+      {
+        offs[m] = (uint32_t) pos;
+        lens[m] = req->lens[i];
+
+        pos += req->lens[i];
+        m++;
+      }
+    }
+
+    const int err = sha256_engine_submit (ctx->eng, data, offs, lens, num_msgs, f->digests, &f->job);
+
+    pthread_mutex_lock (&ctx->lock);
+
+    if (err != SHA256_ENGINE_OK)
+    {
+      fprintf (stderr, "[Serve] Batch of %u requests / %u messages rejected: %s\n",
+               num_reqs, num_msgs, sha256_engine_strerror (err));
+
+      serve_finish_reqs (ctx, first, SERVE_E_ENGINE);
+
+      free (f->digests);
+      free (f);
+      continue;
+    }
+
+    if (ctx->ftail) ctx->ftail->next = f;
+    else            ctx->fhead       = f;
+
+    ctx->ftail = f;
+
+    pthread_cond_signal (&ctx->flight_cond);
+  }
+
+  ctx->batcher_done = 1;
+
+  pthread_cond_broadcast (&ctx->flight_cond);
+  pthread_mutex_unlock (&ctx->lock);
+
+  free (data);
+  free (offs);
+  free (lens);
+
+  return NULL;
+}
+
+// 按提交顺序等每一批做完，把 digest 分回各个请求
+static void *serve_completer (void *p)
+{
+  serve_ctx_t *ctx = (serve_ctx_t *) p;
+
+  pthread_mutex_lock (&ctx->lock);
+
+  for (;;)
+  {
+    while (!ctx->fhead && !ctx->batcher_done) pthread_cond_wait (&ctx->flight_cond, &ctx->lock);
+
+    serve_flight_t *f = ctx->fhead;
+
+    if (!f) break;
+
+    ctx->fhead = f->next;
+
+    if (!ctx->fhead) ctx->ftail = NULL;
+
+    pthread_mutex_unlock (&ctx->lock);
+
+    // 提交之后才出的错（设备出错）由 wait 返回，这时 digests 的内容不确定，不能当结果发出去
+    const int err = sha256_engine_wait (f->job);
+
+    const double t_done = now_seconds ();
+
+    if (err == SHA256_ENGINE_OK)
+    {
+      size_t pos = 0;
+
+      for (serve_req_t *req = f->reqs; req; req = req->next)
+      {
+        const size_t n = (size_t) req->num * ctx->digest_bytes;
+
+        memcpy (req->digests, (const unsigned char *) f->digests + pos, n);
+
+        pos += n;
+      }
+    }
+
+    pthread_mutex_lock (&ctx->lock);
+
+    if (err != SHA256_ENGINE_OK)
+    {
+      fprintf (stderr, "[Serve] Batch of %u requests / %u messages failed: %s\n",
+               f->num_reqs, f->num_msgs, sha256_engine_strerror (err));
+
+      serve_finish_reqs (ctx, f->reqs, SERVE_E_ENGINE);
+
+      free (f->digests);
+      free (f);
+      continue;
+    }
+
+    ctx->batches++;
+    ctx->msgs += f->num_msgs;
+    ctx->reqs += f->num_reqs;
+
+    fprintf (stderr, "[Serve] Batch %llu: %u requests, %u messages, oldest request answered after %.3f ms\n",
+             ctx->batches, f->num_reqs, f->num_msgs, (t_done - f->t_first) * 1e3);
+
+    serve_finish_reqs (ctx, f->reqs, SERVE_OK);
+
+    free (f->digests);
+    free (f);
+  }
+
+  pthread_mutex_unlock (&ctx->lock);
+
+  return NULL;
+}
+
+typedef struct serve_conn
+{
+  serve_ctx_t *ctx;
+  int          fd;
+
+} serve_conn_t;
+
+static void *serve_client (void *p)
+{
+  serve_conn_t *conn = (serve_conn_t *) p;
+  serve_ctx_t  *ctx  = conn->ctx;
+  const int     fd   = conn->fd;
+
+  free (conn);
+
+  for (;;)
+  {
+    uint32_t hdr[2];
+
+    if (serve_read_full (fd, hdr, sizeof (hdr)) <= 0) break;
+
+    const uint32_t num        = hdr[0];
+    const uint32_t data_bytes = hdr[1];
+
+    if (num > SERVE_MAX_REQ_MSGS || data_bytes > SERVE_MAX_BATCH_BYTES)
+    {
+      const uint32_t status = SERVE_E_REQUEST;
+      serve_write_full (fd, &status, sizeof (status));
+      break;
+    }
+
+    serve_req_t *req = (serve_req_t *) calloc (1, sizeof (serve_req_t));
+
+    if (req)
+    {
+      req->num        = num;
+      req->data_bytes = data_bytes;
+      req->lens       = (uint32_t *) malloc ((size_t) num * sizeof (uint32_t) + 1);
+      req->data       = (unsigned char *) malloc ((size_t) data_bytes + 1);
+      req->digests    = (unsigned char *) malloc ((size_t) num * ctx->digest_bytes + 1);
+    }
+
+    if (!req || !req->lens || !req->data || !req->digests)
+    {
+      fprintf (stderr, "malloc failed for serve request\n");
+      exit (1);
+    }
+
+    if (serve_read_full (fd, req->lens, (size_t) num * sizeof (uint32_t)) != 1 && num > 0)
+    {
+      serve_req_free (req);
+      break;
+    }
+
+    if (serve_read_full (fd, req->data, data_bytes) != 1 && data_bytes > 0)
+    {
+      serve_req_free (req);
+      break;
+    }
+
+    unsigned long long sum = 0;
+
+    for (uint32_t i = 0; i < num; i++) sum += req->lens[i];
+
+    if (sum != data_bytes)
+    {
+      const uint32_t status = SERVE_E_REQUEST;
+      serve_write_full (fd, &status, sizeof (status));
+      serve_req_free (req);
+      break;
+    }
+
+    pthread_mutex_lock (&ctx->lock);
+
+    if (ctx->stop)
+    {
+      req->status = SERVE_E_SHUTDOWN;
+    }
+    else if (num == 0)
+    {
+      req->status = SERVE_OK;
+    }
+    else
+    {
+      req->t_arrive = now_seconds ();
+
+      if (ctx->tail) ctx->tail->next = req;
+      else           ctx->head       = req;
+
+      ctx->tail          = req;
+      ctx->queued_msgs  += num;
+      ctx->queued_bytes += data_bytes;
+
+      pthread_cond_signal (&ctx->queue_cond);
+
+      while (!req->done) pthread_cond_wait (&ctx->done_cond, &ctx->lock);
+    }
+
+    pthread_mutex_unlock (&ctx->lock);
+
+    const uint32_t status = (uint32_t) req->status;
+
+    int failed = serve_write_full (fd, &status, sizeof (status));
+
+    if (!failed && status == SERVE_OK)
+    {
+      failed = serve_write_full (fd, req->digests, (size_t) num * ctx->digest_bytes);
+    }
+
+    serve_req_free (req);
+
+    if (failed) break;
+  }
+
+  close (fd);
+
+  return NULL;
+}
+
+static volatile sig_atomic_t serve_stop_signal = 0;
+
+static void serve_on_signal (int sig)
+{
+  (void) sig;
+
+  serve_stop_signal = 1;
+}
+
+static int run_serve (const char *path, const sha256_engine_opts_t *opts, uint32_t batch_msgs, unsigned latency_ms)
+{
+  struct sockaddr_un addr;
+
+  if (strlen (path) >= sizeof (addr.sun_path))
+  {
+    fprintf (stderr, "--serve: socket path is too long (max %zu bytes)\n", sizeof (addr.sun_path) - 1);
+    return 1;
+  }
+
+  sha256_engine_t *eng = NULL;
+
+  const int err = sha256_engine_create (opts, &eng);
+
+  if (err != SHA256_ENGINE_OK)
+  {
+    fprintf (stderr, "[Serve] Engine setup failed: %s\n", sha256_engine_strerror (err));
+    return 1;
+  }
+
+  // 上次没清掉的 socket 文件（只删 socket，别的文件不碰）
+  struct stat st;
+
+  if (stat (path, &st) == 0 && S_ISSOCK (st.st_mode)) unlink (path);
+
+  const int lfd = socket (AF_UNIX, SOCK_STREAM, 0);
+
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  memcpy (addr.sun_path, path, strlen (path) + 1);
+
+  if (lfd < 0 || bind (lfd, (const struct sockaddr *) &addr, sizeof (addr)) != 0 || listen (lfd, SERVE_BACKLOG) != 0)
+  {
+    perror (path);
+    if (lfd >= 0) close (lfd);
+    sha256_engine_destroy (eng);
+    return 1;
+  }
+
+  serve_ctx_t ctx;
+  memset (&ctx, 0, sizeof (ctx));
+
+  ctx.eng          = eng;
+  ctx.digest_bytes = sha256_engine_digest_bytes (eng);
+  ctx.batch_msgs   = batch_msgs;
+  ctx.latency_s    = latency_ms * 1e-3;
+
+  pthread_condattr_t cattr;
+  pthread_condattr_init (&cattr);
+  pthread_condattr_setclock (&cattr, CLOCK_MONOTONIC);
+
+  pthread_mutex_init (&ctx.lock, NULL);
+  pthread_cond_init (&ctx.queue_cond, &cattr);
+  pthread_cond_init (&ctx.flight_cond, NULL);
+  pthread_cond_init (&ctx.done_cond, NULL);
+
+  pthread_condattr_destroy (&cattr);
+
+  struct sigaction sa;
+  memset (&sa, 0, sizeof (sa));
+  sa.sa_handler = serve_on_signal;
+  sigaction (SIGINT,  &sa, NULL);
+  sigaction (SIGTERM, &sa, NULL);
+
+  signal (SIGPIPE, SIG_IGN);
+
+  pthread_t batcher, completer;
+
+  if (pthread_create (&batcher, NULL, serve_batcher, &ctx) != 0
+      || pthread_create (&completer, NULL, serve_completer, &ctx) != 0)
+  {
+    fprintf (stderr, "pthread_create failed\n");
+    exit (1);
+  }
+
+  fprintf (stderr, "[Serve] Listening on %s: up to %u messages or %u ms per batch\n", path, batch_msgs, latency_ms);
+
+  while (!serve_stop_signal)
+  {
+    struct pollfd pfd = { lfd, POLLIN, 0 };
+
+    if (poll (&pfd, 1, SERVE_POLL_MS) <= 0) continue;
+
+    const int cfd = accept (lfd, NULL, NULL);
+
+    if (cfd < 0) continue;
+
+    serve_conn_t *conn = (serve_conn_t *) malloc (sizeof (serve_conn_t));
+
+    pthread_t      th;
+    pthread_attr_t attr;
+
+    pthread_attr_init (&attr);
+    pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+
+    if (conn)
+    {
+      conn->ctx = &ctx;
+      conn->fd  = cfd;
+    }
+
+    if (!conn || pthread_create (&th, &attr, serve_client, conn) != 0)
+    {
+      fprintf (stderr, "[Serve] Cannot start a connection thread, dropping the client\n");
+      free (conn);
+      close (cfd);
+    }
+
+    pthread_attr_destroy (&attr);
+  }
+
+  // 退出：不再收新请求，已经排队的照常做完、回给客户端
+  close (lfd);
+  unlink (path);
+
+  pthread_mutex_lock (&ctx.lock);
+  ctx.stop = 1;
+  pthread_cond_broadcast (&ctx.queue_cond);
+  pthread_mutex_unlock (&ctx.lock);
+
+  pthread_join (batcher, NULL);
+  pthread_join (completer, NULL);
+
+  fprintf (stderr, "[Serve] Stopped: %llu requests, %llu messages in %llu batches\n", ctx.reqs, ctx.msgs, ctx.batches);
+
+  sha256_engine_destroy (eng);
+
+  return 0;
+}
+
+// CPU 上的参考 SHA-256 / SHA-512（--bench 校验设备结果用），输出标准的大端 digest 字节
+static const uint32_t cpu_sha256_k[64] =
+{
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint64_t cpu_sha512_k[80] =
+{
+  0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+  0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+  0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+  0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+  0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+  0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+  0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+  0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+  0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+  0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+  0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+  0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+  0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+  0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+  0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+  0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+  0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+  0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+  0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+  0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+};
+
+#define CPU_ROTR32(x,n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define CPU_ROTR64(x,n) (((x) >> (n)) | ((x) << (64 - (n))))
+
+static void cpu_sha256_block (uint32_t h[8], const unsigned char *p)
+{
+  uint32_t w[64];
+
+  for (int i = 0; i < 16; i++)
+  {
+    w[i] = ((uint32_t) p[i * 4] << 24) | ((uint32_t) p[i * 4 + 1] << 16) | ((uint32_t) p[i * 4 + 2] << 8) | p[i * 4 + 3];
+  }
+
+  for (int i = 16; i < 64; i++)
+  {
+    const uint32_t s0 = CPU_ROTR32 (w[i - 15], 7) ^ CPU_ROTR32 (w[i - 15], 18) ^ (w[i - 15] >> 3);
+    const uint32_t s1 = CPU_ROTR32 (w[i - 2], 17) ^ CPU_ROTR32 (w[i - 2], 19)  ^ (w[i - 2] >> 10);
+
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], k = h[7];
+
+  for (int i = 0; i < 64; i++)
+  {
+    const uint32_t t1 = k + (CPU_ROTR32 (e, 6) ^ CPU_ROTR32 (e, 11) ^ CPU_ROTR32 (e, 25)) + ((e & f) ^ (~e & g)) + cpu_sha256_k[i] + w[i];
+    const uint32_t t2 = (CPU_ROTR32 (a, 2) ^ CPU_ROTR32 (a, 13) ^ CPU_ROTR32 (a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+
+    k = g; g = f; f = e; e = d + t1;
+    d = c; c = b; b = a; a = t1 + t2;
+  }
+
+  h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+static void cpu_sha512_block (uint64_t h[8], const unsigned char *p)
+{
+  uint64_t w[80];
+
+  for (int i = 0; i < 16; i++)
+  {
+    uint64_t v = 0;
+    for (int j = 0; j < 8; j++) v = (v << 8) | p[i * 8 + j];
+    w[i] = v;
+  }
+
+  for (int i = 16; i < 80; i++)
+  {
+    const uint64_t s0 = CPU_ROTR64 (w[i - 15], 1) ^ CPU_ROTR64 (w[i - 15], 8) ^ (w[i - 15] >> 7);
+    const uint64_t s1 = CPU_ROTR64 (w[i - 2], 19) ^ CPU_ROTR64 (w[i - 2], 61) ^ (w[i - 2] >> 6);
+
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint64_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], k = h[7];
+
+  for (int i = 0; i < 80; i++)
+  {
+    const uint64_t t1 = k + (CPU_ROTR64 (e, 14) ^ CPU_ROTR64 (e, 18) ^ CPU_ROTR64 (e, 41)) + ((e & f) ^ (~e & g)) + cpu_sha512_k[i] + w[i];
+    const uint64_t t2 = (CPU_ROTR64 (a, 28) ^ CPU_ROTR64 (a, 34) ^ CPU_ROTR64 (a, 39)) + ((a & b) ^ (a & c) ^ (b & c));
+
+    k = g; g = f; f = e; e = d + t1;
+    d = c; c = b; b = a; a = t1 + t2;
+  }
+
+  h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+// 一条消息的 digest（algo->digest_words * 4 字节，大端）
+static void cpu_hash_ref (const hash_algo_t *algo, const unsigned char *msg, size_t len, unsigned char *out)
+{
+  const size_t block = algo->block_bytes;
+
+  unsigned char tail[256];
+
+  // 末尾不完整的 block + 0x80 + 零 + 长度字段（1 或 2 个 block）
+  const size_t full      = len / block * block;
+  const size_t rest      = len - full;
+  const size_t tail_len  = (rest + 1 + algo->len_bytes <= block) ? block : block * 2;
+  const uint64_t bits    = (uint64_t) len * 8u;
+
+  memset (tail, 0, tail_len);
+  memcpy (tail, msg + full, rest);
+  tail[rest] = 0x80;
+
+  for (int j = 0; j < 8; j++) tail[tail_len - 1 - j] = (unsigned char) (bits >> (8 * j));
+
+  if (algo->block_bytes == 64)
+  {
+    uint32_t h[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+
+    for (size_t off = 0; off < full; off += block) cpu_sha256_block (h, msg + off);
+    for (size_t off = 0; off < tail_len; off += block) cpu_sha256_block (h, tail + off);
+
+    for (int i = 0; i < 8; i++)
+    {
+      for (int j = 0; j < 4; j++) out[i * 4 + j] = (unsigned char) (h[i] >> (24 - 8 * j));
+    }
+  }
+  else
+  {
+    uint64_t h[8] =
+    {
+      0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+      0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+    };
+
+    for (size_t off = 0; off < full; off += block) cpu_sha512_block (h, msg + off);
+    for (size_t off = 0; off < tail_len; off += block) cpu_sha512_block (h, tail + off);
+
+    for (int i = 0; i < 8; i++)
+    {
+      for (int j = 0; j < 8; j++) out[i * 8 + j] = (unsigned char) (h[i] >> (56 - 8 * j));
+    }
+  }
+}
+
+// --bench 的语料：长度分布按名字固定，内容由 BENCH_SEED 生成
+#define BENCH_LEN_FIXED    0
+#define BENCH_LEN_ZIPF     1
+#define BENCH_LEN_OUTLIERS 2
+
+typedef struct bench_corpus
+{
+  const char *name;
+  int         kind;
+  unsigned    len;            // BENCH_LEN_FIXED 的行长
+
+} bench_corpus_t;
+
+static const bench_corpus_t bench_corpora[] =
+{
+  { "fixed-8",   BENCH_LEN_FIXED,      8 },
+  { "fixed-16",  BENCH_LEN_FIXED,     16 },
+  { "fixed-55",  BENCH_LEN_FIXED,     55 },  // SHA-256 单 block 的上限
+  { "fixed-64",  BENCH_LEN_FIXED,     64 },
+  { "fixed-119", BENCH_LEN_FIXED,    119 },  // SHA-256 两个 block / SHA-512 单 block 的上限
+  { "zipf",      BENCH_LEN_ZIPF,       0 },
+  { "outliers",  BENCH_LEN_OUTLIERS,  32 },
+};
+
+#define NUM_BENCH_CORPORA (sizeof (bench_corpora) / sizeof (bench_corpora[0]))
+
+// 要比较的 kernel / host 模式：各自跑一遍完整的 sha256_host，只是命令行参数不同
+typedef struct bench_variant
+{
+  const char *name;
+  int         vector;         // 要求算法有向量版 kernel（没有就跳过）
+  const char *backend;        // --backend：固定下来，auto 不会在没有 GPU 的机器上把所有变体都换成 native
+  const char *args[6];        // NULL 结尾
+
+} bench_variant_t;
+
+static const bench_variant_t bench_variants[] =
+{
+  { "wrapper",      0, "opencl", { "--no-single-block", "--vector", "1", NULL } },  // 通用 stride kernel
+  { "single-block", 0, "opencl", { "--vector", "1", NULL } },                       // 桶 0 走 *_short
+  { "vector",       1, "opencl", { "--vector", "4", NULL } },
+  { "packed",       0, "opencl", { "--layout", "packed", NULL } },
+  { "serial",       0, "opencl", { "--pipeline", "1", "--vector", "1", NULL } },     // 跟 single-block 比：不开流水线
+  { "native",       0, "native", { NULL } },                                        // CPU 实现按 --cpu-impl auto 选
+};
+
+#define NUM_BENCH_VARIANTS (sizeof (bench_variants) / sizeof (bench_variants[0]))
+
+typedef struct bench_cfg
+{
+  uint32_t           lines;
+  unsigned           warmup;
+  unsigned           reps;
+  const char        *variants;      // --bench-variants：逗号分隔，NULL = 全部
+  const char        *corpora;       // --bench-corpora：同上
+  const hash_algo_t *algo;
+  const char        *devices_spec;
+  const char        *cache_dir;     // NULL = --no-cache
+  const char        *metrics_path;  // 每个 (语料, 变体) 一行 JSON
+
+} bench_cfg_t;
+
+// name 是否在逗号分隔的 list 里（list 为 NULL 时都算）
+static int bench_selected (const char *list, const char *name)
+{
+  if (!list) return 1;
+
+  const size_t n = strlen (name);
+
+  for (const char *p = list; *p; )
+  {
+    const char *end = strchr (p, ',');
+    const size_t len = end ? (size_t) (end - p) : strlen (p);
+
+    if (len == n && memcmp (p, name, n) == 0) return 1;
+
+    if (!end) break;
+    p = end + 1;
+  }
+
+  return 0;
+}
+
+static uint64_t bench_rand (uint64_t *state)
+{
+  uint64_t x = *state;
+
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+
+  *state = x;
+
+  return x * 0x2545f4914f6cdd1dULL;
+}
+
+// 生成一个语料文件，同时算出 CPU 参考 digest（lines * digest_bytes）。返回总字节数
+static unsigned long long bench_make_corpus (const bench_corpus_t *bc, unsigned index, uint32_t lines,
+                                             const hash_algo_t *algo, const char *path, unsigned char *ref)
+{
+  static const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+
+  const size_t digest_bytes = (size_t) algo->digest_words * 4u;
+  const size_t max_line     = 16384;
+
+  FILE *fp = fopen (path, "wb");
+  if (!fp)
+  {
+    perror (path);
+    exit (1);
+  }
+
+  unsigned char *line = (unsigned char *) malloc (max_line + 1);
+  if (!line)
+  {
+    fprintf (stderr, "malloc failed for bench line\n");
+    exit (1);
+  }
+
+  // Zipf：按 1 / k 的累积分布查表
+  double cdf[BENCH_ZIPF_MAX_LEN];
+  double sum = 0.0;
+
+  for (unsigned k = 0; k < BENCH_ZIPF_MAX_LEN; k++)
+  {
+    sum   += 1.0 / (double) (k + 1);
+    cdf[k] = sum;
+  }
+
+  uint64_t state = BENCH_SEED + index * 0x9e3779b97f4a7c15ULL;
+
+  unsigned long long total = 0;
+
+  for (uint32_t i = 0; i < lines; i++)
+  {
+    size_t len = bc->len;
+
+    if (bc->kind == BENCH_LEN_ZIPF)
+    {
+      const double u = (double) (bench_rand (&state) >> 11) / 9007199254740992.0 * sum;
+
+      unsigned lo = 0, hi = BENCH_ZIPF_MAX_LEN - 1;
+      while (lo < hi)
+      {
+        const unsigned mid = (lo + hi) / 2;
+        if (cdf[mid] < u) lo = mid + 1; else hi = mid;
+      }
+
+      len = lo + 1;
+    }
+    else if (bc->kind == BENCH_LEN_OUTLIERS && (i % BENCH_OUTLIER_EVERY) == BENCH_OUTLIER_EVERY - 1)
+    {
+      len = 1024 + bench_rand (&state) % (max_line - 1024 + 1);
+    }
+
+    for (size_t j = 0; j < len; j++) line[j] = (unsigned char) alphabet[bench_rand (&state) % (sizeof (alphabet) - 1)];
+
+    cpu_hash_ref (algo, line, len, ref + (size_t) i * digest_bytes);
+
+    line[len] = '\n';
+
+    if (fwrite (line, 1, len + 1, fp) != len + 1)
+    {
+      perror (path);
+      exit (1);
+    }
+
+    total += len;
+  }
+
+  free (line);
+
+  if (fclose (fp) != 0)
+  {
+    perror (path);
+    exit (1);
+  }
+
+  return total;
+}
+
+// 在 "key":数字 里取数字（child 写的 --metrics 合计行）
+static double json_number (const char *line, const char *key)
+{
+  char pat[64];
+  snprintf (pat, sizeof (pat), "\"%s\":", key);
+
+  const char *p = strstr (line, pat);
+
+  return p ? strtod (p + strlen (pat), NULL) : 0.0;
+}
+
+// 跑一次 child，成功时从它的 --metrics 合计行取 messages / in_bytes / kernel_s / wall_s，
+// 并把 raw 输出跟参考 digest 比较。返回 0 = 通过，1 = 结果不对，-1 = 运行失败
+static int bench_run_once (const bench_cfg_t *cfg, const char *self, const bench_variant_t *bv,
+                           const char *corpus_path, const char *out_path, const char *metrics_path,
+                           const unsigned char *ref, uint32_t lines, double *kernel_s, double *wall_s)
+{
+  const char *args[32];
+  unsigned    n = 0;
+
+  args[n++] = self;
+  args[n++] = "--algo";
+  args[n++] = cfg->algo->name;
+  args[n++] = "--backend";
+  args[n++] = bv->backend;
+
+  if (cfg->devices_spec && strcmp (bv->backend, "native") != 0)
+  {
+    args[n++] = "--devices";
+    args[n++] = cfg->devices_spec;
+  }
+
+  if (cfg->cache_dir)
+  {
+    args[n++] = "--cache-dir";
+    args[n++] = cfg->cache_dir;
+  }
+  else
+  {
+    args[n++] = "--no-cache";
+  }
+
+  for (unsigned i = 0; bv->args[i]; i++) args[n++] = bv->args[i];
+
+  args[n++] = "--out-format";
+  args[n++] = "raw";
+  args[n++] = "--metrics";
+  args[n++] = metrics_path;
+  args[n++] = corpus_path;
+  args[n++] = out_path;
+  args[n]   = NULL;
+
+  fflush (stdout);
+  fflush (stderr);
+
+  const pid_t pid = fork ();
+  if (pid < 0)
+  {
+    perror ("fork");
+    exit (1);
+  }
+
+  if (pid == 0)
+  {
+    // child 的日志不要跟结果表混在一起
+    FILE *null = freopen ("/dev/null", "w", stderr);
+    (void) null;
+
+    execv (self, (char * const *) args);
+    _exit (127);
+  }
+
+  int status = 0;
+  while (waitpid (pid, &status, 0) < 0 && errno == EINTR) { }
+
+  if (!WIFEXITED (status) || WEXITSTATUS (status) != 0) return -1;
+
+  // 合计行是 metrics 文件的最后一行
+  FILE *mf = fopen (metrics_path, "r");
+  if (!mf) return -1;
+
+  char buf[2048], last[2048] = "";
+  while (fgets (buf, sizeof (buf), mf)) memcpy (last, buf, sizeof (last));
+  fclose (mf);
+
+  if (!strstr (last, "\"type\":\"total\"")) return -1;
+
+  *kernel_s = json_number (last, "kernel_s");
+  *wall_s   = json_number (last, "wall_s");
+
+  // 校验 raw 输出
+  const size_t expect = (size_t) lines * cfg->algo->digest_words * 4u;
+
+  FILE *of = fopen (out_path, "rb");
+  if (!of) return -1;
+
+  unsigned char chunk[65536];
+  size_t        pos = 0;
+  int           bad = 0;
+
+  for (size_t got; (got = fread (chunk, 1, sizeof (chunk), of)) > 0; pos += got)
+  {
+    if (pos + got > expect || memcmp (chunk, ref + pos, got) != 0) bad = 1;
+  }
+
+  fclose (of);
+
+  return (bad || pos != expect) ? 1 : 0;
+}
+
+static int bench_double_cmp (const void *pa, const void *pb)
+{
+  const double a = *(const double *) pa;
+  const double b = *(const double *) pb;
+
+  return (a > b) - (a < b);
+}
+
+static double bench_median (double *v, unsigned n)
+{
+  qsort (v, n, sizeof (double), bench_double_cmp);
+
+  return (n % 2) ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2.0;
+}
+
+// --bench：生成语料，每个 (语料, 变体) 先跑 warmup 次（不计时），再跑 reps 次取中位数；
+// 每一次的输出都和 CPU 参考实现比较。结果表打到 stdout，有一次不对或跑失败就返回 1
+static int run_bench (const bench_cfg_t *cfg)
+{
+  const hash_algo_t *algo         = cfg->algo;
+  const size_t       digest_bytes = (size_t) algo->digest_words * 4u;
+  const unsigned     runs         = cfg->warmup + cfg->reps;
+
+  // child 执行的是同一个可执行文件
+  char self[4096];
+  const ssize_t self_len = readlink ("/proc/self/exe", self, sizeof (self) - 1);
+  if (self_len <= 0)
+  {
+    fprintf (stderr, "--bench: cannot resolve /proc/self/exe\n");
+    return 1;
+  }
+  self[self_len] = '\0';
+
+  const char *tmp_root = getenv ("TMPDIR");
+
+  char dir[4096];
+  snprintf (dir, sizeof (dir), "%s/sha256_bench.XXXXXX", (tmp_root && *tmp_root) ? tmp_root : "/tmp");
+
+  if (!mkdtemp (dir))
+  {
+    perror (dir);
+    return 1;
+  }
+
+  char corpus_path[4200], out_path[4200], metrics_path[4200];
+  snprintf (corpus_path,  sizeof (corpus_path),  "%s/corpus.txt",   dir);
+  snprintf (out_path,     sizeof (out_path),     "%s/out.bin",      dir);
+  snprintf (metrics_path, sizeof (metrics_path), "%s/metrics.json", dir);
+
+  FILE *jf = NULL;
+
+  if (cfg->metrics_path)
+  {
+    jf = fopen (cfg->metrics_path, "w");
+    if (!jf)
+    {
+      perror (cfg->metrics_path);
+      return 1;
+    }
+  }
+
+  unsigned char *ref = (unsigned char *) malloc ((size_t) cfg->lines * digest_bytes);
+  if (!ref)
+  {
+    fprintf (stderr, "malloc failed for bench reference digests\n");
+    exit (1);
+  }
+
+  fprintf (stderr, "[OpenCL] Bench: %s, %u lines per corpus, %u warmup + %u timed runs, seed 0x%llx\n",
+           algo->name, cfg->lines, cfg->warmup, cfg->reps, (unsigned long long) BENCH_SEED);
+
+  printf ("%-10s %-13s %10s %12s %12s %12s %10s  %s\n",
+          "corpus", "variant", "lines", "bytes", "kernel MH/s", "e2e MH/s", "e2e MB/s", "check");
+
+  int failed = 0;
+
+  for (unsigned c = 0; c < NUM_BENCH_CORPORA; c++)
+  {
+    const bench_corpus_t *bc = &bench_corpora[c];
+
+    if (!bench_selected (cfg->corpora, bc->name)) continue;
+
+    const unsigned long long bytes = bench_make_corpus (bc, c, cfg->lines, algo, corpus_path, ref);
+
+    for (unsigned v = 0; v < NUM_BENCH_VARIANTS; v++)
+    {
+      const bench_variant_t *bv = &bench_variants[v];
+
+      if (!bench_selected (cfg->variants, bv->name)) continue;
+
+      if (bv->vector && !algo->kernel_vector) continue;
+
+      double kernel_mhs[BENCH_MAX_REPS], e2e_mhs[BENCH_MAX_REPS], e2e_mbs[BENCH_MAX_REPS];
+
+      unsigned    timed  = 0;
+      const char *check  = "ok";
+
+      for (unsigned r = 0; r < runs; r++)
+      {
+        double kernel_s = 0.0, wall_s = 0.0;
+
+        const int rc = bench_run_once (cfg, self, bv, corpus_path, out_path, metrics_path,
+                                       ref, cfg->lines, &kernel_s, &wall_s);
+
+        if (rc != 0)
+        {
+          check = (rc < 0) ? "FAILED" : "MISMATCH";
+          break;
+        }
+
+        if (r < cfg->warmup) continue;
+
+        kernel_mhs[timed] = (kernel_s > 0.0) ? (double) cfg->lines / kernel_s / 1e6 : 0.0;
+        e2e_mhs[timed]    = (wall_s > 0.0)   ? (double) cfg->lines / wall_s / 1e6   : 0.0;
+        e2e_mbs[timed]    = (wall_s > 0.0)   ? (double) bytes / wall_s / 1e6        : 0.0;
+        timed++;
+      }
+
+      if (timed < cfg->reps)
+      {
+        failed = 1;
+
+        printf ("%-10s %-13s %10u %12llu %12s %12s %10s  %s\n",
+                bc->name, bv->name, cfg->lines, bytes, "-", "-", "-", check);
+
+        if (jf) fprintf (jf, "{\"type\":\"bench\",\"algo\":\"%s\",\"corpus\":\"%s\",\"variant\":\"%s\",\"lines\":%u,\"bytes\":%llu,\"check\":\"%s\"}\n",
+                         algo->name, bc->name, bv->name, cfg->lines, bytes, check);
+        continue;
+      }
+
+      const double k_mhs = bench_median (kernel_mhs, timed);
+      const double e_mhs = bench_median (e2e_mhs, timed);
+      const double e_mbs = bench_median (e2e_mbs, timed);
+
+      printf ("%-10s %-13s %10u %12llu %12.2f %12.2f %10.1f  %s\n",
+              bc->name, bv->name, cfg->lines, bytes, k_mhs, e_mhs, e_mbs, check);
+      fflush (stdout);
+
+      if (jf) fprintf (jf, "{\"type\":\"bench\",\"algo\":\"%s\",\"corpus\":\"%s\",\"variant\":\"%s\",\"lines\":%u,\"bytes\":%llu,\"reps\":%u,"
+                           "\"kernel_mhs\":%.4f,\"e2e_mhs\":%.4f,\"e2e_mbs\":%.4f,\"check\":\"%s\"}\n",
+                       algo->name, bc->name, bv->name, cfg->lines, bytes, timed, k_mhs, e_mhs, e_mbs, check);
+    }
+  }
+
+  free (ref);
+
+  if (jf && fclose (jf) != 0) perror (cfg->metrics_path);
+
+  unlink (corpus_path);
+  unlink (out_path);
+  unlink (metrics_path);
+  rmdir (dir);
+
+  return failed;
+}
+
+int main (int argc, char **argv)
+{
+  unsigned pipeline_depth   = DEFAULT_PIPELINE_DEPTH;
+  unsigned host_threads     = default_host_threads ();
+  int      use_mmap         = 0;
+  int      use_buckets      = 1;
+  int      layout           = LAYOUT_STRIDE;
+  int      use_single_block = 1;
+  unsigned vector_width     = 0;  // 0 = 按设备自动选
+  const char *search_path   = NULL;
+  const char *cache_dir     = "kernels";
+  int      use_cache        = 1;
+  const char *devices_spec  = NULL;
+  int      out_format       = OUT_FORMAT_HEX;
+  unsigned out_bytes        = 0;  // 0 = 整个 digest
+  const hash_algo_t *algo   = &hash_algos[0];
+  hmac_cfg_t hmac           = { HMAC_NONE, NULL, 0 };
+  int      hmac_per_line    = 0;
+  kdf_cfg_t kdf             = { KDF_NONE, 1, DEFAULT_LOOP_CHUNK, NULL, 0 };
+  stream_cfg_t stream       = { 0, DEFAULT_STREAM_CHUNK, DEFAULT_STREAM_FILES };
+  int      merkle           = 0;
+  long long merkle_proof    = -1;  // --merkle-proof：要输出审计路径的叶子（-1 = 不输出）
+  uint32_t batch_lines_opt  = 0;  // 0 = 按设备内存算
+  size_t   local_size_opt   = 0;  // 0 = 按 preferred multiple 自动选
+  int      autotune         = 0;
+  const char *metrics_path  = NULL;
+  int      metrics_format   = METRICS_JSON;
+  int      bench            = 0;
+  bench_cfg_t bench_cfg     = { BENCH_DEFAULT_LINES, BENCH_DEFAULT_WARMUP, BENCH_DEFAULT_REPS, NULL, NULL,
+                                NULL, NULL, NULL, NULL };
+  int      backend          = BACKEND_AUTO;
+  int      cpu_impl         = NATIVE_IMPL_AUTO;  // --cpu-impl（只对 native 后端有意义）
+  const char *serve_path    = NULL;
+  uint32_t serve_batch      = SERVE_DEFAULT_BATCH;
+  unsigned serve_latency_ms = SERVE_DEFAULT_LATENCY_MS;
+  size_t   max_mem          = 0;  // --max-mem（字节，0 = 不限）
+  unsigned flush_ms         = 0;  // --flush-ms（0 = 每批读满为止）
+  const char *mask_text     = NULL;
+  int      encoding         = ENCODING_RAW;
+  salt_cfg_t salt           = { SALT_NONE, SALT_PREFIX, NULL, 0 };
+  int      salt_per_line    = 0;
+  int      dedup            = DEDUP_NONE;
+  mask_cfg_t mask;
+
+  static const struct option long_opts[] =
+  {
+    { "pipeline",        required_argument, NULL, 'p' },
+    { "mmap",            no_argument,       NULL, 'm' },
+    { "threads",         required_argument, NULL, 't' },
+    { "no-buckets",      no_argument,       NULL, 'B' },
+    { "layout",          required_argument, NULL, 'L' },
+    { "no-single-block", no_argument,       NULL, 'S' },
+    { "vector",          required_argument, NULL, 'V' },
+    { "search",          required_argument, NULL, 's' },
+    { "cache-dir",       required_argument, NULL, 'C' },
+    { "no-cache",        no_argument,       NULL, 'N' },
+    { "devices",         required_argument, NULL, 'D' },
+    { "out-format",      required_argument, NULL, 'F' },
+    { "out-bytes",       required_argument, NULL, 'O' },
+    { "algo",            required_argument, NULL, 'A' },
+    { "hmac-key",        required_argument, NULL, 'K' },
+    { "hmac-key-hex",    required_argument, NULL, 'X' },
+    { "hmac-per-line",   no_argument,       NULL, 'H' },
+    { "iterations",      required_argument, NULL, 'I' },
+    { "loop-chunk",      required_argument, NULL, 'c' },
+    { "pbkdf2-salt",     required_argument, NULL, 'P' },
+    { "pbkdf2-salt-hex", required_argument, NULL, 'Q' },
+    { "stream",          no_argument,       NULL, 'T' },
+    { "stream-chunk",    required_argument, NULL, 'U' },
+    { "stream-files",    required_argument, NULL, 'W' },
+    { "merkle",          no_argument,       NULL, 'M' },
+    { "merkle-proof",    required_argument, NULL, 'R' },
+    { "batch-lines",     required_argument, NULL, 'b' },
+    { "local-size",      required_argument, NULL, 'l' },
+    { "autotune",        no_argument,       NULL, 'a' },
+    { "metrics",         required_argument, NULL, 'j' },
+    { "metrics-format",  required_argument, NULL, 'g' },
+    { "bench",           no_argument,       NULL, 'e' },
+    { "bench-lines",     required_argument, NULL, 'n' },
+    { "bench-warmup",    required_argument, NULL, 'w' },
+    { "bench-reps",      required_argument, NULL, 'r' },
+    { "bench-variants",  required_argument, NULL, 'v' },
+    { "bench-corpora",   required_argument, NULL, 'o' },
+    { "backend",         required_argument, NULL, 'E' },
+    { "cpu-impl",        required_argument, NULL, 'Z' },
+    { "serve",           required_argument, NULL, 'Y' },
+    { "serve-batch",     required_argument, NULL, 'y' },
+    { "serve-latency",   required_argument, NULL, 'k' },
+    { "max-mem",         required_argument, NULL, 'x' },
+    { "flush-ms",        required_argument, NULL, 'f' },
+    { "mask",            required_argument, NULL, 'q' },
+    { "encoding",        required_argument, NULL, 'u' },
+    { "salt",            required_argument, NULL, 'z' },
+    { "salt-hex",        required_argument, NULL, 'J' },
+    { "salt-per-line",   no_argument,       NULL, 'G' },
+    { "salt-pos",        required_argument, NULL, 'i' },
+    { "dedup",           required_argument, NULL, 'd' },
+    { NULL,              0,                 NULL,  0  }
+  };
+
+  const char *usage = "Usage: %s [--algo sha256|sha512] [--pipeline N] [--mmap] [--threads N] [--no-buckets] [--layout stride|packed] [--no-single-block] [--vector N] [--search targets_file [--mask MASK]] [--cache-dir DIR] [--no-cache] [--devices all|i,j,...] [--out-format hex|raw] [--out-bytes N] [--encoding raw|utf16le] [--hmac-key KEY | --hmac-key-hex HEX | --hmac-per-line] [--salt SALT | --salt-hex HEX | --salt-per-line] [--salt-pos prefix|suffix] [--dedup first|count] [--iterations N] [--pbkdf2-salt SALT | --pbkdf2-salt-hex HEX] [--loop-chunk N] [--stream [--stream-chunk BYTES] [--stream-files N]] [--merkle [--merkle-proof LEAF]] [--batch-lines N] [--local-size N] [--autotune] [--metrics FILE [--metrics-format json|prom]] [--backend auto|opencl|native|cuda|hip] [--cpu-impl auto|scalar|avx2|avx512|shani] [--max-mem MB] [--flush-ms MS] <input_file|-> <output_file|->\n"
+                      "       %s --bench [--bench-lines N] [--bench-warmup N] [--bench-reps N] [--bench-variants LIST] [--bench-corpora LIST] [--algo ...] [--devices ...] [--metrics FILE]\n"
+                      "       %s --serve SOCKET [--serve-batch N] [--serve-latency MS] [--algo ...] [--devices ...] [--pipeline N] [--backend auto|opencl|native] [--cpu-impl ...] [--threads N] [--local-size N] [--autotune] [--cache-dir DIR] [--no-cache]\n";
+
+  int opt;
+  while ((opt = getopt_long (argc, argv, "p:mt:", long_opts, NULL)) != -1)
+  {
+    switch (opt)
+    {
+      case 'p':
+        pipeline_depth = (unsigned) strtoul (optarg, NULL, 10);
+        if (pipeline_depth < 1 || pipeline_depth > MAX_PIPELINE_DEPTH)
+        {
+          fprintf (stderr, "--pipeline must be between 1 and %d\n", MAX_PIPELINE_DEPTH);
+          return 1;
+        }
+        break;
+
+      case 'm':
+        use_mmap = 1;
+        break;
+
+      case 'B':
+        use_buckets = 0;
+        break;
+
+      case 'S':
+        use_single_block = 0;
+        break;
+
+      case 's':
+        search_path = optarg;
+        break;
+
+      case 'C':
+        cache_dir = optarg;
+        break;
+
+      case 'N':
+        use_cache = 0;
+        break;
+
+      case 'D':
+        devices_spec = optarg;
+        break;
+
+      case 'F':
+        if (strcmp (optarg, "hex") == 0)
+        {
+          out_format = OUT_FORMAT_HEX;
+        }
+        else if (strcmp (optarg, "raw") == 0)
+        {
+          out_format = OUT_FORMAT_RAW;
+        }
+        else
+        {
+          fprintf (stderr, "--out-format must be hex or raw\n");
+          return 1;
+        }
+        break;
+
+      case 'O':
+        out_bytes = (unsigned) strtoul (optarg, NULL, 10);
+        if (out_bytes < 1)
+        {
+          fprintf (stderr, "--out-bytes must be at least 1\n");
+          return 1;
+        }
+        break;
+
+      case 'A':
+      {
+        algo = NULL;
+
+        for (size_t i = 0; i < NUM_HASH_ALGOS; i++)
+        {
+          if (strcmp (optarg, hash_algos[i].name) == 0) algo = &hash_algos[i];
+        }
+
+        if (!algo)
+        {
+          fprintf (stderr, "--algo must be sha256 or sha512\n");
+          return 1;
+        }
+        break;
+      }
+
+      case 'K':
+        free (hmac.key);
+        hmac.mode    = HMAC_SHARED;
+        hmac.key_len = strlen (optarg);
+        hmac.key     = (unsigned char *) malloc (hmac.key_len + 1);
+        if (!hmac.key)
+        {
+          fprintf (stderr, "malloc failed for HMAC key\n");
+          return 1;
+        }
+        memcpy (hmac.key, optarg, hmac.key_len);
+        break;
+
+      case 'X':
+        if (parse_hex_arg ("--hmac-key-hex", optarg, &hmac.key, &hmac.key_len) != 0) return 1;
+        hmac.mode = HMAC_SHARED;
+        break;
+
+      case 'I':
+        kdf.iterations = (unsigned) strtoul (optarg, NULL, 10);
+        if (kdf.iterations < 1)
+        {
+          fprintf (stderr, "--iterations must be at least 1\n");
+          return 1;
+        }
+        break;
+
+      case 'c':
+        kdf.loop_chunk = (unsigned) strtoul (optarg, NULL, 10);
+        if (kdf.loop_chunk < 1)
+        {
+          fprintf (stderr, "--loop-chunk must be at least 1\n");
+          return 1;
+        }
+        break;
+
+      case 'P':
+        free (kdf.salt);
+        kdf.mode     = KDF_PBKDF2;
+        kdf.salt_len = strlen (optarg);
+        kdf.salt     = (unsigned char *) malloc (kdf.salt_len + 1);
+        if (!kdf.salt)
+        {
+          fprintf (stderr, "malloc failed for PBKDF2 salt\n");
+          return 1;
+        }
+        memcpy (kdf.salt, optarg, kdf.salt_len);
+        break;
+
+      case 'Q':
+        if (parse_hex_arg ("--pbkdf2-salt-hex", optarg, &kdf.salt, &kdf.salt_len) != 0) return 1;
+        kdf.mode = KDF_PBKDF2;
+        break;
+
+      case 'T':
+        stream.enabled = 1;
+        break;
+
+      case 'U':
+        stream.chunk_bytes = (size_t) strtoull (optarg, NULL, 10);
+        if (stream.chunk_bytes < 1 || stream.chunk_bytes > (1u << 30))
+        {
+          fprintf (stderr, "--stream-chunk must be between 1 and %u bytes\n", 1u << 30);
+          return 1;
+        }
+        break;
+
+      case 'M':
+        merkle = 1;
+        break;
+
+      case 'R':
+      {
+        char *end = NULL;
+
+        merkle_proof = strtoll (optarg, &end, 10);
+        if (end == optarg || *end || merkle_proof < 0)
+        {
+          fprintf (stderr, "--merkle-proof needs a leaf index (line number from 0)\n");
+          return 1;
+        }
+
+        merkle = 1;
+        break;
+      }
+
+      case 'W':
+        stream.group_files = (uint32_t) strtoul (optarg, NULL, 10);
+        if (stream.group_files < 1 || stream.group_files > 65536)
+        {
+          fprintf (stderr, "--stream-files must be between 1 and 65536\n");
+          return 1;
+        }
+        break;
+
+      case 'H':
+        hmac_per_line = 1;
+        break;
+
+      case 'b':
+        batch_lines_opt = (uint32_t) strtoul (optarg, NULL, 10);
+        if (batch_lines_opt < 1 || batch_lines_opt > MAX_BATCH_LINES)
+        {
+          fprintf (stderr, "--batch-lines must be between 1 and %u\n", MAX_BATCH_LINES);
+          return 1;
+        }
+        break;
+
+      case 'l':
+        local_size_opt = (size_t) strtoul (optarg, NULL, 10);
+        if (local_size_opt < 1 || local_size_opt > 65536)
+        {
+          fprintf (stderr, "--local-size must be between 1 and 65536\n");
+          return 1;
+        }
+        break;
+
+      case 'a':
+        autotune = 1;
+        break;
+
+      case 'j':
+        metrics_path = optarg;
+        break;
+
+      case 'e':
+        bench = 1;
+        break;
+
+      case 'n':
+        bench_cfg.lines = (uint32_t) strtoul (optarg, NULL, 10);
+        if (bench_cfg.lines < 1 || bench_cfg.lines > MAX_BATCH_LINES)
+        {
+          fprintf (stderr, "--bench-lines must be between 1 and %u\n", MAX_BATCH_LINES);
+          return 1;
+        }
+        break;
+
+      case 'w':
+        bench_cfg.warmup = (unsigned) strtoul (optarg, NULL, 10);
+        if (bench_cfg.warmup > BENCH_MAX_REPS)
+        {
+          fprintf (stderr, "--bench-warmup must be between 0 and %u\n", BENCH_MAX_REPS);
+          return 1;
+        }
+        break;
+
+      case 'r':
+        bench_cfg.reps = (unsigned) strtoul (optarg, NULL, 10);
+        if (bench_cfg.reps < 1 || bench_cfg.reps > BENCH_MAX_REPS)
+        {
+          fprintf (stderr, "--bench-reps must be between 1 and %u\n", BENCH_MAX_REPS);
+          return 1;
+        }
+        break;
+
+      case 'v':
+        bench_cfg.variants = optarg;
+        break;
+
+      case 'o':
+        bench_cfg.corpora = optarg;
+        break;
+
+      case 'E':
+        if (strcmp (optarg, "auto") == 0)
+        {
+          backend = BACKEND_AUTO;
+        }
+        else if (strcmp (optarg, "opencl") == 0)
+        {
+          backend = BACKEND_OPENCL;
+        }
+        else if (strcmp (optarg, "native") == 0)
+        {
+          backend = BACKEND_NATIVE;
+        }
+        else if (strcmp (optarg, "cuda") == 0)
+        {
+          backend = BACKEND_CUDA;
+        }
+        else if (strcmp (optarg, "hip") == 0)
+        {
+          backend = BACKEND_HIP;
+        }
+        else
+        {
+          fprintf (stderr, "--backend must be auto, opencl, native, cuda or hip\n");
+          return 1;
+        }
+        break;
+
+      case 'Y':
+        serve_path = optarg;
+        break;
+
+      case 'y':
+        serve_batch = (uint32_t) strtoul (optarg, NULL, 10);
+        if (serve_batch < 1 || serve_batch > SERVE_MAX_REQ_MSGS)
+        {
+          fprintf (stderr, "--serve-batch must be between 1 and %u\n", SERVE_MAX_REQ_MSGS);
+          return 1;
+        }
+        break;
+
+      case 'k':
+        serve_latency_ms = (unsigned) strtoul (optarg, NULL, 10);
+        break;
+
+      case 'x':
+        max_mem = (size_t) strtoull (optarg, NULL, 10) << 20;
+        if (max_mem < ((size_t) MIN_MAX_MEM_MB << 20))
+        {
+          fprintf (stderr, "--max-mem must be at least %u MB\n", MIN_MAX_MEM_MB);
+          return 1;
+        }
+        break;
+
+      case 'f':
+        flush_ms = (unsigned) strtoul (optarg, NULL, 10);
+        break;
+
+      case 'q':
+        mask_text = optarg;
+        break;
+
+      case 'u':
+        if (strcmp (optarg, "raw") == 0)
+        {
+          encoding = ENCODING_RAW;
+        }
+        else if (strcmp (optarg, "utf16le") == 0)
+        {
+          encoding = ENCODING_UTF16LE;
+        }
+        else
+        {
+          fprintf (stderr, "--encoding must be raw or utf16le\n");
+          return 1;
+        }
+        break;
+
+      case 'z':
+        free (salt.salt);
+        salt.mode     = SALT_SHARED;
+        salt.salt_len = strlen (optarg);
+        salt.salt     = (unsigned char *) malloc (salt.salt_len + 1);
+        if (!salt.salt)
+        {
+          fprintf (stderr, "malloc failed for salt\n");
+          return 1;
+        }
+        memcpy (salt.salt, optarg, salt.salt_len);
+        break;
+
+      case 'J':
+        if (parse_hex_arg ("--salt-hex", optarg, &salt.salt, &salt.salt_len) != 0) return 1;
+        salt.mode = SALT_SHARED;
+        break;
+
+      case 'G':
+        salt_per_line = 1;
+        break;
+
+      case 'i':
+        if (strcmp (optarg, "prefix") == 0)
+        {
+          salt.pos = SALT_PREFIX;
+        }
+        else if (strcmp (optarg, "suffix") == 0)
+        {
+          salt.pos = SALT_SUFFIX;
+        }
+        else
+        {
+          fprintf (stderr, "--salt-pos must be prefix or suffix\n");
+          return 1;
+        }
+        break;
+
+      case 'd':
+        if (strcmp (optarg, "first") == 0)
+        {
+          dedup = DEDUP_FIRST;
+        }
+        else if (strcmp (optarg, "count") == 0)
+        {
+          dedup = DEDUP_COUNT;
+        }
+        else
+        {
+          fprintf (stderr, "--dedup must be first or count\n");
+          return 1;
+        }
+        break;
+
+      case 'Z':
+        cpu_impl = native_impl_parse (optarg);
+        if (cpu_impl < NATIVE_IMPL_AUTO)
+        {
+          fprintf (stderr, "--cpu-impl must be auto, scalar, avx2, avx512 or shani\n");
+          return 1;
+        }
+        break;
+
+      case 'g':
+        if (strcmp (optarg, "json") == 0)
+        {
+          metrics_format = METRICS_JSON;
+        }
+        else if (strcmp (optarg, "prom") == 0)
+        {
+          metrics_format = METRICS_PROM;
+        }
+        else
+        {
+          fprintf (stderr, "--metrics-format must be json or prom\n");
+          return 1;
+        }
+        break;
+
+      case 'V':
+        vector_width = (unsigned) strtoul (optarg, NULL, 10);
+        if (vector_width != 1 && vector_width != 2 && vector_width != 4 &&
+            vector_width != 8 && vector_width != 16)
+        {
+          fprintf (stderr, "--vector must be 1, 2, 4, 8 or 16\n");
+          return 1;
+        }
+        break;
+
+      case 'L':
+        if (strcmp (optarg, "stride") == 0)
+        {
+          layout = LAYOUT_STRIDE;
+        }
+        else if (strcmp (optarg, "packed") == 0)
+        {
+          layout = LAYOUT_PACKED;
+        }
+        else
+        {
+          fprintf (stderr, "--layout must be stride or packed\n");
+          return 1;
+        }
+        break;
+
+      case 't':
+        host_threads = (unsigned) strtoul (optarg, NULL, 10);
+        if (host_threads < 1 || host_threads > MAX_HOST_THREADS)
+        {
+          fprintf (stderr, "--threads must be between 1 and %d\n", MAX_HOST_THREADS);
+          return 1;
+        }
+        break;
+
+      default:
+        fprintf (stderr, usage, argv[0], argv[0], argv[0]);
+        return 1;
+    }
+  }
+
+  // --bench：每个变体都是带相应参数重新执行一遍本程序，这里只带过去算法 / 设备 / 缓存目录
+  if (bench)
+  {
+    if (argc != optind)
+    {
+      fprintf (stderr, usage, argv[0], argv[0], argv[0]);
+      return 1;
+    }
+
+    bench_cfg.algo         = algo;
+    bench_cfg.devices_spec = devices_spec;
+    bench_cfg.cache_dir    = use_cache ? cache_dir : NULL;
+    bench_cfg.metrics_path = metrics_path;
+
+    return run_bench (&bench_cfg);
+  }
+
+  // --serve：引擎按命令行的算法 / 设备 / 后端选项建一次，之后一直常驻
+  if (serve_path)
+  {
+    if (argc != optind)
+    {
+      fprintf (stderr, usage, argv[0], argv[0], argv[0]);
+      return 1;
+    }
+
+    if (backend == BACKEND_CUDA || backend == BACKEND_HIP)
+    {
+      fprintf (stderr, "--serve supports --backend auto, opencl and native\n");
+      return 1;
+    }
+
+    // 引擎只算普通的 digest：会改变 digest 或者输出内容的选项不能被悄悄忽略
+    const char *unsupported = (hmac.mode != HMAC_NONE || hmac_per_line)    ? "--hmac-key / --hmac-key-hex / --hmac-per-line"
+                            : (salt.mode != SALT_NONE || salt_per_line)    ? "--salt / --salt-hex / --salt-per-line"
+                            : (kdf.mode != KDF_NONE || kdf.iterations > 1) ? "--iterations / --pbkdf2-salt"
+                            : (encoding != ENCODING_RAW)                   ? "--encoding utf16le"
+                            : search_path                                  ? "--search"
+                            : mask_text                                    ? "--mask"
+                            : (dedup != DEDUP_NONE)                        ? "--dedup"
+                            : out_bytes                                    ? "--out-bytes"
+                            : stream.enabled                               ? "--stream"
+                            : merkle                                       ? "--merkle"
+                            : NULL;
+
+    if (unsupported)
+    {
+      fprintf (stderr, "--serve only computes plain digests and cannot be combined with %s\n", unsupported);
+      return 1;
+    }
+
+    sha256_engine_opts_t eopts;
+    sha256_engine_opts_init (&eopts);
+
+    eopts.algo       = algo->name;
+    eopts.backend    = (backend == BACKEND_OPENCL) ? SHA256_ENGINE_BACKEND_OPENCL
+                     : (backend == BACKEND_NATIVE) ? SHA256_ENGINE_BACKEND_NATIVE : SHA256_ENGINE_BACKEND_AUTO;
+    eopts.devices    = devices_spec;
+    eopts.pipeline   = pipeline_depth;
+    eopts.local_size = local_size_opt;
+    eopts.autotune   = autotune;
+    eopts.cache_dir  = use_cache ? cache_dir : NULL;
+    eopts.threads    = host_threads;
+    eopts.cpu_impl   = cpu_impl;
+
+    return run_serve (serve_path, &eopts, serve_batch, serve_latency_ms);
+  }
+
+  if (argc - optind != 2)
+  {
+    fprintf (stderr, usage, argv[0], argv[0], argv[0]);
+    return 1;
+  }
+
+  const unsigned digest_bytes = algo->digest_words * 4u;
+
+  if (out_bytes > digest_bytes)
+  {
+    fprintf (stderr, "--out-bytes must be between 1 and %u for %s\n", digest_bytes, algo->name);
+    return 1;
+  }
+
+  // 搜索模式的输出是 "行号:hex"，固定文本
+  if (search_path && (out_format != OUT_FORMAT_HEX || (out_bytes != 0 && out_bytes != digest_bytes)))
+  {
+    fprintf (stderr, "--out-format / --out-bytes cannot be combined with --search\n");
+    return 1;
+  }
+
+  if (search_path && !algo->search)
+  {
+    fprintf (stderr, "--search is not supported with --algo %s\n", algo->name);
+    return 1;
+  }
+
+  if (vector_width > 1 && !algo->kernel_vector)
+  {
+    fprintf (stderr, "--vector is not supported with --algo %s\n", algo->name);
+    return 1;
+  }
+
+  if (hmac_per_line)
+  {
+    if (hmac.key)
+    {
+      fprintf (stderr, "--hmac-per-line cannot be combined with --hmac-key / --hmac-key-hex\n");
+      return 1;
+    }
+
+    hmac.mode = HMAC_PER_LINE;
+  }
+
+  if (hmac.mode != HMAC_NONE && vector_width > 1)
+  {
+    fprintf (stderr, "--vector cannot be combined with HMAC\n");
+    return 1;
+  }
+
+  // 每行的 key 和消息在行内的偏移任意，只有 packed kernel 能直接按字节偏移读
+  if (hmac.mode == HMAC_PER_LINE && layout != LAYOUT_PACKED)
+  {
+    fprintf (stderr, "[OpenCL] --hmac-per-line uses the packed layout\n");
+    layout = LAYOUT_PACKED;
+  }
+
+  if (salt_per_line)
+  {
+    if (salt.salt)
+    {
+      fprintf (stderr, "--salt-per-line cannot be combined with --salt / --salt-hex\n");
+      return 1;
+    }
+
+    salt.mode = SALT_PER_LINE;
+  }
+
+  if (salt.mode == SALT_SHARED && salt.salt_len > SALT_MAX_LEN)
+  {
+    fprintf (stderr, "--salt / --salt-hex must be at most %u bytes\n", SALT_MAX_LEN);
+    return 1;
+  }
+
+  // HMAC 有自己的 key 状态，跟 salt 占同一个 kernel 参数位置；加盐的行照样可以再 --iterations
+  if (salt.mode != SALT_NONE && (hmac.mode != HMAC_NONE || kdf.mode == KDF_PBKDF2 || stream.enabled))
+  {
+    fprintf (stderr, "--salt / --salt-hex / --salt-per-line cannot be combined with HMAC, --pbkdf2-salt or --stream\n");
+    return 1;
+  }
+
+  if (salt.mode == SALT_SHARED && vector_width > 1)
+  {
+    fprintf (stderr, "--vector cannot be combined with --salt / --salt-hex\n");
+    return 1;
+  }
+
+  // 每行的 salt 和行在行内的偏移任意，跟 --hmac-per-line 一样走 packed
+  if (salt.mode == SALT_PER_LINE && layout != LAYOUT_PACKED)
+  {
+    fprintf (stderr, "[OpenCL] --salt-per-line uses the packed layout\n");
+    layout = LAYOUT_PACKED;
+  }
+
+  // 没给 salt 时 --iterations 就是对 digest 反复做哈希；PBKDF2 的 password 就是整行，不再叠加 HMAC
+  if (kdf.mode == KDF_NONE && kdf.iterations > 1) kdf.mode = KDF_ITER;
+
+  if (kdf.mode != KDF_NONE && hmac.mode != HMAC_NONE)
+  {
+    fprintf (stderr, "--iterations / --pbkdf2-salt cannot be combined with HMAC\n");
+    return 1;
+  }
+
+  // 迭代模式把 digests 当状态缓冲，搜索模式没有这个缓冲
+  if (kdf.mode == KDF_ITER && search_path)
+  {
+    fprintf (stderr, "--iterations without --pbkdf2-salt cannot be combined with --search\n");
+    return 1;
+  }
+
+  // PBKDF2 的 password 是整行、按任意字节偏移读，跟 --hmac-per-line 一样走 packed
+  if (kdf.mode == KDF_PBKDF2 && layout != LAYOUT_PACKED)
+  {
+    fprintf (stderr, "[OpenCL] --pbkdf2-salt uses the packed layout\n");
+    layout = LAYOUT_PACKED;
+  }
+
+  // --mask 只把命中带回来，所以要配 --search；base word 按任意字节偏移读，走 packed
+  if (mask_text)
+  {
+    if (!search_path)
+    {
+      fprintf (stderr, "--mask requires --search\n");
+      return 1;
+    }
+
+    if (hmac.mode != HMAC_NONE || kdf.mode != KDF_NONE || salt.mode == SALT_PER_LINE)
+    {
+      fprintf (stderr, "--mask cannot be combined with HMAC, --iterations / --pbkdf2-salt or --salt-per-line\n");
+      return 1;
+    }
+
+    if (mask_parse (mask_text, &mask) != 0) return 1;
+
+    if (layout != LAYOUT_PACKED)
+    {
+      fprintf (stderr, "[OpenCL] --mask uses the packed layout\n");
+      layout = LAYOUT_PACKED;
+    }
+
+    fprintf (stderr, "[OpenCL] Mask: %s, %u positions, %llu candidates per word\n",
+             mask_text, mask.len, (unsigned long long) mask.keyspace);
+  }
+
+  // 宽化只做在每行的消息上：per-line HMAC 的 key、PBKDF2 的 password 和 --stream 的文件内容都不动
+  if (encoding != ENCODING_RAW && (hmac.mode == HMAC_PER_LINE || kdf.mode == KDF_PBKDF2 || stream.enabled))
+  {
+    fprintf (stderr, "--encoding utf16le cannot be combined with --hmac-per-line, --pbkdf2-salt or --stream\n");
+    return 1;
+  }
+
+  if (stream.enabled && (search_path || hmac.mode != HMAC_NONE || kdf.mode != KDF_NONE))
+  {
+    fprintf (stderr, "--stream cannot be combined with --search, HMAC or --iterations / --pbkdf2-salt\n");
+    return 1;
+  }
+
+  // Merkle 输出是根（和审计路径）的 hex 文本
+  if (merkle && (search_path || stream.enabled || out_format != OUT_FORMAT_HEX
+                 || (out_bytes != 0 && out_bytes != digest_bytes)))
+  {
+    fprintf (stderr, "--merkle cannot be combined with --search, --stream, --out-format or --out-bytes\n");
+    return 1;
+  }
+
+  // --dedup 的输出是 "行号:hex" 文本（或每批的计数），只对逐行的 digest 有意义
+  if (dedup != DEDUP_NONE && (search_path || stream.enabled || merkle || out_format != OUT_FORMAT_HEX))
+  {
+    fprintf (stderr, "--dedup cannot be combined with --search, --stream, --merkle or --out-format raw\n");
+    return 1;
+  }
+
+  // 原生 CPU 和 CUDA / HIP 后端只做普通的逐行哈希
+  const int plain_hash = !search_path && hmac.mode == HMAC_NONE && kdf.mode == KDF_NONE && salt.mode == SALT_NONE
+                         && !stream.enabled && !merkle && dedup == DEDUP_NONE;
+
+  // 原生 CPU 后端不经过 PCIe，没有在设备上宽化的必要，只做原始字节
+  if (backend == BACKEND_NATIVE && encoding != ENCODING_RAW)
+  {
+    fprintf (stderr, "--encoding utf16le is not supported with --backend native\n");
+    return 1;
+  }
+
+  if ((backend == BACKEND_NATIVE || backend == BACKEND_CUDA || backend == BACKEND_HIP) && !plain_hash)
+  {
+    fprintf (stderr, "--search, HMAC, --salt, --iterations / --pbkdf2-salt, --stream, --merkle and --dedup are not supported with --backend %s\n",
+             (backend == BACKEND_NATIVE) ? "native" : (backend == BACKEND_CUDA) ? "cuda" : "hip");
+    return 1;
+  }
+
+  // CUDA / HIP 只用一个设备：--devices N 是它自己的设备编号
+  int gpu_ordinal = 0;
+
+  if ((backend == BACKEND_CUDA || backend == BACKEND_HIP) && devices_spec)
+  {
+    char *end = NULL;
+
+    gpu_ordinal = (int) strtol (devices_spec, &end, 10);
+    if (end == devices_spec || *end || gpu_ordinal < 0)
+    {
+      fprintf (stderr, "--backend cuda / hip uses one device: --devices N\n");
+      return 1;
+    }
+  }
+
+  if (cpu_impl != NATIVE_IMPL_AUTO && !native_impl_supported (cpu_impl, algo->native_algo))
+  {
+    fprintf (stderr, "--cpu-impl %s is not supported for --algo %s on this CPU\n",
+             native_impl_name (cpu_impl), algo->name);
+    return 1;
+  }
+
+  // 除最后一块外每轮都是整数个 block，launch 之间 ctx 的 block 缓冲才总是空的
+  stream.chunk_bytes = (stream.chunk_bytes + algo->block_bytes - 1) / algo->block_bytes * algo->block_bytes;
+
+  if (out_bytes == 0) out_bytes = digest_bytes;
+
+  const char *input_path  = argv[optind + 0];
+  const char *output_path = argv[optind + 1];
+
+  // 0. 打开输入 / 输出文件（"-" 是 stdin / stdout）
+  FILE *fin = (strcmp (input_path, "-") == 0) ? stdin : fopen (input_path, "rb");
+  if (!fin)
+  {
+    perror (input_path);
+    return 1;
+  }
+
+  FILE *fout = (strcmp (output_path, "-") == 0) ? stdout : fopen (output_path, "wb");
+  if (!fout)
+  {
+    perror (output_path);
+    fclose (fin);
+    return 1;
+  }
+
+  const double flush_s = flush_ms * 1e-3;
+
+  // 1. 枚举所有平台的所有设备，按 --devices 选出要用的（--backend native 不碰 OpenCL）
+  device_entry_t all_devices[64];
+  const unsigned num_all = (backend == BACKEND_OPENCL || backend == BACKEND_AUTO) ? enumerate_devices (all_devices, 64) : 0;
+
+  // auto：没指定 --devices、也没有 GPU 时，普通哈希交给原生 CPU 实现（比 CPU 的 OpenCL runtime 快）
+  if (backend == BACKEND_AUTO && plain_hash && encoding == ENCODING_RAW && !devices_spec)
+  {
+    unsigned num_gpus = 0;
+
+    for (unsigned i = 0; i < num_all; i++)
+    {
+      if (all_devices[i].type & CL_DEVICE_TYPE_GPU) num_gpus++;
+    }
+
+    if (num_gpus == 0)
+    {
+      fprintf (stderr, "[Native] No OpenCL GPU found (%u other devices), using the native CPU backend\n", num_all);
+      backend = BACKEND_NATIVE;
+    }
+  }
+
+  if (backend == BACKEND_NATIVE)
+  {
+    const int impl = (cpu_impl == NATIVE_IMPL_AUTO) ? native_impl_best (algo->native_algo) : cpu_impl;
+    uint32_t native_lines = batch_lines_opt ? batch_lines_opt : NATIVE_BATCH_LINES;
+
+    fprintf (stderr, "[Native] Algorithm: %s, implementation: %s, threads: %u, up to %u lines per batch\n",
+             algo->label, native_impl_name (impl), host_threads, batch_lines_opt ? batch_lines_opt : NATIVE_BATCH_LINES);
+
+    if (devices_spec) fprintf (stderr, "[Native] --devices is ignored with --backend native\n");
+
+    line_reader_t reader;
+    line_reader_init (&reader, fin, host_threads);
+
+    reader.flush_s = flush_s;
+
+    out_writer_t writer;
+    out_writer_init (&writer, fout, host_threads, out_format, out_bytes, algo->digest_words);
+
+    // --max-mem：一半给读入的原始数据，另一半给每行的索引 + digest + 输出记录
+    if (max_mem)
+    {
+      const size_t per_line = 2 * sizeof (uint32_t) + digest_bytes + writer.rec_bytes;
+
+      line_reader_cap_mem (&reader, max_mem / 2);
+
+      if (max_mem / 2 / per_line < native_lines) native_lines = (uint32_t) (max_mem / 2 / per_line);
+
+      fprintf (stderr, "[Native] Memory cap: %zu MB, up to %u lines / %zu MB of input per batch\n",
+               max_mem >> 20, native_lines, reader.max_bytes >> 20);
+    }
+
+    metrics_t metrics;
+    metrics_open (&metrics, metrics_format, metrics_path, algo->name);
+
+    metrics.label  = "Native";
+    writer.metrics = &metrics;
+
+    if (use_mmap)
+    {
+      if (line_reader_map (&reader) == 0)
+      {
+        fprintf (stderr, "[Native] Input: mmap, %u scan threads\n", host_threads);
+      }
+      else
+      {
+        fprintf (stderr, "[Native] Input: %s is not mappable, falling back to fread\n", input_path);
+      }
+    }
+
+    const double wall_start = now_seconds ();
+
+    double hash_time_s = 0.0;
+
+    const unsigned long long total_msgs = run_native (&reader, &writer, algo, impl, host_threads, native_lines,
+                                                      &hash_time_s);
+
+    const double wall_time_s = now_seconds () - wall_start;
+
+    if (total_msgs > 0 && hash_time_s > 0.0)
+    {
+      double hps  = (double) total_msgs / hash_time_s;
+      double mhps = hps / 1e6;
+
+      fprintf (stderr,
+               "[Native] TOTAL: messages = %llu, hash time = %.3f ms, speed = %.2f MH/s (%.3e H/s)\n",
+               total_msgs, hash_time_s * 1e3, mhps, hps);
+    }
+
+    if (total_msgs > 0 && wall_time_s > 0.0)
+    {
+      double hps  = (double) total_msgs / wall_time_s;
+      double mhps = hps / 1e6;
+
+      fprintf (stderr,
+               "[Native] TOTAL: messages = %llu, end-to-end time = %.3f ms, speed = %.2f MH/s (%.3e H/s)\n",
+               total_msgs, wall_time_s * 1e3, mhps, hps);
+    }
+
+    metrics_finish (&metrics, &writer, wall_time_s);
+
+    line_reader_free (&reader);
+    out_writer_free (&writer);
+    fclose (fin);
+    fclose (fout);
+
+    return 0;
+  }
+
+  if (backend == BACKEND_CUDA || backend == BACKEND_HIP)
+  {
+    gpu_ctx_t *g = (gpu_ctx_t *) calloc (1, sizeof (gpu_ctx_t));
+    if (!g)
+    {
+      fprintf (stderr, "malloc failed for GPU context\n");
+      return 1;
+    }
 
-#define _GNU_SOURCE
-#define CL_TARGET_OPENCL_VERSION 120
-#include <CL/cl.h>
-
-/*
- * 在很多系统里，如果 CL_TARGET_OPENCL_VERSION < 200，
- * 头文件不会声明 cl_queue_properties 和 clCreateCommandQueueWithProperties。
- * 这里自己补上 typedef + 原型，方便在 OpenCL 1.2 头文件下使用 2.0 API。
- */
-#ifndef CL_VERSION_2_0
-typedef cl_bitfield cl_queue_properties;
-extern CL_API_ENTRY cl_command_queue CL_API_CALL
-clCreateCommandQueueWithProperties (cl_context                 context,
-                                    cl_device_id               device,
-                                    const cl_queue_properties *properties,
-                                    cl_int                    *errcode_ret);
-#endif
+    gpu_setup (g, (backend == BACKEND_CUDA) ? GPU_API_CUDA : GPU_API_HIP, gpu_ordinal, algo, encoding, pipeline_depth,
+               local_size_opt, use_cache ? cache_dir : NULL);
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <stdint.h>
-#include <string.h>
+    // 每个 slot 最多用显存的 1 / (2 x 深度)，一半给原始数据，一半给每行的偏移 / 长度 / digest
+    // --max-mem：pinned staging 跟设备 buffer 一样大，host 上再留读入和输出各一份
+    size_t slot_bytes = g->total_mem / (2u * pipeline_depth);
 
-#define CHECK_CL(err, msg) \
-  do { \
-    if ((err) != CL_SUCCESS) { \
-      fprintf(stderr, "%s failed with error %d\n", (msg), (err)); \
-      exit(1); \
-    } \
-  } while (0)
+    if (max_mem && max_mem / (pipeline_depth + 2u) < slot_bytes) slot_bytes = max_mem / (pipeline_depth + 2u);
 
-// 一批最多处理多少行（可根据内存调大或调小）
-#define MAX_BATCH_LINES 50000000u  // 5000 万
+    uint32_t gpu_lines = batch_lines_opt;
 
-// 读取 CL 源码文件
-static char *read_text_file (const char *path, size_t *out_size)
-{
-  FILE *f = fopen (path, "rb");
-  if (!f)
-  {
-    perror (path);
-    exit (1);
-  }
+    if (!gpu_lines)
+    {
+      const size_t fit = slot_bytes / 2 / (2 * sizeof (uint32_t) + digest_bytes);
 
-  if (fseek (f, 0, SEEK_END) != 0)
-  {
-    perror ("fseek");
-    exit (1);
-  }
+      gpu_lines = (fit < GPU_BATCH_LINES) ? (uint32_t) fit : GPU_BATCH_LINES;
+      if (gpu_lines < 1) gpu_lines = 1;
+    }
 
-  long len = ftell (f);
-  if (len < 0)
-  {
-    perror ("ftell");
-    exit (1);
-  }
-  rewind (f);
+    line_reader_t reader;
+    line_reader_init (&reader, fin, host_threads);
 
-  char *buf = (char *) malloc ((size_t) len + 1);
-  if (!buf)
-  {
-    fprintf (stderr, "malloc failed for %s\n", path);
-    exit (1);
-  }
+    if (slot_bytes / 2 - PACKED_TAIL_PAD < reader.max_bytes) reader.max_bytes = slot_bytes / 2 - PACKED_TAIL_PAD;
 
-  size_t nread = fread (buf, 1, (size_t) len, f);
-  fclose (f);
+    if (max_mem) line_reader_cap_mem (&reader, slot_bytes / 2);
 
-  buf[nread] = '\0';
-  if (out_size) *out_size = nread;
-  return buf;
-}
+    reader.flush_s    = flush_s;
+    reader.check_utf8 = (encoding == ENCODING_UTF16LE);
 
-// 打印平台和设备信息
-static void print_platform_device_info (cl_platform_id platform, cl_device_id device)
-{
-  char buf[256];
-  size_t sz = 0;
+    fprintf (stderr, "[%s] Algorithm: %s, pipeline depth: %u, up to %u lines / %zu MB per batch%s\n",
+             g->api.label, algo->label, pipeline_depth, gpu_lines, reader.max_bytes >> 20,
+             batch_lines_opt ? " (--batch-lines)" : "");
 
-  if (clGetPlatformInfo (platform, CL_PLATFORM_NAME, sizeof (buf), buf, &sz) == CL_SUCCESS)
-  {
-    if (sz >= sizeof (buf)) sz = sizeof (buf) - 1;
-    buf[sz] = '\0';
-    fprintf (stderr, "[OpenCL] Platform: %s\n", buf);
+    out_writer_t writer;
+    out_writer_init (&writer, fout, host_threads, out_format, out_bytes, algo->digest_words);
+
+    metrics_t metrics;
+    metrics_open (&metrics, metrics_format, metrics_path, algo->name);
+
+    metrics.label  = g->api.label;
+    writer.metrics = &metrics;
+
+    if (use_mmap)
+    {
+      if (line_reader_map (&reader) == 0)
+      {
+        fprintf (stderr, "[%s] Input: mmap, %u scan threads\n", g->api.label, host_threads);
+      }
+      else
+      {
+        fprintf (stderr, "[%s] Input: %s is not mappable, falling back to fread\n", g->api.label, input_path);
+      }
+    }
+
+    const double wall_start = now_seconds ();
+
+    const unsigned long long total_msgs = run_gpu (g, &reader, &writer, gpu_lines);
+
+    const double wall_time_s = now_seconds () - wall_start;
+
+    if (total_msgs > 0 && g->kernel_time_s > 0.0)
+    {
+      double hps  = (double) total_msgs / g->kernel_time_s;
+      double mhps = hps / 1e6;
+
+      fprintf (stderr,
+               "[%s] TOTAL: messages = %llu, kernel time = %.3f ms, speed = %.2f MH/s (%.3e H/s)\n",
+               g->api.label, total_msgs, g->kernel_time_s * 1e3, mhps, hps);
+    }
+
+    if (total_msgs > 0 && wall_time_s > 0.0)
+    {
+      double hps  = (double) total_msgs / wall_time_s;
+      double mhps = hps / 1e6;
+
+      fprintf (stderr,
+               "[%s] TOTAL: messages = %llu, end-to-end time = %.3f ms, speed = %.2f MH/s (%.3e H/s)\n",
+               g->api.label, total_msgs, wall_time_s * 1e3, mhps, hps);
+    }
+
+    metrics_finish (&metrics, &writer, wall_time_s);
+
+    const int utf8_bad = reader.utf8_bad;  // line_reader_free 会清零 reader
+
+    line_reader_free (&reader);
+    out_writer_free (&writer);
+    fclose (fin);
+    fclose (fout);
+
+    gpu_release (g);
+    free (g);
+
+    return utf8_bad ? 1 : 0;
   }
 
-  if (clGetDeviceInfo (device, CL_DEVICE_NAME, sizeof (buf), buf, &sz) == CL_SUCCESS)
+  if (num_all == 0)
   {
-    if (sz >= sizeof (buf)) sz = sizeof (buf) - 1;
-    buf[sz] = '\0';
-    fprintf (stderr, "[OpenCL] Device  : %s\n", buf);
+    fprintf (stderr, "No OpenCL devices found on any platform\n");
+    fclose (fin);
+    fclose (fout);
+    return 1;
   }
-}
 
-// digest[32] -> hex[65]
-static void digest_to_hex (const uint8_t *digest, char *hex_out)
-{
-  static const char hexdig[] = "0123456789abcdef";
-  for (int i = 0; i < 32; i++)
+  if (devices_spec || num_all > 1)
   {
-    unsigned v = digest[i];
-    hex_out[i*2+0] = hexdig[v >> 4];
-    hex_out[i*2+1] = hexdig[v & 0xF];
+    for (unsigned i = 0; i < num_all; i++)
+    {
+      char name[256] = "";
+      clGetDeviceInfo (all_devices[i].device, CL_DEVICE_NAME, sizeof (name) - 1, name, NULL);
+
+      fprintf (stderr, "[OpenCL] Available device %u: %s (%s)\n", i, name,
+               (all_devices[i].type & CL_DEVICE_TYPE_GPU) ? "GPU" :
+               (all_devices[i].type & CL_DEVICE_TYPE_CPU) ? "CPU" : "other");
+    }
   }
-  hex_out[64] = '\0';
-}
 
-int main (int argc, char **argv)
-{
-  if (argc != 3)
+  unsigned dev_sel[MAX_DEVICES];
+  unsigned num_devs = select_devices (all_devices, num_all, devices_spec, dev_sel);
+
+  if (num_devs == 0)
   {
-    fprintf (stderr, "Usage: %s <input_file> <output_file>\n", argv[0]);
+    fclose (fin);
+    fclose (fout);
     return 1;
   }
 
-  const char *input_path  = argv[1];
-  const char *output_path = argv[2];
+  // 同一个文件的块必须按顺序更新同一份设备状态，流式模式只用一个设备；
+  // Merkle 的叶子要常驻同一块设备内存，也只用一个设备
+  if ((stream.enabled || merkle) && num_devs > 1)
+  {
+    fprintf (stderr, "[OpenCL] %s uses only the first selected device\n", stream.enabled ? "--stream" : "--merkle");
+    num_devs = 1;
+  }
 
-  cl_int err;
+  fprintf (stderr, "[OpenCL] Algorithm: %s%s, pipeline depth: %u, devices: %u\n",
+           (hmac.mode != HMAC_NONE) ? "HMAC-" : "", algo->label, pipeline_depth, num_devs);
 
-  // 0. 打开输入 / 输出文件
-  FILE *fin = fopen (input_path, "rb");
-  if (!fin)
+  if (hmac.mode == HMAC_SHARED)
   {
-    perror (input_path);
-    return 1;
+    fprintf (stderr, "[OpenCL] HMAC: shared key (%zu bytes), ipad/opad state precomputed per device\n",
+             hmac.key_len);
   }
-
-  FILE *fout = fopen (output_path, "wb");
-  if (!fout)
+  else if (hmac.mode == HMAC_PER_LINE)
   {
-    perror (output_path);
-    fclose (fin);
-    return 1;
+    fprintf (stderr, "[OpenCL] HMAC: per-line keys (key:message)\n");
   }
 
-  // 1. 选择 OpenCL 平台 & 设备
-  cl_uint num_platforms = 0;
-  CHECK_CL (clGetPlatformIDs (0, NULL, &num_platforms), "clGetPlatformIDs(count)");
-
-  if (num_platforms == 0)
+  if (salt.mode == SALT_SHARED)
   {
-    fprintf (stderr, "No OpenCL platforms found\n");
-    fclose (fin);
-    fclose (fout);
-    return 1;
+    fprintf (stderr, "[OpenCL] Salt: shared %s (%zu bytes)%s\n",
+             (salt.pos == SALT_PREFIX) ? "prefix, H (salt . line)" : "suffix, H (line . salt)", salt.salt_len,
+             (salt.pos == SALT_PREFIX) ? ", midstate precomputed per device" : "");
+  }
+  else if (salt.mode == SALT_PER_LINE)
+  {
+    fprintf (stderr, "[OpenCL] Salt: per-line salts (salt:line), %s\n",
+             (salt.pos == SALT_PREFIX) ? "H (salt . line)" : "H (line . salt)");
   }
 
-  cl_platform_id *platforms =
-      (cl_platform_id *) malloc (sizeof (cl_platform_id) * num_platforms);
-  CHECK_CL (clGetPlatformIDs (num_platforms, platforms, NULL),
-            "clGetPlatformIDs(list)");
+  if (dedup != DEDUP_NONE)
+  {
+    fprintf (stderr, "[OpenCL] Dedup: device hash table per batch, %s\n",
+             (dedup == DEDUP_FIRST) ? "first occurrences read back as line:hex" : "unique counts only (first_line:lines:unique)");
+  }
 
-  cl_platform_id chosen_platform = NULL;
-  cl_device_id   chosen_device   = NULL;
+  if (merkle)
+  {
+    fprintf (stderr, "[OpenCL] Merkle: leaves = %s of each line, parent = %s (left || right), leaves stay on the device\n",
+             algo->label, algo->label);
+  }
 
-  for (cl_uint pi = 0; pi < num_platforms; pi++)
+  if (stream.enabled)
   {
-    cl_platform_id p = platforms[pi];
+    fprintf (stderr, "[OpenCL] Stream: input is a list of file paths, %zu bytes per file per launch, %u files per group\n",
+             stream.chunk_bytes, stream.group_files);
+  }
 
-    cl_uint num_devices = 0;
-    cl_int err_local;
+  if (kdf.mode != KDF_NONE)
+  {
+    const unsigned loop_launches = (kdf.iterations - 1 + kdf.loop_chunk - 1) / kdf.loop_chunk;
 
-    // 优先 GPU，再 CPU，最后 ALL
-    err_local = clGetDeviceIDs (p, CL_DEVICE_TYPE_GPU, 0, NULL, &num_devices);
-    if (err_local == CL_DEVICE_NOT_FOUND || num_devices == 0)
+    if (kdf.mode == KDF_PBKDF2)
     {
-      err_local = clGetDeviceIDs (p, CL_DEVICE_TYPE_CPU, 0, NULL, &num_devices);
+      fprintf (stderr, "[OpenCL] KDF: PBKDF2-HMAC-%s, %u iterations, salt %zu bytes, dkLen %u\n",
+               algo->label, kdf.iterations, kdf.salt_len, digest_bytes);
     }
-    if (err_local == CL_DEVICE_NOT_FOUND || num_devices == 0)
+    else
     {
-      err_local = clGetDeviceIDs (p, CL_DEVICE_TYPE_ALL, 0, NULL, &num_devices);
+      fprintf (stderr, "[OpenCL] KDF: iterated %s, %u iterations\n", algo->label, kdf.iterations);
     }
 
-    if (err_local != CL_SUCCESS || num_devices == 0)
-    {
-      continue;
-    }
+    fprintf (stderr, "[OpenCL] KDF: %u iterations per launch, %u loop launches per batch\n",
+             kdf.loop_chunk, loop_launches);
+  }
+
+  // 2. 搜索模式：目标和 bitmap 在 host 上只准备一次
+  search_ctx_t  search_ctx;
+  search_ctx_t *search = NULL;
 
-    cl_device_id *devices =
-        (cl_device_id *) malloc (sizeof (cl_device_id) * num_devices);
-    CHECK_CL (clGetDeviceIDs (p, CL_DEVICE_TYPE_ALL, num_devices, devices, NULL),
-              "clGetDeviceIDs(list)");
+  if (search_path)
+  {
+    memset (&search_ctx, 0, sizeof (search_ctx));
 
-    chosen_platform = p;
-    chosen_device   = devices[0];
+    load_search_targets (search_path, &search_ctx);
+    search_build (&search_ctx);
 
-    free (devices);
-    break;
+    search_ctx.mask = mask_text ? &mask : NULL;
+
+    search = &search_ctx;
   }
 
-  if (chosen_platform == NULL || chosen_device == NULL)
+  // 3. 每个设备：context / slot queue / 常驻搜索 buffer / program / kernel
+  device_ctx_t *devs = (device_ctx_t *) calloc (num_devs, sizeof (device_ctx_t));
+  if (!devs)
   {
-    fprintf (stderr, "No OpenCL devices found on any platform\n");
-    free (platforms);
-    fclose (fin);
-    fclose (fout);
+    fprintf (stderr, "malloc failed for device contexts\n");
     return 1;
   }
 
-  cl_platform_id platform = chosen_platform;
-  cl_device_id   device   = chosen_device;
+  for (unsigned d = 0; d < num_devs; d++)
+  {
+    CHECK_DEV (device_setup (&devs[d], dev_sel[d], &all_devices[dev_sel[d]], algo, pipeline_depth, search, &hmac, &kdf,
+                             &salt, encoding, vector_width, layout, use_single_block, local_size_opt, autotune,
+                             use_cache ? cache_dir : NULL));
 
-  free (platforms);
+    devs[d].merkle = merkle;
 
-  print_platform_device_info (platform, device);
+    dedup_setup (&devs[d], dedup, pipeline_depth);
+  }
 
-  // 2. 创建 context & queue（带 profiling）
-  cl_context context = clCreateContext (NULL, 1, &device, NULL, NULL, &err);
-  CHECK_CL (err, "clCreateContext");
+  // 多设备时 batch 的完成顺序和提交顺序不一致：先收进环形缓冲，再按顺序写出。
+  // 环的容量 = 全部 slot 数的两倍，积压超过它就等最老的那一批。
+  const unsigned ring_cap = 2u * num_devs * pipeline_depth;
 
-  const cl_queue_properties props[] =
+  batch_out_t *ring = (batch_out_t *) calloc (ring_cap, sizeof (batch_out_t));
+  if (!ring)
   {
-    CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE,
-    0
-  };
+    fprintf (stderr, "malloc failed for output ring\n");
+    return 1;
+  }
 
-  cl_command_queue queue =
-      clCreateCommandQueueWithProperties (context, device, props, &err);
-  CHECK_CL (err, "clCreateCommandQueueWithProperties");
 
-  // 3. 读取 & 编译 sha256_wrapper.cl （只编译一次）
-  size_t src_size = 0;
-  char *src = read_text_file ("sha256_wrapper.cl", &src_size);
+  // 4. 输入读取器（arena + 行索引，跨 batch 复用）
+  //    每批的行数按设备内存算；原始数据的上限同时受 MAX_ALLOC（packed 的 buf_msgs）和
+  //    slot 预算的一半（另一半留给每行的索引 / 输出）限制
+  batch_budget_t budget;
+  batch_budget_init (&budget, devs, num_devs, pipeline_depth, &hmac, &kdf, search != NULL, dedup, batch_lines_opt);
 
-  const char  *sources[] = { src };
-  const size_t lengths[] = { src_size };
+  // --max-mem：每个 slot 的 pinned staging 跟它的设备 buffer 一样大，host 上再留读入和输出各一份
+  const unsigned mem_slices = num_devs * pipeline_depth + 2u;
 
-  cl_program program =
-      clCreateProgramWithSource (context, 1, sources, lengths, &err);
-  CHECK_CL (err, "clCreateProgramWithSource");
+  if (max_mem && max_mem / mem_slices < budget.slot_bytes) budget.slot_bytes = max_mem / mem_slices;
 
-  const char *build_opts = NULL; // 如需 -I/path/to/hashcat/OpenCL 在这里加
+  double   line_bytes      = (double) algo->block_bytes;  // 每行消息占的设备字节，按上一批更新
+  uint32_t max_batch_lines = batch_lines_for (&budget, line_bytes);
 
-  err = clBuildProgram (program, 1, &device, build_opts, NULL, NULL);
-  if (err != CL_SUCCESS)
-  {
-    size_t log_size = 0;
-    clGetProgramBuildInfo (program, device, CL_PROGRAM_BUILD_LOG,
-                           0, NULL, &log_size);
+  line_reader_t reader;
+  line_reader_init (&reader, fin, host_threads);
+
+  if (budget.max_alloc - PACKED_TAIL_PAD < reader.max_bytes) reader.max_bytes = budget.max_alloc - PACKED_TAIL_PAD;
+  if (budget.slot_bytes / 2              < reader.max_bytes) reader.max_bytes = budget.slot_bytes / 2;
 
-    char *log = (char *) malloc (log_size + 1);
-    clGetProgramBuildInfo (program, device, CL_PROGRAM_BUILD_LOG,
-                           log_size, log, NULL);
-    log[log_size] = '\0';
+  if (max_mem) line_reader_cap_mem (&reader, budget.slot_bytes / 2);
 
-    fprintf (stderr, "Build failed:\n%s\n", log);
-    free (log);
-    CHECK_CL (err, "clBuildProgram");
+  reader.flush_s    = flush_s;
+  reader.check_utf8 = (encoding == ENCODING_UTF16LE);
+
+  if (max_mem)
+  {
+    fprintf (stderr, "[OpenCL] Memory cap: %zu MB host memory in %u slices (%u slots + input + output)\n",
+             max_mem >> 20, mem_slices, mem_slices - 2u);
   }
 
-  free (src);
+  fprintf (stderr, "[OpenCL] Batch memory: %zu MB per slot, max alloc %zu MB, first batch up to %u lines%s\n",
+           budget.slot_bytes >> 20, budget.max_alloc >> 20, max_batch_lines,
+           batch_lines_opt ? " (--batch-lines)" : "");
 
-  cl_kernel kernel = clCreateKernel (program, "sha256_wrapper", &err);
-  CHECK_CL (err, "clCreateKernel");
+  // 输出：hex 格式化和 writev 在一个地方
+  out_writer_t writer;
+  out_writer_init (&writer, fout, host_threads, out_format, out_bytes, algo->digest_words);
 
-  // 4. 为 batch 分配复用的 host 侧辅助数组
-  uint32_t max_batch_lines = MAX_BATCH_LINES;
+  metrics_t metrics;
+  metrics_open (&metrics, metrics_format, metrics_path, algo->name);
 
-  char     **line_bufs = (char   **) malloc (max_batch_lines * sizeof (char *));
-  uint32_t *lens_host  = (uint32_t *) malloc (max_batch_lines * sizeof (uint32_t));
-  if (!line_bufs || !lens_host)
-  {
-    fprintf (stderr, "malloc failed for batch metadata\n");
-    fclose (fin);
-    fclose (fout);
-    return 1;
-  }
+  writer.metrics = &metrics;
 
-  // 用于 getline
-  char  *line    = NULL;
-  size_t linecap = 0;
+  // slot 的调度（挑设备 / 空 slot、积压、收尾）跟引擎共用 slot_pipeline_t，收尾的结果进 out_ring
+  out_ring_t out_ring;
 
-  // 统计整体性能
-  double              total_kernel_time_s = 0.0;
-  unsigned long long  total_msgs          = 0ULL;
-  unsigned int        batch_index         = 0;
+  out_ring.ring        = ring;
+  out_ring.cap         = ring_cap;
+  out_ring.next_write  = 1;
+  out_ring.batch_index = 0;
+  out_ring.w           = &writer;
+  out_ring.sc          = search;
 
-  for (;;)
-  {
-    // 5. 读一批行
-    uint32_t num_msgs = 0;
-    size_t   max_len  = 0;
+  slot_pipeline_t pl;
+
+  pl.devs         = devs;
+  pl.num_devs     = num_devs;
+  pl.depth        = pipeline_depth;
+  pl.retire       = retire_slot;
+  pl.backlog_full = out_ring_full;
+  pl.ctx          = &out_ring;
 
-    for (;;)
+  if (use_mmap)
+  {
+    if (line_reader_map (&reader) == 0)
+    {
+      fprintf (stderr, "[OpenCL] Input: mmap, %u scan threads\n", host_threads);
+    }
+    else
     {
-      if (num_msgs >= max_batch_lines) break;
+      fprintf (stderr, "[OpenCL] Input: %s is not mappable, falling back to fread\n", input_path);
+    }
+  }
 
-      ssize_t linelen = getline (&line, &linecap, fin);
-      if (linelen < 0) break; // EOF
+  unsigned int batch_index = 0;
 
-      size_t len = (size_t) linelen;
+  const double wall_start = now_seconds ();
 
-      // 去掉末尾 '\n'
-      if (len > 0 && line[len - 1] == '\n')
-      {
-        len--;
-      }
+  // --stream：清单整个交给 run_stream，下面的批处理循环读不到行，直接结束
+  if (stream.enabled) run_stream (&devs[0], &reader, &writer, &stream, pipeline_depth);
 
-      char *copy = (char *) malloc (len > 0 ? len : 1);
-      if (!copy)
-      {
-        fprintf (stderr, "malloc failed for line copy\n");
-        exit (1);
-      }
-      if (len > 0) memcpy (copy, line, len);
+  for (;;)
+  {
+    // 5. 读一批行（此时前面的 batch 还在设备上跑）
+    size_t   max_len  = 0;
+    double   t_read   = now_seconds ();
+    uint32_t num_msgs = line_reader_fill (&reader, max_batch_lines, &max_len);
 
-      line_bufs[num_msgs] = copy;
-      lens_host[num_msgs] = (uint32_t) len;
+    t_read = now_seconds () - t_read;
 
-      if (len > max_len) max_len = len;
+    if (num_msgs == 0 && reader.idle)
+    {
+      // --flush-ms：输入暂时没有新行，把在飞的批次全部收尾写出去，再接着等
+      CHECK_DEV (pipeline_drain (&pl));
 
-      num_msgs++;
+      continue;
     }
 
     if (num_msgs == 0)
@@ -326,212 +5730,359 @@ int main (int argc, char **argv)
 
     batch_index++;
 
-    // 6. 为这一批计算 stride_bytes & 分配 msgs_bytes
-    size_t stride_bytes;
-    if (max_len == 0)
+    out_ring.batch_index = batch_index;
+
+    // 6. 先把已经跑完的 batch 收掉（不阻塞），按顺序能写多少写多少
+    CHECK_DEV (pipeline_reap (&pl));
+
+    // 积压太多（最老的一批还没回来）就等它；选中的设备没有空 slot 就等它最早提交的那一批
+    batch_slot_t *slot = NULL;
+
+    CHECK_DEV (pipeline_acquire (&pl, num_msgs, &slot));
+
+    device_ctx_t *dev     = slot->dev;
+    cl_context    context = dev->context;
+
+    pipeline_begin (slot, num_msgs, reader.total_lines - num_msgs, batch_index);
+
+    // 从这里到 clFlush 都算 pack（分桶、拷进 staging、设置参数、enqueue）
+    const double t_pack = now_seconds ();
+
+    // 7. 本批的输出 buffer & 读回目标（两种布局共用，grow-only）；搜索模式只需要把命中计数清零
+    //    迭代模式的 loop kernel 在 buf_out 上原地读写，--dedup 的 kernel 也要读它；
+    //    --dedup first 读回的是 (行号, digest) 记录，每条多一个 u32，count 什么也不读回
+    const size_t out_bytes = (size_t) num_msgs * algo->digest_words * sizeof (uint32_t);
+
+    if (search)
     {
-      stride_bytes = 64;
+      const cl_uint zero = 0;
+      CHECK_CL (clEnqueueFillBuffer (slot->queue, slot->buf_result, &zero, sizeof (zero),
+                                     0, sizeof (cl_uint), 0, NULL, NULL),
+                "clEnqueueFillBuffer(d_return_buf)");
     }
     else
     {
-      // 仍然对齐到 64 bytes
-      stride_bytes = ((max_len + 63) / 64) * 64;
+      CHECK_DEV (device_reserve (context, &slot->buf_out, &slot->out_cap, out_bytes,
+                                 (kdf.mode == KDF_ITER || dedup != DEDUP_NONE) ? CL_MEM_READ_WRITE : CL_MEM_WRITE_ONLY,
+                                 dev->max_alloc, "buf_out"));
+
+      if (merkle)
+      {
+        merkle_reserve (dev, (size_t) reader.total_lines * algo->digest_words * sizeof (uint32_t), pipeline_depth);
+      }
+      else if (dedup == DEDUP_FIRST)
+      {
+        if (!pinned_reserve (context, slot->queue, &slot->stage_out, (size_t) num_msgs * (algo->digest_words + 1u) * sizeof (uint32_t),
+                             dev->max_alloc, "dedup records")) exit (1);
+      }
+      else if (dedup == DEDUP_NONE)
+      {
+        if (!pinned_reserve (context, slot->queue, &slot->stage_out, out_bytes, dev->max_alloc, "digests")) exit (1);
+      }
     }
 
-    uint32_t msg_stride = (uint32_t) (stride_bytes / 4);
-    size_t   total_bytes  = (size_t) num_msgs * stride_bytes;
+    const search_dev_t *sd = search ? &dev->search : NULL;
 
-    fprintf (stderr,
-             "[OpenCL] Batch %u: %u messages, max_len=%zu, stride_bytes=%zu (msg_stride=%u)\n",
-             batch_index, num_msgs, max_len, stride_bytes, msg_stride);
+    // 8. stride：按长度分桶，计算每个桶的 stride & 分配 msgs_bytes
+    //    分桶后还是放不进设备预算（一批里有很长的行）时，这一批改走 packed
+    const unsigned pack_threads = (num_msgs < 65536u) ? 1 : host_threads;
+    const size_t   data_bytes   = (size_t) reader.offs[num_msgs - 1] + reader.lens[num_msgs - 1];
 
-    unsigned char *msgs_bytes = (unsigned char *) malloc (total_bytes);
-    if (!msgs_bytes)
-    {
-      fprintf (stderr, "malloc failed for msgs_bytes (%zu bytes) in batch %u\n",
-               total_bytes, batch_index);
-      exit (1);
-    }
-    memset (msgs_bytes, 0, total_bytes);
-
-    // 把每行复制到本批 msgs_bytes
-    for (uint32_t k = 0; k < num_msgs; k++)
-    {
-      uint32_t len_k = lens_host[k];
-      if (len_k > 0)
-      {
-        unsigned char *dst = msgs_bytes + (size_t) k * stride_bytes;
-        unsigned char *src = (unsigned char *) line_bufs[k];
-        memcpy (dst, src, len_k);
-      }
-    }
-
-    // 7. 创建本批的 OpenCL buffers
-    cl_mem buf_msgs = clCreateBuffer (
-        context,
-        CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-        total_bytes,
-        msgs_bytes,
-        &err);
-    CHECK_CL (err, "clCreateBuffer(buf_msgs)");
-
-    cl_mem buf_lens = clCreateBuffer (
-        context,
-        CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-        (size_t) num_msgs * sizeof (uint32_t),
-        lens_host,
-        &err);
-    CHECK_CL (err, "clCreateBuffer(buf_lens)");
-
-    cl_mem buf_out = clCreateBuffer (
-        context,
-        CL_MEM_WRITE_ONLY,
-        (size_t) num_msgs * 8u * sizeof (uint32_t),
-        NULL,
-        &err);
-    CHECK_CL (err, "clCreateBuffer(buf_out)");
-
-    free (msgs_bytes);
-
-    // 8. 设置 kernel 参数（注意每批 msg_stride 不同，要重新 set）
-    int arg = 0;
-    CHECK_CL (clSetKernelArg (kernel, arg++, sizeof (cl_mem),   &buf_msgs),
-              "clSetKernelArg(msgs)");
-    CHECK_CL (clSetKernelArg (kernel, arg++, sizeof (cl_mem),   &buf_lens),
-              "clSetKernelArg(lens)");
-    CHECK_CL (clSetKernelArg (kernel, arg++, sizeof (uint32_t), &msg_stride),
-              "clSetKernelArg(msg_stride)");
-    CHECK_CL (clSetKernelArg (kernel, arg++, sizeof (cl_mem),   &buf_out),
-              "clSetKernelArg(digests)");
-
-    // 9. 启动 kernel + profiling
-    size_t   global_work_size[1] = { (size_t) num_msgs };
-    cl_event kernel_event;
-
-    CHECK_CL (clEnqueueNDRangeKernel (queue, kernel, 1, NULL,
-                                      global_work_size, NULL,
-                                      0, NULL, &kernel_event),
-              "clEnqueueNDRangeKernel");
-
-    CHECK_CL (clWaitForEvents (1, &kernel_event), "clWaitForEvents");
-    CHECK_CL (clFinish (queue), "clFinish");
-
-    cl_ulong time_start = 0, time_end = 0;
-    CHECK_CL (clGetEventProfilingInfo (kernel_event,
-                                       CL_PROFILING_COMMAND_START,
-                                       sizeof (time_start), &time_start, NULL),
-              "clGetEventProfilingInfo(START)");
-    CHECK_CL (clGetEventProfilingInfo (kernel_event,
-                                       CL_PROFILING_COMMAND_END,
-                                       sizeof (time_end), &time_end, NULL),
-              "clGetEventProfilingInfo(END)");
+    slot->stats.seconds[STAGE_READ] = t_read;
+    slot->stats.in_bytes            = data_bytes;
 
-    double kernel_time_ns = (double) (time_end - time_start);
-    double kernel_time_s  = kernel_time_ns * 1e-9;
+    pack_ctx_t    pack;
+    bucket_plan_t plan;
 
-    total_kernel_time_s += kernel_time_s;
-    total_msgs          += num_msgs;
+    int batch_packed = (layout == LAYOUT_PACKED);
 
-    double hps  = (kernel_time_s > 0.0) ? ((double) num_msgs / kernel_time_s) : 0.0;
-    double mhps = hps / 1e6;
+    if (!batch_packed)
+    {
+      pack.arena    = reader.arena;
+      pack.offs     = reader.offs;
+      pack.lens     = reader.lens;
+      pack.num_msgs = num_msgs;
+      pack.algo     = algo;
 
-    fprintf (stderr,
-             "[OpenCL] Batch %u: kernel time = %.3f ms, speed = %.2f MH/s (%.3e H/s)\n",
-             batch_index, kernel_time_s * 1e3, mhps, hps);
+      plan_buckets (&pack, &plan, use_buckets, max_len, pack_threads);
+
+      if (plan.total_bytes > budget.max_alloc
+          || plan.total_bytes + (size_t) num_msgs * budget.fixed_bytes > budget.slot_bytes)
+      {
+        fprintf (stderr, "[OpenCL] Batch %u: stride layout needs %zu bytes (device budget %zu), using packed for this batch\n",
+                 batch_index, plan.total_bytes, budget.slot_bytes);
+
+        batch_packed = 1;
+      }
+    }
 
-    clReleaseEvent (kernel_event);
+    // 下一批的行数按这一批每行实际占的字节算
+    line_bytes = (double) (batch_packed ? data_bytes : plan.total_bytes) / (double) num_msgs;
 
-    // 10. 读回 digest，写出到输出文件
-    uint32_t *digests_host =
-        (uint32_t *) malloc ((size_t) num_msgs * 8u * sizeof (uint32_t));
-    if (!digests_host)
+    if (batch_packed)
     {
-      fprintf (stderr, "malloc failed for digests_host in batch %u\n", batch_index);
-      exit (1);
+      // packed：arena 里的原始字节直接上传，不做任何打包拷贝
+      CHECK_DEV (enqueue_packed_batch (slot, search, &reader, num_msgs, max_len, host_threads));
     }
+    else
+    {
+      size_t total_bytes = plan.total_bytes;
 
-    CHECK_CL (clEnqueueReadBuffer (queue, buf_out, CL_TRUE, 0,
-                                   (size_t) num_msgs * 8u * sizeof (uint32_t),
-                                   digests_host,
-                                   0, NULL, NULL),
-              "clEnqueueReadBuffer");
+      fprintf (stderr,
+               "[OpenCL] Batch %u (device %u): %u messages, max_len=%zu, buckets=%u, msgs_bytes=%zu (flat stride would need %zu)\n",
+               batch_index, dev->id, num_msgs, max_len, plan.num_nonempty, total_bytes,
+               (size_t) num_msgs * stride_for_len (max_len, algo));
 
-    char hex[64 + 1];
+      // 打包目标直接是 slot 的 pinned staging（上传在 slot 收尾前完成，下一批用别的 slot）
+      const size_t idx_bytes = (size_t) num_msgs * sizeof (uint32_t);
 
-    for (uint32_t k = 0; k < num_msgs; k++)
-    {
-      uint32_t *d = digests_host + (size_t) k * 8u;
-      uint8_t   digest[32];
+      unsigned char *msgs_bytes = (unsigned char *)
+          pinned_reserve (context, slot->queue, &slot->stage_msgs, total_bytes, dev->max_alloc, "msgs");
+      uint32_t *lens_stage = (uint32_t *)
+          pinned_reserve (context, slot->queue, &slot->stage_lens, idx_bytes, dev->max_alloc, "lens");
+      uint32_t *idx_stage  = pack.bucketed ? (uint32_t *)
+          pinned_reserve (context, slot->queue, &slot->stage_idx, idx_bytes, dev->max_alloc, "idx") : NULL;
 
-      // 以大端方式写入（和标准 SHA256 一致）
-      for (int j = 0; j < 8; j++)
+      if (!msgs_bytes || !lens_stage || (pack.bucketed && !idx_stage)) exit (1);
+
+      // 把每行从 arena 直接复制到所在桶的槽里（唯一一次拷贝），多线程分段进行
+      pack.msgs_bytes  = msgs_bytes;
+      pack.lens_sorted = lens_stage;
+      pack.idx_sorted  = idx_stage;
+
+      parallel_run (pack_threads, pack_thread, &pack);
+
+      // 不分桶时 lens 就是 reader 的顺序，reader 会被下一批覆盖，拷一份
+      if (!pack.bucketed) memcpy (lens_stage, reader.lens, idx_bytes);
+
+      // 9. 复用本 slot 的设备 buffer，非阻塞上传（in-order queue 保证排在 kernel 前面）
+      CHECK_DEV (device_reserve (context, &slot->buf_msgs, &slot->msgs_cap, total_bytes,
+                                 CL_MEM_READ_ONLY, dev->max_alloc, "buf_msgs"));
+      CHECK_DEV (device_reserve (context, &slot->buf_lens, &slot->lens_cap, idx_bytes,
+                                 CL_MEM_READ_ONLY, dev->max_alloc, "buf_lens"));
+
+      CHECK_DEV (slot_upload (slot, slot->buf_msgs, total_bytes, msgs_bytes, "clEnqueueWriteBuffer(buf_msgs)"));
+      CHECK_DEV (slot_upload (slot, slot->buf_lens, idx_bytes, lens_stage, "clEnqueueWriteBuffer(buf_lens)"));
+
+      slot->use_idx = pack.bucketed;
+
+      if (pack.bucketed)
       {
-        uint32_t v = d[j];
-        digest[j*4 + 0] = (uint8_t)((v >> 24) & 0xff);
-        digest[j*4 + 1] = (uint8_t)((v >> 16) & 0xff);
-        digest[j*4 + 2] = (uint8_t)((v >>  8) & 0xff);
-        digest[j*4 + 3] = (uint8_t)( v        & 0xff);
+        CHECK_DEV (device_reserve (context, &slot->buf_idx, &slot->idx_cap, idx_bytes,
+                                   CL_MEM_READ_ONLY, dev->max_alloc, "buf_idx"));
+
+        CHECK_DEV (slot_upload (slot, slot->buf_idx, idx_bytes, idx_stage, "clEnqueueWriteBuffer(buf_idx)"));
       }
 
-      digest_to_hex (digest, hex);
-      fprintf (fout, "%s\n", hex);
-    }
+      // 10. 每个非空桶 launch 一次（注意每个桶 stride / 偏移不同，要重新 set）
+      //     参数在 enqueue 时被固化，所以多个 slot / 桶共用一个 cl_kernel 没问题
+      //     桶 0（SHA256 <= 55 字节）走单 block 的 sha256_wrapper_short，参数完全一样
 
-    // 可选：打印本批第一条做 sanity check
-    if (batch_index == 1 && num_msgs > 0)
-    {
-      uint32_t *d0 = digests_host + 0 * 8u;
-      uint8_t   digest0[32];
-      for (int j = 0; j < 8; j++)
+      for (unsigned b = 0; b < NUM_LEN_BUCKETS; b++)
       {
-        uint32_t v = d0[j];
-        digest0[j*4 + 0] = (uint8_t)((v >> 24) & 0xff);
-        digest0[j*4 + 1] = (uint8_t)((v >> 16) & 0xff);
-        digest0[j*4 + 2] = (uint8_t)((v >>  8) & 0xff);
-        digest0[j*4 + 3] = (uint8_t)( v        & 0xff);
+        if (plan.count[b] == 0) continue;
+
+        cl_uint  msg_stride = (cl_uint)  (plan.stride_bytes[b] / 4);
+        cl_ulong msg_base   = (cl_ulong) (plan.base_bytes[b] / 4);
+        cl_uint  gid_base   = (cl_uint)  plan.first[b];
+
+        cl_kernel k = (b == 0 && plan.single_block && use_single_block && dev->kernel_short)
+                    ? dev->kernel_short : dev->kernel;
+
+        if (dev->vector_width > 1) k = dev->kernel_vector;
+
+        const cl_uint msg_cnt = (cl_uint) plan.count[b];
+
+        int arg = 0;
+        CHECK_CL (clSetKernelArg (k, arg++, sizeof (cl_mem),   &slot->buf_msgs),
+                  "clSetKernelArg(msgs)");
+        CHECK_CL (clSetKernelArg (k, arg++, sizeof (cl_mem),   &slot->buf_lens),
+                  "clSetKernelArg(lens)");
+        CHECK_CL (clSetKernelArg (k, arg++, sizeof (cl_mem),   slot->use_idx ? &slot->buf_idx : NULL),
+                  "clSetKernelArg(idx)");
+        CHECK_CL (clSetKernelArg (k, arg++, sizeof (cl_uint),  &msg_stride),
+                  "clSetKernelArg(msg_stride)");
+        CHECK_CL (clSetKernelArg (k, arg++, sizeof (cl_ulong), &msg_base),
+                  "clSetKernelArg(msg_base)");
+        CHECK_CL (clSetKernelArg (k, arg++, sizeof (cl_uint),  &gid_base),
+                  "clSetKernelArg(gid_base)");
+        CHECK_CL (clSetKernelArg (k, arg++, sizeof (cl_uint),  &msg_cnt),
+                  "clSetKernelArg(msg_cnt)");
+        if (dev->buf_hmac)
+        {
+          CHECK_CL (clSetKernelArg (k, arg++, sizeof (cl_mem), &dev->buf_hmac),
+                    "clSetKernelArg(hmac_state)");
+        }
+        if (dev->buf_salt_state)
+        {
+          CHECK_CL (clSetKernelArg (k, arg++, sizeof (cl_mem), &dev->buf_salt_state),
+                    "clSetKernelArg(salt_state)");
+        }
+
+        CHECK_DEV (set_output_args (k, arg, sd, slot));
+
+        // 11. 启动 kernel，挂在本 slot 的 queue 上，不在这里等
+        //     向量版每个 work-item 算 vector_width 条；global size 再向上取整到 work-group 大小
+        const size_t work_items = (k == dev->kernel_vector)
+                                ? ((size_t) msg_cnt + dev->vector_width - 1) / dev->vector_width
+                                : (size_t) msg_cnt;
+
+        CHECK_DEV (enqueue_kernel_1d (slot->queue, k, work_items, slot->local_size, slot_next_event (slot),
+                                      "clEnqueueNDRangeKernel"));
       }
-      char hex0[65];
-      digest_to_hex (digest0, hex0);
-      fprintf (stderr, "[OpenCL] First line SHA256 = %s\n", hex0);
     }
 
-    free (digests_host);
+    // 12. 迭代 / PBKDF2 的剩余轮数（多次 loop launch），之后是 --dedup
+    enqueue_kdf_loops (slot, search);
+
+    if (dedup != DEDUP_NONE) enqueue_dedup (slot);
+
+    // in-order queue：读回自动排在本批所有 kernel 之后
+    //   搜索模式只读回 4 字节的命中计数，命中记录在收尾时按计数读；--dedup 同样先读唯一数
+    if (search || dedup != DEDUP_NONE)
+    {
+      CHECK_CL (clEnqueueReadBuffer (slot->queue, slot->buf_result, CL_FALSE, 0,
+                                     sizeof (cl_uint), &slot->result_cnt,
+                                     0, NULL, &slot->read_event),
+                "clEnqueueReadBuffer(result count)");
+
+      slot->stats.d2h_bytes = sizeof (cl_uint);
+    }
+    else if (merkle)
+    {
+      // 叶子按行号拷进常驻的 buf_leaves（设备内拷贝），不读回 host
+      CHECK_CL (clEnqueueCopyBuffer (slot->queue, slot->buf_out, dev->buf_leaves, 0,
+                                     (size_t) slot->line_base * algo->digest_words * sizeof (uint32_t),
+                                     out_bytes, 0, NULL, &slot->read_event),
+                "clEnqueueCopyBuffer(merkle leaves)");
+    }
+    else
+    {
+      CHECK_CL (clEnqueueReadBuffer (slot->queue, slot->buf_out, CL_FALSE, 0,
+                                     out_bytes, slot->stage_out.ptr,
+                                     0, NULL, &slot->read_event),
+                "clEnqueueReadBuffer");
+
+      slot->stats.d2h_bytes = out_bytes;
+    }
+
+    CHECK_DEV (pipeline_launch (slot, t_pack));
+
+    max_batch_lines = batch_lines_for (&budget, line_bytes);
+  }
+
+  // 13. 按提交顺序把剩下还在飞的 batch 收尾
+  CHECK_DEV (pipeline_drain (&pl));
+
+  if (merkle) merkle_build (&devs[0], fout, reader.total_lines, merkle_proof, pipeline_depth);
+
+  fflush (fout);
+
+  const double wall_time_s = now_seconds () - wall_start;
+
+  // 整体速度统计：每个设备的 kernel-only 速度，合计（各设备速度之和，kernel time 取最忙的设备），
+  // 以及端到端（含读取、上传、读回、写出）
+  //   速度都按候选数（hashes）算：--mask 时每行是 keyspace 个候选，其它时候跟消息数一样
+  unsigned long long total_msgs      = 0ULL;
+  unsigned long long total_hashes    = 0ULL;
+  double             max_kernel_time = 0.0;
+  double             aggregate_hps   = 0.0;
+
+  for (unsigned d = 0; d < num_devs; d++)
+  {
+    const device_ctx_t *dev = &devs[d];
+
+    total_msgs   += dev->msgs_done;
+    total_hashes += dev->hashes_done;
+
+    if (dev->kernel_time_s > max_kernel_time) max_kernel_time = dev->kernel_time_s;
+
+    if (dev->hashes_done == 0 || dev->kernel_time_s <= 0.0) continue;
 
-    clReleaseMemObject (buf_msgs);
-    clReleaseMemObject (buf_lens);
-    clReleaseMemObject (buf_out);
+    double hps  = (double) dev->hashes_done / dev->kernel_time_s;
+    double mhps = hps / 1e6;
+
+    aggregate_hps += hps;
 
-    // 释放这一批的行缓冲
-    for (uint32_t k = 0; k < num_msgs; k++)
+    if (num_devs > 1)
     {
-      free (line_bufs[k]);
-      line_bufs[k] = NULL;
+      fprintf (stderr,
+               "[OpenCL] Device %u: messages = %llu, hashes = %llu, batches = %u, kernel time = %.3f ms, speed = %.2f MH/s (%.3e H/s)\n",
+               dev->id, dev->msgs_done, dev->hashes_done, dev->batches_done,
+               dev->kernel_time_s * 1e3, mhps, hps);
     }
   }
 
-  // 整体速度统计
-  if (total_msgs > 0 && total_kernel_time_s > 0.0)
+  if (total_msgs > 0 && max_kernel_time > 0.0)
   {
-    double hps  = (double) total_msgs / total_kernel_time_s;
+    double hps  = aggregate_hps;
     double mhps = hps / 1e6;
 
     fprintf (stderr,
-             "[OpenCL] TOTAL: messages = %llu, kernel time = %.3f ms, speed = %.2f MH/s (%.3e H/s)\n",
-             (unsigned long long) total_msgs,
-             total_kernel_time_s * 1e3,
+             "[OpenCL] TOTAL: messages = %llu, hashes = %llu, kernel time = %.3f ms, speed = %.2f MH/s (%.3e H/s)\n",
+             (unsigned long long) total_msgs, (unsigned long long) total_hashes,
+             max_kernel_time * 1e3,
              mhps, hps);
   }
 
-  free (line_bufs);
-  free (lens_host);
-  free (line);
+  if (total_msgs > 0 && wall_time_s > 0.0)
+  {
+    double hps  = (double) total_hashes / wall_time_s;
+    double mhps = hps / 1e6;
+
+    fprintf (stderr,
+             "[OpenCL] TOTAL: messages = %llu, hashes = %llu, end-to-end time = %.3f ms, speed = %.2f MH/s (%.3e H/s)\n",
+             (unsigned long long) total_msgs, (unsigned long long) total_hashes,
+             wall_time_s * 1e3,
+             mhps, hps);
+  }
+
+  if (search)
+  {
+    fprintf (stderr, "[OpenCL] Search: %llu of %u targets found\n",
+             search->total_hits, search->num_targets);
+  }
+
+  if (dedup != DEDUP_NONE && writer.dedup_lines > 0)
+  {
+    fprintf (stderr, "[OpenCL] Dedup: %llu unique of %llu lines (%.1f%% duplicates within batches)\n",
+             writer.dedup_uniq, writer.dedup_lines,
+             100.0 * (double) (writer.dedup_lines - writer.dedup_uniq) / (double) writer.dedup_lines);
+  }
+
+  metrics_finish (&metrics, &writer, wall_time_s);
+
+  const int utf8_bad = reader.utf8_bad;  // line_reader_free 会清零 reader
+
+  line_reader_free (&reader);
+  out_writer_free (&writer);
+  for (unsigned i = 0; i < ring_cap; i++)
+  {
+    free (ring[i].own_digests);
+    free (ring[i].hits);
+    free (ring[i].uniq);
+    free (ring[i].uniq_slot);
+  }
+  free (ring);
   fclose (fin);
   fclose (fout);
 
-  clReleaseKernel (kernel);
-  clReleaseProgram (program);
-  clReleaseCommandQueue (queue);
-  clReleaseContext (context);
+  for (unsigned d = 0; d < num_devs; d++)
+  {
+    device_release (&devs[d], pipeline_depth, search != NULL);
+  }
+  free (devs);
 
-  return 0;
+  if (search)
+  {
+    free (search->targets);
+    free (search->bitmaps);
+    free (search->reported);
+  }
+
+  free (hmac.key);
+  free (kdf.salt);
+  free (salt.salt);
+
+  return utf8_bad ? 1 : 0;
 }
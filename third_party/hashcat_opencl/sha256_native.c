@@ -0,0 +1,560 @@
+// 原生 CPU 后端，见 sha256_native.h。
+// hashcat 的 inc_*.cl 整个包含进来按 IS_NATIVE 编成普通 C：标量实现直接调 sha256_update_swap /
+// sha512_update_swap，multi-buffer 和 SHA-NI 复用里面的 k_sha256 / k_sha512 和初始值。
+
+#include "cpu_opencl_emu.h"
+
+#include "inc_vendor.h"
+#include "inc_types.h"
+#include "inc_platform.cl"
+#include "inc_common.cl"
+#include "inc_hash_sha256.cl"
+#include "inc_hash_sha512.cl"
+
+#include "sha256_native.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined (__x86_64__) || defined (__i386__)
+#define NATIVE_X86
+#include <immintrin.h>
+#endif
+
+// multi-buffer 最多的 lane 数（AVX-512）
+#define MB_MAX_LANES_SHA256 16
+#define MB_MAX_LANES_SHA512  8
+
+// inc_hash_sha*.cl 里的常数表已经注释掉了（kernel 直接用 SHA256C00 这些枚举），这里按同样的顺序排一份
+static const uint32_t native_k256[64] __attribute__ ((aligned (16))) =
+{
+  SHA256C00, SHA256C01, SHA256C02, SHA256C03,
+  SHA256C04, SHA256C05, SHA256C06, SHA256C07,
+  SHA256C08, SHA256C09, SHA256C0a, SHA256C0b,
+  SHA256C0c, SHA256C0d, SHA256C0e, SHA256C0f,
+  SHA256C10, SHA256C11, SHA256C12, SHA256C13,
+  SHA256C14, SHA256C15, SHA256C16, SHA256C17,
+  SHA256C18, SHA256C19, SHA256C1a, SHA256C1b,
+  SHA256C1c, SHA256C1d, SHA256C1e, SHA256C1f,
+  SHA256C20, SHA256C21, SHA256C22, SHA256C23,
+  SHA256C24, SHA256C25, SHA256C26, SHA256C27,
+  SHA256C28, SHA256C29, SHA256C2a, SHA256C2b,
+  SHA256C2c, SHA256C2d, SHA256C2e, SHA256C2f,
+  SHA256C30, SHA256C31, SHA256C32, SHA256C33,
+  SHA256C34, SHA256C35, SHA256C36, SHA256C37,
+  SHA256C38, SHA256C39, SHA256C3a, SHA256C3b,
+  SHA256C3c, SHA256C3d, SHA256C3e, SHA256C3f
+};
+
+static const uint64_t native_k512[80] =
+{
+  SHA512C00, SHA512C01, SHA512C02, SHA512C03,
+  SHA512C04, SHA512C05, SHA512C06, SHA512C07,
+  SHA512C08, SHA512C09, SHA512C0a, SHA512C0b,
+  SHA512C0c, SHA512C0d, SHA512C0e, SHA512C0f,
+  SHA512C10, SHA512C11, SHA512C12, SHA512C13,
+  SHA512C14, SHA512C15, SHA512C16, SHA512C17,
+  SHA512C18, SHA512C19, SHA512C1a, SHA512C1b,
+  SHA512C1c, SHA512C1d, SHA512C1e, SHA512C1f,
+  SHA512C20, SHA512C21, SHA512C22, SHA512C23,
+  SHA512C24, SHA512C25, SHA512C26, SHA512C27,
+  SHA512C28, SHA512C29, SHA512C2a, SHA512C2b,
+  SHA512C2c, SHA512C2d, SHA512C2e, SHA512C2f,
+  SHA512C30, SHA512C31, SHA512C32, SHA512C33,
+  SHA512C34, SHA512C35, SHA512C36, SHA512C37,
+  SHA512C38, SHA512C39, SHA512C3a, SHA512C3b,
+  SHA512C3c, SHA512C3d, SHA512C3e, SHA512C3f,
+  SHA512C40, SHA512C41, SHA512C42, SHA512C43,
+  SHA512C44, SHA512C45, SHA512C46, SHA512C47,
+  SHA512C48, SHA512C49, SHA512C4a, SHA512C4b,
+  SHA512C4c, SHA512C4d, SHA512C4e, SHA512C4f
+};
+
+static const char *native_impl_names[NUM_NATIVE_IMPLS] = { "scalar", "avx2", "avx512", "shani" };
+
+const char *native_impl_name (int impl)
+{
+  return (impl >= 0 && impl < NUM_NATIVE_IMPLS) ? native_impl_names[impl] : "auto";
+}
+
+int native_impl_parse (const char *name)
+{
+  if (strcmp (name, "auto") == 0) return NATIVE_IMPL_AUTO;
+
+  for (int i = 0; i < NUM_NATIVE_IMPLS; i++)
+  {
+    if (strcmp (name, native_impl_names[i]) == 0) return i;
+  }
+
+  return -2;
+}
+
+int native_impl_supported (int impl, int algo)
+{
+  switch (impl)
+  {
+    case NATIVE_IMPL_SCALAR: return 1;
+    #if defined NATIVE_X86
+    case NATIVE_IMPL_AVX2:   return __builtin_cpu_supports ("avx2") != 0;
+    case NATIVE_IMPL_AVX512: return __builtin_cpu_supports ("avx512f") != 0;
+    case NATIVE_IMPL_SHANI:  return algo == NATIVE_SHA256 && __builtin_cpu_supports ("sha") != 0
+                                                          && __builtin_cpu_supports ("sse4.1") != 0;
+    #endif
+    default:                 return 0;
+  }
+}
+
+// SHA-256：短消息时 16 路 AVX-512 比 SHA-NI 的单条快，没有 AVX-512 时 SHA-NI 比 AVX2 快
+int native_impl_best (int algo)
+{
+  static const int order[] = { NATIVE_IMPL_AVX512, NATIVE_IMPL_SHANI, NATIVE_IMPL_AVX2 };
+
+  for (unsigned i = 0; i < sizeof (order) / sizeof (order[0]); i++)
+  {
+    if (native_impl_supported (order[i], algo)) return order[i];
+  }
+
+  return NATIVE_IMPL_SCALAR;
+}
+
+// 一条消息补位之后的 block 数，以及末尾 1 - 2 个 block（不完整的数据 + 0x80 + 零 + 大端长度）
+static inline unsigned native_tail (const unsigned char *msg, uint32_t len, unsigned block, unsigned len_bytes,
+                                    unsigned char *tail, uint32_t *full_blocks)
+{
+  const uint32_t full = len / block;
+  const uint32_t rest = len - full * block;
+
+  const unsigned tail_blocks = (rest + 1 + len_bytes <= block) ? 1 : 2;
+  const unsigned tail_len    = tail_blocks * block;
+
+  const uint64_t bits = (uint64_t) len * 8u;
+
+  memset (tail, 0, tail_len);
+  memcpy (tail, msg + (size_t) full * block, rest);
+
+  tail[rest] = 0x80;
+
+  for (int j = 0; j < 8; j++) tail[tail_len - 1 - j] = (unsigned char) (bits >> (8 * j));
+
+  *full_blocks = full;
+
+  return full + tail_blocks;
+}
+
+static inline uint32_t load_be32 (const unsigned char *p)
+{
+  uint32_t v;
+  memcpy (&v, p, 4);
+  return __builtin_bswap32 (v);
+}
+
+static inline uint64_t load_be64 (const unsigned char *p)
+{
+  uint64_t v;
+  memcpy (&v, p, 8);
+  return __builtin_bswap64 (v);
+}
+
+// 标量：hashcat 的 *_update_swap 按 u32 读整块，消息拷进按块零填充的缓冲
+static void native_scalar_range (int algo, const unsigned char *arena, const uint32_t *offs,
+                                 const uint32_t *lens, uint32_t begin, uint32_t end, uint32_t *digests)
+{
+  u32    *buf = NULL;
+  size_t  cap = 0;
+
+  for (uint32_t i = begin; i < end; i++)
+  {
+    const uint32_t len  = lens[i];
+    const size_t   need = ((size_t) len + 128) / 128 * 128;
+
+    if (need > cap)
+    {
+      free (buf);
+
+      cap = need;
+      buf = (u32 *) malloc (cap);
+      if (!buf) abort ();
+    }
+
+    memcpy (buf, arena + offs[i], len);
+    memset ((unsigned char *) buf + len, 0, need - len);
+
+    if (algo == NATIVE_SHA256)
+    {
+      sha256_ctx_t ctx;
+
+      sha256_init (&ctx);
+      sha256_update_swap (&ctx, buf, (int) len);
+      sha256_final (&ctx);
+
+      memcpy (digests + (size_t) i * 8u, ctx.h, 8 * sizeof (u32));
+    }
+    else
+    {
+      sha512_ctx_t ctx;
+
+      sha512_init (&ctx);
+      sha512_update_swap (&ctx, buf, (int) len);
+      sha512_final (&ctx);
+
+      for (int k = 0; k < 8; k++)
+      {
+        digests[(size_t) i * 16u + k * 2 + 0] = (uint32_t) (ctx.h[k] >> 32);
+        digests[(size_t) i * 16u + k * 2 + 1] = (uint32_t) (ctx.h[k]);
+      }
+    }
+  }
+
+  free (buf);
+}
+
+#if defined NATIVE_X86
+
+// ---- multi-buffer ----
+// 状态和消息都按 SoA 存：state[k * lanes + j] 是 lane j 的第 k 个字。
+// 压缩函数用 GCC 的向量扩展按 lane 数实例化：AVX2 一个 ymm（SHA-256 8 路 / SHA-512 4 路），
+// AVX-512 一个 zmm（16 路 / 8 路）。更宽的向量在 AVX2 上要拆成两半，寄存器不够反而慢
+
+#define MB_ROTR(x,n,bits) (((x) >> (n)) | ((x) << ((bits) - (n))))
+
+#define MB_SHA256_COMPRESS(name,lanes,isa)                                                          \
+__attribute__ ((target (isa)))                                                                      \
+static void name (uint32_t *state, const uint32_t *wsoa)                                            \
+{                                                                                                   \
+  typedef uint32_t v_t __attribute__ ((vector_size ((lanes) * 4)));                                 \
+                                                                                                    \
+  v_t w[16];                                                                                        \
+  v_t s[8];                                                                                         \
+                                                                                                    \
+  for (int k = 0; k < 16; k++) memcpy (&w[k], wsoa  + k * (lanes), sizeof (v_t));                  \
+  for (int k = 0; k <  8; k++) memcpy (&s[k], state + k * (lanes), sizeof (v_t));                  \
+                                                                                                    \
+  v_t a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];               \
+                                                                                                    \
+  _Pragma ("GCC unroll 64")                                                                         \
+  for (int i = 0; i < 64; i++)                                                                      \
+  {                                                                                                 \
+    if (i >= 16)                                                                                    \
+    {                                                                                               \
+      const v_t w15 = w[(i - 15) & 15];                                                             \
+      const v_t w2  = w[(i -  2) & 15];                                                             \
+                                                                                                    \
+      w[i & 15] += (MB_ROTR (w15,  7, 32) ^ MB_ROTR (w15, 18, 32) ^ (w15 >>  3)) + w[(i - 7) & 15]  \
+                 + (MB_ROTR (w2,  17, 32) ^ MB_ROTR (w2,  19, 32) ^ (w2  >> 10));                   \
+    }                                                                                               \
+                                                                                                    \
+    const v_t t1 = h + (MB_ROTR (e, 6, 32) ^ MB_ROTR (e, 11, 32) ^ MB_ROTR (e, 25, 32))             \
+                 + (g ^ (e & (f ^ g))) + native_k256[i] + w[i & 15];                                \
+    const v_t t2 = (MB_ROTR (a, 2, 32) ^ MB_ROTR (a, 13, 32) ^ MB_ROTR (a, 22, 32))                 \
+                 + ((a & b) | (c & (a | b)));                                                       \
+                                                                                                    \
+    h = g; g = f; f = e; e = d + t1;                                                                \
+    d = c; c = b; b = a; a = t1 + t2;                                                               \
+  }                                                                                                 \
+                                                                                                    \
+  s[0] += a; s[1] += b; s[2] += c; s[3] += d; s[4] += e; s[5] += f; s[6] += g; s[7] += h;           \
+                                                                                                    \
+  for (int k = 0; k < 8; k++) memcpy (state + k * (lanes), &s[k], sizeof (v_t));                   \
+}
+
+#define MB_SHA512_COMPRESS(name,lanes,isa)                                                          \
+__attribute__ ((target (isa)))                                                                      \
+static void name (uint64_t *state, const uint64_t *wsoa)                                            \
+{                                                                                                   \
+  typedef uint64_t v_t __attribute__ ((vector_size ((lanes) * 8)));                                 \
+                                                                                                    \
+  v_t w[16];                                                                                        \
+  v_t s[8];                                                                                         \
+                                                                                                    \
+  for (int k = 0; k < 16; k++) memcpy (&w[k], wsoa  + k * (lanes), sizeof (v_t));                  \
+  for (int k = 0; k <  8; k++) memcpy (&s[k], state + k * (lanes), sizeof (v_t));                  \
+                                                                                                    \
+  v_t a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];               \
+                                                                                                    \
+  _Pragma ("GCC unroll 80")                                                                         \
+  for (int i = 0; i < 80; i++)                                                                      \
+  {                                                                                                 \
+    if (i >= 16)                                                                                    \
+    {                                                                                               \
+      const v_t w15 = w[(i - 15) & 15];                                                             \
+      const v_t w2  = w[(i -  2) & 15];                                                             \
+                                                                                                    \
+      w[i & 15] += (MB_ROTR (w15,  1, 64) ^ MB_ROTR (w15,  8, 64) ^ (w15 >> 7)) + w[(i - 7) & 15]   \
+                 + (MB_ROTR (w2,  19, 64) ^ MB_ROTR (w2,  61, 64) ^ (w2  >> 6));                    \
+    }                                                                                               \
+                                                                                                    \
+    const v_t t1 = h + (MB_ROTR (e, 14, 64) ^ MB_ROTR (e, 18, 64) ^ MB_ROTR (e, 41, 64))            \
+                 + (g ^ (e & (f ^ g))) + native_k512[i] + w[i & 15];                                \
+    const v_t t2 = (MB_ROTR (a, 28, 64) ^ MB_ROTR (a, 34, 64) ^ MB_ROTR (a, 39, 64))                \
+                 + ((a & b) | (c & (a | b)));                                                       \
+                                                                                                    \
+    h = g; g = f; f = e; e = d + t1;                                                                \
+    d = c; c = b; b = a; a = t1 + t2;                                                               \
+  }                                                                                                 \
+                                                                                                    \
+  s[0] += a; s[1] += b; s[2] += c; s[3] += d; s[4] += e; s[5] += f; s[6] += g; s[7] += h;           \
+                                                                                                    \
+  for (int k = 0; k < 8; k++) memcpy (state + k * (lanes), &s[k], sizeof (v_t));                   \
+}
+
+MB_SHA256_COMPRESS (sha256_mb_avx2,    8, "avx2")
+MB_SHA256_COMPRESS (sha256_mb_avx512, 16, "avx512f")
+MB_SHA512_COMPRESS (sha512_mb_avx2,    4, "avx2")
+MB_SHA512_COMPRESS (sha512_mb_avx512,  8, "avx512f")
+
+// 一个 lane 当前在算的消息
+typedef struct mb_lane
+{
+  const unsigned char *msg;
+  uint32_t             index;       // 批内行号
+  uint32_t             block;       // 下一个要压缩的 block
+  uint32_t             full;        // 不用补位的 block 数（直接从 arena 读）
+  uint32_t             nblocks;
+  int                  active;
+  unsigned char        tail[256];   // 补位后的末尾 block
+
+} mb_lane_t;
+
+// lane 调度：每个 lane 一条消息，做完就写出 digest 换下一条，直到区间里的消息都做完。
+// 长度不一的消息互不拖累，只有最后一轮会有空闲的 lane
+static void sha256_mb_range (void (*compress) (uint32_t *, const uint32_t *), unsigned L, const unsigned char *arena,
+                             const uint32_t *offs, const uint32_t *lens, uint32_t begin, uint32_t end,
+                             uint32_t *digests)
+{
+  uint32_t  state[8 * MB_MAX_LANES_SHA256]  __attribute__ ((aligned (64)));
+  uint32_t  w[16 * MB_MAX_LANES_SHA256]     __attribute__ ((aligned (64)));
+  mb_lane_t lanes[MB_MAX_LANES_SHA256];
+
+  static const uint32_t iv[8] = { SHA256M_A, SHA256M_B, SHA256M_C, SHA256M_D, SHA256M_E, SHA256M_F, SHA256M_G, SHA256M_H };
+
+  memset (state, 0, sizeof (state));
+  memset (w,     0, sizeof (w));
+  memset (lanes, 0, sizeof (lanes));
+
+  uint32_t next = begin;
+
+  for (;;)
+  {
+    int active = 0;
+
+    for (unsigned j = 0; j < L; j++)
+    {
+      mb_lane_t *ln = &lanes[j];
+
+      if (!ln->active)
+      {
+        if (next == end) continue;
+
+        ln->index   = next++;
+        ln->msg     = arena + offs[ln->index];
+        ln->nblocks = native_tail (ln->msg, lens[ln->index], 64, 8, ln->tail, &ln->full);
+        ln->block   = 0;
+        ln->active  = 1;
+
+        for (int k = 0; k < 8; k++) state[k * L + j] = iv[k];
+      }
+
+      const unsigned char *p = (ln->block < ln->full) ? ln->msg + (size_t) ln->block * 64
+                                                      : ln->tail + (size_t) (ln->block - ln->full) * 64;
+
+      for (int k = 0; k < 16; k++) w[k * L + j] = load_be32 (p + k * 4);
+
+      active++;
+    }
+
+    if (active == 0) break;
+
+    compress (state, w);
+
+    for (unsigned j = 0; j < L; j++)
+    {
+      mb_lane_t *ln = &lanes[j];
+
+      if (!ln->active || ++ln->block < ln->nblocks) continue;
+
+      for (int k = 0; k < 8; k++) digests[(size_t) ln->index * 8u + k] = state[k * L + j];
+
+      ln->active = 0;
+    }
+  }
+}
+
+static void sha512_mb_range (void (*compress) (uint64_t *, const uint64_t *), unsigned L, const unsigned char *arena,
+                             const uint32_t *offs, const uint32_t *lens, uint32_t begin, uint32_t end,
+                             uint32_t *digests)
+{
+  uint64_t  state[8 * MB_MAX_LANES_SHA512]  __attribute__ ((aligned (64)));
+  uint64_t  w[16 * MB_MAX_LANES_SHA512]     __attribute__ ((aligned (64)));
+  mb_lane_t lanes[MB_MAX_LANES_SHA512];
+
+  static const uint64_t iv[8] = { SHA512M_A, SHA512M_B, SHA512M_C, SHA512M_D, SHA512M_E, SHA512M_F, SHA512M_G, SHA512M_H };
+
+  memset (state, 0, sizeof (state));
+  memset (w,     0, sizeof (w));
+  memset (lanes, 0, sizeof (lanes));
+
+  uint32_t next = begin;
+
+  for (;;)
+  {
+    int active = 0;
+
+    for (unsigned j = 0; j < L; j++)
+    {
+      mb_lane_t *ln = &lanes[j];
+
+      if (!ln->active)
+      {
+        if (next == end) continue;
+
+        ln->index   = next++;
+        ln->msg     = arena + offs[ln->index];
+        ln->nblocks = native_tail (ln->msg, lens[ln->index], 128, 16, ln->tail, &ln->full);
+        ln->block   = 0;
+        ln->active  = 1;
+
+        for (int k = 0; k < 8; k++) state[k * L + j] = iv[k];
+      }
+
+      const unsigned char *p = (ln->block < ln->full) ? ln->msg + (size_t) ln->block * 128
+                                                      : ln->tail + (size_t) (ln->block - ln->full) * 128;
+
+      for (int k = 0; k < 16; k++) w[k * L + j] = load_be64 (p + k * 8);
+
+      active++;
+    }
+
+    if (active == 0) break;
+
+    compress (state, w);
+
+    for (unsigned j = 0; j < L; j++)
+    {
+      mb_lane_t *ln = &lanes[j];
+
+      if (!ln->active || ++ln->block < ln->nblocks) continue;
+
+      for (int k = 0; k < 8; k++)
+      {
+        digests[(size_t) ln->index * 16u + k * 2 + 0] = (uint32_t) (state[k * L + j] >> 32);
+        digests[(size_t) ln->index * 16u + k * 2 + 1] = (uint32_t) (state[k * L + j]);
+      }
+
+      ln->active = 0;
+    }
+  }
+}
+
+// ---- SHA-NI ----
+// 状态按 ABEF / CDGH 排在两个寄存器里；每 4 轮一组，消息扩展跟着轮次滚动（m[] 在展开后都是寄存器）
+
+__attribute__ ((target ("sha,sse4.1")))
+static void sha256_shani_blocks (uint32_t h[8], const unsigned char *data, uint32_t nblocks)
+{
+  const __m128i mask = _mm_set_epi64x (0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+  __m128i tmp    = _mm_loadu_si128 ((const __m128i *) &h[0]);
+  __m128i state1 = _mm_loadu_si128 ((const __m128i *) &h[4]);
+
+  tmp    = _mm_shuffle_epi32 (tmp, 0xb1);         // CDAB
+  state1 = _mm_shuffle_epi32 (state1, 0x1b);      // EFGH
+
+  __m128i state0 = _mm_alignr_epi8 (tmp, state1, 8);  // ABEF
+  state1 = _mm_blend_epi16 (state1, tmp, 0xf0);       // CDGH
+
+  for (uint32_t n = 0; n < nblocks; n++, data += 64)
+  {
+    const __m128i abef_save = state0;
+    const __m128i cdgh_save = state1;
+
+    __m128i m[4];
+
+    for (int k = 0; k < 4; k++) m[k] = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) (data + k * 16)), mask);
+
+    #pragma GCC unroll 16
+    for (int g = 0; g < 16; g++)
+    {
+      __m128i msg = _mm_add_epi32 (m[g & 3], _mm_loadu_si128 ((const __m128i *) &native_k256[g * 4]));
+
+      state1 = _mm_sha256rnds2_epu32 (state1, state0, msg);
+
+      if (g >= 3 && g <= 14)
+      {
+        const __m128i t = _mm_alignr_epi8 (m[g & 3], m[(g - 1) & 3], 4);
+
+        m[(g + 1) & 3] = _mm_sha256msg2_epu32 (_mm_add_epi32 (m[(g + 1) & 3], t), m[g & 3]);
+      }
+
+      msg    = _mm_shuffle_epi32 (msg, 0x0e);
+      state0 = _mm_sha256rnds2_epu32 (state0, state1, msg);
+
+      if (g >= 1 && g <= 12) m[(g - 1) & 3] = _mm_sha256msg1_epu32 (m[(g - 1) & 3], m[g & 3]);
+    }
+
+    state0 = _mm_add_epi32 (state0, abef_save);
+    state1 = _mm_add_epi32 (state1, cdgh_save);
+  }
+
+  tmp    = _mm_shuffle_epi32 (state0, 0x1b);      // FEBA
+  state1 = _mm_shuffle_epi32 (state1, 0xb1);      // DCHG
+  state0 = _mm_blend_epi16 (tmp, state1, 0xf0);   // DCBA
+  state1 = _mm_alignr_epi8 (state1, tmp, 8);      // ABEF
+
+  _mm_storeu_si128 ((__m128i *) &h[0], state0);
+  _mm_storeu_si128 ((__m128i *) &h[4], state1);
+}
+
+static void sha256_shani_range (const unsigned char *arena, const uint32_t *offs, const uint32_t *lens,
+                                uint32_t begin, uint32_t end, uint32_t *digests)
+{
+  unsigned char tail[128];
+
+  for (uint32_t i = begin; i < end; i++)
+  {
+    const unsigned char *msg = arena + offs[i];
+
+    uint32_t full = 0;
+
+    const unsigned nblocks = native_tail (msg, lens[i], 64, 8, tail, &full);
+
+    uint32_t h[8] = { SHA256M_A, SHA256M_B, SHA256M_C, SHA256M_D, SHA256M_E, SHA256M_F, SHA256M_G, SHA256M_H };
+
+    sha256_shani_blocks (h, msg, full);
+    sha256_shani_blocks (h, tail, nblocks - full);
+
+    memcpy (digests + (size_t) i * 8u, h, sizeof (h));
+  }
+}
+
+#endif // NATIVE_X86
+
+void native_hash_range (int impl, int algo, const unsigned char *arena, const uint32_t *offs,
+                        const uint32_t *lens, uint32_t begin, uint32_t end, uint32_t *digests)
+{
+  #if defined NATIVE_X86
+  switch (impl)
+  {
+    case NATIVE_IMPL_AVX2:
+      if (algo == NATIVE_SHA256) sha256_mb_range (sha256_mb_avx2,    8, arena, offs, lens, begin, end, digests);
+      else                       sha512_mb_range (sha512_mb_avx2,    4, arena, offs, lens, begin, end, digests);
+      return;
+
+    case NATIVE_IMPL_AVX512:
+      if (algo == NATIVE_SHA256) sha256_mb_range (sha256_mb_avx512, 16, arena, offs, lens, begin, end, digests);
+      else                       sha512_mb_range (sha512_mb_avx512,  8, arena, offs, lens, begin, end, digests);
+      return;
+
+    case NATIVE_IMPL_SHANI:
+      if (algo == NATIVE_SHA256)
+      {
+        sha256_shani_range (arena, offs, lens, begin, end, digests);
+        return;
+      }
+      break;
+  }
+  #else
+  (void) impl;
+  #endif
+
+  native_scalar_range (algo, arena, offs, lens, begin, end, digests);
+}
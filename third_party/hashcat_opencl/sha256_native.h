@@ -0,0 +1,39 @@
+// 原生 CPU 后端（sha256_host --backend native）：不经过 OpenCL，直接在 host 线程上算每行的 digest。
+// 标量实现就是 hashcat 的 inc_hash_sha256.cl / inc_hash_sha512.cl 按 IS_NATIVE 编译（见 cpu_opencl_emu.h）；
+// x86 上另有 SHA-NI 和 AVX2 / AVX-512 multi-buffer（每个 lane 一条消息，做完一条立刻换下一条），
+// 运行时按 CPU 特性选。digest 的布局和设备 kernel 写回的一样（SHA-512 每个 u64 拆成高 / 低两个 u32）。
+
+#ifndef SHA256_NATIVE_H
+#define SHA256_NATIVE_H
+
+#include <stdint.h>
+
+// 算法（hash_algo_t.native_algo）
+#define NATIVE_SHA256 0
+#define NATIVE_SHA512 1
+
+// 实现（--cpu-impl）
+#define NATIVE_IMPL_AUTO   -1
+#define NATIVE_IMPL_SCALAR  0  // hashcat inc_hash_sha*.cl，逐条消息
+#define NATIVE_IMPL_AVX2    1  // multi-buffer：SHA-256 8 路 / SHA-512 4 路
+#define NATIVE_IMPL_AVX512  2  // multi-buffer：SHA-256 16 路 / SHA-512 8 路
+#define NATIVE_IMPL_SHANI   3  // SHA-256 专用的 SHA 指令扩展，逐条消息
+#define NUM_NATIVE_IMPLS    4
+
+const char *native_impl_name (int impl);
+
+// 名字 -> NATIVE_IMPL_*（"auto" 是 NATIVE_IMPL_AUTO），不认识返回 -2
+int native_impl_parse (const char *name);
+
+// 本机 CPU 是否支持该算法的这个实现
+int native_impl_supported (int impl, int algo);
+
+// 本机上该算法最快的实现
+int native_impl_best (int algo);
+
+// 算 [begin, end) 这些行的 digest，写到 digests[i * digest_words]（i 是批内行号）。
+// 可以在多个线程上对不相交的区间同时调用
+void native_hash_range (int impl, int algo, const unsigned char *arena, const uint32_t *offs,
+                        const uint32_t *lens, uint32_t begin, uint32_t end, uint32_t *digests);
+
+#endif // SHA256_NATIVE_H
@@ -7,18 +7,94 @@
  *
  *   参数:
  *     msgs        : 所有消息拼在一起的缓冲区，按字节存储（raw bytes）
- *                   在 host 侧保证每条消息所在区域零填充到固定 stride。
- *     msg_lens    : 每条消息的真实长度（字节数）
- *     msg_stride  : 每条消息在 msgs 中占用的跨度（单位：u32，也就是 4 字节一个单位）
- *     digests     : 输出，每条消息 8 个 u32（标准 SHA256 256-bit）
+ *                   host 侧按长度分桶：同一个桶里的消息连续存放，零填充到该桶的固定 stride。
+ *     msg_lens    : 每条消息的真实长度（字节数），按分桶后的顺序
+ *     msg_idx     : 分桶后第 i 条消息在原始输入中的行号，digest 按它写回原始顺序；
+ *                   只有一个桶（顺序没变）时 host 传 NULL
+ *     msg_stride  : 本桶每条消息在 msgs 中占用的跨度（单位：u32，也就是 4 字节一个单位）
+ *     msg_base    : 本桶第一条消息在 msgs 中的偏移（单位：u32）
+ *     gid_base    : 本桶第一条消息在 msg_lens / msg_idx 中的下标
+ *     msg_cnt     : 本桶消息数
+ *     digests     : 输出，每条消息 8 个 u32（标准 SHA256 256-bit），按原始输入顺序
+ *                   （-D SEARCH_MODE 时换成 bitmap / 目标 / 命中缓冲，见 WRAPPER_OUT_ATTR）
  *
  *   注意:
  *     - 长度 msg_lens[] 是“字节数”，跟 SHA-256 标准一致。
  *     - msg_stride 是“以 u32 为单位的跨度”，即 msg_stride_words。
  *       如果你 host 侧用的是字节数 stride_bytes，则有:
  *           msg_stride = stride_bytes / 4;
+ *     - 每个桶单独 launch 一次，global size = 本桶消息数向上取整到 work-group 大小的整数倍，
+ *       gid >= msg_cnt 的 work-item 直接返回。下面所有 kernel 都一样带越界检查。
+ *
+ * sha256_wrapper_short：参数同上，只处理 <= 55 字节（一个 block）的桶，
+ *   跳过 ctx 缓冲，直接 padding + 一次 sha256_transform。
+ *
+ * sha256_wrapper_vector：参数同上，每个 work-item 算 VECT_SIZE 条消息
+ *   （u32x + sha256_transform_vector），host 按设备的 preferred vector width 编译。
+ *
+ * 另一个入口 sha256_wrapper_packed：消息首尾相接、不做任何填充，
+ *   msg_offs[i] 给出第 i 条消息的起始字节偏移（可以不是 4 字节对齐），
+ *   kernel 用 hc_bytealign_be_S 拼出对齐后的 big-endian word。
+ *   host 上传量就是真实数据量；msgs 末尾需要留出至少 68 字节的余量。
+ *
+ * HMAC（host 加 -D HMAC_MODE，共享一个 key）：
+ *   sha256_hmac_setup 只跑一个 work-item，把 key 的 ipad / opad 压缩状态算好写进 state[16]；
+ *   之后 sha256_wrapper / sha256_wrapper_packed 在 msg_cnt 后面多一个
+ *   hmac_state 参数（constant memory），每条消息只做 inner 的剩余部分 + 一次 outer 压缩，
+ *   不再每条都重做 key schedule。单 block / 向量版不支持 HMAC。
+ *
+ * UTF-16LE（host 的 --encoding utf16le，加 -D UTF16LE_MODE）：上传的还是原始字节，
+ *   sha256_wrapper / sha256_wrapper_packed / sha256_wrapper_mask 在 kernel 里把每行宽化成 UTF-16LE 再哈希：
+ *   全是 ASCII 时每个字节后面补 0（hashcat 的 *_utf16le_swap），否则整行按 UTF-8 逐个码点转成 UTF-16LE，
+ *   U+10000 以上拆成代理对，行长不限。kernel 假定输入是合法的 UTF-8，host 事先校验、不合法的行直接报错。
+ *   单 block / 向量版不支持。
+ *
+ * sha256_wrapper_hmac_lines：每行自带 key（packed 布局，不需要 HMAC_MODE），
+ *   key_lens[i] 是第 i 行 key 的字节数（host 找到的第一个 ':' 的位置），
+ *   消息是 ':' 之后的部分；key_lens[i] == msg_lens[i] 表示这一行没有 ':'，消息为空。
+ *
+ * 迭代 / PBKDF2（host 的 --iterations / --pbkdf2-salt）按 hashcat 的 init / loop / comp 拆开：
+ *   sha256_iter_loop   : 普通 kernel 算出第一轮后，在 digests 上原地再做 loop_cnt 轮 h = SHA256 (h)
+ *   sha256_pbkdf2_init : packed 布局，每行是 password，写 tmps[]（ipad / opad / U_1 / T）
+ *   sha256_pbkdf2_loop : 每次 launch loop_cnt 轮 U = HMAC (P, U)，T ^= U
+ *   sha256_pbkdf2_comp : T 交给输出阶段
+ *   loop 拆成多次 launch，保证单次 launch 不会撞上 watchdog。
+ *
+ * sha256_stream_update（host 的 --stream）：大文件按块分多次 launch 喂进来，
+ *   每个文件的 h 和 64 位总长度放在 states[] 里跨 launch 保存，最后一块收尾写 digest。
+ *
+ * sha256_merkle_level（host 的 --merkle）：叶子 digest 常驻设备，每次 launch 算一层
+ *   parent = SHA256 (left || right)，一直到根。
+ *
+ * sha256_wrapper_mask（host 的 --mask，只在 SEARCH_MODE 下有）：packed 布局的每行是 base word，
+ *   候选 = word + 掩码生成的后缀，在 kernel 里逐个生成、哈希、比对，只有命中回到 host
+ *   （hashcat -a 6 的 il_pos 循环）。命中的 il_pos 是候选在掩码 keyspace 里的编号。
+ *
+ * 加盐（host 的 --salt / --salt-hex，--salt-pos prefix|suffix）：
+ *   -D SALT_PREFIX_MODE 时 sha256_salt_setup 只跑一次，把 SHA256 (salt . 行) 里 salt 那部分的 ctx
+ *   （midstate + 没满一块的零头）留在 constant memory；-D SALT_SUFFIX_MODE 时 SHA256 (行 . salt) 的 salt
+ *   原样放在 constant memory，收尾前接上。两种都在 msg_cnt 后面多一个 salt_state 参数（跟 HMAC 同一个位置，
+ *   两者互斥），sha256_wrapper / sha256_wrapper_packed / sha256_wrapper_mask 都支持。单 block / 向量版不支持。
+ *
+ * sha256_wrapper_salt_lines：每行自带 salt（"salt:行"，packed 布局），salt_lens[i] 同 hmac_lines 的 key_lens，
+ *   salt_pos 为 0 时算 SHA256 (salt . 行)、为 1 时算 SHA256 (行 . salt)，salt 直接从 msgs 里原地读。
+ *
+ * sha256_dedup_insert / sha256_dedup_emit（host 的 --dedup）：digests 算完后用全局内存里的 hash 表
+ *   （CAS 占槽 + atomic_min）找出本批每个 digest 第一次出现的行，只把这些 (行号, digest) 追加到 records，
+ *   或者只数唯一的个数；读回量按重复率缩小。
  */
 
+#if defined __CUDACC__ || defined __HIPCC__
+
+// ---- NVRTC / hiprtc（host 的 --backend cuda / hip）：inc_vendor.h 自己认出 IS_CUDA / IS_HIP，
+//      运行时编译没有 <stdint.h>，同样补上 inc_types.h 要的类型（Linux 上 64 位是 unsigned long）----
+typedef unsigned char  uint8_t;
+typedef unsigned short uint16_t;
+typedef unsigned int   uint32_t;
+typedef unsigned long  uint64_t;
+
+#else
+
 #define IS_OPENCL 1  // 给 inc_vendor.h 一个环境标记（可选）
 
 // ---- 在 OpenCL 里补上 stdint 风格类型，让 inc_types.h 不再报 uint8_t 未定义 ----
@@ -27,6 +103,19 @@ typedef ushort uint16_t;
 typedef uint   uint32_t;
 typedef ulong  uint64_t;
 
+#endif
+
+// ---- 搜索模式（host 加 -D SEARCH_MODE）：用 hashcat 自己的 bitmap / find_hash 比对目标 ----
+// digest_t / find_hash 只在 KERNEL_STATIC 下提供；比较的是前 4 个 word（跟 hashcat 的 -m 1400 一样）
+#ifdef SEARCH_MODE
+#define KERNEL_STATIC
+#define DGST_ELEM 8
+#define DGST_R0   0
+#define DGST_R1   1
+#define DGST_R2   2
+#define DGST_R3   3
+#endif
+
 // ---- 引入 hashcat 的通用工具 & SHA256 实现 ----
 // inc_common.cl 自己会 #include inc_vendor.h / inc_types.h / inc_platform.h / inc_common.h
 #include "inc_common.cl"
@@ -34,44 +123,1425 @@ typedef ulong  uint64_t;
 // inc_hash_sha256.cl 会 #include inc_vendor.h / inc_types.h / inc_platform.h / inc_common.h / inc_hash_sha256.h
 #include "inc_hash_sha256.cl"
 
+#ifdef SEARCH_MODE
+#include "inc_scalar.cl"
+#endif
+
+// ---- 输出阶段（所有 kernel 共用）----
+// 普通模式：digest 写回 digests[out_pos * 8]。
+// 搜索模式：不写 digest，先过两级 bitmap（check），再在排好序的目标里二分（find_hash），
+//   命中且该目标第一次命中（hashes_shown）时，mark_hash 把 (行号 = gidvid, 目标 = hash_pos)
+//   追加到 plains_buf，d_return_buf 是追加计数。参数名跟 hashcat 的 KERN_ATTR 一致，
+//   这样可以直接用 COMPARE_M_SCALAR。
+#ifdef SEARCH_MODE
+
+#define WRAPPER_OUT_ATTR                            \
+  GLOBAL_AS const u32            *bitmaps_buf_s1_a, \
+  GLOBAL_AS const u32            *bitmaps_buf_s1_b, \
+  GLOBAL_AS const u32            *bitmaps_buf_s1_c, \
+  GLOBAL_AS const u32            *bitmaps_buf_s1_d, \
+  GLOBAL_AS const u32            *bitmaps_buf_s2_a, \
+  GLOBAL_AS const u32            *bitmaps_buf_s2_b, \
+  GLOBAL_AS const u32            *bitmaps_buf_s2_c, \
+  GLOBAL_AS const u32            *bitmaps_buf_s2_d, \
+  GLOBAL_AS const digest_t       *digests_buf,      \
+  GLOBAL_AS       u32            *hashes_shown,     \
+  GLOBAL_AS       plain_t        *plains_buf,       \
+  GLOBAL_AS       u32            *d_return_buf,     \
+  GLOBAL_AS const kernel_param_t *kernel_param
+
+#define WRAPPER_OUT_ARGS                                                  \
+  bitmaps_buf_s1_a, bitmaps_buf_s1_b, bitmaps_buf_s1_c, bitmaps_buf_s1_d, \
+  bitmaps_buf_s2_a, bitmaps_buf_s2_b, bitmaps_buf_s2_c, bitmaps_buf_s2_d, \
+  digests_buf, hashes_shown, plains_buf, d_return_buf, kernel_param
+
+#else
+
+#define WRAPPER_OUT_ATTR GLOBAL_AS u32 *digests
+#define WRAPPER_OUT_ARGS digests
+
+#endif
+
+// ---- HMAC 模式：kernel 多一个预先算好的 ipad / opad 状态参数 ----
+#ifdef HMAC_MODE
+#define WRAPPER_HMAC_ATTR , CONSTANT_AS const u32 *hmac_state
+#define WRAPPER_HMAC_ARGS , hmac_state
+#else
+#define WRAPPER_HMAC_ATTR
+#define WRAPPER_HMAC_ARGS
+#endif
+
+// ---- 共享 salt（host 加 -D SALT_PREFIX_MODE / -D SALT_SUFFIX_MODE）：kernel 多一个 constant 的 salt_state ----
+// 前缀：sha256_salt_setup 把 salt 压过之后的整个 ctx（h + 没满一块的余下字节 + len）留在设备上，
+//   每条消息从这个 midstate 接着压，salt 的整块不再每条重算。
+// 后缀：salt_state[0] 是 salt 字节数，后面是零填充到 64 字节整数倍的原始 salt，收尾前接在消息后面。
+#if defined HMAC_MODE && (defined SALT_PREFIX_MODE || defined SALT_SUFFIX_MODE)
+#error "HMAC_MODE and SALT_*_MODE are mutually exclusive"
+#endif
+
+#if defined SALT_PREFIX_MODE
+#define WRAPPER_SALT_ATTR , CONSTANT_AS const sha256_ctx_t *salt_state
+#define WRAPPER_SALT_ARGS , salt_state
+#elif defined SALT_SUFFIX_MODE
+#define WRAPPER_SALT_ATTR , CONSTANT_AS const u32 *salt_state
+#define WRAPPER_SALT_ARGS , salt_state
+#else
+#define WRAPPER_SALT_ATTR
+#define WRAPPER_SALT_ARGS
+#endif
+
+// ---- UTF-16LE 模式：消息先宽化再喂进 ctx ----
+#ifdef UTF16LE_MODE
+#define sha256_wrapper_update_global sha256_wrapper_update_global_utf16le
+#define sha256_wrapper_packed_update sha256_packed_update_utf16le
+#else
+#define sha256_wrapper_update_global sha256_update_global_swap
+#define sha256_wrapper_packed_update sha256_packed_update
+#endif
+
+#ifdef UTF16LE_MODE
+
+// 把 buf 第 pos 个字节起的 len 字节按 UTF-8 解码成 UTF-16LE 喂进 ctx，每攒满 64 字节压一块。
+// 整行都解（hashcat 的 hc_enc_next_global 只认一部分 3 / 4 字节的首字节、源窗口只有 256 字节，
+// 超出就放弃），U+10000 以上拆成代理对。host 读行时（line_reader_fill）已经按 RFC 3629 校验过，这里不再判错
+DECLSPEC void sha256_update_global_utf8_utf16le (PRIVATE_AS sha256_ctx_t *ctx, GLOBAL_AS const u32 *buf, const int pos, const int len)
+{
+  GLOBAL_AS const u8 *src = (GLOBAL_AS const u8 *) buf;
+
+  u32 blk[16] = { 0 };
+
+  int blk_len = 0;
+
+  const int end = pos + len;
+
+  for (int i = pos; i < end; )
+  {
+    const u32 c = src[i++];
+
+    u32 cp;
+    int extra;
+
+    if      (c < 0x80) { cp = c;        extra = 0; }
+    else if (c < 0xe0) { cp = c & 0x1f; extra = 1; }
+    else if (c < 0xf0) { cp = c & 0x0f; extra = 2; }
+    else               { cp = c & 0x07; extra = 3; }
+
+    for (int j = 0; j < extra && i < end; j++) cp = (cp << 6) | (src[i++] & 0x3f);
+
+    u32 units[2];
+    int num_units = 1;
+
+    units[0] = cp;
+
+    if (cp >= 0x10000)
+    {
+      cp -= 0x10000;
+
+      units[0]  = 0xd800 | (cp >> 10);
+      units[1]  = 0xdc00 | (cp & 0x3ff);
+      num_units = 2;
+    }
+
+    for (int u = 0; u < num_units; u++)
+    {
+      // ctx 要 big-endian word：UTF-16LE 的(低字节, 高字节)落在 word 的高 16 位（偏移 0）或低 16 位（偏移 2）
+      const u32 be = ((units[u] & 0xff) << 8) | (units[u] >> 8);
+
+      blk[blk_len / 4] |= be << (16 - 8 * (blk_len & 3));
+
+      blk_len += 2;
+
+      if (blk_len == 64)
+      {
+        sha256_update_64 (ctx, blk + 0, blk + 4, blk + 8, blk + 12, 64);
+
+        for (int j = 0; j < 16; j++) blk[j] = 0;
+
+        blk_len = 0;
+      }
+    }
+  }
+
+  if (blk_len) sha256_update_64 (ctx, blk + 0, blk + 4, blk + 8, blk + 12, blk_len);
+}
+
+// stride 布局：纯 ASCII 走 hashcat 的 sha256_update_global_utf16le_swap，含非 ASCII 时整行解码
+DECLSPEC void sha256_wrapper_update_global_utf16le (PRIVATE_AS sha256_ctx_t *ctx, GLOBAL_AS const u32 *w, const int len)
+{
+  if (hc_enc_scan_global (w, len))
+  {
+    sha256_update_global_utf8_utf16le (ctx, w, 0, len);
+
+    return;
+  }
+
+  sha256_update_global_utf16le_swap (ctx, w, len);
+}
+
+#endif
+
+// 普通模式：sha256_init。HMAC 模式：从 ipad 状态接着压（key block 已经压过，len = 64）。
+// 前缀 salt：从 salt 的 midstate 接着压
+DECLSPEC void sha256_wrapper_init (PRIVATE_AS sha256_ctx_t *ctx WRAPPER_HMAC_ATTR WRAPPER_SALT_ATTR)
+{
+  #if defined SALT_PREFIX_MODE
+
+  *ctx = *salt_state;
+
+  #elif defined HMAC_MODE
+
+  for (int k = 0; k < 8; k++) ctx->h[k] = hmac_state[k];
+
+  for (int k = 0; k < 4; k++)
+  {
+    ctx->w0[k] = 0;
+    ctx->w1[k] = 0;
+    ctx->w2[k] = 0;
+    ctx->w3[k] = 0;
+  }
+
+  ctx->len = 64;
+
+  #else
+
+  sha256_init (ctx);
+
+  #endif
+}
+
+// 普通模式：sha256_final。HMAC 模式：inner 收尾后，从 opad 状态再压一次 32 字节的 inner digest。
+// 后缀 salt：先把 salt 接在消息后面再收尾
+DECLSPEC void sha256_wrapper_final (PRIVATE_AS sha256_ctx_t *ctx WRAPPER_HMAC_ATTR WRAPPER_SALT_ATTR)
+{
+  #ifdef SALT_SUFFIX_MODE
+
+  const int salt_len = (int) salt_state[0];
+
+  u32 w[16];
+
+  for (int pos1 = 0, pos4 = 1; pos1 < salt_len; pos1 += 64, pos4 += 16)
+  {
+    for (int j = 0; j < 16; j++) w[j] = hc_swap32_S (salt_state[pos4 + j]);
+
+    const int rem = salt_len - pos1;
+
+    sha256_update_64 (ctx, w + 0, w + 4, w + 8, w + 12, (rem < 64) ? rem : 64);
+  }
+
+  #endif
+
+  sha256_final (ctx);
+
+  #ifdef HMAC_MODE
+
+  u32 w0[4];
+  u32 w1[4];
+  u32 w2[4];
+  u32 w3[4];
+
+  w0[0] = ctx->h[0];
+  w0[1] = ctx->h[1];
+  w0[2] = ctx->h[2];
+  w0[3] = ctx->h[3];
+  w1[0] = ctx->h[4];
+  w1[1] = ctx->h[5];
+  w1[2] = ctx->h[6];
+  w1[3] = ctx->h[7];
+  w2[0] = 0;
+  w2[1] = 0;
+  w2[2] = 0;
+  w2[3] = 0;
+  w3[0] = 0;
+  w3[1] = 0;
+  w3[2] = 0;
+  w3[3] = 0;
+
+  sha256_wrapper_init (ctx, hmac_state + 8);
+
+  sha256_update_64 (ctx, w0, w1, w2, w3, 32);
+
+  sha256_final (ctx);
+
+  #endif
+}
+
+// HMAC 预处理：一个 work-item 算出 key 的 ipad / opad 状态（state[0..7] / state[8..15]）。
+// key 要零填充到至少 64 字节、且是 64 的整数倍（sha256_hmac_init_global_swap 按整块读）
+KERNEL_FQ void sha256_hmac_setup (
+  GLOBAL_AS const u32 *key,
+  const        u32    key_len,
+  GLOBAL_AS       u32 *state
+)
+{
+  if (get_global_id (0) != 0) return;
+
+  sha256_hmac_ctx_t ctx;
+
+  sha256_hmac_init_global_swap (&ctx, key, (int) key_len);
+
+  for (int k = 0; k < 8; k++)
+  {
+    state[k + 0] = ctx.ipad.h[k];
+    state[k + 8] = ctx.opad.h[k];
+  }
+}
+
+// 前缀 salt 预处理：一个 work-item 把 salt 喂进 ctx，整个 ctx 写进 state（之后按 constant 读）。
+// salt 零填充到 64 字节的整数倍（sha256_update_global_swap 按整块读）
+KERNEL_FQ void sha256_salt_setup (
+  GLOBAL_AS const u32          *salt,
+  const        u32              salt_len,
+  GLOBAL_AS       sha256_ctx_t *state
+)
+{
+  if (get_global_id (0) != 0) return;
+
+  sha256_ctx_t ctx;
+
+  sha256_init (&ctx);
+
+  sha256_update_global_swap (&ctx, salt, (int) salt_len);
+
+  *state = ctx;
+}
+
+DECLSPEC void sha256_wrapper_out (const u32 out_pos, PRIVATE_AS const u32 *h, WRAPPER_OUT_ATTR)
+{
+  #ifdef SEARCH_MODE
+
+  const u64 gid    = out_pos;  // mark_hash 把它记成 plains_buf[].gidvid
+  const u32 il_pos = 0;
+
+  COMPARE_M_SCALAR (h[0], h[1], h[2], h[3]);
+
+  #else
+
+  GLOBAL_AS u32 *out = digests + ((size_t) out_pos * 8u);
+
+  out[0] = h[0];
+  out[1] = h[1];
+  out[2] = h[2];
+  out[3] = h[3];
+  out[4] = h[4];
+  out[5] = h[5];
+  out[6] = h[6];
+  out[7] = h[7];
+
+  #endif
+}
+
 // ---- 封装 kernel ----
 // 使用 hashcat 自己定义的地址空间/修饰符: GLOBAL_AS / PRIVATE_AS / KERNEL_FQ / u32 / u8 等
 KERNEL_FQ void sha256_wrapper (
   GLOBAL_AS const u32 *msgs,       // 注意：底层其实是 byte buffer，只是按 u32* 访问
   GLOBAL_AS const u32 *msg_lens,   // 每条消息长度（字节）
-  const        u32    msg_stride,  // 每条消息占用的 u32 数（即 stride_bytes / 4）
-  GLOBAL_AS       u32 *digests     // 输出：N * 8 个 u32
+  GLOBAL_AS const u32 *msg_idx,    // 分桶顺序 -> 原始行号（可以是 NULL）
+  const        u32    msg_stride,  // 本桶每条消息占用的 u32 数（即 stride_bytes / 4）
+  const        u64    msg_base,    // 本桶在 msgs 中的起始位置（u32 单位）
+  const        u32    gid_base,    // 本桶在 msg_lens / msg_idx 中的起始下标
+  const        u32    msg_cnt      // 本桶消息数（global size 向上取整过，多出的 work-item 直接返回）
+  WRAPPER_HMAC_ATTR                // HMAC 模式：ipad / opad 状态
+  WRAPPER_SALT_ATTR,               // 共享 salt：前缀的 midstate / 后缀的 salt
+  WRAPPER_OUT_ATTR                 // 输出：N * 8 个 u32（搜索模式下是 bitmap / 目标 / 命中缓冲）
 )
 {
   const u32 gid = get_global_id (0);
 
+  if (gid >= msg_cnt) return;
+
+  const u32 i = gid_base + gid;
+
   // 取出本条消息长度（字节）
-  const u32 len = msg_lens[gid];
+  const u32 len = msg_lens[i];
 
   // 计算本条消息对应的 u32* 起始位置
-  GLOBAL_AS const u32 *w = msgs + ((size_t) gid * (size_t) msg_stride);
+  GLOBAL_AS const u32 *w = msgs + msg_base + ((size_t) gid * (size_t) msg_stride);
 
   // hashcat 的 SHA256 上下文
   sha256_ctx_t ctx;
 
-  sha256_init (&ctx);
+  sha256_wrapper_init (&ctx WRAPPER_HMAC_ARGS WRAPPER_SALT_ARGS);
 
   // 关键点：用 hashcat 提供的 "global + swap" 版本，直接从 GLOBAL_AS 读取并做字节序转换
-  // len 是字节数，w 是 4 字节对齐的 global 缓冲区
-  sha256_update_global_swap (&ctx, w, (int) len);
+  // len 是字节数，w 是 4 字节对齐的 global 缓冲区（UTF-16LE 模式换成 *_utf16le_swap）
+  sha256_wrapper_update_global (&ctx, w, (int) len);
+
+  // 做最终的 padding + 长度写入 + transform（HMAC 模式再做 outer）
+  sha256_wrapper_final (&ctx WRAPPER_HMAC_ARGS WRAPPER_SALT_ARGS);
+
+  // 写回 8 × u32 的 digest（写到原始行号的位置）
+  const u32 out_pos = (msg_idx) ? msg_idx[i] : i;
+
+  sha256_wrapper_out (out_pos, ctx.h, WRAPPER_OUT_ARGS);
+}
+
+// ---- 单 block 快速路径 ----
+// 参数跟 sha256_wrapper 完全一样，host 只把 "桶里全是 <= 55 字节" 的 launch 路由过来：
+// 这时 0x80 和 64-bit 长度都放得进同一个 block，不需要 ctx 缓冲 / 长度记账，
+// 直接把 14 个 word 读进 w0..w3，补 padding 和长度，做一次 sha256_transform。
+// 依赖 host 把槽里 len 之后的字节清零（打包时就是这么做的）。
+KERNEL_FQ void sha256_wrapper_short (
+  GLOBAL_AS const u32 *msgs,
+  GLOBAL_AS const u32 *msg_lens,
+  GLOBAL_AS const u32 *msg_idx,
+  const        u32    msg_stride,
+  const        u64    msg_base,
+  const        u32    gid_base,
+  const        u32    msg_cnt,
+  WRAPPER_OUT_ATTR
+)
+{
+  const u32 gid = get_global_id (0);
+
+  if (gid >= msg_cnt) return;
+
+  const u32 i = gid_base + gid;
+
+  const u32 len = msg_lens[i];
+
+  GLOBAL_AS const u32 *w = msgs + msg_base + ((size_t) gid * (size_t) msg_stride);
+
+  u32 w0[4];
+  u32 w1[4];
+  u32 w2[4];
+  u32 w3[4];
+
+  w0[0] = hc_swap32_S (w[ 0]);
+  w0[1] = hc_swap32_S (w[ 1]);
+  w0[2] = hc_swap32_S (w[ 2]);
+  w0[3] = hc_swap32_S (w[ 3]);
+  w1[0] = hc_swap32_S (w[ 4]);
+  w1[1] = hc_swap32_S (w[ 5]);
+  w1[2] = hc_swap32_S (w[ 6]);
+  w1[3] = hc_swap32_S (w[ 7]);
+  w2[0] = hc_swap32_S (w[ 8]);
+  w2[1] = hc_swap32_S (w[ 9]);
+  w2[2] = hc_swap32_S (w[10]);
+  w2[3] = hc_swap32_S (w[11]);
+  w3[0] = hc_swap32_S (w[12]);
+  w3[1] = hc_swap32_S (w[13]);
+  w3[2] = 0;
+  w3[3] = 0;
+
+  // 跟 sha256_final 一样的 padding：swap 之后字节序反了，所以偏移要 ^ 3
+  append_0x80_4x4_S (w0, w1, w2, w3, len ^ 3);
+
+  w3[3] = len * 8;
+
+  u32 digest[8];
+
+  digest[0] = SHA256M_A;
+  digest[1] = SHA256M_B;
+  digest[2] = SHA256M_C;
+  digest[3] = SHA256M_D;
+  digest[4] = SHA256M_E;
+  digest[5] = SHA256M_F;
+  digest[6] = SHA256M_G;
+  digest[7] = SHA256M_H;
+
+  sha256_transform (w0, w1, w2, w3, digest);
+
+  const u32 out_pos = (msg_idx) ? msg_idx[i] : i;
+
+  sha256_wrapper_out (out_pos, digest, WRAPPER_OUT_ARGS);
+}
+
+// ---- 向量版：每个 work-item 同时算 VECT_SIZE 条消息 ----
+// host 用 -D NEW_SIMD_CODE -D VECT_SIZE=N 编译（N 取设备的 preferred vector width），
+// 没有这两个宏时 inc_types.h 会把 VECT_SIZE 定成 1，这个 kernel 就退化成标量版。
+//
+// 每条 lane 各自按 SHA-256 规则补 0x80 和 64-bit 长度，block 数不同的 lane
+// 在自己最后一个 block 之后不再更新 digest（用掩码保留），
+// 同一个桶里的消息 block 数相同，所以除了最后一个桶之外不会有空转的 lane。
+
+#if   VECT_SIZE == 1
+#define VECT_LANE(v,e)    (v)
+#define VECT_MAKE(F)      (F (0, 0))
+#define VECT_FOR_LANES(F) F (0, 0)
+#elif VECT_SIZE == 2
+#define VECT_LANE(v,e)    ((v).s##e)
+#define VECT_MAKE(F)      make_u32x (F (0, 0), F (1, 1))
+#define VECT_FOR_LANES(F) F (0, 0) F (1, 1)
+#elif VECT_SIZE == 4
+#define VECT_LANE(v,e)    ((v).s##e)
+#define VECT_MAKE(F)      make_u32x (F (0, 0), F (1, 1), F (2, 2), F (3, 3))
+#define VECT_FOR_LANES(F) F (0, 0) F (1, 1) F (2, 2) F (3, 3)
+#elif VECT_SIZE == 8
+#define VECT_LANE(v,e)    ((v).s##e)
+#define VECT_MAKE(F)      make_u32x (F (0, 0), F (1, 1), F (2, 2), F (3, 3), F (4, 4), F (5, 5), F (6, 6), F (7, 7))
+#define VECT_FOR_LANES(F) F (0, 0) F (1, 1) F (2, 2) F (3, 3) F (4, 4) F (5, 5) F (6, 6) F (7, 7)
+#elif VECT_SIZE == 16
+#define VECT_LANE(v,e)    ((v).s##e)
+#define VECT_MAKE(F)      make_u32x (F (0, 0), F (1, 1), F (2,  2), F (3,  3), F (4,  4), F (5,  5), F (6,  6), F (7,  7), \
+                                     F (8, 8), F (9, 9), F (a, 10), F (b, 11), F (c, 12), F (d, 13), F (e, 14), F (f, 15))
+#define VECT_FOR_LANES(F) F (0, 0) F (1, 1) F (2,  2) F (3,  3) F (4,  4) F (5,  5) F (6,  6) F (7,  7) \
+                          F (8, 8) F (9, 9) F (a, 10) F (b, 11) F (c, 12) F (d, 13) F (e, 14) F (f, 15)
+#endif
+
+// 第 n 条 lane 在第 k 个 block 的第 j 个 word（big-endian，已经补好 0x80 / 长度）
+DECLSPEC u32 sha256_vector_word (GLOBAL_AS const u32 *w, const u32 len, const u32 nblk, const u32 k, const u32 j)
+{
+  if (k >= nblk) return 0;
+
+  const u32 pos = k * 16 + j;
+
+  // 槽里 len 之后的字节是零，但最后一个 block 可能超出 stride，所以按 len 判断要不要读
+  u32 v = (pos * 4 < len) ? hc_swap32_S (w[pos]) : 0;
+
+  if (pos == len / 4) v |= 0x80000000 >> ((len & 3) * 8);
+
+  if (k == nblk - 1)
+  {
+    if (j == 14) v = len >> 29;
+    if (j == 15) v = len << 3;
+  }
+
+  return v;
+}
+
+KERNEL_FQ void sha256_wrapper_vector (
+  GLOBAL_AS const u32 *msgs,
+  GLOBAL_AS const u32 *msg_lens,
+  GLOBAL_AS const u32 *msg_idx,
+  const        u32    msg_stride,
+  const        u64    msg_base,
+  const        u32    gid_base,
+  const        u32    msg_cnt,     // 本桶消息数（global size >= ceil (msg_cnt / VECT_SIZE)）
+  WRAPPER_OUT_ATTR
+)
+{
+  const u32 gid = get_global_id (0);
+
+  if (gid * VECT_SIZE >= msg_cnt) return;
+
+  GLOBAL_AS const u32 *lane_w[VECT_SIZE];
+
+  u32 lane_len[VECT_SIZE];
+  u32 lane_blk[VECT_SIZE];
+
+  u32 max_blk = 0;
+
+  for (int n = 0; n < VECT_SIZE; n++)
+  {
+    const u32 m = gid * VECT_SIZE + n;
+
+    // 桶尾凑不满 VECT_SIZE 的 lane：0 个 block，不读也不写
+    const u32 valid = (m < msg_cnt);
+
+    lane_len[n] = (valid) ? msg_lens[gid_base + m] : 0;
+    lane_blk[n] = (valid) ? (lane_len[n] + 8) / 64 + 1 : 0;
+    lane_w[n]   = (valid) ? msgs + msg_base + ((size_t) m * (size_t) msg_stride) : msgs;
+
+    if (lane_blk[n] > max_blk) max_blk = lane_blk[n];
+  }
+
+  u32x digest[8];
+
+  digest[0] = SHA256M_A;
+  digest[1] = SHA256M_B;
+  digest[2] = SHA256M_C;
+  digest[3] = SHA256M_D;
+  digest[4] = SHA256M_E;
+  digest[5] = SHA256M_F;
+  digest[6] = SHA256M_G;
+  digest[7] = SHA256M_H;
+
+  for (u32 k = 0; k < max_blk; k++)
+  {
+    u32x w[16];
+
+    for (u32 j = 0; j < 16; j++)
+    {
+      #define LOAD_LANE(e,n) sha256_vector_word (lane_w[n], lane_len[n], lane_blk[n], k, j)
+
+      w[j] = VECT_MAKE (LOAD_LANE);
+
+      #undef LOAD_LANE
+    }
+
+    #define KEEP_LANE(e,n) ((k < lane_blk[n]) ? 0xffffffff : 0)
+
+    const u32x keep = VECT_MAKE (KEEP_LANE);
+
+    #undef KEEP_LANE
+
+    u32x t[8];
+
+    t[0] = digest[0];
+    t[1] = digest[1];
+    t[2] = digest[2];
+    t[3] = digest[3];
+    t[4] = digest[4];
+    t[5] = digest[5];
+    t[6] = digest[6];
+    t[7] = digest[7];
+
+    sha256_transform_vector (w + 0, w + 4, w + 8, w + 12, t);
+
+    digest[0] = (t[0] & keep) | (digest[0] & ~keep);
+    digest[1] = (t[1] & keep) | (digest[1] & ~keep);
+    digest[2] = (t[2] & keep) | (digest[2] & ~keep);
+    digest[3] = (t[3] & keep) | (digest[3] & ~keep);
+    digest[4] = (t[4] & keep) | (digest[4] & ~keep);
+    digest[5] = (t[5] & keep) | (digest[5] & ~keep);
+    digest[6] = (t[6] & keep) | (digest[6] & ~keep);
+    digest[7] = (t[7] & keep) | (digest[7] & ~keep);
+  }
+
+  #define STORE_LANE(e,n)                                                   \
+  if (gid * VECT_SIZE + n < msg_cnt)                                        \
+  {                                                                         \
+    const u32 i = gid_base + gid * VECT_SIZE + n;                           \
+                                                                            \
+    const u32 out_pos = (msg_idx) ? msg_idx[i] : i;                         \
+                                                                            \
+    u32 h[8];                                                               \
+                                                                            \
+    h[0] = VECT_LANE (digest[0], e);                                        \
+    h[1] = VECT_LANE (digest[1], e);                                        \
+    h[2] = VECT_LANE (digest[2], e);                                        \
+    h[3] = VECT_LANE (digest[3], e);                                        \
+    h[4] = VECT_LANE (digest[4], e);                                        \
+    h[5] = VECT_LANE (digest[5], e);                                        \
+    h[6] = VECT_LANE (digest[6], e);                                        \
+    h[7] = VECT_LANE (digest[7], e);                                        \
+                                                                            \
+    sha256_wrapper_out (out_pos, h, WRAPPER_OUT_ARGS);                      \
+  }
+
+  VECT_FOR_LANES (STORE_LANE)
+
+  #undef STORE_LANE
+}
+
+// ---- packed 布局 ----
+// 从任意字节偏移读出一个 64 字节块（big-endian u32），超过 rem 的字节清零。
+// src 指向包含块起始字节的那个 u32，sh = 起始字节在该 u32 内的偏移（0..3）。
+// 会多读 src[16]（sh != 0 时用到），所以 host 要在 msgs 末尾多留至少 68 字节。
+DECLSPEC void sha256_packed_load_block (GLOBAL_AS const u32 *src, const u32 sh, const int rem, PRIVATE_AS u32 *w)
+{
+  u32 prev = hc_swap32_S (src[0]);
+
+  for (int j = 0; j < 16; j++)
+  {
+    const u32 next = hc_swap32_S (src[j + 1]);
+
+    u32 v = (sh) ? hc_bytealign_be_S (prev, next, 4 - sh) : prev;
+
+    const int left = rem - j * 4;
+
+    if (left <= 0)
+    {
+      v = 0;
+    }
+    else if (left < 4)
+    {
+      v &= 0xffffffff << ((4 - left) * 8);
+    }
+
+    w[j] = v;
+
+    prev = next;
+  }
+}
+
+// 把 msgs 里从字节偏移 off 开始的 len 字节喂进 ctx
+DECLSPEC void sha256_packed_update (PRIVATE_AS sha256_ctx_t *ctx, GLOBAL_AS const u32 *msgs, const u32 off, const u32 len)
+{
+  GLOBAL_AS const u32 *src = msgs + (off / 4);
+
+  const u32 sh = off & 3;
+
+  u32 w[16];
+
+  // 跟 sha256_update_global_swap 一样：最后一块（1..64 字节）留给下面单独处理
+  int pos1;
+  int pos4;
+
+  for (pos1 = 0, pos4 = 0; pos1 < (int) len - 64; pos1 += 64, pos4 += 16)
+  {
+    sha256_packed_load_block (src + pos4, sh, 64, w);
+
+    sha256_update_64 (ctx, w + 0, w + 4, w + 8, w + 12, 64);
+  }
+
+  const int rem = (int) len - pos1;
+
+  sha256_packed_load_block (src + pos4, sh, rem, w);
+
+  sha256_update_64 (ctx, w + 0, w + 4, w + 8, w + 12, rem);
+}
+
+#ifdef UTF16LE_MODE
+
+// UTF-16LE 模式的 sha256_packed_update，规则跟 stride 版一样：
+// 纯 ASCII 时每次读 32 字节原文、宽化成一个 64 字节块；含非 ASCII 时从起点偏移 off & 3 开始整行解码，
+// 两种布局（host 可能临时改走 packed）结果一致
+DECLSPEC void sha256_packed_update_utf16le (PRIVATE_AS sha256_ctx_t *ctx, GLOBAL_AS const u32 *msgs, const u32 off, const u32 len)
+{
+  GLOBAL_AS const u32 *src = msgs + (off / 4);
+
+  const u32 sh = off & 3;
+
+  u32 t[16];
+  u32 w[16];
+
+  // load_block 已经把 len 之外的字节清零，只看本行
+  u32 high = 0;
+
+  for (int pos1 = 0, pos4 = 0; pos1 < (int) len; pos1 += 64, pos4 += 16)
+  {
+    sha256_packed_load_block (src + pos4, sh, (int) len - pos1, t);
+
+    for (int j = 0; j < 16; j++) high |= t[j];
+  }
+
+  if (high & 0x80808080)
+  {
+    sha256_update_global_utf8_utf16le (ctx, src, (int) sh, (int) len);
+
+    return;
+  }
+
+  int pos1;
+  int pos4;
+
+  for (pos1 = 0, pos4 = 0; pos1 < (int) len - 32; pos1 += 32, pos4 += 8)
+  {
+    sha256_packed_load_block (src + pos4, sh, 32, t);
+
+    make_utf16beN_S (t + 0, w + 0, w + 4);
+    make_utf16beN_S (t + 4, w + 8, w + 12);
+
+    sha256_update_64 (ctx, w + 0, w + 4, w + 8, w + 12, 64);
+  }
+
+  const int rem = (int) len - pos1;
+
+  sha256_packed_load_block (src + pos4, sh, rem, t);
+
+  make_utf16beN_S (t + 0, w + 0, w + 4);
+  make_utf16beN_S (t + 4, w + 8, w + 12);
+
+  sha256_update_64 (ctx, w + 0, w + 4, w + 8, w + 12, rem * 2);
+}
+
+#endif
+
+KERNEL_FQ void sha256_wrapper_packed (
+  GLOBAL_AS const u32 *msgs,       // 所有消息首尾相接，不做填充（byte buffer）
+  GLOBAL_AS const u32 *msg_offs,   // 每条消息在 msgs 中的起始字节偏移
+  GLOBAL_AS const u32 *msg_lens,   // 每条消息长度（字节）
+  const        u32    msg_cnt
+  WRAPPER_HMAC_ATTR
+  WRAPPER_SALT_ATTR,
+  WRAPPER_OUT_ATTR
+)
+{
+  const u32 gid = get_global_id (0);
+
+  if (gid >= msg_cnt) return;
+
+  const u32 off = msg_offs[gid];
+  const u32 len = msg_lens[gid];
+
+  sha256_ctx_t ctx;
+
+  sha256_wrapper_init (&ctx WRAPPER_HMAC_ARGS WRAPPER_SALT_ARGS);
+
+  sha256_wrapper_packed_update (&ctx, msgs, off, len);
+
+  sha256_wrapper_final (&ctx WRAPPER_HMAC_ARGS WRAPPER_SALT_ARGS);
+
+  sha256_wrapper_out (gid, ctx.h, WRAPPER_OUT_ARGS);
+}
+
+#ifdef SEARCH_MODE
+
+// ---- --mask：候选在设备上生成 ----
+// mask_cs 前 2 * mask_len 个 u32 是每个位置的 (字符起点, 字符数)，后面是各位置的字符（一个 u32 一个）。
+// 第 w 个 work-item 负责第 w % msg_cnt 个 word 的候选 [first, first + il_step) ∩ [il_start, il_end)，
+// first = il_start + (w / msg_cnt) * il_step：word 只压一次，每个候选从这个 ctx 接着压掩码部分。
+// 候选编号是混合进制数，最后一个位置变化最快；循环里像里程表一样进位，不做除法。
+// UTF-16LE 模式下 word 照常宽化，掩码部分的每个字节后面补 0。
+#define MASK_MAX_LEN 32
+
+KERNEL_FQ void sha256_wrapper_mask (
+  GLOBAL_AS   const u32 *msgs,
+  GLOBAL_AS   const u32 *msg_offs,
+  GLOBAL_AS   const u32 *msg_lens,
+  const       u32        msg_cnt
+  WRAPPER_HMAC_ATTR
+  WRAPPER_SALT_ATTR,
+  CONSTANT_AS const u32 *mask_cs,
+  const       u32        mask_len,
+  const       u32        il_start,
+  const       u32        il_end,
+  const       u32        il_step,
+  WRAPPER_OUT_ATTR
+)
+{
+  const u32 wid = get_global_id (0);
+
+  const u32 word  = wid % msg_cnt;
+  const u64 first = (u64) il_start + (u64) (wid / msg_cnt) * il_step;
+
+  if (first >= il_end) return;
+
+  const u32 last = (first + il_step < il_end) ? (u32) (first + il_step) : il_end;
+
+  sha256_ctx_t base;
+
+  sha256_wrapper_init (&base WRAPPER_HMAC_ARGS WRAPPER_SALT_ARGS);
+
+  sha256_wrapper_packed_update (&base, msgs, msg_offs[word], msg_lens[word]);
+
+  #ifdef UTF16LE_MODE
+  const u32 char_stride = 2;
+  #else
+  const u32 char_stride = 1;
+  #endif
+
+  const u32 suffix_len = mask_len * char_stride;
+
+  // 第一个候选的各位数字
+  u32 digit[MASK_MAX_LEN];
+
+  u32 rest = (u32) first;
+
+  for (int p = (int) mask_len - 1; p >= 0; p--)
+  {
+    const u32 cnt = mask_cs[p * 2 + 1];
+
+    digit[p] = rest % cnt;
+    rest     = rest / cnt;
+  }
+
+  const u64 gid = word;  // mark_hash 把它记成 plains_buf[].gidvid
+
+  for (u32 il_pos = (u32) first; il_pos < last; il_pos++)
+  {
+    u32 w[16] = { 0 };
+
+    for (u32 p = 0; p < mask_len; p++)
+    {
+      const u32 c = mask_cs[mask_cs[p * 2] + digit[p]];
+
+      const u32 q = p * char_stride;
+
+      w[q / 4] |= c << ((3 - (q & 3)) * 8);
+    }
+
+    sha256_ctx_t ctx = base;
+
+    sha256_update (&ctx, w, (int) suffix_len);
+
+    sha256_wrapper_final (&ctx WRAPPER_HMAC_ARGS WRAPPER_SALT_ARGS);
+
+    COMPARE_M_SCALAR (ctx.h[0], ctx.h[1], ctx.h[2], ctx.h[3]);
+
+    for (int p = (int) mask_len - 1; p >= 0; p--)
+    {
+      if (++digit[p] < mask_cs[p * 2 + 1]) break;
+
+      digit[p] = 0;
+    }
+  }
+}
+
+#endif
+
+// 用 msgs 里从 off 开始的 klen 字节当 key 初始化 HMAC ctx（跟 sha256_hmac_init_global_swap 一样：
+// 超过一个 block 的 key 先哈希成 32 字节）
+DECLSPEC void sha256_packed_hmac_init (PRIVATE_AS sha256_hmac_ctx_t *ctx, GLOBAL_AS const u32 *msgs, const u32 off, const u32 klen)
+{
+  u32 w[16];
+
+  if (klen > 64)
+  {
+    sha256_ctx_t tmp;
+
+    sha256_init (&tmp);
+
+    sha256_packed_update (&tmp, msgs, off, klen);
+
+    sha256_final (&tmp);
+
+    for (int k = 0; k < 8; k++)
+    {
+      w[k + 0] = tmp.h[k];
+      w[k + 8] = 0;
+    }
+  }
+  else
+  {
+    sha256_packed_load_block (msgs + (off / 4), off & 3, (int) klen, w);
+  }
+
+  sha256_hmac_init_64 (ctx, w + 0, w + 4, w + 8, w + 12);
+}
+
+// ---- 每行自带 key 的 HMAC（"key:message"，packed 布局）----
+KERNEL_FQ void sha256_wrapper_hmac_lines (
+  GLOBAL_AS const u32 *msgs,
+  GLOBAL_AS const u32 *msg_offs,   // 每行的起始字节偏移
+  GLOBAL_AS const u32 *msg_lens,   // 每行长度（key + ':' + 消息）
+  GLOBAL_AS const u32 *key_lens,   // 每行 key 的长度
+  const        u32    msg_cnt,
+  WRAPPER_OUT_ATTR
+)
+{
+  const u32 gid = get_global_id (0);
+
+  if (gid >= msg_cnt) return;
+
+  const u32 off  = msg_offs[gid];
+  const u32 len  = msg_lens[gid];
+  const u32 klen = key_lens[gid];
+
+  sha256_hmac_ctx_t ctx;
+
+  sha256_packed_hmac_init (&ctx, msgs, off, klen);
+
+  const u32 mlen = (klen < len) ? len - klen - 1 : 0;
+
+  sha256_packed_update (&ctx.ipad, msgs, off + klen + 1, mlen);
+
+  sha256_hmac_final (&ctx);
+
+  sha256_wrapper_out (gid, ctx.opad.h, WRAPPER_OUT_ARGS);
+}
+
+// ---- 每行自带 salt（"salt:行"，packed 布局）----
+// salt 和行都从 msgs 里原地读，不在 host 上拼接；salt_pos：0 = salt . 行，1 = 行 . salt
+KERNEL_FQ void sha256_wrapper_salt_lines (
+  GLOBAL_AS const u32 *msgs,
+  GLOBAL_AS const u32 *msg_offs,   // 每行的起始字节偏移
+  GLOBAL_AS const u32 *msg_lens,   // 每行长度（salt + ':' + 行）
+  GLOBAL_AS const u32 *salt_lens,  // 每行 salt 的长度
+  const        u32    msg_cnt,
+  const        u32    salt_pos,
+  WRAPPER_OUT_ATTR
+)
+{
+  const u32 gid = get_global_id (0);
+
+  if (gid >= msg_cnt) return;
+
+  const u32 off  = msg_offs[gid];
+  const u32 len  = msg_lens[gid];
+  const u32 slen = salt_lens[gid];
+
+  const u32 moff = off + slen + 1;
+  const u32 mlen = (slen < len) ? len - slen - 1 : 0;
+
+  sha256_ctx_t ctx;
+
+  sha256_init (&ctx);
+
+  if (salt_pos == 0)
+  {
+    sha256_packed_update (&ctx, msgs, off, slen);
+
+    sha256_wrapper_packed_update (&ctx, msgs, moff, mlen);
+  }
+  else
+  {
+    sha256_wrapper_packed_update (&ctx, msgs, moff, mlen);
+
+    sha256_packed_update (&ctx, msgs, off, slen);
+  }
 
-  // 做最终的 padding + 长度写入 + transform
   sha256_final (&ctx);
 
-  // 写回 8 × u32 的 digest
-  GLOBAL_AS u32 *out = digests + ((size_t) gid * 8u);
-
-  out[0] = ctx.h[0];
-  out[1] = ctx.h[1];
-  out[2] = ctx.h[2];
-  out[3] = ctx.h[3];
-  out[4] = ctx.h[4];
-  out[5] = ctx.h[5];
-  out[6] = ctx.h[6];
-  out[7] = ctx.h[7];
+  sha256_wrapper_out (gid, ctx.h, WRAPPER_OUT_ARGS);
+}
+
+// ---- 迭代哈希 / PBKDF2（hashcat 的 init / loop / comp 拆分）----
+// 迭代次数很大时一个 kernel 跑完会撞上显示驱动的 watchdog，所以 host 把循环拆成多次
+// launch，每次 loop_cnt 轮，状态放在 global 的 state buffer 里跨 launch 保存，
+// 一次 launch 内部只在寄存器里转。
+
+// 对 32 字节的 digest 再做一次 SHA256（一个 block：digest + 0x80 + 长度 256 bit）
+DECLSPEC void sha256_iter_once (PRIVATE_AS u32 *h)
+{
+  u32 w0[4];
+  u32 w1[4];
+  u32 w2[4];
+  u32 w3[4];
+
+  w0[0] = h[0];
+  w0[1] = h[1];
+  w0[2] = h[2];
+  w0[3] = h[3];
+  w1[0] = h[4];
+  w1[1] = h[5];
+  w1[2] = h[6];
+  w1[3] = h[7];
+  w2[0] = 0x80000000;
+  w2[1] = 0;
+  w2[2] = 0;
+  w2[3] = 0;
+  w3[0] = 0;
+  w3[1] = 0;
+  w3[2] = 0;
+  w3[3] = 32 * 8;
+
+  h[0] = SHA256M_A;
+  h[1] = SHA256M_B;
+  h[2] = SHA256M_C;
+  h[3] = SHA256M_D;
+  h[4] = SHA256M_E;
+  h[5] = SHA256M_F;
+  h[6] = SHA256M_G;
+  h[7] = SHA256M_H;
+
+  sha256_transform (w0, w1, w2, w3, h);
+}
+
+// 迭代模式：第一轮就是普通的 sha256_wrapper / _packed（写进 digests），
+// 之后每次 launch 在 digests 上原地做 loop_cnt 轮 h = SHA256 (h)
+KERNEL_FQ void sha256_iter_loop (
+  GLOBAL_AS       u32 *digests,
+  const        u32    loop_cnt,
+  const        u32    msg_cnt
+)
+{
+  const u32 gid = get_global_id (0);
+
+  if (gid >= msg_cnt) return;
+
+  GLOBAL_AS u32 *d = digests + ((size_t) gid * 8u);
+
+  u32 h[8];
+
+  for (int k = 0; k < 8; k++) h[k] = d[k];
+
+  for (u32 n = 0; n < loop_cnt; n++)
+  {
+    sha256_iter_once (h);
+  }
+
+  for (int k = 0; k < 8; k++) d[k] = h[k];
+}
+
+// PBKDF2-HMAC-SHA256 每条消息的状态（同 hashcat 的 pbkdf2_sha256_tmp_t，只算第一个输出块）
+typedef struct sha256_pbkdf2_tmp
+{
+  u32 ipad[8];
+  u32 opad[8];
+
+  u32 dgst[8];  // U_i
+  u32 out[8];   // T = U_1 ^ ... ^ U_i
+
+} sha256_pbkdf2_tmp_t;
+
+// 已知 ipad / opad 状态时对 32 字节消息做一次 HMAC（inner + outer 各一次压缩）
+DECLSPEC void sha256_hmac_run (PRIVATE_AS u32 *w, PRIVATE_AS const u32 *ipad, PRIVATE_AS const u32 *opad, PRIVATE_AS u32 *digest)
+{
+  u32 w0[4];
+  u32 w1[4];
+  u32 w2[4];
+  u32 w3[4];
+
+  w0[0] = w[0];
+  w0[1] = w[1];
+  w0[2] = w[2];
+  w0[3] = w[3];
+  w1[0] = w[4];
+  w1[1] = w[5];
+  w1[2] = w[6];
+  w1[3] = w[7];
+  w2[0] = 0x80000000;
+  w2[1] = 0;
+  w2[2] = 0;
+  w2[3] = 0;
+  w3[0] = 0;
+  w3[1] = 0;
+  w3[2] = 0;
+  w3[3] = (64 + 32) * 8;
+
+  for (int k = 0; k < 8; k++) digest[k] = ipad[k];
+
+  sha256_transform (w0, w1, w2, w3, digest);
+
+  w0[0] = digest[0];
+  w0[1] = digest[1];
+  w0[2] = digest[2];
+  w0[3] = digest[3];
+  w1[0] = digest[4];
+  w1[1] = digest[5];
+  w1[2] = digest[6];
+  w1[3] = digest[7];
+
+  for (int k = 0; k < 8; k++) digest[k] = opad[k];
+
+  sha256_transform (w0, w1, w2, w3, digest);
+}
+
+// PBKDF2 init：每行就是 password（packed 布局），算出 ipad / opad 和 U_1 = HMAC (P, salt || INT (1))。
+// salt 要零填充到 64 字节的整数倍（sha256_hmac_update_global_swap 按整块读）
+KERNEL_FQ void sha256_pbkdf2_init (
+  GLOBAL_AS const u32 *msgs,
+  GLOBAL_AS const u32 *msg_offs,
+  GLOBAL_AS const u32 *msg_lens,
+  const        u32    msg_cnt,
+  GLOBAL_AS const u32 *salt,
+  const        u32    salt_len,
+  GLOBAL_AS sha256_pbkdf2_tmp_t *tmps
+)
+{
+  const u32 gid = get_global_id (0);
+
+  if (gid >= msg_cnt) return;
+
+  sha256_hmac_ctx_t ctx;
+
+  sha256_packed_hmac_init (&ctx, msgs, msg_offs[gid], msg_lens[gid]);
+
+  for (int k = 0; k < 8; k++)
+  {
+    tmps[gid].ipad[k] = ctx.ipad.h[k];
+    tmps[gid].opad[k] = ctx.opad.h[k];
+  }
+
+  sha256_hmac_update_global_swap (&ctx, salt, (int) salt_len);
+
+  u32 w0[4] = { 1, 0, 0, 0 };  // INT (1)，大端
+  u32 w1[4] = { 0 };
+  u32 w2[4] = { 0 };
+  u32 w3[4] = { 0 };
+
+  sha256_hmac_update_64 (&ctx, w0, w1, w2, w3, 4);
+
+  sha256_hmac_final (&ctx);
+
+  for (int k = 0; k < 8; k++)
+  {
+    tmps[gid].dgst[k] = ctx.opad.h[k];
+    tmps[gid].out[k]  = ctx.opad.h[k];
+  }
+}
+
+// PBKDF2 loop：U_{i+1} = HMAC (P, U_i)，T ^= U_{i+1}，每次 launch loop_cnt 轮
+KERNEL_FQ void sha256_pbkdf2_loop (
+  GLOBAL_AS sha256_pbkdf2_tmp_t *tmps,
+  const        u32    loop_cnt,
+  const        u32    msg_cnt
+)
+{
+  const u32 gid = get_global_id (0);
+
+  if (gid >= msg_cnt) return;
+
+  u32 ipad[8];
+  u32 opad[8];
+  u32 dgst[8];
+  u32 out[8];
+
+  for (int k = 0; k < 8; k++)
+  {
+    ipad[k] = tmps[gid].ipad[k];
+    opad[k] = tmps[gid].opad[k];
+    dgst[k] = tmps[gid].dgst[k];
+    out[k]  = tmps[gid].out[k];
+  }
+
+  for (u32 n = 0; n < loop_cnt; n++)
+  {
+    sha256_hmac_run (dgst, ipad, opad, dgst);
+
+    for (int k = 0; k < 8; k++) out[k] ^= dgst[k];
+  }
+
+  for (int k = 0; k < 8; k++)
+  {
+    tmps[gid].dgst[k] = dgst[k];
+    tmps[gid].out[k]  = out[k];
+  }
+}
+
+// PBKDF2 comp：把 T 交给输出阶段（写 digests；本实现只取第一个输出块，dkLen = 32）
+KERNEL_FQ void sha256_pbkdf2_comp (
+  GLOBAL_AS const sha256_pbkdf2_tmp_t *tmps,
+  const        u32    msg_cnt,
+  WRAPPER_OUT_ATTR
+)
+{
+  const u32 gid = get_global_id (0);
+
+  if (gid >= msg_cnt) return;
+
+  u32 h[8];
+
+  for (int k = 0; k < 8; k++) h[k] = tmps[gid].out[k];
+
+  sha256_wrapper_out (gid, h, WRAPPER_OUT_ARGS);
+}
+
+// ---- 流式多 block（host 的 --stream）----
+// 一个文件分多次 launch 喂进来：除最后一块外每次都是整数个 block，所以 launch 之间
+// ctx 的 block 缓冲总是空的，只需要保存 h 和已经处理的总字节数。
+// sha256_ctx_t.len 是 int、sha256_final 只写 32 位的 bit 长度，超过 512 MB 的输入会算错，
+// 所以总长度单独用 64 位记，收尾时自己写完整的 64 位 bit 长度。
+#define STREAM_FIRST 1  // 文件的第一块：从 sha256_init 开始
+#define STREAM_LAST  2  // 文件的最后一块（可以是 0 字节）：收尾并写 digest
+
+typedef struct sha256_stream_state
+{
+  u32 h[8];
+  u32 len_lo;   // 已处理的字节数（64 位）
+  u32 len_hi;
+
+} sha256_stream_state_t;
+
+// 同 sha256_final，只是 padding 末尾的 bit 长度按 64 位写
+DECLSPEC void sha256_stream_final (PRIVATE_AS sha256_ctx_t *ctx, const u32 len_lo, const u32 len_hi)
+{
+  const int pos = ctx->len & 63;
+
+  append_0x80_4x4_S (ctx->w0, ctx->w1, ctx->w2, ctx->w3, pos ^ 3);
+
+  if (pos >= 56)
+  {
+    sha256_transform (ctx->w0, ctx->w1, ctx->w2, ctx->w3, ctx->h);
+
+    for (int k = 0; k < 4; k++)
+    {
+      ctx->w0[k] = 0;
+      ctx->w1[k] = 0;
+      ctx->w2[k] = 0;
+      ctx->w3[k] = 0;
+    }
+  }
+
+  ctx->w3[2] = (len_hi << 3) | (len_lo >> 29);
+  ctx->w3[3] = len_lo << 3;
+
+  sha256_transform (ctx->w0, ctx->w1, ctx->w2, ctx->w3, ctx->h);
+}
+
+// 每个 work-item 处理一个文件的一块：msgs 里第 gid 个槽（msg_stride 个 u32，最后一个不完整的
+// block 由 host 零填充），chunk_lens[gid] 字节；msg_idx[gid] 是文件在本组里的位置，
+// states / digests 都按它索引（本轮已经读完的文件不参与 launch）
+KERNEL_FQ void sha256_stream_update (
+  GLOBAL_AS const u32 *msgs,
+  GLOBAL_AS const u32 *chunk_lens,
+  GLOBAL_AS const u32 *chunk_flags,  // STREAM_FIRST / STREAM_LAST
+  GLOBAL_AS const u32 *msg_idx,
+  const        u32    msg_stride,
+  const        u32    msg_cnt,       // 本轮参与的文件数
+  GLOBAL_AS sha256_stream_state_t *states,
+  GLOBAL_AS       u32 *digests
+)
+{
+  const u32 gid = get_global_id (0);
+
+  if (gid >= msg_cnt) return;
+
+  const u32 len   = chunk_lens[gid];
+  const u32 flags = chunk_flags[gid];
+  const u32 pos   = msg_idx[gid];
+
+  GLOBAL_AS sha256_stream_state_t *st = states + pos;
+
+  sha256_ctx_t ctx;
+
+  sha256_init (&ctx);
+
+  u32 len_lo = 0;
+  u32 len_hi = 0;
+
+  if ((flags & STREAM_FIRST) == 0)
+  {
+    for (int k = 0; k < 8; k++) ctx.h[k] = st->h[k];
+
+    len_lo = st->len_lo;
+    len_hi = st->len_hi;
+  }
+
+  sha256_update_global_swap (&ctx, msgs + ((size_t) gid * msg_stride), (int) len);
+
+  const u32 new_lo = len_lo + len;
+
+  len_hi += (new_lo < len_lo) ? 1 : 0;
+  len_lo  = new_lo;
+
+  if (flags & STREAM_LAST)
+  {
+    sha256_stream_final (&ctx, len_lo, len_hi);
+
+    for (int k = 0; k < 8; k++) digests[(size_t) pos * 8u + k] = ctx.h[k];
+  }
+  else
+  {
+    for (int k = 0; k < 8; k++) st->h[k] = ctx.h[k];
+
+    st->len_lo = len_lo;
+    st->len_hi = len_hi;
+  }
+}
+
+// ---- Merkle 树（host 的 --merkle）----
+// 一层 n_in 个节点 -> 上一层 (n_in + 1) / 2 个：parent = SHA256 (left || right)。
+// 两个 32 字节的子节点正好是一个 64-byte block，后面再跟一个固定的 padding block（长度 512 bit）；
+// 层的节点数是奇数时，最后一个节点原样升到上一层。
+KERNEL_FQ void sha256_merkle_level (
+  GLOBAL_AS const u32 *in,
+  GLOBAL_AS       u32 *out,
+  const        u32    n_in
+)
+{
+  const u32 gid = get_global_id (0);
+
+  if (gid * 2 >= n_in) return;  // 上一层只有 (n_in + 1) / 2 个节点
+
+  GLOBAL_AS const u32 *src = in  + ((size_t) gid * 16u);
+  GLOBAL_AS       u32 *dst = out + ((size_t) gid * 8u);
+
+  if (gid * 2 + 1 >= n_in)
+  {
+    for (int k = 0; k < 8; k++) dst[k] = src[k];
+
+    return;
+  }
+
+  u32 w0[4];
+  u32 w1[4];
+  u32 w2[4];
+  u32 w3[4];
+
+  for (int k = 0; k < 4; k++)
+  {
+    w0[k] = src[k +  0];
+    w1[k] = src[k +  4];
+    w2[k] = src[k +  8];
+    w3[k] = src[k + 12];
+  }
+
+  u32 h[8];
+
+  h[0] = SHA256M_A;
+  h[1] = SHA256M_B;
+  h[2] = SHA256M_C;
+  h[3] = SHA256M_D;
+  h[4] = SHA256M_E;
+  h[5] = SHA256M_F;
+  h[6] = SHA256M_G;
+  h[7] = SHA256M_H;
+
+  sha256_transform (w0, w1, w2, w3, h);
+
+  for (int k = 0; k < 4; k++)
+  {
+    w0[k] = 0;
+    w1[k] = 0;
+    w2[k] = 0;
+    w3[k] = 0;
+  }
+
+  w0[0] = 0x80000000;
+  w3[3] = 64 * 8;
+
+  sha256_transform (w0, w1, w2, w3, h);
+
+  for (int k = 0; k < 8; k++) dst[k] = h[k];
+}
+
+// ---- 去重（host 的 --dedup）----
+// 本批的 digests 算完之后（同一个 queue，排在最后一个哈希 / loop kernel 后面）再跑两个 kernel。
+// 表是开放寻址的 table_mask + 1 个 u32（host 每批填成 DEDUP_EMPTY，大小 >= 2 倍行数），存的是行号，
+// 从 digest 的第一个 word 开始线性探测：
+//   sha256_dedup_insert：空槽用 CAS 占上；槽里已经是同一个 digest 时 atomic_min 成较小的行号，
+//     所以一个 digest 只占一个槽，最后留下的是它在本批里第一次出现的行；
+//   sha256_dedup_emit  ：沿同样的路径找到自己 digest 的槽，行号就是自己时算唯一：uniq_cnt 加一，
+//     records 非 NULL 时追加一条 (行号, digest 8 个 u32)。追加顺序不定，host 按行号排回去。
+#define DEDUP_EMPTY 0xffffffff
+
+#if defined IS_CUDA || defined IS_HIP
+#define dedup_atomic_cas(p,c,v) atomicCAS ((p), (c), (v))
+#define dedup_atomic_min(p,v)   atomicMin ((p), (v))
+#else
+#define dedup_atomic_cas(p,c,v) atomic_cmpxchg ((p), (c), (v))
+#define dedup_atomic_min(p,v)   atomic_min ((p), (v))
+#endif
+
+DECLSPEC int sha256_dedup_equal (GLOBAL_AS const u32 *a, GLOBAL_AS const u32 *b)
+{
+  for (int k = 0; k < 8; k++)
+  {
+    if (a[k] != b[k]) return 0;
+  }
+
+  return 1;
+}
+
+KERNEL_FQ void sha256_dedup_insert (
+  GLOBAL_AS const u32 *digests,
+  GLOBAL_AS       u32 *table,
+  const        u32    table_mask,
+  const        u32    msg_cnt
+)
+{
+  const u32 gid = get_global_id (0);
+
+  if (gid >= msg_cnt) return;
+
+  GLOBAL_AS const u32 *d = digests + ((size_t) gid * 8u);
+
+  for (u32 pos = d[0] & table_mask; ; pos = (pos + 1) & table_mask)
+  {
+    // 槽一旦占上就只会换成同一个 digest 的更小行号，先普通读一次，空的时候才 CAS
+    u32 cur = table[pos];
+
+    if (cur == DEDUP_EMPTY)
+    {
+      cur = dedup_atomic_cas (table + pos, DEDUP_EMPTY, gid);
+
+      if (cur == DEDUP_EMPTY) return;
+    }
+
+    if (sha256_dedup_equal (d, digests + ((size_t) cur * 8u)))
+    {
+      dedup_atomic_min (table + pos, gid);
+
+      return;
+    }
+  }
+}
+
+KERNEL_FQ void sha256_dedup_emit (
+  GLOBAL_AS const u32 *digests,
+  GLOBAL_AS const u32 *table,
+  const        u32    table_mask,
+  GLOBAL_AS       u32 *uniq_cnt,
+  GLOBAL_AS       u32 *records,
+  const        u32    msg_cnt
+)
+{
+  const u32 gid = get_global_id (0);
+
+  if (gid >= msg_cnt) return;
+
+  GLOBAL_AS const u32 *d = digests + ((size_t) gid * 8u);
+
+  for (u32 pos = d[0] & table_mask; ; pos = (pos + 1) & table_mask)
+  {
+    const u32 cur = table[pos];
+
+    if (cur == gid) break;
+
+    // 同一个 digest 更早的行占着这个槽：重复
+    if (sha256_dedup_equal (d, digests + ((size_t) cur * 8u))) return;
+  }
+
+  const u32 n = hc_atomic_inc (uniq_cnt);
+
+  if (records == NULL) return;
+
+  GLOBAL_AS u32 *r = records + ((size_t) n * 9u);
+
+  r[0] = gid;
+
+  for (int k = 0; k < 8; k++) r[1 + k] = d[k];
 }
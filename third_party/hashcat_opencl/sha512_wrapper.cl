@@ -0,0 +1,1017 @@
+/**
+ * sha512_wrapper.cl
+ *
+ * 使用 hashcat 原生的 SHA512 实现（inc_hash_sha512.*）的封装 kernel，
+ * 参数和 host 侧的分桶 / packed 布局跟 sha256_wrapper.cl 完全一样，只是：
+ *
+ *   - block 是 128 字节：stride 布局下每个桶的 stride 是 128 的整数倍
+ *     （sha512_update_global_swap 按整块读最后一块）；
+ *   - digest 是 16 个 u32（512-bit，每个 u64 拆成 高 32 位 / 低 32 位），
+ *     digests[out_pos * 16 + k]，按大端字节序输出就是标准 SHA512。
+ *
+ * 入口：
+ *   sha512_wrapper        : msgs / msg_lens / msg_idx / msg_stride / msg_base / gid_base / msg_cnt / digests，
+ *                           含义同 sha256_wrapper
+ *   sha512_wrapper_packed : msgs / msg_offs / msg_lens / msg_cnt / digests，含义同 sha256_wrapper_packed，
+ *                           msgs 末尾需要留出至少 132 字节的余量
+ *
+ * 没有单 block / 向量版，也没有搜索模式（host 不会对 sha512 走那些路径）。
+ * 越界检查也一样：global size 向上取整到 work-group 大小，gid >= msg_cnt 的 work-item 直接返回。
+ *
+ * HMAC 跟 sha256_wrapper.cl 一样：-D HMAC_MODE 时两个 kernel 多一个 hmac_state 参数
+ * （sha512_hmac_setup 算出的 ipad / opad 状态，8 + 8 个 u64）；
+ * sha512_wrapper_hmac_lines 处理每行自带 key 的 "key:message"。
+ *
+ * 加盐也一样：-D SALT_PREFIX_MODE / -D SALT_SUFFIX_MODE 时两个 kernel 多一个 salt_state 参数
+ * （前缀是 sha512_salt_setup 压过 salt 的 ctx，后缀是原样的 salt），
+ * sha512_wrapper_salt_lines 处理每行自带 salt 的 "salt:行"。
+ *
+ * UTF-16LE 也一样：-D UTF16LE_MODE 时 sha512_wrapper / sha512_wrapper_packed 在 kernel 里宽化每行
+ * （sha512_wrapper_update_global_utf16le 和它的 packed 版：纯 ASCII 补 0，否则整行 UTF-8 -> UTF-16LE，行长不限）。
+ *
+ * 迭代 / PBKDF2 同样是 sha512_iter_loop / sha512_pbkdf2_init / _loop / _comp，
+ * 参数跟 sha256 版一样，state 里是 u64。sha512_stream_update 对应 --stream，
+ * sha512_merkle_level 对应 --merkle，sha512_dedup_insert / sha512_dedup_emit 对应 --dedup。
+ */
+
+#if defined __CUDACC__ || defined __HIPCC__
+
+// ---- NVRTC / hiprtc（host 的 --backend cuda / hip）：inc_vendor.h 自己认出 IS_CUDA / IS_HIP，
+//      运行时编译没有 <stdint.h>，同样补上 inc_types.h 要的类型（Linux 上 64 位是 unsigned long）----
+typedef unsigned char  uint8_t;
+typedef unsigned short uint16_t;
+typedef unsigned int   uint32_t;
+typedef unsigned long  uint64_t;
+
+#else
+
+#define IS_OPENCL 1  // 给 inc_vendor.h 一个环境标记（可选）
+
+// ---- 在 OpenCL 里补上 stdint 风格类型，让 inc_types.h 不再报 uint8_t 未定义 ----
+typedef uchar  uint8_t;
+typedef ushort uint16_t;
+typedef uint   uint32_t;
+typedef ulong  uint64_t;
+
+#endif
+
+// ---- 引入 hashcat 的通用工具 & SHA512 实现 ----
+#include "inc_common.cl"
+#include "inc_hash_sha512.cl"
+
+// ---- UTF-16LE 模式：消息先宽化再喂进 ctx ----
+#ifdef UTF16LE_MODE
+#define sha512_wrapper_update_global sha512_wrapper_update_global_utf16le
+#define sha512_wrapper_packed_update sha512_packed_update_utf16le
+#else
+#define sha512_wrapper_update_global sha512_update_global_swap
+#define sha512_wrapper_packed_update sha512_packed_update
+#endif
+
+#ifdef UTF16LE_MODE
+
+// 跟 sha256_update_global_utf8_utf16le 一样整行解码，只是每攒满 128 字节压一块
+DECLSPEC void sha512_update_global_utf8_utf16le (PRIVATE_AS sha512_ctx_t *ctx, GLOBAL_AS const u32 *buf, const int pos, const int len)
+{
+  GLOBAL_AS const u8 *src = (GLOBAL_AS const u8 *) buf;
+
+  u32 blk[32] = { 0 };
+
+  int blk_len = 0;
+
+  const int end = pos + len;
+
+  for (int i = pos; i < end; )
+  {
+    const u32 c = src[i++];
+
+    u32 cp;
+    int extra;
+
+    if      (c < 0x80) { cp = c;        extra = 0; }
+    else if (c < 0xe0) { cp = c & 0x1f; extra = 1; }
+    else if (c < 0xf0) { cp = c & 0x0f; extra = 2; }
+    else               { cp = c & 0x07; extra = 3; }
+
+    for (int j = 0; j < extra && i < end; j++) cp = (cp << 6) | (src[i++] & 0x3f);
+
+    u32 units[2];
+    int num_units = 1;
+
+    units[0] = cp;
+
+    if (cp >= 0x10000)
+    {
+      cp -= 0x10000;
+
+      units[0]  = 0xd800 | (cp >> 10);
+      units[1]  = 0xdc00 | (cp & 0x3ff);
+      num_units = 2;
+    }
+
+    for (int u = 0; u < num_units; u++)
+    {
+      const u32 be = ((units[u] & 0xff) << 8) | (units[u] >> 8);
+
+      blk[blk_len / 4] |= be << (16 - 8 * (blk_len & 3));
+
+      blk_len += 2;
+
+      if (blk_len == 128)
+      {
+        sha512_update_128 (ctx, blk + 0, blk + 4, blk + 8, blk + 12, blk + 16, blk + 20, blk + 24, blk + 28, 128);
+
+        for (int j = 0; j < 32; j++) blk[j] = 0;
+
+        blk_len = 0;
+      }
+    }
+  }
+
+  if (blk_len) sha512_update_128 (ctx, blk + 0, blk + 4, blk + 8, blk + 12, blk + 16, blk + 20, blk + 24, blk + 28, blk_len);
+}
+
+DECLSPEC void sha512_wrapper_update_global_utf16le (PRIVATE_AS sha512_ctx_t *ctx, GLOBAL_AS const u32 *w, const int len)
+{
+  if (hc_enc_scan_global (w, len))
+  {
+    sha512_update_global_utf8_utf16le (ctx, w, 0, len);
+
+    return;
+  }
+
+  sha512_update_global_utf16le_swap (ctx, w, len);
+}
+
+#endif
+
+// ---- HMAC 模式：kernel 多一个预先算好的 ipad / opad 状态参数 ----
+#ifdef HMAC_MODE
+#define WRAPPER_HMAC_ATTR , CONSTANT_AS const u64 *hmac_state
+#define WRAPPER_HMAC_ARGS , hmac_state
+#else
+#define WRAPPER_HMAC_ATTR
+#define WRAPPER_HMAC_ARGS
+#endif
+
+// ---- 共享 salt：前缀是 sha512_salt_setup 算好的 ctx，后缀是 [字节数, 零填充到 128 字节整数倍的 salt] ----
+#if defined HMAC_MODE && (defined SALT_PREFIX_MODE || defined SALT_SUFFIX_MODE)
+#error "HMAC_MODE and SALT_*_MODE are mutually exclusive"
+#endif
+
+#if defined SALT_PREFIX_MODE
+#define WRAPPER_SALT_ATTR , CONSTANT_AS const sha512_ctx_t *salt_state
+#define WRAPPER_SALT_ARGS , salt_state
+#elif defined SALT_SUFFIX_MODE
+#define WRAPPER_SALT_ATTR , CONSTANT_AS const u32 *salt_state
+#define WRAPPER_SALT_ARGS , salt_state
+#else
+#define WRAPPER_SALT_ATTR
+#define WRAPPER_SALT_ARGS
+#endif
+
+// 普通模式：sha512_init。HMAC 模式：从 ipad 状态接着压（key block 已经压过，len = 128）。
+// 前缀 salt：从 salt 的 midstate 接着压
+DECLSPEC void sha512_wrapper_init (PRIVATE_AS sha512_ctx_t *ctx WRAPPER_HMAC_ATTR WRAPPER_SALT_ATTR)
+{
+  #if defined SALT_PREFIX_MODE
+
+  *ctx = *salt_state;
+
+  #elif defined HMAC_MODE
+
+  for (int k = 0; k < 8; k++) ctx->h[k] = hmac_state[k];
+
+  for (int k = 0; k < 4; k++)
+  {
+    ctx->w0[k] = 0;
+    ctx->w1[k] = 0;
+    ctx->w2[k] = 0;
+    ctx->w3[k] = 0;
+    ctx->w4[k] = 0;
+    ctx->w5[k] = 0;
+    ctx->w6[k] = 0;
+    ctx->w7[k] = 0;
+  }
+
+  ctx->len = 128;
+
+  #else
+
+  sha512_init (ctx);
+
+  #endif
+}
+
+// 普通模式：sha512_final。HMAC 模式：inner 收尾后，从 opad 状态再压一次 64 字节的 inner digest。
+// 后缀 salt：先把 salt 接在消息后面再收尾
+DECLSPEC void sha512_wrapper_final (PRIVATE_AS sha512_ctx_t *ctx WRAPPER_HMAC_ATTR WRAPPER_SALT_ATTR)
+{
+  #ifdef SALT_SUFFIX_MODE
+
+  const int salt_len = (int) salt_state[0];
+
+  u32 w[32];
+
+  for (int pos1 = 0, pos4 = 1; pos1 < salt_len; pos1 += 128, pos4 += 32)
+  {
+    for (int j = 0; j < 32; j++) w[j] = hc_swap32_S (salt_state[pos4 + j]);
+
+    const int rem = salt_len - pos1;
+
+    sha512_update_128 (ctx, w + 0, w + 4, w + 8, w + 12, w + 16, w + 20, w + 24, w + 28, (rem < 128) ? rem : 128);
+  }
+
+  #endif
+
+  sha512_final (ctx);
+
+  #ifdef HMAC_MODE
+
+  u32 w[32];
+
+  for (int k = 0; k < 8; k++)
+  {
+    w[k * 2 + 0] = h32_from_64_S (ctx->h[k]);
+    w[k * 2 + 1] = l32_from_64_S (ctx->h[k]);
+  }
+
+  for (int k = 16; k < 32; k++) w[k] = 0;
+
+  sha512_wrapper_init (ctx, hmac_state + 8);
+
+  sha512_update_128 (ctx, w + 0, w + 4, w + 8, w + 12, w + 16, w + 20, w + 24, w + 28, 64);
+
+  sha512_final (ctx);
+
+  #endif
+}
+
+// HMAC 预处理：一个 work-item 算出 key 的 ipad / opad 状态（state[0..7] / state[8..15]）。
+// key 要零填充到至少 128 字节、且是 128 的整数倍（sha512_hmac_init_global_swap 按整块读）
+KERNEL_FQ void sha512_hmac_setup (
+  GLOBAL_AS const u32 *key,
+  const        u32    key_len,
+  GLOBAL_AS       u64 *state
+)
+{
+  if (get_global_id (0) != 0) return;
+
+  sha512_hmac_ctx_t ctx;
+
+  sha512_hmac_init_global_swap (&ctx, key, (int) key_len);
+
+  for (int k = 0; k < 8; k++)
+  {
+    state[k + 0] = ctx.ipad.h[k];
+    state[k + 8] = ctx.opad.h[k];
+  }
+}
+
+// 前缀 salt 预处理：一个 work-item 把 salt 喂进 ctx，整个 ctx 写进 state。
+// salt 零填充到 128 字节的整数倍（sha512_update_global_swap 按整块读）
+KERNEL_FQ void sha512_salt_setup (
+  GLOBAL_AS const u32          *salt,
+  const        u32              salt_len,
+  GLOBAL_AS       sha512_ctx_t *state
+)
+{
+  if (get_global_id (0) != 0) return;
+
+  sha512_ctx_t ctx;
+
+  sha512_init (&ctx);
+
+  sha512_update_global_swap (&ctx, salt, (int) salt_len);
+
+  *state = ctx;
+}
+
+// ---- 输出阶段（所有 kernel 共用）：digest 写回 digests[out_pos * 16] ----
+DECLSPEC void sha512_wrapper_out (const u32 out_pos, PRIVATE_AS const u64 *h, GLOBAL_AS u32 *digests)
+{
+  GLOBAL_AS u32 *out = digests + ((size_t) out_pos * 16u);
+
+  for (int k = 0; k < 8; k++)
+  {
+    out[k * 2 + 0] = h32_from_64_S (h[k]);
+    out[k * 2 + 1] = l32_from_64_S (h[k]);
+  }
+}
+
+// ---- stride / 分桶布局 ----
+KERNEL_FQ void sha512_wrapper (
+  GLOBAL_AS const u32 *msgs,       // 注意：底层其实是 byte buffer，只是按 u32* 访问
+  GLOBAL_AS const u32 *msg_lens,   // 每条消息长度（字节）
+  GLOBAL_AS const u32 *msg_idx,    // 分桶顺序 -> 原始行号（可以是 NULL）
+  const        u32    msg_stride,  // 本桶每条消息占用的 u32 数（128 字节的整数倍 / 4）
+  const        u64    msg_base,    // 本桶在 msgs 中的起始位置（u32 单位）
+  const        u32    gid_base,    // 本桶在 msg_lens / msg_idx 中的起始下标
+  const        u32    msg_cnt      // 本桶消息数
+  WRAPPER_HMAC_ATTR                // HMAC 模式：ipad / opad 状态
+  WRAPPER_SALT_ATTR,               // 共享 salt：前缀的 midstate / 后缀的 salt
+  GLOBAL_AS       u32 *digests     // 输出：N * 16 个 u32
+)
+{
+  const u32 gid = get_global_id (0);
+
+  if (gid >= msg_cnt) return;
+
+  const u32 i = gid_base + gid;
+
+  const u32 len = msg_lens[i];
+
+  GLOBAL_AS const u32 *w = msgs + msg_base + ((size_t) gid * (size_t) msg_stride);
+
+  sha512_ctx_t ctx;
+
+  sha512_wrapper_init (&ctx WRAPPER_HMAC_ARGS WRAPPER_SALT_ARGS);
+
+  sha512_wrapper_update_global (&ctx, w, (int) len);
+
+  sha512_wrapper_final (&ctx WRAPPER_HMAC_ARGS WRAPPER_SALT_ARGS);
+
+  const u32 out_pos = (msg_idx) ? msg_idx[i] : i;
+
+  sha512_wrapper_out (out_pos, ctx.h, digests);
+}
+
+// ---- packed 布局 ----
+// 从任意字节偏移读出一个 128 字节块（big-endian u32），超过 rem 的字节清零。
+// 会多读 src[32]（sh != 0 时用到），所以 host 要在 msgs 末尾多留至少 132 字节。
+DECLSPEC void sha512_packed_load_block (GLOBAL_AS const u32 *src, const u32 sh, const int rem, PRIVATE_AS u32 *w)
+{
+  u32 prev = hc_swap32_S (src[0]);
+
+  for (int j = 0; j < 32; j++)
+  {
+    const u32 next = hc_swap32_S (src[j + 1]);
+
+    u32 v = (sh) ? hc_bytealign_be_S (prev, next, 4 - sh) : prev;
+
+    const int left = rem - j * 4;
+
+    if (left <= 0)
+    {
+      v = 0;
+    }
+    else if (left < 4)
+    {
+      v &= 0xffffffff << ((4 - left) * 8);
+    }
+
+    w[j] = v;
+
+    prev = next;
+  }
+}
+
+// 把 msgs 里从字节偏移 off 开始的 len 字节喂进 ctx
+DECLSPEC void sha512_packed_update (PRIVATE_AS sha512_ctx_t *ctx, GLOBAL_AS const u32 *msgs, const u32 off, const u32 len)
+{
+  GLOBAL_AS const u32 *src = msgs + (off / 4);
+
+  const u32 sh = off & 3;
+
+  u32 w[32];
+
+  // 跟 sha512_update_global_swap 一样：最后一块（1..128 字节）留给下面单独处理
+  int pos1;
+  int pos4;
+
+  for (pos1 = 0, pos4 = 0; pos1 < (int) len - 128; pos1 += 128, pos4 += 32)
+  {
+    sha512_packed_load_block (src + pos4, sh, 128, w);
+
+    sha512_update_128 (ctx, w + 0, w + 4, w + 8, w + 12, w + 16, w + 20, w + 24, w + 28, 128);
+  }
+
+  const int rem = (int) len - pos1;
+
+  sha512_packed_load_block (src + pos4, sh, rem, w);
+
+  sha512_update_128 (ctx, w + 0, w + 4, w + 8, w + 12, w + 16, w + 20, w + 24, w + 28, rem);
+}
+
+#ifdef UTF16LE_MODE
+
+// UTF-16LE 模式的 sha512_packed_update，跟 sha256_packed_update_utf16le 一样：
+// 纯 ASCII 时每次读 64 字节原文、宽化成一个 128 字节块，含非 ASCII 时整行解码
+DECLSPEC void sha512_packed_update_utf16le (PRIVATE_AS sha512_ctx_t *ctx, GLOBAL_AS const u32 *msgs, const u32 off, const u32 len)
+{
+  GLOBAL_AS const u32 *src = msgs + (off / 4);
+
+  const u32 sh = off & 3;
+
+  u32 t[32];
+  u32 w[32];
+
+  u32 high = 0;
+
+  for (int pos1 = 0, pos4 = 0; pos1 < (int) len; pos1 += 128, pos4 += 32)
+  {
+    sha512_packed_load_block (src + pos4, sh, (int) len - pos1, t);
+
+    for (int j = 0; j < 32; j++) high |= t[j];
+  }
+
+  if (high & 0x80808080)
+  {
+    sha512_update_global_utf8_utf16le (ctx, src, (int) sh, (int) len);
+
+    return;
+  }
+
+  int pos1;
+  int pos4;
+
+  for (pos1 = 0, pos4 = 0; pos1 < (int) len - 64; pos1 += 64, pos4 += 16)
+  {
+    sha512_packed_load_block (src + pos4, sh, 64, t);
+
+    for (int j = 0; j < 16; j += 4) make_utf16beN_S (t + j, w + j * 2, w + j * 2 + 4);
+
+    sha512_update_128 (ctx, w + 0, w + 4, w + 8, w + 12, w + 16, w + 20, w + 24, w + 28, 128);
+  }
+
+  const int rem = (int) len - pos1;
+
+  sha512_packed_load_block (src + pos4, sh, rem, t);
+
+  for (int j = 0; j < 16; j += 4) make_utf16beN_S (t + j, w + j * 2, w + j * 2 + 4);
+
+  sha512_update_128 (ctx, w + 0, w + 4, w + 8, w + 12, w + 16, w + 20, w + 24, w + 28, rem * 2);
+}
+
+#endif
+
+KERNEL_FQ void sha512_wrapper_packed (
+  GLOBAL_AS const u32 *msgs,       // 所有消息首尾相接，不做填充（byte buffer）
+  GLOBAL_AS const u32 *msg_offs,   // 每条消息在 msgs 中的起始字节偏移
+  GLOBAL_AS const u32 *msg_lens,   // 每条消息长度（字节）
+  const        u32    msg_cnt
+  WRAPPER_HMAC_ATTR
+  WRAPPER_SALT_ATTR,
+  GLOBAL_AS       u32 *digests     // 输出：N * 16 个 u32
+)
+{
+  const u32 gid = get_global_id (0);
+
+  if (gid >= msg_cnt) return;
+
+  const u32 off = msg_offs[gid];
+  const u32 len = msg_lens[gid];
+
+  sha512_ctx_t ctx;
+
+  sha512_wrapper_init (&ctx WRAPPER_HMAC_ARGS WRAPPER_SALT_ARGS);
+
+  sha512_wrapper_packed_update (&ctx, msgs, off, len);
+
+  sha512_wrapper_final (&ctx WRAPPER_HMAC_ARGS WRAPPER_SALT_ARGS);
+
+  sha512_wrapper_out (gid, ctx.h, digests);
+}
+
+// 用 msgs 里从 off 开始的 klen 字节当 key 初始化 HMAC ctx
+// （跟 sha512_hmac_init_global_swap 一样：超过一个 block 的 key 先哈希成 64 字节）
+DECLSPEC void sha512_packed_hmac_init (PRIVATE_AS sha512_hmac_ctx_t *ctx, GLOBAL_AS const u32 *msgs, const u32 off, const u32 klen)
+{
+  u32 w[32];
+
+  if (klen > 128)
+  {
+    sha512_ctx_t tmp;
+
+    sha512_init (&tmp);
+
+    sha512_packed_update (&tmp, msgs, off, klen);
+
+    sha512_final (&tmp);
+
+    for (int k = 0; k < 8; k++)
+    {
+      w[k * 2 + 0] = h32_from_64_S (tmp.h[k]);
+      w[k * 2 + 1] = l32_from_64_S (tmp.h[k]);
+    }
+
+    for (int k = 16; k < 32; k++) w[k] = 0;
+  }
+  else
+  {
+    sha512_packed_load_block (msgs + (off / 4), off & 3, (int) klen, w);
+  }
+
+  sha512_hmac_init_128 (ctx, w + 0, w + 4, w + 8, w + 12, w + 16, w + 20, w + 24, w + 28);
+}
+
+// ---- 每行自带 key 的 HMAC（"key:message"，packed 布局）----
+KERNEL_FQ void sha512_wrapper_hmac_lines (
+  GLOBAL_AS const u32 *msgs,
+  GLOBAL_AS const u32 *msg_offs,   // 每行的起始字节偏移
+  GLOBAL_AS const u32 *msg_lens,   // 每行长度（key + ':' + 消息）
+  GLOBAL_AS const u32 *key_lens,   // 每行 key 的长度
+  const        u32    msg_cnt,
+  GLOBAL_AS       u32 *digests
+)
+{
+  const u32 gid = get_global_id (0);
+
+  if (gid >= msg_cnt) return;
+
+  const u32 off  = msg_offs[gid];
+  const u32 len  = msg_lens[gid];
+  const u32 klen = key_lens[gid];
+
+  sha512_hmac_ctx_t ctx;
+
+  sha512_packed_hmac_init (&ctx, msgs, off, klen);
+
+  const u32 mlen = (klen < len) ? len - klen - 1 : 0;
+
+  sha512_packed_update (&ctx.ipad, msgs, off + klen + 1, mlen);
+
+  sha512_hmac_final (&ctx);
+
+  sha512_wrapper_out (gid, ctx.opad.h, digests);
+}
+
+// ---- 每行自带 salt（"salt:行"，packed 布局，含义同 sha256_wrapper_salt_lines）----
+KERNEL_FQ void sha512_wrapper_salt_lines (
+  GLOBAL_AS const u32 *msgs,
+  GLOBAL_AS const u32 *msg_offs,   // 每行的起始字节偏移
+  GLOBAL_AS const u32 *msg_lens,   // 每行长度（salt + ':' + 行）
+  GLOBAL_AS const u32 *salt_lens,  // 每行 salt 的长度
+  const        u32    msg_cnt,
+  const        u32    salt_pos,    // 0 = salt . 行，1 = 行 . salt
+  GLOBAL_AS       u32 *digests
+)
+{
+  const u32 gid = get_global_id (0);
+
+  if (gid >= msg_cnt) return;
+
+  const u32 off  = msg_offs[gid];
+  const u32 len  = msg_lens[gid];
+  const u32 slen = salt_lens[gid];
+
+  const u32 moff = off + slen + 1;
+  const u32 mlen = (slen < len) ? len - slen - 1 : 0;
+
+  sha512_ctx_t ctx;
+
+  sha512_init (&ctx);
+
+  if (salt_pos == 0)
+  {
+    sha512_packed_update (&ctx, msgs, off, slen);
+
+    sha512_wrapper_packed_update (&ctx, msgs, moff, mlen);
+  }
+  else
+  {
+    sha512_wrapper_packed_update (&ctx, msgs, moff, mlen);
+
+    sha512_packed_update (&ctx, msgs, off, slen);
+  }
+
+  sha512_final (&ctx);
+
+  sha512_wrapper_out (gid, ctx.h, digests);
+}
+
+// ---- 迭代哈希 / PBKDF2（init / loop / comp，含义同 sha256_wrapper.cl）----
+
+// 把 64 字节消息（16 个大端 u32）做成一个 block：消息 + 0x80 + 长度（前面还有 prefix 字节）
+DECLSPEC void sha512_pad_64 (PRIVATE_AS const u32 *m, const u32 prefix, PRIVATE_AS u32 *w)
+{
+  for (int k = 0; k < 16; k++) w[k] = m[k];
+
+  w[16] = 0x80000000;
+
+  for (int k = 17; k < 32; k++) w[k] = 0;
+
+  w[31] = (prefix + 64) * 8;
+}
+
+DECLSPEC void sha512_h_to_words (PRIVATE_AS const u64 *h, PRIVATE_AS u32 *m)
+{
+  for (int k = 0; k < 8; k++)
+  {
+    m[k * 2 + 0] = h32_from_64_S (h[k]);
+    m[k * 2 + 1] = l32_from_64_S (h[k]);
+  }
+}
+
+DECLSPEC void sha512_init_h (PRIVATE_AS u64 *h)
+{
+  h[0] = SHA512M_A;
+  h[1] = SHA512M_B;
+  h[2] = SHA512M_C;
+  h[3] = SHA512M_D;
+  h[4] = SHA512M_E;
+  h[5] = SHA512M_F;
+  h[6] = SHA512M_G;
+  h[7] = SHA512M_H;
+}
+
+// 迭代模式：在 digests 上原地做 loop_cnt 轮 h = SHA512 (h)
+KERNEL_FQ void sha512_iter_loop (
+  GLOBAL_AS       u32 *digests,
+  const        u32    loop_cnt,
+  const        u32    msg_cnt
+)
+{
+  const u32 gid = get_global_id (0);
+
+  if (gid >= msg_cnt) return;
+
+  GLOBAL_AS u32 *d = digests + ((size_t) gid * 16u);
+
+  u32 m[16];
+
+  for (int k = 0; k < 16; k++) m[k] = d[k];
+
+  for (u32 n = 0; n < loop_cnt; n++)
+  {
+    u32 w[32];
+
+    sha512_pad_64 (m, 0, w);
+
+    u64 h[8];
+
+    sha512_init_h (h);
+
+    sha512_transform (w + 0, w + 4, w + 8, w + 12, w + 16, w + 20, w + 24, w + 28, h);
+
+    sha512_h_to_words (h, m);
+  }
+
+  for (int k = 0; k < 16; k++) d[k] = m[k];
+}
+
+// PBKDF2-HMAC-SHA512 每条消息的状态（同 hashcat 的 pbkdf2_sha512_tmp_t，只算第一个输出块）
+typedef struct sha512_pbkdf2_tmp
+{
+  u64 ipad[8];
+  u64 opad[8];
+
+  u64 dgst[8];  // U_i
+  u64 out[8];   // T = U_1 ^ ... ^ U_i
+
+} sha512_pbkdf2_tmp_t;
+
+// 已知 ipad / opad 状态时对 64 字节消息（dgst）做一次 HMAC，结果写回 dgst
+DECLSPEC void sha512_hmac_run (PRIVATE_AS u64 *dgst, PRIVATE_AS const u64 *ipad, PRIVATE_AS const u64 *opad)
+{
+  u32 m[16];
+  u32 w[32];
+
+  sha512_h_to_words (dgst, m);
+
+  sha512_pad_64 (m, 128, w);
+
+  for (int k = 0; k < 8; k++) dgst[k] = ipad[k];
+
+  sha512_transform (w + 0, w + 4, w + 8, w + 12, w + 16, w + 20, w + 24, w + 28, dgst);
+
+  sha512_h_to_words (dgst, m);
+
+  sha512_pad_64 (m, 128, w);
+
+  for (int k = 0; k < 8; k++) dgst[k] = opad[k];
+
+  sha512_transform (w + 0, w + 4, w + 8, w + 12, w + 16, w + 20, w + 24, w + 28, dgst);
+}
+
+// PBKDF2 init：每行是 password，算出 ipad / opad 和 U_1 = HMAC (P, salt || INT (1))。
+// salt 要零填充到 128 字节的整数倍
+KERNEL_FQ void sha512_pbkdf2_init (
+  GLOBAL_AS const u32 *msgs,
+  GLOBAL_AS const u32 *msg_offs,
+  GLOBAL_AS const u32 *msg_lens,
+  const        u32    msg_cnt,
+  GLOBAL_AS const u32 *salt,
+  const        u32    salt_len,
+  GLOBAL_AS sha512_pbkdf2_tmp_t *tmps
+)
+{
+  const u32 gid = get_global_id (0);
+
+  if (gid >= msg_cnt) return;
+
+  sha512_hmac_ctx_t ctx;
+
+  sha512_packed_hmac_init (&ctx, msgs, msg_offs[gid], msg_lens[gid]);
+
+  for (int k = 0; k < 8; k++)
+  {
+    tmps[gid].ipad[k] = ctx.ipad.h[k];
+    tmps[gid].opad[k] = ctx.opad.h[k];
+  }
+
+  sha512_hmac_update_global_swap (&ctx, salt, (int) salt_len);
+
+  u32 w[32] = { 0 };
+
+  w[0] = 1;  // INT (1)，大端
+
+  sha512_hmac_update_128 (&ctx, w + 0, w + 4, w + 8, w + 12, w + 16, w + 20, w + 24, w + 28, 4);
+
+  sha512_hmac_final (&ctx);
+
+  for (int k = 0; k < 8; k++)
+  {
+    tmps[gid].dgst[k] = ctx.opad.h[k];
+    tmps[gid].out[k]  = ctx.opad.h[k];
+  }
+}
+
+// PBKDF2 loop：U_{i+1} = HMAC (P, U_i)，T ^= U_{i+1}，每次 launch loop_cnt 轮
+KERNEL_FQ void sha512_pbkdf2_loop (
+  GLOBAL_AS sha512_pbkdf2_tmp_t *tmps,
+  const        u32    loop_cnt,
+  const        u32    msg_cnt
+)
+{
+  const u32 gid = get_global_id (0);
+
+  if (gid >= msg_cnt) return;
+
+  u64 ipad[8];
+  u64 opad[8];
+  u64 dgst[8];
+  u64 out[8];
+
+  for (int k = 0; k < 8; k++)
+  {
+    ipad[k] = tmps[gid].ipad[k];
+    opad[k] = tmps[gid].opad[k];
+    dgst[k] = tmps[gid].dgst[k];
+    out[k]  = tmps[gid].out[k];
+  }
+
+  for (u32 n = 0; n < loop_cnt; n++)
+  {
+    sha512_hmac_run (dgst, ipad, opad);
+
+    for (int k = 0; k < 8; k++) out[k] ^= dgst[k];
+  }
+
+  for (int k = 0; k < 8; k++)
+  {
+    tmps[gid].dgst[k] = dgst[k];
+    tmps[gid].out[k]  = out[k];
+  }
+}
+
+// PBKDF2 comp：T 写回 digests（只取第一个输出块，dkLen = 64）
+KERNEL_FQ void sha512_pbkdf2_comp (
+  GLOBAL_AS const sha512_pbkdf2_tmp_t *tmps,
+  const        u32    msg_cnt,
+  GLOBAL_AS       u32 *digests
+)
+{
+  const u32 gid = get_global_id (0);
+
+  if (gid >= msg_cnt) return;
+
+  u64 h[8];
+
+  for (int k = 0; k < 8; k++) h[k] = tmps[gid].out[k];
+
+  sha512_wrapper_out (gid, h, digests);
+}
+
+// ---- 流式多 block（--stream，含义同 sha256_stream_update）----
+// SHA-512 的 padding 末尾是 128 位 bit 长度：总字节数 64 位，左移 3 位后高 3 位进 w7[1]
+#define STREAM_FIRST 1
+#define STREAM_LAST  2
+
+typedef struct sha512_stream_state
+{
+  u64 h[8];
+  u32 len_lo;
+  u32 len_hi;
+
+} sha512_stream_state_t;
+
+DECLSPEC void sha512_stream_final (PRIVATE_AS sha512_ctx_t *ctx, const u32 len_lo, const u32 len_hi)
+{
+  const int pos = ctx->len & 127;
+
+  append_0x80_8x4_S (ctx->w0, ctx->w1, ctx->w2, ctx->w3, ctx->w4, ctx->w5, ctx->w6, ctx->w7, pos ^ 3);
+
+  if (pos >= 112)
+  {
+    sha512_transform (ctx->w0, ctx->w1, ctx->w2, ctx->w3, ctx->w4, ctx->w5, ctx->w6, ctx->w7, ctx->h);
+
+    for (int k = 0; k < 4; k++)
+    {
+      ctx->w0[k] = 0;
+      ctx->w1[k] = 0;
+      ctx->w2[k] = 0;
+      ctx->w3[k] = 0;
+      ctx->w4[k] = 0;
+      ctx->w5[k] = 0;
+      ctx->w6[k] = 0;
+      ctx->w7[k] = 0;
+    }
+  }
+
+  ctx->w7[0] = 0;
+  ctx->w7[1] = len_hi >> 29;
+  ctx->w7[2] = (len_hi << 3) | (len_lo >> 29);
+  ctx->w7[3] = len_lo << 3;
+
+  sha512_transform (ctx->w0, ctx->w1, ctx->w2, ctx->w3, ctx->w4, ctx->w5, ctx->w6, ctx->w7, ctx->h);
+}
+
+KERNEL_FQ void sha512_stream_update (
+  GLOBAL_AS const u32 *msgs,
+  GLOBAL_AS const u32 *chunk_lens,
+  GLOBAL_AS const u32 *chunk_flags,
+  GLOBAL_AS const u32 *msg_idx,
+  const        u32    msg_stride,
+  const        u32    msg_cnt,
+  GLOBAL_AS sha512_stream_state_t *states,
+  GLOBAL_AS       u32 *digests
+)
+{
+  const u32 gid = get_global_id (0);
+
+  if (gid >= msg_cnt) return;
+
+  const u32 len   = chunk_lens[gid];
+  const u32 flags = chunk_flags[gid];
+  const u32 pos   = msg_idx[gid];
+
+  GLOBAL_AS sha512_stream_state_t *st = states + pos;
+
+  sha512_ctx_t ctx;
+
+  sha512_init (&ctx);
+
+  u32 len_lo = 0;
+  u32 len_hi = 0;
+
+  if ((flags & STREAM_FIRST) == 0)
+  {
+    for (int k = 0; k < 8; k++) ctx.h[k] = st->h[k];
+
+    len_lo = st->len_lo;
+    len_hi = st->len_hi;
+  }
+
+  sha512_update_global_swap (&ctx, msgs + ((size_t) gid * msg_stride), (int) len);
+
+  const u32 new_lo = len_lo + len;
+
+  len_hi += (new_lo < len_lo) ? 1 : 0;
+  len_lo  = new_lo;
+
+  if (flags & STREAM_LAST)
+  {
+    sha512_stream_final (&ctx, len_lo, len_hi);
+
+    sha512_wrapper_out (pos, ctx.h, digests);
+  }
+  else
+  {
+    for (int k = 0; k < 8; k++) st->h[k] = ctx.h[k];
+
+    st->len_lo = len_lo;
+    st->len_hi = len_hi;
+  }
+}
+
+// ---- Merkle 树（--merkle，含义同 sha256_merkle_level）----
+// 两个 64 字节子节点正好一个 128-byte block，再加一个固定的 padding block（长度 1024 bit）
+KERNEL_FQ void sha512_merkle_level (
+  GLOBAL_AS const u32 *in,
+  GLOBAL_AS       u32 *out,
+  const        u32    n_in
+)
+{
+  const u32 gid = get_global_id (0);
+
+  if (gid * 2 >= n_in) return;
+
+  GLOBAL_AS const u32 *src = in  + ((size_t) gid * 32u);
+  GLOBAL_AS       u32 *dst = out + ((size_t) gid * 16u);
+
+  if (gid * 2 + 1 >= n_in)
+  {
+    for (int k = 0; k < 16; k++) dst[k] = src[k];
+
+    return;
+  }
+
+  u32 w[32];
+
+  for (int k = 0; k < 32; k++) w[k] = src[k];
+
+  u64 h[8];
+
+  sha512_init_h (h);
+
+  sha512_transform (w + 0, w + 4, w + 8, w + 12, w + 16, w + 20, w + 24, w + 28, h);
+
+  for (int k = 0; k < 32; k++) w[k] = 0;
+
+  w[0]  = 0x80000000;
+  w[31] = 128 * 8;
+
+  sha512_transform (w + 0, w + 4, w + 8, w + 12, w + 16, w + 20, w + 24, w + 28, h);
+
+  sha512_wrapper_out (gid, h, out);
+}
+
+// ---- 去重（host 的 --dedup）：同 sha256_wrapper.cl，digest 是 16 个 u32，records 每条 17 个 u32 ----
+#define DEDUP_EMPTY 0xffffffff
+
+#if defined IS_CUDA || defined IS_HIP
+#define dedup_atomic_cas(p,c,v) atomicCAS ((p), (c), (v))
+#define dedup_atomic_min(p,v)   atomicMin ((p), (v))
+#else
+#define dedup_atomic_cas(p,c,v) atomic_cmpxchg ((p), (c), (v))
+#define dedup_atomic_min(p,v)   atomic_min ((p), (v))
+#endif
+
+DECLSPEC int sha512_dedup_equal (GLOBAL_AS const u32 *a, GLOBAL_AS const u32 *b)
+{
+  for (int k = 0; k < 16; k++)
+  {
+    if (a[k] != b[k]) return 0;
+  }
+
+  return 1;
+}
+
+KERNEL_FQ void sha512_dedup_insert (
+  GLOBAL_AS const u32 *digests,
+  GLOBAL_AS       u32 *table,
+  const        u32    table_mask,
+  const        u32    msg_cnt
+)
+{
+  const u32 gid = get_global_id (0);
+
+  if (gid >= msg_cnt) return;
+
+  GLOBAL_AS const u32 *d = digests + ((size_t) gid * 16u);
+
+  for (u32 pos = d[0] & table_mask; ; pos = (pos + 1) & table_mask)
+  {
+    u32 cur = table[pos];
+
+    if (cur == DEDUP_EMPTY)
+    {
+      cur = dedup_atomic_cas (table + pos, DEDUP_EMPTY, gid);
+
+      if (cur == DEDUP_EMPTY) return;
+    }
+
+    if (sha512_dedup_equal (d, digests + ((size_t) cur * 16u)))
+    {
+      dedup_atomic_min (table + pos, gid);
+
+      return;
+    }
+  }
+}
+
+KERNEL_FQ void sha512_dedup_emit (
+  GLOBAL_AS const u32 *digests,
+  GLOBAL_AS const u32 *table,
+  const        u32    table_mask,
+  GLOBAL_AS       u32 *uniq_cnt,
+  GLOBAL_AS       u32 *records,
+  const        u32    msg_cnt
+)
+{
+  const u32 gid = get_global_id (0);
+
+  if (gid >= msg_cnt) return;
+
+  GLOBAL_AS const u32 *d = digests + ((size_t) gid * 16u);
+
+  for (u32 pos = d[0] & table_mask; ; pos = (pos + 1) & table_mask)
+  {
+    const u32 cur = table[pos];
+
+    if (cur == gid) break;
+
+    if (sha512_dedup_equal (d, digests + ((size_t) cur * 16u))) return;
+  }
+
+  const u32 n = hc_atomic_inc (uniq_cnt);
+
+  if (records == NULL) return;
+
+  GLOBAL_AS u32 *r = records + ((size_t) n * 17u);
+
+  r[0] = gid;
+
+  for (int k = 0; k < 16; k++) r[1 + k] = d[k];
+}
@@ -0,0 +1,103 @@
+#!/bin/bash
+# --serve 的端到端测试：用原生 CPU 后端（不需要 GPU），编译时打开引擎的出错注入（SHA256_ENGINE_FAULT_TEST）。
+#   1. 引擎的 job 在提交之后出错（wait 返回 SHA256_ENGINE_E_RUNTIME）时，这一批的请求回 SERVE_E_ENGINE，
+#      不把没算完的 digest 当结果发出去；之后的批次照常
+#   2. 会改变 digest 的选项（HMAC / salt / KDF / --encoding / --search / --mask / --dedup / --out-bytes ...）
+#      跟 --serve 一起用时直接报错退出，不悄悄算成普通哈希
+#
+# 用法: tests/serve_test.sh        （在 third_party/hashcat_opencl 下运行；需要 gcc、python3）
+#   CFLAGS / LDFLAGS 可以指向别处的 OpenCL 头文件和库
+
+set -u
+
+cd "$(dirname "$0")/.." || exit 1
+
+tmp=$(mktemp -d)
+trap 'kill $serve_pid 2>/dev/null; rm -rf "$tmp"' EXIT
+
+serve_pid=
+
+fail=0
+
+check ()
+{
+  if [ "$2" = "$3" ]; then echo "ok   $1"; else echo "FAIL $1: got '$2', want '$3'"; fail=1; fi
+}
+
+gcc -O2 -DSHA256_ENGINE_FAULT_TEST ${CFLAGS:-} -I. -o "$tmp/sha256_host" \
+    sha256_host.c sha256_engine.c sha256_native.c sha256_gpu.c \
+    ${LDFLAGS:-} -lOpenCL -lpthread -lm -ldl || exit 1
+
+# 在 socket 上连着发 n 个请求（一个问答完再发下一个，每个自成一批），打印每个的状态，
+# 状态是 0 时再核对 digest
+cat > "$tmp/client.py" <<'EOF'
+import hashlib, socket, struct, sys, time
+
+path, n = sys.argv[1], int (sys.argv[2])
+
+for _ in range (100):
+    try:
+        s = socket.socket (socket.AF_UNIX)
+        s.connect (path)
+        break
+    except OSError:
+        time.sleep (0.05)
+
+def recv_full (k):
+    buf = b""
+    while len (buf) < k:
+        chunk = s.recv (k - len (buf))
+        if not chunk: raise SystemExit ("connection closed")
+        buf += chunk
+    return buf
+
+out = []
+for r in range (n):
+    msgs = [b"abc", b"request %d" % r, b""]
+    s.sendall (struct.pack ("<II", len (msgs), sum (map (len, msgs)))
+               + b"".join (struct.pack ("<I", len (m)) for m in msgs) + b"".join (msgs))
+    status = struct.unpack ("<I", recv_full (4))[0]
+    if status == 0:
+        want = b"".join (hashlib.sha256 (m).digest () for m in msgs)
+        if recv_full (len (want)) != want: status = "bad-digest"
+    out.append (str (status))
+
+print (" ".join (out))
+EOF
+
+# 1. 第 2 批在引擎里出错
+SHA256_ENGINE_FAIL_BATCH=2 "$tmp/sha256_host" --serve "$tmp/s.sock" --backend native 2> "$tmp/serve.log" &
+serve_pid=$!
+
+check "engine error after submit -> SERVE_E_ENGINE" "$(python3 "$tmp/client.py" "$tmp/s.sock" 3)" "0 2 0"
+
+kill $serve_pid; wait $serve_pid 2>/dev/null
+
+check "failed batch is logged" "$(grep -c 'failed: OpenCL runtime error' "$tmp/serve.log")" "1"
+
+# 2. 不支持的选项：退出码 1、说明是哪个选项，也不会建 socket（被误收下时 timeout 结束它，退出码不是 1）
+while read -r opts; do
+  msg=$(timeout 5 "$tmp/sha256_host" --serve "$tmp/u.sock" --backend native $opts 2>&1 >/dev/null)
+  rc=$?
+
+  check "--serve $opts -> usage error" "$rc:$(echo "$msg" | grep -c 'cannot be combined with')" "1:1"
+  check "--serve $opts -> no socket" "$([ -e "$tmp/u.sock" ] && echo yes || echo no)" "no"
+done <<'EOF'
+--hmac-key secret --salt x --iterations 5 --encoding utf16le
+--hmac-key-hex 00ff
+--hmac-per-line
+--salt x
+--salt-hex 00
+--salt-per-line
+--iterations 5
+--pbkdf2-salt s
+--encoding utf16le
+--search /dev/null
+--mask ?d
+--dedup first
+--out-bytes 8
+--stream
+--merkle
+EOF
+
+exit $fail